@@ -0,0 +1,174 @@
+#include "admission.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log_ring.h"
+#include "platform_thread.h"
+
+#define DEFAULT_CONCURRENCY 4
+#define DEFAULT_TEMPLATE_QUEUE_MAX 256
+#define DEFAULT_TASK_QUEUE_MAX 65536
+// Replies after which the idle latency is measured afresh, so the baseline
+// follows templates that got slower or faster.
+#define BASELINE_SAMPLES 256
+#define LATENCY_TOLERANCE 2
+#define DECREASE_FACTOR 0.75
+#define MIN_RETRY_AFTER_MS 10u
+#define MAX_RETRY_AFTER_MS 60000u
+#define NSEC_PER_MSEC 1000000ull
+
+// Set by admission_install.
+static TaskQueue *g_tasks;
+static size_t g_task_queue_max;
+static uint32_t g_max_concurrency = DEFAULT_CONCURRENCY;
+static uint32_t g_queue_max = DEFAULT_TEMPLATE_QUEUE_MAX;
+static bool g_adaptive = true;
+
+// Platform thread only.
+static double g_limit = 1;
+static uint64_t g_baseline_nanos;
+static uint32_t g_samples;
+// The window to return to once a probe measured the baseline, 0 outside a
+// probe.
+static double g_probe_resume;
+static uint64_t g_average_nanos;
+static uint64_t g_last_decrease;
+static bool g_engine_backlogged;
+
+// Copies for metrics.h, which reads them from its own thread.
+static PlatformMutex g_stats_mutex = PLATFORM_MUTEX_INIT;
+static AdmissionStats g_stats = {1, 0, {0}};
+
+static uint64_t env_count(const char *name, uint64_t fallback) {
+  const char *value = getenv(name);
+  if (!value || !*value)
+    return fallback;
+  char *end;
+  unsigned long long number = strtoull(value, &end, 10);
+  if (*end != '\0' || number == 0 || number > UINT32_MAX) {
+    fprintf(stderr, "Ignoring %s=%s: not a positive count\n", name, value);
+    return fallback;
+  }
+  return number;
+}
+
+static void publish_stats(void) {
+  platform_mutex_lock(&g_stats_mutex);
+  g_stats.concurrency_limit = admission_concurrency_limit();
+  g_stats.average_latency_nanos = g_average_nanos;
+  platform_mutex_unlock(&g_stats_mutex);
+}
+
+void admission_install(TaskQueue *tasks) {
+  g_max_concurrency = (uint32_t)env_count("HEADLESS_TEMPLATE_CONCURRENCY",
+                                          DEFAULT_CONCURRENCY);
+  g_queue_max = (uint32_t)env_count("HEADLESS_TEMPLATE_QUEUE_MAX",
+                                    DEFAULT_TEMPLATE_QUEUE_MAX);
+  const char *adaptive = getenv("HEADLESS_ADAPTIVE_CONCURRENCY");
+  g_adaptive = !adaptive || strcmp(adaptive, "0") != 0;
+  size_t task_max =
+      (size_t)env_count("HEADLESS_TASK_QUEUE_MAX", DEFAULT_TASK_QUEUE_MAX);
+  g_tasks = tasks;
+  g_task_queue_max = task_max;
+  // Starting small lets the first replies measure an idle engine.
+  g_limit = g_adaptive ? 1 : g_max_concurrency;
+  publish_stats();
+}
+
+// Before the first reply the average is 0 and the hint the shortest one.
+static uint32_t retry_after_ms(uint32_t pending) {
+  uint64_t nanos = g_average_nanos * (pending / 2 + 1) /
+                   admission_concurrency_limit();
+  uint64_t ms = (nanos + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC;
+  if (ms < MIN_RETRY_AFTER_MS)
+    return MIN_RETRY_AFTER_MS;
+  return ms > MAX_RETRY_AFTER_MS ? MAX_RETRY_AFTER_MS : (uint32_t)ms;
+}
+
+static bool engine_backlogged(void) {
+  size_t tasks = g_tasks ? task_queue_size(g_tasks) : 0;
+  bool backlogged = tasks > g_task_queue_max;
+  if (backlogged && !g_engine_backlogged)
+    log_ring_printf(kLogWarning, "admission", 0,
+                    "%zu platform tasks pending, refusing new jobs", tasks);
+  g_engine_backlogged = backlogged;
+  return backlogged;
+}
+
+AdmissionVerdict admission_check(uint32_t pending, uint32_t *retry_after) {
+  AdmissionVerdict verdict = kAdmissionAccepted;
+  if (pending >= g_queue_max)
+    verdict = kAdmissionQueueFull;
+  else if (engine_backlogged())
+    verdict = kAdmissionEngineBusy;
+  platform_mutex_lock(&g_stats_mutex);
+  g_stats.verdicts[verdict]++;
+  platform_mutex_unlock(&g_stats_mutex);
+  if (verdict != kAdmissionAccepted)
+    *retry_after = retry_after_ms(pending);
+  return verdict;
+}
+
+uint32_t admission_concurrency_limit(void) {
+  uint32_t limit = (uint32_t)g_limit;
+  return limit > 0 ? limit : 1;
+}
+
+void admission_observe(uint64_t latency, uint32_t concurrency, uint64_t now) {
+  g_average_nanos = g_average_nanos
+                        ? g_average_nanos - g_average_nanos / 8 + latency / 8
+                        : latency;
+  if (!g_adaptive) {
+    publish_stats();
+    return;
+  }
+
+  if (concurrency <= 1) {
+    if (g_baseline_nanos == 0 || latency < g_baseline_nanos) {
+      g_baseline_nanos = latency;
+    } else if (g_probe_resume > 0 || g_limit < 2) {
+      // Half way, so one slow job does not set the baseline on its own.
+      g_baseline_nanos += (latency - g_baseline_nanos) / 2;
+    }
+    if (g_probe_resume > 0) {
+      g_limit = g_probe_resume;
+      g_probe_resume = 0;
+      g_samples = 0;
+      publish_stats();
+      return;
+    }
+  }
+  // Replies of jobs sent before the probe say nothing new.
+  if (g_probe_resume > 0)
+    return;
+  if (++g_samples >= BASELINE_SAMPLES && g_limit >= 2) {
+    g_probe_resume = g_limit;
+    g_limit = 1;
+    publish_stats();
+    return;
+  }
+
+  if (latency > LATENCY_TOLERANCE * g_baseline_nanos) {
+    // One decrease per round trip: the replies of jobs sent before the last
+    // one still carry the old congestion.
+    if (now - g_last_decrease > g_average_nanos) {
+      g_limit *= DECREASE_FACTOR;
+      if (g_limit < 1)
+        g_limit = 1;
+      g_last_decrease = now;
+    }
+  } else {
+    g_limit += 1 / g_limit;
+    if (g_limit > g_max_concurrency)
+      g_limit = g_max_concurrency;
+  }
+  publish_stats();
+}
+
+void admission_stats(AdmissionStats *stats) {
+  platform_mutex_lock(&g_stats_mutex);
+  *stats = g_stats;
+  platform_mutex_unlock(&g_stats_mutex);
+}
@@ -0,0 +1,74 @@
+// Admission control for template jobs.
+//
+// Under overload, jobs arrive faster than the engine renders them. Queueing
+// them all only adds memory and latency until every job misses its
+// deadline, so the embedder sheds load at the door instead:
+//
+// - Jobs on the Dart side are limited by a window that adapts to their
+//   latency (additive increase, multiplicative decrease). The latency of a
+//   job that rendered alone stands for an idle engine. While jobs come back
+//   within twice that, the window grows by one per window's worth of
+//   replies. When they take longer, it shrinks by a quarter, at most once
+//   per average job latency, down to a single job. The window starts at
+//   one job and drops back to one every 256 replies until a job has
+//   rendered alone, so the idle latency follows templates that get slower
+//   or faster.
+// - Template jobs waiting in the embedder are bounded. A job that would
+//   exceed the bound is refused at once.
+// - New jobs are also refused while more platform tasks are pending than
+//   HEADLESS_TASK_QUEUE_MAX, since that backlog delays every job already
+//   admitted. The task queue itself keeps growing: the engine's tasks
+//   cannot be refused, only the work that makes it post them.
+//
+// A refusal carries a hint for when to retry: the time the engine needs to
+// drain half of the waiting jobs at the current window and average latency.
+//
+// Environment:
+//   HEADLESS_TEMPLATE_CONCURRENCY=N  largest window, default 4.
+//   HEADLESS_ADAPTIVE_CONCURRENCY=0  keeps the window at its largest.
+//   HEADLESS_TEMPLATE_QUEUE_MAX=N    template jobs waiting, default 256.
+//   HEADLESS_TASK_QUEUE_MAX=N        platform tasks pending before new jobs
+//                                    are refused, default 65536.
+
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "task_queue.h"
+
+typedef enum {
+  kAdmissionAccepted,
+  // Too many template jobs are waiting.
+  kAdmissionQueueFull,
+  // The platform task queue is backed up.
+  kAdmissionEngineBusy,
+  kAdmissionVerdictCount,
+} AdmissionVerdict;
+
+typedef struct {
+  uint32_t concurrency_limit;
+  uint64_t average_latency_nanos;
+  // Jobs by admission_check's verdict.
+  uint64_t verdicts[kAdmissionVerdictCount];
+} AdmissionStats;
+
+// `tasks` is the platform task queue. Call before the engine starts.
+void admission_install(TaskQueue *tasks);
+
+// The rest run on the platform thread, except admission_stats.
+
+// Whether a new job may join the `pending` ones waiting. On refusal
+// `*retry_after_ms` is set to the retry hint.
+AdmissionVerdict admission_check(uint32_t pending, uint32_t *retry_after_ms);
+// Jobs that may be on the Dart side at once.
+uint32_t admission_concurrency_limit(void);
+// Reports how long a job took from dispatch to reply; `concurrency` is the
+// number of jobs on the Dart side once it was sent, itself included.
+void admission_observe(uint64_t latency_nanos, uint32_t concurrency,
+                       uint64_t now);
+
+void admission_stats(AdmissionStats *stats);
+
+#endif // ADMISSION_H
@@ -0,0 +1,63 @@
+#include "auto_crop.h"
+
+#include <string.h>
+
+#include "pixel_kernels.h"
+
+bool auto_crop_bounds(const uint8_t *rgba, size_t stride, uint32_t width,
+                      uint32_t height, const uint8_t background[4],
+                      CropRect *bounds) {
+  static const uint8_t kAlphaOnly[4] = {0, 0, 0, 0xff};
+  static const uint8_t kAllChannels[4] = {0xff, 0xff, 0xff, 0xff};
+  uint32_t value, mask;
+  memcpy(&mask, background[3] == 0 ? kAlphaOnly : kAllChannels, 4);
+  memcpy(&value, background, 4);
+  value &= mask;
+
+  const PixelKernels *kernels = pixel_kernels();
+  uint32_t top = 0;
+  size_t left = width;
+  for (; top < height; ++top) {
+    left = kernels->first_mismatch(rgba + (size_t)top * stride, width, value,
+                                   mask);
+    if (left < width)
+      break;
+  }
+  if (top == height) {
+    bounds->left = bounds->top = 0;
+    bounds->width = bounds->height = 1;
+    return false;
+  }
+
+  uint32_t bottom = height - 1;
+  size_t right = 0;
+  for (;; --bottom) {
+    right = kernels->last_mismatch(rgba + (size_t)bottom * stride, width, value,
+                                   mask);
+    if (right < width)
+      break;
+  }
+
+  // Only the margins outside the current [left, right] span can widen it.
+  for (uint32_t y = top; y <= bottom; ++y) {
+    const uint8_t *row = rgba + (size_t)y * stride;
+    if (left > 0) {
+      size_t first = kernels->first_mismatch(row, left, value, mask);
+      if (first < left)
+        left = first;
+    }
+    if (right + 1 < width) {
+      size_t count = width - right - 1;
+      size_t last =
+          kernels->last_mismatch(row + (right + 1) * 4, count, value, mask);
+      if (last < count)
+        right = right + 1 + last;
+    }
+  }
+
+  bounds->left = (uint32_t)left;
+  bounds->top = top;
+  bounds->width = (uint32_t)(right - left + 1);
+  bounds->height = bottom - top + 1;
+  return true;
+}
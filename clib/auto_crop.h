@@ -0,0 +1,41 @@
+// Trimming of uniform borders from rendered images.
+//
+// Instead of shrink-wrapping the widget (which needs a size report and a
+// view resize, i.e. extra frames), a job can be rendered on a generous
+// canvas and cropped natively afterwards. The bounds are found with the
+// vectorized mismatch scans from pixel_kernels.h: rows are scanned from the
+// top and the bottom until content shows up, and only the still-uncovered
+// left and right margins of the rows in between are scanned after that.
+// Cropping itself is a view into the original buffer with the original
+// stride, so no pixels are copied.
+
+#ifndef AUTO_CROP_H
+#define AUTO_CROP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  uint32_t left;
+  uint32_t top;
+  uint32_t width;
+  uint32_t height;
+} CropRect;
+
+// Finds the smallest rect holding every pixel of the straight-alpha RGBA
+// image that differs from `background` (R, G, B, A bytes). When the
+// background is fully transparent only alpha is compared, so invisible
+// pixels of any color count as background. Returns false, with `bounds` set
+// to the top-left pixel, when the whole image is background.
+bool auto_crop_bounds(const uint8_t *rgba, size_t stride, uint32_t width,
+                      uint32_t height, const uint8_t background[4],
+                      CropRect *bounds);
+
+// The top-left pixel of `rect`; rows keep `stride`.
+static inline const uint8_t *auto_crop_view(const uint8_t *rgba, size_t stride,
+                                            CropRect rect) {
+  return rgba + (size_t)rect.top * stride + (size_t)rect.left * 4;
+}
+
+#endif // AUTO_CROP_H
@@ -0,0 +1,164 @@
+// Checks auto_crop_bounds (see auto_crop.h), run without the engine.
+//
+// Covers the cases the header promises: an image that is all background,
+// a transparent background where only alpha counts, rows with padding past
+// `width * 4` that holds other pixels, and content confined to the first or
+// last column. Random images with a few content pixels are then checked
+// against a brute-force scan.
+//
+// The scans run on the mismatch kernels of pixel_kernels.h, so ctest runs
+// this once per HEADLESS_PIXEL_KERNELS value, like pixel_kernels_test.
+//
+// Exits with 1 on the first wrong result.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "auto_crop.h"
+#include "pixel_kernels.h"
+
+#define RANDOM_IMAGES 2000
+#define MAX_SIDE 70
+
+static const uint8_t kWhite[4] = {255, 255, 255, 255};
+static const uint8_t kClear[4] = {0, 0, 0, 0};
+
+static uint64_t g_state = 0x2545f4914f6cdd1dull;
+
+static uint32_t next_random(void) {
+  g_state ^= g_state >> 12;
+  g_state ^= g_state << 25;
+  g_state ^= g_state >> 27;
+  return (uint32_t)((g_state * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+typedef struct {
+  uint8_t *pixels;
+  size_t stride;
+  uint32_t width;
+  uint32_t height;
+} Image;
+
+// Rows are padded to `stride` with bytes that never match `background`.
+static Image image_new(uint32_t width, uint32_t height, size_t padding,
+                       const uint8_t background[4]) {
+  Image image = {NULL, (size_t)width * 4 + padding, width, height};
+  image.pixels = (uint8_t *)malloc(image.stride * height);
+  memset(image.pixels, 0x5a, image.stride * height);
+  for (uint32_t y = 0; y < height; ++y) {
+    for (uint32_t x = 0; x < width; ++x)
+      memcpy(image.pixels + y * image.stride + x * 4, background, 4);
+  }
+  return image;
+}
+
+static void set_pixel(Image *image, uint32_t x, uint32_t y, uint8_t r,
+                      uint8_t g, uint8_t b, uint8_t a) {
+  uint8_t *pixel = image->pixels + y * image->stride + x * 4;
+  pixel[0] = r;
+  pixel[1] = g;
+  pixel[2] = b;
+  pixel[3] = a;
+}
+
+static void expect(const char *name, const Image *image,
+                   const uint8_t background[4], bool found, CropRect rect) {
+  CropRect bounds;
+  bool result = auto_crop_bounds(image->pixels, image->stride, image->width,
+                                 image->height, background, &bounds);
+  if (result != found || bounds.left != rect.left || bounds.top != rect.top ||
+      bounds.width != rect.width || bounds.height != rect.height) {
+    fprintf(stderr,
+            "%s (%s kernels): got %d %ux%u at %u,%u, expected %d %ux%u at "
+            "%u,%u\n",
+            name, pixel_kernels()->name, result, bounds.width, bounds.height,
+            bounds.left, bounds.top, found, rect.width, rect.height,
+            rect.left, rect.top);
+    exit(1);
+  }
+}
+
+static void check_all_background(void) {
+  Image image = image_new(37, 11, 0, kWhite);
+  expect("all background", &image, kWhite, false, (CropRect){0, 0, 1, 1});
+  free(image.pixels);
+}
+
+static void check_transparent_background(void) {
+  Image image = image_new(40, 9, 0, kClear);
+  // Invisible pixels of any colour are background.
+  for (uint32_t y = 0; y < image.height; ++y) {
+    for (uint32_t x = 0; x < image.width; x += 3)
+      set_pixel(&image, x, y, 200, 10, 90, 0);
+  }
+  expect("invisible colours", &image, kClear, false, (CropRect){0, 0, 1, 1});
+  set_pixel(&image, 23, 4, 0, 0, 0, 1);
+  set_pixel(&image, 17, 6, 0, 0, 0, 255);
+  expect("transparent background", &image, kClear, true,
+         (CropRect){17, 4, 7, 3});
+  free(image.pixels);
+}
+
+static void check_padded_stride(void) {
+  // The padding differs from the background on every row and must not
+  // widen the bounds.
+  Image image = image_new(21, 13, 44, kWhite);
+  set_pixel(&image, 5, 2, 0, 0, 0, 255);
+  set_pixel(&image, 14, 9, 255, 254, 255, 255);
+  expect("padded stride", &image, kWhite, true, (CropRect){5, 2, 10, 8});
+  free(image.pixels);
+}
+
+static void check_edge_columns(void) {
+  Image image = image_new(33, 17, 12, kWhite);
+  set_pixel(&image, 0, 6, 1, 2, 3, 255);
+  set_pixel(&image, 0, 9, 1, 2, 3, 255);
+  expect("first column", &image, kWhite, true, (CropRect){0, 6, 1, 4});
+  free(image.pixels);
+
+  image = image_new(33, 17, 12, kWhite);
+  set_pixel(&image, 32, 0, 1, 2, 3, 255);
+  set_pixel(&image, 32, 16, 1, 2, 3, 255);
+  expect("last column", &image, kWhite, true, (CropRect){32, 0, 1, 17});
+  free(image.pixels);
+}
+
+static void check_random_images(void) {
+  for (int n = 0; n < RANDOM_IMAGES; ++n) {
+    uint32_t width = 1 + next_random() % MAX_SIDE;
+    uint32_t height = 1 + next_random() % MAX_SIDE;
+    const uint8_t *background = n % 2 ? kClear : kWhite;
+    Image image = image_new(width, height, (next_random() % 4) * 4, background);
+    uint32_t left = width, top = height, right = 0, bottom = 0;
+    int content = (int)(next_random() % 4);
+    for (int i = 0; i < content; ++i) {
+      uint32_t x = next_random() % width;
+      uint32_t y = next_random() % height;
+      set_pixel(&image, x, y, (uint8_t)next_random(), 0, 0,
+                (uint8_t)(1 + next_random() % 255));
+      left = x < left ? x : left;
+      right = x > right ? x : right;
+      top = y < top ? y : top;
+      bottom = y > bottom ? y : bottom;
+    }
+    if (content == 0)
+      expect("random", &image, background, false, (CropRect){0, 0, 1, 1});
+    else
+      expect("random", &image, background, true,
+             (CropRect){left, top, right - left + 1, bottom - top + 1});
+    free(image.pixels);
+  }
+}
+
+int main(void) {
+  check_all_background();
+  check_transparent_background();
+  check_padded_stride();
+  check_edge_columns();
+  check_random_images();
+  printf("auto_crop_test: passed with %s kernels\n", pixel_kernels()->name);
+  return 0;
+}
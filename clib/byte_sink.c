@@ -0,0 +1,276 @@
+#include "byte_sink.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET SocketHandle;
+#define INVALID_SOCKET_HANDLE INVALID_SOCKET
+#define close_socket closesocket
+#else
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int SocketHandle;
+#define INVALID_SOCKET_HANDLE (-1)
+#define close_socket close
+#ifndef MSG_NOSIGNAL
+// macOS has no MSG_NOSIGNAL; SO_NOSIGPIPE is set on the socket instead.
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+static void disable_sigpipe(SocketHandle handle) {
+#if defined(__APPLE__)
+  int on = 1;
+  setsockopt(handle, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#else
+  (void)handle;
+#endif
+}
+
+static void set_error(char *error, size_t error_size, const char *text) {
+  if (error_size > 0)
+    snprintf(error, error_size, "%s", text);
+}
+
+static SocketHandle connect_tcp(const char *address, char *error,
+                                size_t error_size) {
+#ifdef _WIN32
+  static bool winsock_ready = false;
+  if (!winsock_ready) {
+    WSADATA data;
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+      set_error(error, error_size, "cannot initialize Winsock");
+      return INVALID_SOCKET_HANDLE;
+    }
+    winsock_ready = true;
+  }
+#endif
+  // The port follows the last colon so bracket-less IPv6 hosts still parse.
+  const char *colon = strrchr(address, ':');
+  if (!colon || colon == address || colon[1] == '\0') {
+    set_error(error, error_size, "expected tcp:<host>:<port>");
+    return INVALID_SOCKET_HANDLE;
+  }
+  char host[256];
+  size_t host_length = (size_t)(colon - address);
+  if (address[0] == '[' && colon[-1] == ']') {
+    address++;
+    host_length -= 2;
+  }
+  if (host_length >= sizeof(host)) {
+    set_error(error, error_size, "host name is too long");
+    return INVALID_SOCKET_HANDLE;
+  }
+  memcpy(host, address, host_length);
+  host[host_length] = '\0';
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *results = NULL;
+  if (getaddrinfo(host, colon + 1, &hints, &results) != 0) {
+    set_error(error, error_size, "cannot resolve host");
+    return INVALID_SOCKET_HANDLE;
+  }
+  SocketHandle handle = INVALID_SOCKET_HANDLE;
+  for (struct addrinfo *info = results; info; info = info->ai_next) {
+    handle = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+    if (handle == INVALID_SOCKET_HANDLE)
+      continue;
+    if (connect(handle, info->ai_addr, (int)info->ai_addrlen) == 0)
+      break;
+    close_socket(handle);
+    handle = INVALID_SOCKET_HANDLE;
+  }
+  freeaddrinfo(results);
+  if (handle == INVALID_SOCKET_HANDLE)
+    set_error(error, error_size, "cannot connect");
+  return handle;
+}
+
+#ifndef _WIN32
+static SocketHandle connect_unix(const char *path, char *error,
+                                 size_t error_size) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    set_error(error, error_size, "socket path is too long");
+    return INVALID_SOCKET_HANDLE;
+  }
+  strcpy(address.sun_path, path);
+  SocketHandle handle = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (handle == INVALID_SOCKET_HANDLE ||
+      connect(handle, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    if (handle != INVALID_SOCKET_HANDLE)
+      close_socket(handle);
+    set_error(error, error_size, "cannot connect");
+    return INVALID_SOCKET_HANDLE;
+  }
+  return handle;
+}
+#endif
+
+#define MAX_SINK_SCHEMES 4
+
+typedef struct {
+  const char *scheme;
+  ByteSinkOpener opener;
+} SinkScheme;
+
+static SinkScheme g_schemes[MAX_SINK_SCHEMES];
+static size_t g_scheme_count = 0;
+
+bool byte_sink_register_scheme(const char *scheme, ByteSinkOpener opener) {
+  if (g_scheme_count == MAX_SINK_SCHEMES)
+    return false;
+  g_schemes[g_scheme_count].scheme = scheme;
+  g_schemes[g_scheme_count].opener = opener;
+  g_scheme_count++;
+  return true;
+}
+
+bool byte_sink_is_file_target(const char *target) {
+  for (size_t i = 0; i < g_scheme_count; ++i) {
+    size_t length = strlen(g_schemes[i].scheme);
+    if (strncmp(target, g_schemes[i].scheme, length) == 0 &&
+        target[length] == ':')
+      return false;
+  }
+#ifndef _WIN32
+  if (strncmp(target, "unix:", 5) == 0)
+    return false;
+#endif
+  return strncmp(target, "tcp:", 4) != 0;
+}
+
+bool byte_sink_open(ByteSink *sink, const char *target, char *error,
+                    size_t error_size) {
+  memset(sink, 0, sizeof(*sink));
+  for (size_t i = 0; i < g_scheme_count; ++i) {
+    size_t length = strlen(g_schemes[i].scheme);
+    if (strncmp(target, g_schemes[i].scheme, length) == 0 &&
+        target[length] == ':')
+      return g_schemes[i].opener(sink, target + length + 1, error, error_size);
+  }
+  if (strncmp(target, "tcp:", 4) == 0) {
+    SocketHandle handle = connect_tcp(target + 4, error, error_size);
+    if (handle == INVALID_SOCKET_HANDLE)
+      return false;
+    disable_sigpipe(handle);
+    sink->socket = handle;
+    sink->kind = kByteSinkSocket;
+#ifndef _WIN32
+  } else if (strncmp(target, "unix:", 5) == 0) {
+    SocketHandle handle = connect_unix(target + 5, error, error_size);
+    if (handle == INVALID_SOCKET_HANDLE)
+      return false;
+    disable_sigpipe(handle);
+    sink->socket = handle;
+    sink->kind = kByteSinkSocket;
+#endif
+  } else {
+    sink->kind = kByteSinkFile;
+    sink->file = fopen(target, "wb");
+    if (!sink->file) {
+      set_error(error, error_size, "cannot open output file");
+      return false;
+    }
+  }
+  sink->ok = true;
+  return true;
+}
+
+void byte_sink_open_memory(ByteSink *sink) {
+  memset(sink, 0, sizeof(*sink));
+  sink->kind = kByteSinkMemory;
+  sink->ok = true;
+}
+
+void byte_sink_open_buffer(ByteSink *sink, uint8_t *buffer, size_t capacity) {
+  memset(sink, 0, sizeof(*sink));
+  sink->kind = kByteSinkBuffer;
+  sink->memory = buffer;
+  sink->memory_capacity = capacity;
+  sink->ok = true;
+}
+
+static bool memory_write(ByteSink *sink, const void *data, size_t size) {
+  size_t used = (size_t)sink->bytes_written;
+  if (size > sink->memory_capacity - used) {
+    if (sink->kind == kByteSinkBuffer)
+      return false;
+    size_t capacity = sink->memory_capacity ? sink->memory_capacity : 4096;
+    while (capacity - used < size)
+      capacity *= 2;
+    uint8_t *memory = (uint8_t *)realloc(sink->memory, capacity);
+    if (!memory)
+      return false;
+    sink->memory = memory;
+    sink->memory_capacity = capacity;
+  }
+  memcpy(sink->memory + used, data, size);
+  return true;
+}
+
+bool byte_sink_write(ByteSink *sink, const void *data, size_t size) {
+  if (!sink->ok)
+    return false;
+  if (sink->kind == kByteSinkFile) {
+    sink->ok = fwrite(data, 1, size, sink->file) == size;
+  } else if (sink->kind == kByteSinkMemory || sink->kind == kByteSinkBuffer) {
+    sink->ok = memory_write(sink, data, size);
+  } else {
+    const char *cursor = (const char *)data;
+    size_t remaining = size;
+    while (remaining > 0) {
+      int chunk = remaining > (1u << 30) ? (1 << 30) : (int)remaining;
+#ifdef _WIN32
+      int sent = send((SocketHandle)sink->socket, cursor, chunk, 0);
+#else
+      ssize_t sent = send(sink->socket, cursor, (size_t)chunk, MSG_NOSIGNAL);
+      if (sent < 0 && errno == EINTR)
+        continue;
+#endif
+      if (sent <= 0) {
+        sink->ok = false;
+        break;
+      }
+      cursor += sent;
+      remaining -= (size_t)sent;
+    }
+  }
+  if (sink->ok)
+    sink->bytes_written += size;
+  return sink->ok;
+}
+
+bool byte_sink_flush(ByteSink *sink) {
+  if (sink->ok && sink->file && fflush(sink->file) != 0)
+    sink->ok = false;
+  return sink->ok;
+}
+
+bool byte_sink_close(ByteSink *sink) {
+  bool ok = byte_sink_flush(sink);
+  if (sink->file) {
+    ok = fclose(sink->file) == 0 && ok;
+    sink->file = NULL;
+  } else if (sink->kind == kByteSinkSocket) {
+    close_socket((SocketHandle)sink->socket);
+    sink->kind = kByteSinkFile;
+  }
+  if (sink->kind == kByteSinkMemory)
+    free(sink->memory);
+  sink->memory = NULL;
+  sink->memory_capacity = 0;
+  sink->ok = false;
+  return ok;
+}
@@ -0,0 +1,63 @@
+// Output destination for encoded images: a file, a connected stream socket,
+// a growable memory buffer or a fixed caller-owned buffer.
+//
+// Targets are strings: `tcp:<host>:<port>` and, outside Windows,
+// `unix:<path>` connect a socket, schemes registered with
+// `byte_sink_register_scheme` go to their opener; anything else is a file
+// path. Writes block
+// until every byte is accepted, so callers can flush partial output (for
+// example one PNG band) while the rest is still being produced.
+
+#ifndef BYTE_SINK_H
+#define BYTE_SINK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+  kByteSinkFile,
+  kByteSinkSocket,
+  kByteSinkMemory,
+  kByteSinkBuffer,
+} ByteSinkKind;
+
+typedef struct {
+  ByteSinkKind kind;
+  FILE *file;
+#ifdef _WIN32
+  uintptr_t socket;
+#else
+  int socket;
+#endif
+  // Memory sinks own `memory`, buffer sinks borrow it; its first
+  // `bytes_written` bytes are valid.
+  uint8_t *memory;
+  size_t memory_capacity;
+  uint64_t bytes_written;
+  bool ok;
+} ByteSink;
+
+// On failure `error` receives a short reason and the sink is left closed.
+bool byte_sink_open(ByteSink *sink, const char *target, char *error,
+                    size_t error_size);
+// Whether `target` names a file rather than a socket or a registered scheme.
+bool byte_sink_is_file_target(const char *target);
+void byte_sink_open_memory(ByteSink *sink);
+// Writes into `buffer`; a write that does not fit fails the sink.
+void byte_sink_open_buffer(ByteSink *sink, uint8_t *buffer, size_t capacity);
+
+// Opens targets of the form `<scheme>:<rest>`, receiving `rest`. Schemes are
+// registered at startup, before any sink is opened.
+typedef bool (*ByteSinkOpener)(ByteSink *sink, const char *rest, char *error,
+                               size_t error_size);
+bool byte_sink_register_scheme(const char *scheme, ByteSinkOpener opener);
+bool byte_sink_write(ByteSink *sink, const void *data, size_t size);
+// Pushes buffered file data to the OS; sockets are unbuffered.
+bool byte_sink_flush(ByteSink *sink);
+// Returns false if any write failed during the sink's lifetime. Frees the
+// buffer of memory sinks.
+bool byte_sink_close(ByteSink *sink);
+
+#endif // BYTE_SINK_H
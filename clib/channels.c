@@ -0,0 +1,94 @@
+#include "channels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_CHANNELS 16
+
+typedef struct {
+  const char *name;
+  ChannelHandler handler;
+  void *user_data;
+} ChannelEntry;
+
+static ChannelEntry g_channels[MAX_CHANNELS];
+static size_t g_channels_count = 0;
+static FlutterEngine g_channels_engine = NULL;
+
+bool channels_register(const char *channel, ChannelHandler handler,
+                       void *user_data) {
+  if (g_channels_count == MAX_CHANNELS) {
+    fprintf(stderr, "Too many platform channels, dropping %s\n", channel);
+    return false;
+  }
+  g_channels[g_channels_count].name = channel;
+  g_channels[g_channels_count].handler = handler;
+  g_channels[g_channels_count].user_data = user_data;
+  g_channels_count++;
+  return true;
+}
+
+void channels_set_engine(FlutterEngine engine) { g_channels_engine = engine; }
+
+FlutterEngine channels_engine(void) { return g_channels_engine; }
+
+void channels_dispatch(const FlutterPlatformMessage *message,
+                       void *user_data) {
+  (void)user_data;
+  for (size_t i = 0; i < g_channels_count; ++i) {
+    if (strcmp(g_channels[i].name, message->channel) == 0) {
+      g_channels[i].handler(message, g_channels[i].user_data);
+      return;
+    }
+  }
+  channels_respond(message->response_handle, NULL, 0);
+}
+
+bool channels_respond(const FlutterPlatformMessageResponseHandle *handle,
+                      const uint8_t *data, size_t size) {
+  if (!handle || !g_channels_engine)
+    return false;
+  return FlutterEngineSendPlatformMessageResponse(g_channels_engine, handle,
+                                                  data, size) == kSuccess;
+}
+
+bool channels_respond_status(const FlutterPlatformMessageResponseHandle *handle,
+                             uint8_t status, const char *text) {
+  size_t text_length = text ? strlen(text) : 0;
+  uint8_t stack_buffer[256];
+  uint8_t *buffer = stack_buffer;
+  if (text_length + 1 > sizeof(stack_buffer)) {
+    buffer = (uint8_t *)malloc(text_length + 1);
+    if (!buffer)
+      return channels_respond(handle, &status, 1);
+  }
+  buffer[0] = status;
+  if (text_length > 0)
+    memcpy(buffer + 1, text, text_length);
+  bool sent = channels_respond(handle, buffer, text_length + 1);
+  if (buffer != stack_buffer)
+    free(buffer);
+  return sent;
+}
+
+bool channels_send(const char *channel, const uint8_t *data, size_t size,
+                   FlutterDataCallback reply, void *user_data) {
+  if (!g_channels_engine)
+    return false;
+  FlutterPlatformMessageResponseHandle *handle = NULL;
+  if (reply && FlutterPlatformMessageCreateResponseHandle(
+                   g_channels_engine, reply, user_data, &handle) != kSuccess)
+    return false;
+  FlutterPlatformMessage message;
+  memset(&message, 0, sizeof(message));
+  message.struct_size = sizeof(message);
+  message.channel = channel;
+  message.message = data;
+  message.message_size = size;
+  message.response_handle = handle;
+  bool sent = FlutterEngineSendPlatformMessage(g_channels_engine, &message) ==
+              kSuccess;
+  if (handle)
+    FlutterPlatformMessageReleaseResponseHandle(g_channels_engine, handle);
+  return sent;
+}
@@ -0,0 +1,135 @@
+// Platform channel routing between the Dart side (`HeadlessRender`) and the
+// embedder subsystems. Messages use little-endian binary payloads; the layout
+// of each channel is documented next to its handler.
+
+#ifndef CHANNELS_H
+#define CHANNELS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "embedder.h"
+
+// Invoked on the platform thread. Every handler must eventually answer the
+// message through `channels_respond`, possibly from another thread.
+typedef void (*ChannelHandler)(const FlutterPlatformMessage *message,
+                               void *user_data);
+
+bool channels_register(const char *channel, ChannelHandler handler,
+                       void *user_data);
+void channels_set_engine(FlutterEngine engine);
+FlutterEngine channels_engine(void);
+
+// Suitable as `FlutterProjectArgs.platform_message_callback`. Messages on
+// channels without a handler are answered with an empty response, which the
+// framework reports as "no handler".
+void channels_dispatch(const FlutterPlatformMessage *message, void *user_data);
+
+bool channels_respond(const FlutterPlatformMessageResponseHandle *handle,
+                      const uint8_t *data, size_t size);
+
+// Replies with a one-byte status followed by an optional UTF-8 message.
+bool channels_respond_status(const FlutterPlatformMessageResponseHandle *handle,
+                             uint8_t status, const char *text);
+
+// Sends a message to the Dart side. `reply`, when given, receives the
+// response on the platform thread; a channel without a Dart handler answers
+// with an empty one. Returns false (and never calls `reply`) when the message
+// could not be sent. The engine copies `data`.
+bool channels_send(const char *channel, const uint8_t *data, size_t size,
+                   FlutterDataCallback reply, void *user_data);
+
+enum {
+  kChannelStatusOk = 0,
+  kChannelStatusError = 1,
+};
+
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  size_t offset;
+  bool ok;
+} MessageReader;
+
+static inline MessageReader message_reader(const uint8_t *data, size_t size) {
+  MessageReader reader = {data, size, 0, true};
+  return reader;
+}
+
+static inline const uint8_t *message_read_bytes(MessageReader *reader,
+                                                size_t count) {
+  if (!reader->ok || reader->size - reader->offset < count) {
+    reader->ok = false;
+    return NULL;
+  }
+  const uint8_t *bytes = reader->data + reader->offset;
+  reader->offset += count;
+  return bytes;
+}
+
+static inline uint8_t message_read_u8(MessageReader *reader) {
+  const uint8_t *bytes = message_read_bytes(reader, 1);
+  return bytes ? bytes[0] : 0;
+}
+
+static inline uint16_t message_read_u16(MessageReader *reader) {
+  const uint8_t *bytes = message_read_bytes(reader, 2);
+  return bytes ? (uint16_t)(bytes[0] | (bytes[1] << 8)) : 0;
+}
+
+static inline uint32_t message_read_u32(MessageReader *reader) {
+  const uint8_t *bytes = message_read_bytes(reader, 4);
+  return bytes ? (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) |
+                     ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24)
+               : 0;
+}
+
+static inline uint64_t message_read_u64(MessageReader *reader) {
+  uint64_t low = message_read_u32(reader);
+  uint64_t high = message_read_u32(reader);
+  return (high << 32) | low;
+}
+
+static inline double message_read_f64(MessageReader *reader) {
+  const uint8_t *bytes = message_read_bytes(reader, 8);
+  double value = 0;
+  if (bytes) {
+    uint64_t bits = 0;
+    for (int i = 7; i >= 0; --i)
+      bits = (bits << 8) | bytes[i];
+    memcpy(&value, &bits, sizeof(value));
+  }
+  return value;
+}
+
+// Reads a u16 length-prefixed UTF-8 string into `out` (always terminated).
+static inline bool message_read_string(MessageReader *reader, char *out,
+                                       size_t out_size) {
+  uint16_t length = message_read_u16(reader);
+  const uint8_t *bytes = message_read_bytes(reader, length);
+  if (!bytes || length >= out_size) {
+    reader->ok = false;
+    if (out_size > 0)
+      out[0] = '\0';
+    return false;
+  }
+  memcpy(out, bytes, length);
+  out[length] = '\0';
+  return true;
+}
+
+static inline void message_write_u32(uint8_t *out, uint32_t value) {
+  out[0] = (uint8_t)value;
+  out[1] = (uint8_t)(value >> 8);
+  out[2] = (uint8_t)(value >> 16);
+  out[3] = (uint8_t)(value >> 24);
+}
+
+static inline void message_write_u64(uint8_t *out, uint64_t value) {
+  message_write_u32(out, (uint32_t)value);
+  message_write_u32(out + 4, (uint32_t)(value >> 32));
+}
+
+#endif // CHANNELS_H
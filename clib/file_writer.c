@@ -0,0 +1,733 @@
+#ifdef __linux__
+// O_DIRECT.
+#define _GNU_SOURCE
+#endif
+
+#include "file_writer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "byte_sink.h"
+#include "log_ring.h"
+#include "platform_thread.h"
+#include "trace_events.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+// The opcodes used below arrived with Linux 5.6; FAST_POLL came in 5.7.
+#ifdef IORING_FEAT_FAST_POLL
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#define MAX_FILES_IN_FLIGHT 64
+
+static PlatformMutex g_writer_mutex = PLATFORM_MUTEX_INIT;
+// Guarded by g_writer_mutex.
+static PlatformCond g_room;
+static PlatformCond g_idle;
+static uint32_t g_in_flight;
+static FileWriterStats g_stats;
+
+static unsigned g_sync_batch;
+
+static void record_completion(bool ok, uint64_t bytes, bool synced) {
+  platform_mutex_lock(&g_writer_mutex);
+  if (ok) {
+    g_stats.completed++;
+    g_stats.bytes += bytes;
+  } else {
+    g_stats.failed++;
+  }
+  if (synced)
+    g_stats.syncs++;
+  g_in_flight--;
+  platform_cond_signal(&g_room);
+  if (g_in_flight == 0)
+    platform_cond_broadcast(&g_idle);
+  platform_mutex_unlock(&g_writer_mutex);
+}
+
+static bool sync_stream(FILE *file) {
+#ifdef _WIN32
+  return _commit(_fileno(file)) == 0;
+#else
+  return fsync(fileno(file)) == 0;
+#endif
+}
+
+static void write_blocking(const char *path, const void *data, size_t size,
+                           FileWriteDone done, void *user_data) {
+  platform_mutex_lock(&g_writer_mutex);
+  g_in_flight++;
+  g_stats.submitted++;
+  platform_mutex_unlock(&g_writer_mutex);
+
+  TraceSpan span = trace_begin("WriteFile");
+  ByteSink sink;
+  char error[96];
+  uint64_t bytes = 0;
+  bool synced = false;
+  bool ok = byte_sink_open(&sink, path, error, sizeof(error));
+  if (ok) {
+    byte_sink_write(&sink, data, size);
+    if (g_sync_batch > 0 && sink.ok)
+      synced = byte_sink_flush(&sink) && sync_stream(sink.file);
+    bytes = sink.bytes_written;
+    ok = byte_sink_close(&sink) && (synced || g_sync_batch == 0);
+    if (!ok)
+      snprintf(error, sizeof(error), "%s",
+               synced || g_sync_batch == 0 ? "cannot write to target"
+                                           : "cannot sync output file");
+  }
+  trace_end(span, 0);
+  done(ok, ok ? bytes : 0, ok ? NULL : error, user_data);
+  record_completion(ok, bytes, synced);
+}
+
+#ifdef HAVE_IO_URING
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#define RING_ENTRIES 256
+#define DIRECT_BUFFER_COUNT 16
+#define DIRECT_BUFFER_SIZE (1u << 20)
+#define DIRECT_ALIGNMENT 4096u
+// Buffered files are written in pieces of at most this size; the kernel caps
+// a single write just below 2 GiB anyway.
+#define MAX_WRITE_SIZE (1u << 30)
+#define WAKEUP_TAG UINT64_MAX
+
+// Every file has at most one open, write, sync or close in flight, except
+// direct writes, which are bounded by the staging buffers. Ops therefore
+// never outnumber ring entries and the completion queue cannot overflow.
+_Static_assert(1 + MAX_FILES_IN_FLIGHT + DIRECT_BUFFER_COUNT <= RING_ENTRIES,
+               "the ring must hold every operation that can be in flight");
+
+typedef struct FileWrite {
+  char *path;
+  const uint8_t *data;
+  size_t size;
+  FileWriteDone done;
+  void *user_data;
+  int fd;
+  bool direct;
+  bool waiting_for_buffer;
+  // Bytes handed to write operations and bytes the kernel confirmed.
+  size_t issued;
+  size_t written;
+  unsigned writes_pending;
+  // First failure, as an errno and what was being done.
+  int error;
+  const char *failed_step;
+  bool synced;
+  // Pairs the begin and end of the write in the trace.
+  uint64_t trace_id;
+  struct FileWrite *next;
+} FileWrite;
+
+enum {
+  kOpOpen,
+  kOpWrite,
+  kOpSync,
+  kOpClose,
+};
+
+typedef struct {
+  FileWrite *file;
+  uint8_t kind;
+  // Staging buffer of a direct write, or -1.
+  int16_t buffer;
+  uint32_t length;
+  uint64_t offset;
+} UringOp;
+
+typedef struct {
+  int fd;
+  unsigned entries;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+  // Entries filled in but not yet published to the kernel.
+  unsigned local_tail;
+} Uring;
+
+// Guarded by g_writer_mutex.
+static FileWrite *g_incoming_head;
+static FileWrite *g_incoming_tail;
+static bool g_stopping;
+
+// Set while the writer thread runs; only changed while no output worker can
+// submit.
+static bool g_uring_running;
+
+// Everything below belongs to the writer thread.
+static Uring g_ring;
+static int g_wakeup_fd = -1;
+static uint64_t g_wakeup_value;
+static PlatformThread g_writer_thread;
+static bool g_direct;
+static UringOp g_ops[RING_ENTRIES];
+static uint16_t g_free_ops[RING_ENTRIES];
+static unsigned g_free_op_count;
+static uint8_t *g_direct_buffers;
+static int16_t g_free_buffers[DIRECT_BUFFER_COUNT];
+static unsigned g_free_buffer_count;
+static bool g_buffers_registered;
+// Direct files waiting for a staging buffer, oldest first.
+static FileWrite *g_buffer_waiters;
+// Written files waiting for their data sync.
+static FileWrite *g_sync_list;
+static unsigned g_sync_count;
+// Files taken off the incoming list and not completed.
+static unsigned g_active;
+
+static void uring_teardown(Uring *ring) {
+  if (ring->sqes)
+    munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  if (ring->sq_ring)
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  if (ring->fd >= 0)
+    close(ring->fd);
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+}
+
+static void *map_ring(int fd, size_t size, off_t offset) {
+  void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, offset);
+  return mapping == MAP_FAILED ? NULL : mapping;
+}
+
+static bool uring_setup(Uring *ring, unsigned entries) {
+  memset(ring, 0, sizeof(*ring));
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0)
+    return false;
+  ring->entries = params.sq_entries;
+  ring->sq_ring_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap && ring->cq_ring_size > ring->sq_ring_size)
+    ring->sq_ring_size = ring->cq_ring_size;
+  ring->sq_ring = map_ring(ring->fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+  ring->cq_ring = single_mmap ? ring->sq_ring
+                              : map_ring(ring->fd, ring->cq_ring_size,
+                                         IORING_OFF_CQ_RING);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = map_ring(ring->fd, ring->sqes_size, IORING_OFF_SQES);
+  if (!ring->sq_ring || !ring->cq_ring || !ring->sqes) {
+    uring_teardown(ring);
+    return false;
+  }
+
+  uint8_t *sq = (uint8_t *)ring->sq_ring;
+  uint8_t *cq = (uint8_t *)ring->cq_ring;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  ring->local_tail = *ring->sq_tail;
+  return true;
+}
+
+static bool uring_supports(const Uring *ring, const uint8_t *opcodes,
+                           size_t count) {
+  size_t size = sizeof(struct io_uring_probe) +
+                IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, size);
+  bool ok = probe && syscall(__NR_io_uring_register, ring->fd,
+                             IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0;
+  for (size_t i = 0; ok && i < count; ++i)
+    ok = opcodes[i] <= probe->last_op &&
+         (probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED);
+  free(probe);
+  return ok;
+}
+
+static struct io_uring_sqe *uring_next_sqe(Uring *ring) {
+  unsigned index = ring->local_tail++ & ring->sq_mask;
+  ring->sq_array[index] = index;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+// Publishes the filled-in entries, submits them and waits for at least
+// `wait` completions.
+static int uring_enter(Uring *ring, unsigned wait) {
+  __atomic_store_n(ring->sq_tail, ring->local_tail, __ATOMIC_RELEASE);
+  unsigned pending =
+      ring->local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  return (int)syscall(__NR_io_uring_enter, ring->fd, pending, wait,
+                      IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+static struct io_uring_sqe *queue_op(FileWrite *file, uint8_t kind,
+                                     int16_t buffer, uint32_t length,
+                                     uint64_t offset) {
+  uint16_t tag = g_free_ops[--g_free_op_count];
+  g_ops[tag].file = file;
+  g_ops[tag].kind = kind;
+  g_ops[tag].buffer = buffer;
+  g_ops[tag].length = length;
+  g_ops[tag].offset = offset;
+  struct io_uring_sqe *sqe = uring_next_sqe(&g_ring);
+  sqe->user_data = tag;
+  return sqe;
+}
+
+static void arm_wakeup(void) {
+  struct io_uring_sqe *sqe = uring_next_sqe(&g_ring);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = g_wakeup_fd;
+  sqe->addr = (uint64_t)(uintptr_t)&g_wakeup_value;
+  sqe->len = sizeof(g_wakeup_value);
+  sqe->user_data = WAKEUP_TAG;
+}
+
+static void queue_open(FileWrite *file) {
+  struct io_uring_sqe *sqe = queue_op(file, kOpOpen, -1, 0, 0);
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uint64_t)(uintptr_t)file->path;
+  sqe->len = 0666;
+  sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC |
+                    (file->direct ? O_DIRECT : 0);
+}
+
+static void queue_write(FileWrite *file, int16_t buffer, const uint8_t *data,
+                        size_t length, uint64_t offset) {
+  struct io_uring_sqe *sqe =
+      queue_op(file, kOpWrite, buffer, (uint32_t)length, offset);
+  sqe->opcode = buffer >= 0 && g_buffers_registered ? IORING_OP_WRITE_FIXED
+                                                    : IORING_OP_WRITE;
+  sqe->fd = file->fd;
+  sqe->addr = (uint64_t)(uintptr_t)data;
+  sqe->len = (uint32_t)length;
+  sqe->off = offset;
+  if (sqe->opcode == IORING_OP_WRITE_FIXED)
+    sqe->buf_index = (uint16_t)buffer;
+  file->writes_pending++;
+}
+
+static void queue_close(FileWrite *file) {
+  struct io_uring_sqe *sqe = queue_op(file, kOpClose, -1, 0, 0);
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = file->fd;
+}
+
+static void fail_file(FileWrite *file, int error, const char *step) {
+  if (file->error == 0) {
+    file->error = error;
+    file->failed_step = step;
+  }
+}
+
+static void remove_buffer_waiter(FileWrite *file) {
+  for (FileWrite **link = &g_buffer_waiters; *link; link = &(*link)->next) {
+    if (*link == file) {
+      *link = file->next;
+      break;
+    }
+  }
+  file->waiting_for_buffer = false;
+}
+
+static void complete_file(FileWrite *file) {
+  bool ok = file->error == 0;
+  char error[128];
+  if (!ok)
+    snprintf(error, sizeof(error), "%s: %s", file->failed_step,
+             strerror(file->error));
+  trace_async_end("WriteFile", file->trace_id);
+  file->done(ok, ok ? file->written : 0, ok ? NULL : error, file->user_data);
+  g_active--;
+  record_completion(ok, file->written, file->synced);
+  free(file->path);
+  free(file);
+}
+
+static void finish_writes(FileWrite *file) {
+  // The last direct write was padded to the alignment.
+  if (file->error == 0 && file->direct && file->size % DIRECT_ALIGNMENT != 0 &&
+      ftruncate(file->fd, (off_t)file->size) != 0)
+    fail_file(file, errno, "cannot write to target");
+  if (file->error == 0 && g_sync_batch > 0) {
+    file->next = g_sync_list;
+    g_sync_list = file;
+    g_sync_count++;
+    return;
+  }
+  queue_close(file);
+}
+
+static void issue_writes(FileWrite *file) {
+  if (file->error == 0 && !file->direct) {
+    // One write at a time, so short writes simply continue where they ended.
+    if (file->writes_pending == 0 && file->issued < file->size) {
+      size_t length = file->size - file->issued;
+      if (length > MAX_WRITE_SIZE)
+        length = MAX_WRITE_SIZE;
+      queue_write(file, -1, file->data + file->issued, length, file->issued);
+      file->issued += length;
+    }
+  }
+  // A file queued for a buffer is resumed from the queue, in turn.
+  while (file->error == 0 && file->direct && !file->waiting_for_buffer &&
+         file->issued < file->size) {
+    if (g_free_buffer_count == 0) {
+      FileWrite **link = &g_buffer_waiters;
+      while (*link)
+        link = &(*link)->next;
+      file->next = NULL;
+      *link = file;
+      file->waiting_for_buffer = true;
+      return;
+    }
+    int16_t buffer = g_free_buffers[--g_free_buffer_count];
+    uint8_t *staging = g_direct_buffers + (size_t)buffer * DIRECT_BUFFER_SIZE;
+    size_t length = file->size - file->issued;
+    if (length > DIRECT_BUFFER_SIZE)
+      length = DIRECT_BUFFER_SIZE;
+    size_t padded = (length + DIRECT_ALIGNMENT - 1) & ~(DIRECT_ALIGNMENT - 1);
+    // The encoded output is not aligned for O_DIRECT (see file_writer.h).
+    memcpy(staging, file->data + file->issued, length);
+    memset(staging + length, 0, padded - length);
+    queue_write(file, buffer, staging, padded, file->issued);
+    file->issued += length;
+  }
+  if (file->writes_pending == 0 &&
+      (file->error != 0 || file->issued == file->size))
+    finish_writes(file);
+}
+
+static void take_incoming(void) {
+  platform_mutex_lock(&g_writer_mutex);
+  FileWrite *file = g_incoming_head;
+  g_incoming_head = g_incoming_tail = NULL;
+  platform_mutex_unlock(&g_writer_mutex);
+  while (file) {
+    FileWrite *next = file->next;
+    file->next = NULL;
+    g_active++;
+    queue_open(file);
+    file = next;
+  }
+}
+
+static void handle_completion(uint64_t tag, int result) {
+  if (tag == WAKEUP_TAG) {
+    take_incoming();
+    arm_wakeup();
+    return;
+  }
+  UringOp op = g_ops[tag];
+  g_free_ops[g_free_op_count++] = (uint16_t)tag;
+  FileWrite *file = op.file;
+  switch (op.kind) {
+  case kOpOpen:
+    if (result == -EINVAL && file->direct) {
+      // The filesystem does not do O_DIRECT; write this file buffered.
+      file->direct = false;
+      queue_open(file);
+      return;
+    }
+    if (result < 0) {
+      fail_file(file, -result, "cannot open output file");
+      complete_file(file);
+      return;
+    }
+    file->fd = result;
+    issue_writes(file);
+    return;
+  case kOpWrite:
+    file->writes_pending--;
+    if (op.buffer >= 0)
+      g_free_buffers[g_free_buffer_count++] = op.buffer;
+    if (result < 0) {
+      fail_file(file, -result, "cannot write to target");
+    } else if ((uint32_t)result < op.length &&
+               (op.buffer >= 0 || result == 0)) {
+      // Direct writes are all or nothing, and a zero-length write would
+      // repeat forever.
+      fail_file(file, EIO, "cannot write to target");
+    } else if (op.buffer >= 0) {
+      size_t data = file->size - op.offset;
+      file->written += data < op.length ? data : op.length;
+    } else {
+      file->written += (size_t)result;
+      file->issued = op.offset + (size_t)result;
+    }
+    if (file->error != 0 && file->waiting_for_buffer)
+      remove_buffer_waiter(file);
+    issue_writes(file);
+    return;
+  case kOpSync:
+    if (result < 0)
+      fail_file(file, -result, "cannot sync output file");
+    else
+      file->synced = true;
+    queue_close(file);
+    return;
+  case kOpClose:
+    if (result < 0)
+      fail_file(file, -result, "cannot write to target");
+    complete_file(file);
+    return;
+  }
+}
+
+static void flush_syncs(void) {
+  // Wait for a full batch unless every file in flight is waiting anyway.
+  if (g_sync_count == 0 ||
+      (g_sync_count < g_sync_batch && g_sync_count < g_active))
+    return;
+  for (FileWrite *file = g_sync_list; file;) {
+    FileWrite *next = file->next;
+    struct io_uring_sqe *sqe = queue_op(file, kOpSync, -1, 0, 0);
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = file->fd;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    file = next;
+  }
+  g_sync_list = NULL;
+  g_sync_count = 0;
+}
+
+static void writer_main(void *argument) {
+  (void)argument;
+  trace_thread_name("file-writer");
+  arm_wakeup();
+  for (;;) {
+    if (uring_enter(&g_ring, 1) < 0 && errno != EINTR && errno != EAGAIN &&
+        errno != EBUSY)
+      log_ring_printf(kLogError, "file-writer", 0, "io_uring_enter failed: %s",
+                      strerror(errno));
+
+    unsigned head = *g_ring.cq_head;
+    unsigned tail = __atomic_load_n(g_ring.cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      struct io_uring_cqe *cqe = &g_ring.cqes[head & g_ring.cq_mask];
+      uint64_t tag = cqe->user_data;
+      int result = cqe->res;
+      __atomic_store_n(g_ring.cq_head, ++head, __ATOMIC_RELEASE);
+      handle_completion(tag, result);
+    }
+
+    while (g_free_buffer_count > 0 && g_buffer_waiters) {
+      FileWrite *file = g_buffer_waiters;
+      g_buffer_waiters = file->next;
+      file->waiting_for_buffer = false;
+      issue_writes(file);
+    }
+    flush_syncs();
+
+    platform_mutex_lock(&g_writer_mutex);
+    bool stop = g_stopping && g_in_flight == 0;
+    platform_mutex_unlock(&g_writer_mutex);
+    if (stop)
+      break;
+  }
+}
+
+static void stop_uring(void) {
+  uring_teardown(&g_ring);
+  if (g_wakeup_fd >= 0)
+    close(g_wakeup_fd);
+  g_wakeup_fd = -1;
+  if (g_direct_buffers)
+    munmap(g_direct_buffers, (size_t)DIRECT_BUFFER_COUNT * DIRECT_BUFFER_SIZE);
+  g_direct_buffers = NULL;
+  g_buffers_registered = false;
+}
+
+static bool start_uring(bool direct) {
+  static const uint8_t needed[] = {
+      IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_WRITE_FIXED,
+      IORING_OP_FSYNC,  IORING_OP_CLOSE, IORING_OP_READ,
+  };
+  if (!uring_setup(&g_ring, RING_ENTRIES))
+    return false;
+  g_wakeup_fd = eventfd(0, EFD_CLOEXEC);
+  if (g_ring.entries < RING_ENTRIES ||
+      !uring_supports(&g_ring, needed, sizeof(needed)) || g_wakeup_fd < 0) {
+    stop_uring();
+    return false;
+  }
+  g_free_op_count = 0;
+  for (unsigned i = RING_ENTRIES; i-- > 0;)
+    g_free_ops[g_free_op_count++] = (uint16_t)i;
+
+  if (direct) {
+    size_t size = (size_t)DIRECT_BUFFER_COUNT * DIRECT_BUFFER_SIZE;
+    void *buffers = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED) {
+      fprintf(stderr, "Output writer: no staging buffers, direct I/O is off\n");
+      direct = false;
+    } else {
+      g_direct_buffers = (uint8_t *)buffers;
+      struct iovec iovecs[DIRECT_BUFFER_COUNT];
+      g_free_buffer_count = 0;
+      for (int i = DIRECT_BUFFER_COUNT; i-- > 0;) {
+        iovecs[i].iov_base = g_direct_buffers + (size_t)i * DIRECT_BUFFER_SIZE;
+        iovecs[i].iov_len = DIRECT_BUFFER_SIZE;
+        g_free_buffers[g_free_buffer_count++] = (int16_t)i;
+      }
+      // Pinning can fail under a low RLIMIT_MEMLOCK; plain writes from the
+      // same buffers still work.
+      g_buffers_registered =
+          syscall(__NR_io_uring_register, g_ring.fd, IORING_REGISTER_BUFFERS,
+                  iovecs, DIRECT_BUFFER_COUNT) == 0;
+    }
+  }
+  g_direct = direct;
+  g_uring_running = true;
+  if (!platform_thread_start(&g_writer_thread, writer_main, NULL)) {
+    g_uring_running = false;
+    stop_uring();
+    return false;
+  }
+  return true;
+}
+
+#endif // HAVE_IO_URING
+
+void file_writer_install(void) {
+  platform_cond_init(&g_room);
+  platform_cond_init(&g_idle);
+  const char *batch = getenv("HEADLESS_FSYNC_BATCH");
+  if (batch && atoi(batch) > 0)
+    g_sync_batch = (unsigned)atoi(batch);
+  if (g_sync_batch > MAX_FILES_IN_FLIGHT)
+    g_sync_batch = MAX_FILES_IN_FLIGHT;
+
+  const char *direct = getenv("HEADLESS_DIRECT_IO");
+  bool want_direct = direct && strcmp(direct, "1") == 0;
+#ifdef HAVE_IO_URING
+  const char *uring = getenv("HEADLESS_IO_URING");
+  if (!(uring && strcmp(uring, "0") == 0) && start_uring(want_direct))
+    return;
+#endif
+  if (want_direct)
+    fprintf(stderr, "Output writer: direct I/O needs io_uring, ignoring "
+                    "HEADLESS_DIRECT_IO\n");
+}
+
+void file_writer_write(const char *path, const void *data, size_t size,
+                       FileWriteDone done, void *user_data) {
+#ifdef HAVE_IO_URING
+  if (g_uring_running) {
+    FileWrite *file = (FileWrite *)calloc(1, sizeof(FileWrite));
+    char *copy = file ? strdup(path) : NULL;
+    if (!copy) {
+      free(file);
+      done(false, 0, "out of memory", user_data);
+      return;
+    }
+    file->path = copy;
+    file->data = (const uint8_t *)data;
+    file->size = size;
+    file->done = done;
+    file->user_data = user_data;
+    file->fd = -1;
+    file->direct = g_direct;
+
+    platform_mutex_lock(&g_writer_mutex);
+    while (g_in_flight >= MAX_FILES_IN_FLIGHT)
+      platform_cond_wait(&g_room, &g_writer_mutex);
+    g_in_flight++;
+    file->trace_id = ++g_stats.submitted;
+    // Only the first file of a batch has to wake the writer; it takes the
+    // whole list at once.
+    bool wake = g_incoming_head == NULL;
+    if (g_incoming_tail)
+      g_incoming_tail->next = file;
+    else
+      g_incoming_head = file;
+    g_incoming_tail = file;
+    trace_async_begin("WriteFile", file->trace_id);
+    platform_mutex_unlock(&g_writer_mutex);
+
+    if (wake) {
+      uint64_t one = 1;
+      ssize_t written = write(g_wakeup_fd, &one, sizeof(one));
+      (void)written;
+    }
+    return;
+  }
+#endif
+  write_blocking(path, data, size, done, user_data);
+}
+
+void file_writer_drain(void) {
+  platform_mutex_lock(&g_writer_mutex);
+  while (g_in_flight > 0)
+    platform_cond_wait(&g_idle, &g_writer_mutex);
+  platform_mutex_unlock(&g_writer_mutex);
+}
+
+void file_writer_stats(FileWriterStats *stats) {
+  platform_mutex_lock(&g_writer_mutex);
+  *stats = g_stats;
+  stats->in_flight = g_in_flight;
+#ifdef HAVE_IO_URING
+  stats->uring = g_uring_running;
+  stats->direct = g_uring_running && g_direct;
+#endif
+  platform_mutex_unlock(&g_writer_mutex);
+}
+
+void file_writer_shutdown(void) {
+#ifdef HAVE_IO_URING
+  if (!g_uring_running)
+    return;
+  platform_mutex_lock(&g_writer_mutex);
+  g_stopping = true;
+  platform_mutex_unlock(&g_writer_mutex);
+  uint64_t one = 1;
+  ssize_t written = write(g_wakeup_fd, &one, sizeof(one));
+  (void)written;
+  platform_thread_join(g_writer_thread);
+  g_uring_running = false;
+  g_stopping = false;
+  stop_uring();
+#endif
+}
@@ -0,0 +1,75 @@
+// Asynchronous file output for the pipeline's output stage.
+//
+// On Linux the writes go through io_uring: a writer thread owns one ring and
+// runs every file as a chain of open, write, optional data sync and close
+// operations. The steps of all files in flight are submitted together, so a
+// batch of small images costs a few `io_uring_enter` calls instead of four
+// or more syscalls per file, and no output worker blocks on the disk. Where
+// io_uring is missing (older kernels, seccomp, other platforms) or disabled,
+// `file_writer_write` writes on the calling thread instead.
+//
+// Only the O_DIRECT staging pool is registered with the ring
+// (IORING_OP_WRITE_FIXED); buffered files are written with plain
+// IORING_OP_WRITE straight from the encoded output. That output is a memory
+// sink that PNG encoding grows with realloc, so its size and address are
+// only known once the image is done. Registering it would pin and unpin
+// every file with an extra io_uring_register call, which costs more than
+// the kernel's per-write page lookup that fixed buffers save, and buffered
+// writes copy into the page cache either way. Direct writes need aligned
+// memory, so they copy each piece into a staging buffer first.
+//
+// Environment:
+//   HEADLESS_IO_URING=0     always write on the calling thread.
+//   HEADLESS_DIRECT_IO=1    open files with O_DIRECT. Data is staged in a
+//                           pool of aligned buffers registered with the ring
+//                           and the padding of the last block is truncated
+//                           away. Filesystems without O_DIRECT (tmpfs) fall
+//                           back to buffered writes per file.
+//   HEADLESS_FSYNC_BATCH=N  make each file durable (fdatasync) before it
+//                           completes. Syncs are held back until N files
+//                           wait for one, or nothing else is in flight, and
+//                           then issued together so the filesystem can
+//                           commit them as one journal transaction. Without
+//                           io_uring every file is synced on its own.
+
+#ifndef FILE_WRITER_H
+#define FILE_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// `error` is NULL on success; `bytes` counts the bytes that reached the file.
+typedef void (*FileWriteDone)(bool ok, uint64_t bytes, const char *error,
+                              void *user_data);
+
+typedef struct {
+  uint64_t submitted;
+  uint64_t completed;
+  uint64_t failed;
+  uint64_t bytes;
+  uint64_t syncs;
+  // Submitted files whose `done` has not run yet.
+  uint32_t in_flight;
+  bool uring;
+  bool direct;
+} FileWriterStats;
+
+void file_writer_install(void);
+
+// Replaces the file at `path` with `size` bytes of `data`, which must stay
+// valid until `done` runs. With io_uring this returns once the file is
+// queued, waiting only while too many files are in flight, and `done` runs
+// on the writer thread. Otherwise the file is written before returning and
+// `done` runs on the calling thread.
+void file_writer_write(const char *path, const void *data, size_t size,
+                       FileWriteDone done, void *user_data);
+
+// Blocks until every submitted file completed.
+void file_writer_drain(void);
+void file_writer_stats(FileWriterStats *stats);
+
+// Drains and stops the writer thread.
+void file_writer_shutdown(void);
+
+#endif // FILE_WRITER_H
@@ -0,0 +1,364 @@
+#include "frame_capture.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "channels.h"
+#include "gif_writer.h"
+#include "log_ring.h"
+#include "pixel_kernels.h"
+#include "platform_thread.h"
+#include "png_writer.h"
+#include "work_queue.h"
+
+#define CAPTURE_CHANNEL "headless/capture"
+// Frames converted and waiting for the encoder. The raster thread waits for
+// one to come back once all of them are.
+#define FRAME_QUEUE_DEPTH 4
+
+enum {
+  kCaptureOpBegin = 1,
+  kCaptureOpSync = 2,
+  kCaptureOpEnd = 3,
+};
+
+typedef struct {
+  // Taking frames; cleared by end.
+  bool active;
+  // End is queued behind the frames and the encoder has not finished yet.
+  bool finishing;
+  bool failed;
+  // The raster thread is filling a frame it took from `free_frames`.
+  bool converting;
+  FrameFormat format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t frame_count;
+  uint32_t frames_presented;
+  uint32_t frames_written;
+  // The output and encoders are only touched by the encoder once the
+  // session began.
+  FILE *file;
+  PngWriter png;
+  GifWriter gif;
+  uint8_t *frames[FRAME_QUEUE_DEPTH];
+  uint8_t *free_frames[FRAME_QUEUE_DEPTH];
+  uint32_t free_count;
+  const FlutterPlatformMessageResponseHandle *pending_sync;
+  uint32_t pending_sync_frame;
+} CaptureSession;
+
+static CaptureSession g_capture;
+static PlatformMutex g_capture_mutex = PLATFORM_MUTEX_INIT;
+// Broadcast when a frame goes back to `free_frames` or a conversion ends.
+static PlatformCond g_frame_freed = PLATFORM_COND_INIT;
+// Encodes and writes the frames in order, then finishes the file.
+static WorkQueue g_encoder;
+
+// Must be called with the capture mutex held.
+static void release_session(void) {
+  for (int i = 0; i < FRAME_QUEUE_DEPTH; ++i)
+    free(g_capture.frames[i]);
+  if (g_capture.file)
+    fclose(g_capture.file);
+  memset(&g_capture, 0, sizeof(g_capture));
+}
+
+// Runs `run` on the encoder, or right here when it is not running. Call
+// without the capture mutex held.
+static void encode(WorkFunction run, void *argument) {
+  if (!work_queue_post(&g_encoder, run, argument))
+    run(argument);
+}
+
+static void encode_frame(void *argument) {
+  uint8_t *rgba = (uint8_t *)argument;
+  size_t stride = (size_t)g_capture.width * 4;
+  bool written = true;
+  if (g_capture.format == kFrameFormatApng) {
+    written = png_writer_add_frame(&g_capture.png, rgba, stride);
+  } else if (g_capture.format == kFrameFormatGif) {
+    written = gif_writer_add_frame(&g_capture.gif, rgba, stride);
+  } else {
+    size_t size = stride * g_capture.height;
+    written = fwrite(rgba, 1, size, g_capture.file) == size;
+  }
+  platform_mutex_lock(&g_capture_mutex);
+  if (written)
+    g_capture.frames_written++;
+  else
+    g_capture.failed = true;
+  g_capture.free_frames[g_capture.free_count++] = rgba;
+  platform_mutex_unlock(&g_capture_mutex);
+  platform_cond_broadcast(&g_frame_freed);
+}
+
+// Queued behind every frame, so they have all been written. `argument` is
+// the end request to answer, or NULL.
+static void finish_capture(void *argument) {
+  const FlutterPlatformMessageResponseHandle *handle =
+      (const FlutterPlatformMessageResponseHandle *)argument;
+  bool ok = true;
+  if (g_capture.format == kFrameFormatApng)
+    ok = png_writer_finish(&g_capture.png);
+  else if (g_capture.format == kFrameFormatGif)
+    ok = gif_writer_finish(&g_capture.gif);
+  long bytes = ftell(g_capture.file);
+  ok = fflush(g_capture.file) == 0 && ok;
+
+  platform_mutex_lock(&g_capture_mutex);
+  ok = !g_capture.failed && ok;
+  uint32_t frames = g_capture.frames_written;
+  const FlutterPlatformMessageResponseHandle *pending = g_capture.pending_sync;
+  release_session();
+  platform_mutex_unlock(&g_capture_mutex);
+
+  if (pending)
+    channels_respond_status(pending, kChannelStatusOk, NULL);
+  if (!handle)
+    return;
+  uint8_t reply[13];
+  reply[0] = ok ? kChannelStatusOk : kChannelStatusError;
+  message_write_u32(reply + 1, frames);
+  message_write_u64(reply + 5, bytes > 0 ? (uint64_t)bytes : 0);
+  channels_respond(handle, reply, sizeof(reply));
+}
+
+// Stops taking frames. Once it returns, every frame taken is queued, so
+// finish_capture can be queued behind them. Must be called with the capture
+// mutex held and a session active.
+static void end_session(void) {
+  g_capture.active = false;
+  g_capture.finishing = true;
+  // A raster thread waiting for a free frame gives up; one converting a
+  // frame still queues it.
+  platform_cond_broadcast(&g_frame_freed);
+  while (g_capture.converting)
+    platform_cond_wait(&g_frame_freed, &g_capture_mutex);
+}
+
+static void handle_begin(MessageReader *reader,
+                         const FlutterPlatformMessageResponseHandle *handle) {
+  uint32_t width = message_read_u32(reader);
+  uint32_t height = message_read_u32(reader);
+  uint32_t frame_count = message_read_u32(reader);
+  uint32_t fps = message_read_u32(reader);
+  double pixel_ratio = message_read_f64(reader);
+  uint8_t format = message_read_u8(reader);
+  char path[4096];
+  message_read_string(reader, path, sizeof(path));
+  if (!reader->ok || width == 0 || height == 0 || frame_count == 0 ||
+      fps == 0 || format > kFrameFormatGif) {
+    channels_respond_status(handle, kChannelStatusError,
+                            "malformed capture request");
+    return;
+  }
+  if (format == kFrameFormatGif && (width > UINT16_MAX || height > UINT16_MAX)) {
+    channels_respond_status(handle, kChannelStatusError,
+                            "GIF frames are limited to 65535 pixels");
+    return;
+  }
+
+  platform_mutex_lock(&g_capture_mutex);
+  if (g_capture.active || g_capture.finishing) {
+    platform_mutex_unlock(&g_capture_mutex);
+    channels_respond_status(handle, kChannelStatusError,
+                            "a capture is already running");
+    return;
+  }
+
+  g_capture.file = fopen(path, "wb");
+  bool allocated = true;
+  for (int i = 0; i < FRAME_QUEUE_DEPTH; ++i) {
+    g_capture.frames[i] = (uint8_t *)malloc((size_t)width * height * 4);
+    g_capture.free_frames[i] = g_capture.frames[i];
+    allocated = allocated && g_capture.frames[i];
+  }
+  g_capture.free_count = FRAME_QUEUE_DEPTH;
+  if (!g_capture.file || !allocated) {
+    release_session();
+    platform_mutex_unlock(&g_capture_mutex);
+    channels_respond_status(handle, kChannelStatusError,
+                            "cannot open capture output");
+    return;
+  }
+
+  bool opened = true;
+  if (format == kFrameFormatApng) {
+    opened = png_writer_open(&g_capture.png, g_capture.file, width, height,
+                             frame_count, 1, (uint16_t)fps);
+  } else if (format == kFrameFormatGif) {
+    opened = gif_writer_open(&g_capture.gif, g_capture.file, (uint16_t)width,
+                             (uint16_t)height, (uint16_t)((100 + fps / 2) / fps));
+  }
+  if (!opened) {
+    release_session();
+    platform_mutex_unlock(&g_capture_mutex);
+    channels_respond_status(handle, kChannelStatusError,
+                            "cannot start encoder");
+    return;
+  }
+
+  g_capture.active = true;
+  g_capture.format = (FrameFormat)format;
+  g_capture.width = width;
+  g_capture.height = height;
+  g_capture.frame_count = frame_count;
+  platform_mutex_unlock(&g_capture_mutex);
+
+  // Size the implicit view to the capture so presented frames match it.
+  FlutterWindowMetricsEvent metrics = {0};
+  metrics.struct_size = sizeof(FlutterWindowMetricsEvent);
+  metrics.width = width;
+  metrics.height = height;
+  metrics.pixel_ratio = pixel_ratio;
+  metrics.view_id = 0;
+  FlutterEngineSendWindowMetricsEvent(channels_engine(), &metrics);
+
+  channels_respond_status(handle, kChannelStatusOk, NULL);
+}
+
+static void handle_sync(MessageReader *reader,
+                        const FlutterPlatformMessageResponseHandle *handle) {
+  uint32_t frame_index = message_read_u32(reader);
+  platform_mutex_lock(&g_capture_mutex);
+  const char *error = NULL;
+  if (!g_capture.active)
+    error = "no capture is running";
+  else if (g_capture.pending_sync)
+    // Only one handle can wait; answering this one OK would let Dart run
+    // ahead of a frame that has not landed yet.
+    error = "sync already pending";
+  if (error || g_capture.frames_presented > frame_index) {
+    platform_mutex_unlock(&g_capture_mutex);
+    channels_respond_status(handle,
+                            error ? kChannelStatusError : kChannelStatusOk,
+                            error);
+    return;
+  }
+  g_capture.pending_sync = handle;
+  g_capture.pending_sync_frame = frame_index;
+  platform_mutex_unlock(&g_capture_mutex);
+}
+
+static void handle_end(const FlutterPlatformMessageResponseHandle *handle) {
+  platform_mutex_lock(&g_capture_mutex);
+  if (!g_capture.active) {
+    platform_mutex_unlock(&g_capture_mutex);
+    channels_respond_status(handle, kChannelStatusError,
+                            "no capture is running");
+    return;
+  }
+
+  end_session();
+  platform_mutex_unlock(&g_capture_mutex);
+  // Replies once the frames still queued are written.
+  encode(finish_capture, (void *)handle);
+}
+
+static void handle_capture_message(const FlutterPlatformMessage *message,
+                                   void *user_data) {
+  (void)user_data;
+  MessageReader reader = message_reader(message->message, message->message_size);
+  switch (message_read_u8(&reader)) {
+  case kCaptureOpBegin:
+    handle_begin(&reader, message->response_handle);
+    break;
+  case kCaptureOpSync:
+    handle_sync(&reader, message->response_handle);
+    break;
+  case kCaptureOpEnd:
+    handle_end(message->response_handle);
+    break;
+  default:
+    channels_respond_status(message->response_handle, kChannelStatusError,
+                            "unknown capture opcode");
+    break;
+  }
+}
+
+void frame_capture_install(void) {
+  work_queue_start(&g_encoder, "capture-encoder", 0);
+  channels_register(CAPTURE_CHANNEL, handle_capture_message, NULL);
+}
+
+bool frame_capture_present(const void *allocation, size_t row_bytes,
+                           size_t height) {
+  platform_mutex_lock(&g_capture_mutex);
+  if (!g_capture.active) {
+    platform_mutex_unlock(&g_capture_mutex);
+    return false;
+  }
+
+  uint8_t *rgba = NULL;
+  if (g_capture.frames_presented < g_capture.frame_count) {
+    if (row_bytes < (size_t)g_capture.width * 4 || height != g_capture.height) {
+      log_ring_printf(kLogError, "capture", 0,
+                      "Captured frame is %zux%zu, expected %ux%u",
+                      row_bytes / 4, height, g_capture.width,
+                      g_capture.height);
+      g_capture.failed = true;
+    } else {
+      while (g_capture.active && g_capture.free_count == 0)
+        platform_cond_wait(&g_frame_freed, &g_capture_mutex);
+      if (!g_capture.active) {
+        platform_mutex_unlock(&g_capture_mutex);
+        return true;
+      }
+      rgba = g_capture.free_frames[--g_capture.free_count];
+      g_capture.converting = true;
+    }
+  }
+  uint32_t width = g_capture.width;
+  platform_mutex_unlock(&g_capture_mutex);
+
+  if (rgba) {
+    // The software surface holds kN32 pixels, which are premultiplied BGRA
+    // on the little-endian desktop targets.
+    const PixelKernels *kernels = pixel_kernels();
+    const uint8_t *pixels = (const uint8_t *)allocation;
+    size_t stride = (size_t)width * 4;
+    if (row_bytes == stride) {
+      kernels->native_to_rgba(pixels, rgba, (size_t)width * height);
+    } else {
+      for (size_t y = 0; y < height; ++y)
+        kernels->native_to_rgba(pixels + y * row_bytes, rgba + y * stride,
+                                width);
+    }
+  }
+
+  if (rgba)
+    encode(encode_frame, rgba);
+
+  platform_mutex_lock(&g_capture_mutex);
+  if (rgba) {
+    g_capture.converting = false;
+    platform_cond_broadcast(&g_frame_freed);
+  }
+  g_capture.frames_presented++;
+
+  const FlutterPlatformMessageResponseHandle *ready = NULL;
+  if (g_capture.pending_sync &&
+      g_capture.frames_presented > g_capture.pending_sync_frame) {
+    ready = g_capture.pending_sync;
+    g_capture.pending_sync = NULL;
+  }
+  platform_mutex_unlock(&g_capture_mutex);
+
+  if (ready)
+    channels_respond_status(ready, kChannelStatusOk, NULL);
+  return true;
+}
+
+void frame_capture_shutdown(void) {
+  platform_mutex_lock(&g_capture_mutex);
+  bool active = g_capture.active;
+  if (active)
+    end_session();
+  platform_mutex_unlock(&g_capture_mutex);
+  if (active)
+    encode(finish_capture, NULL);
+  work_queue_stop(&g_encoder);
+}
@@ -0,0 +1,44 @@
+// Frame-sequence capture for animated output.
+//
+// `HeadlessRender.captureFrames` drives the animation in virtual time and
+// renders every frame into the implicit view. The engine rasterizes those
+// frames into the software surface, and the present callback hands them to
+// the active capture session. The raster thread only converts a frame to
+// RGBA; an encoder thread (see work_queue.h) writes it as APNG, GIF or a raw
+// RGBA stream, so rendering the next frame overlaps encoding this one.
+//
+// Channel "headless/capture", first byte is the opcode:
+//   1 begin: u32 width, u32 height, u32 frame_count, u32 fps,
+//            f64 pixel_ratio, u8 format, u16 length + UTF-8 output path.
+//            Replies with a status byte once the view has been resized.
+//   2 sync:  u32 frame_index. Replies once that frame has been presented, so
+//            the next frame is only produced after the previous one landed.
+//            Only one sync may wait at a time; another one is refused with
+//            "sync already pending".
+//   3 end:   Replies with status, u32 frames written and u64 bytes written.
+
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+  kFrameFormatRaw = 0,
+  kFrameFormatApng = 1,
+  kFrameFormatGif = 2,
+} FrameFormat;
+
+void frame_capture_install(void);
+
+// Called from the software surface present callback on the raster thread.
+// Returns false when no capture session is active. Waits while the encoder
+// is four frames behind.
+bool frame_capture_present(const void *allocation, size_t row_bytes,
+                           size_t height);
+
+// Finishes a capture Dart never ended. Call while the engine can still
+// deliver replies.
+void frame_capture_shutdown(void);
+
+#endif // FRAME_CAPTURE_H
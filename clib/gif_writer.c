@@ -0,0 +1,335 @@
+#include "gif_writer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define HISTOGRAM_SIZE (1 << 15)
+#define MAX_OPAQUE_COLORS 255
+#define LZW_MAX_CODE 4095
+#define LZW_HASH_SIZE 8192
+
+static inline uint32_t color_bin(const uint8_t *pixel) {
+  return ((uint32_t)(pixel[0] >> 3) << 10) | ((uint32_t)(pixel[1] >> 3) << 5) |
+         (uint32_t)(pixel[2] >> 3);
+}
+
+// ---------------------------------------------------------------------------
+// Median-cut quantization over a 5-bit-per-channel histogram.
+
+typedef struct {
+  uint8_t lo[3];
+  uint8_t hi[3];
+  uint32_t count;
+} ColorBox;
+
+#define FOR_EACH_BIN(box, r, g, b)                                             \
+  for (uint32_t r = (box)->lo[0]; r <= (box)->hi[0]; ++r)                      \
+    for (uint32_t g = (box)->lo[1]; g <= (box)->hi[1]; ++g)                    \
+      for (uint32_t b = (box)->lo[2]; b <= (box)->hi[2]; ++b)
+
+// Recomputes the population of `box` and shrinks it to its occupied bins.
+static void shrink_box(const uint32_t *histogram, ColorBox *box) {
+  uint8_t lo[3] = {31, 31, 31};
+  uint8_t hi[3] = {0, 0, 0};
+  uint32_t count = 0;
+  FOR_EACH_BIN(box, r, g, b) {
+    uint32_t bin_count = histogram[(r << 10) | (g << 5) | b];
+    if (bin_count == 0)
+      continue;
+    count += bin_count;
+    uint32_t coords[3] = {r, g, b};
+    for (int axis = 0; axis < 3; ++axis) {
+      if (coords[axis] < lo[axis])
+        lo[axis] = (uint8_t)coords[axis];
+      if (coords[axis] > hi[axis])
+        hi[axis] = (uint8_t)coords[axis];
+    }
+  }
+  box->count = count;
+  if (count > 0) {
+    memcpy(box->lo, lo, sizeof(lo));
+    memcpy(box->hi, hi, sizeof(hi));
+  }
+}
+
+static int longest_axis(const ColorBox *box) {
+  int axis = 0;
+  for (int i = 1; i < 3; ++i) {
+    if (box->hi[i] - box->lo[i] > box->hi[axis] - box->lo[axis])
+      axis = i;
+  }
+  return axis;
+}
+
+// Splits `box` at the population median of its longest axis.
+static void split_box(const uint32_t *histogram, ColorBox *box,
+                      ColorBox *out) {
+  int axis = longest_axis(box);
+  uint32_t marginal[32] = {0};
+  FOR_EACH_BIN(box, r, g, b) {
+    uint32_t coords[3] = {r, g, b};
+    marginal[coords[axis]] += histogram[(r << 10) | (g << 5) | b];
+  }
+  uint32_t half = box->count / 2;
+  uint32_t accumulated = 0;
+  uint8_t split = box->lo[axis];
+  for (uint32_t i = box->lo[axis]; i < box->hi[axis]; ++i) {
+    accumulated += marginal[i];
+    split = (uint8_t)i;
+    if (accumulated >= half)
+      break;
+  }
+  *out = *box;
+  box->hi[axis] = split;
+  out->lo[axis] = (uint8_t)(split + 1);
+  shrink_box(histogram, box);
+  shrink_box(histogram, out);
+}
+
+// Builds a palette for the opaque pixels counted in `histogram` and rewrites
+// every occupied histogram entry with its palette index. Returns the number
+// of palette entries.
+static uint32_t build_palette(uint32_t *histogram, uint8_t *palette) {
+  ColorBox boxes[MAX_OPAQUE_COLORS];
+  uint32_t box_count = 1;
+  boxes[0].lo[0] = boxes[0].lo[1] = boxes[0].lo[2] = 0;
+  boxes[0].hi[0] = boxes[0].hi[1] = boxes[0].hi[2] = 31;
+  shrink_box(histogram, &boxes[0]);
+  if (boxes[0].count == 0)
+    return 0;
+
+  while (box_count < MAX_OPAQUE_COLORS) {
+    int best = -1;
+    for (uint32_t i = 0; i < box_count; ++i) {
+      const ColorBox *box = &boxes[i];
+      bool splittable = box->hi[0] > box->lo[0] || box->hi[1] > box->lo[1] ||
+                        box->hi[2] > box->lo[2];
+      if (splittable && (best < 0 || box->count > boxes[best].count))
+        best = (int)i;
+    }
+    if (best < 0)
+      break;
+    split_box(histogram, &boxes[best], &boxes[box_count++]);
+  }
+
+  for (uint32_t i = 0; i < box_count; ++i) {
+    const ColorBox *box = &boxes[i];
+    uint64_t sum[3] = {0, 0, 0};
+    uint64_t total = 0;
+    FOR_EACH_BIN(box, r, g, b) {
+      uint32_t index = (r << 10) | (g << 5) | b;
+      uint32_t count = histogram[index];
+      if (count == 0)
+        continue;
+      sum[0] += (uint64_t)((r << 3) | 4) * count;
+      sum[1] += (uint64_t)((g << 3) | 4) * count;
+      sum[2] += (uint64_t)((b << 3) | 4) * count;
+      total += count;
+      histogram[index] = i;
+    }
+    for (int c = 0; c < 3; ++c)
+      palette[i * 3 + c] = total ? (uint8_t)(sum[c] / total) : 0;
+  }
+  return box_count;
+}
+
+// ---------------------------------------------------------------------------
+// LZW compression into 255-byte data sub-blocks.
+
+typedef struct {
+  FILE *file;
+  uint8_t block[255];
+  size_t block_size;
+  uint32_t bits;
+  int bit_count;
+  bool ok;
+} BlockWriter;
+
+static void block_flush(BlockWriter *writer) {
+  if (writer->block_size == 0)
+    return;
+  uint8_t size = (uint8_t)writer->block_size;
+  if (fwrite(&size, 1, 1, writer->file) != 1 ||
+      fwrite(writer->block, 1, size, writer->file) != size)
+    writer->ok = false;
+  writer->block_size = 0;
+}
+
+static void put_code(BlockWriter *writer, uint32_t code, int size) {
+  writer->bits |= code << writer->bit_count;
+  writer->bit_count += size;
+  while (writer->bit_count >= 8) {
+    writer->block[writer->block_size++] = (uint8_t)writer->bits;
+    if (writer->block_size == sizeof(writer->block))
+      block_flush(writer);
+    writer->bits >>= 8;
+    writer->bit_count -= 8;
+  }
+}
+
+static bool lzw_encode(FILE *file, const uint8_t *indices, size_t count,
+                       int min_code_size) {
+  uint32_t keys[LZW_HASH_SIZE];
+  uint16_t codes[LZW_HASH_SIZE];
+  BlockWriter writer = {file, {0}, 0, 0, 0, true};
+  uint8_t size_byte = (uint8_t)min_code_size;
+  if (fwrite(&size_byte, 1, 1, file) != 1)
+    return false;
+
+  const uint32_t clear_code = 1u << min_code_size;
+  const uint32_t end_code = clear_code + 1;
+  int code_size = min_code_size + 1;
+  uint32_t next_code = clear_code + 2;
+  memset(keys, 0, sizeof(keys));
+
+  // Mirrors giflib: the code size grows right after writing a code once the
+  // next free dictionary slot no longer fits, which is when decoders grow.
+#define EMIT(code)                                                             \
+  do {                                                                         \
+    put_code(&writer, (code), code_size);                                      \
+    if (next_code >= (1u << code_size) && code_size < 12)                      \
+      code_size++;                                                             \
+  } while (0)
+
+  EMIT(clear_code);
+  uint32_t prefix = count > 0 ? indices[0] : 0;
+  for (size_t i = 1; i < count; ++i) {
+    uint32_t key = ((prefix << 8) | indices[i]) + 1;
+    uint32_t slot = (key * 2654435761u) & (LZW_HASH_SIZE - 1);
+    while (keys[slot] != 0 && keys[slot] != key)
+      slot = (slot + 1) & (LZW_HASH_SIZE - 1);
+    if (keys[slot] == key) {
+      prefix = codes[slot];
+      continue;
+    }
+    EMIT(prefix);
+    if (next_code >= LZW_MAX_CODE) {
+      EMIT(clear_code);
+      code_size = min_code_size + 1;
+      next_code = clear_code + 2;
+      memset(keys, 0, sizeof(keys));
+    } else {
+      keys[slot] = key;
+      codes[slot] = (uint16_t)next_code++;
+    }
+    prefix = indices[i];
+  }
+  if (count > 0)
+    EMIT(prefix);
+  EMIT(end_code);
+#undef EMIT
+
+  if (writer.bit_count > 0)
+    put_code(&writer, 0, 8 - writer.bit_count);
+  block_flush(&writer);
+  uint8_t terminator = 0;
+  if (fwrite(&terminator, 1, 1, file) != 1)
+    writer.ok = false;
+  return writer.ok;
+}
+
+// ---------------------------------------------------------------------------
+
+static void put_u16_le(uint8_t *out, uint16_t value) {
+  out[0] = (uint8_t)value;
+  out[1] = (uint8_t)(value >> 8);
+}
+
+bool gif_writer_open(GifWriter *writer, FILE *file, uint16_t width,
+                     uint16_t height, uint16_t delay_cs) {
+  memset(writer, 0, sizeof(*writer));
+  writer->file = file;
+  writer->width = width;
+  writer->height = height;
+  writer->delay_cs = delay_cs;
+  writer->indices = (uint8_t *)malloc((size_t)width * height);
+  writer->histogram = (uint32_t *)malloc(HISTOGRAM_SIZE * sizeof(uint32_t));
+  writer->ok = writer->indices && writer->histogram;
+  if (!writer->ok)
+    return false;
+
+  uint8_t header[13] = {'G', 'I', 'F', '8', '9', 'a'};
+  put_u16_le(header + 6, width);
+  put_u16_le(header + 8, height);
+  // No global color table; every frame carries its own palette.
+  static const uint8_t loop[19] = {0x21, 0xff, 0x0b, 'N', 'E', 'T', 'S',
+                                   'C',  'A',  'P',  'E', '2', '.', '0',
+                                   0x03, 0x01, 0x00, 0x00, 0x00};
+  writer->ok = fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+               fwrite(loop, 1, sizeof(loop), file) == sizeof(loop);
+  return writer->ok;
+}
+
+bool gif_writer_add_frame(GifWriter *writer, const uint8_t *rgba,
+                          size_t stride) {
+  if (!writer->ok)
+    return false;
+
+  memset(writer->histogram, 0, HISTOGRAM_SIZE * sizeof(uint32_t));
+  bool has_transparency = false;
+  for (uint32_t y = 0; y < writer->height; ++y) {
+    const uint8_t *pixel = rgba + (size_t)y * stride;
+    for (uint32_t x = 0; x < writer->width; ++x, pixel += 4) {
+      if (pixel[3] < 128)
+        has_transparency = true;
+      else
+        writer->histogram[color_bin(pixel)]++;
+    }
+  }
+
+  uint8_t palette[256 * 3];
+  memset(palette, 0, sizeof(palette));
+  uint32_t colors = build_palette(writer->histogram, palette);
+  uint32_t transparent_index = colors;
+  uint32_t entries = colors + (has_transparency ? 1 : 0);
+  int table_bits = 1;
+  while ((1u << table_bits) < entries)
+    table_bits++;
+
+  uint8_t *index = writer->indices;
+  for (uint32_t y = 0; y < writer->height; ++y) {
+    const uint8_t *pixel = rgba + (size_t)y * stride;
+    for (uint32_t x = 0; x < writer->width; ++x, pixel += 4) {
+      *index++ = pixel[3] < 128
+                     ? (uint8_t)transparent_index
+                     : (uint8_t)writer->histogram[color_bin(pixel)];
+    }
+  }
+
+  uint8_t control[8] = {0x21, 0xf9, 0x04};
+  // Frames are full-size; clear to background between transparent frames so
+  // earlier content does not show through.
+  control[3] = (uint8_t)(((has_transparency ? 2 : 1) << 2) |
+                         (has_transparency ? 1 : 0));
+  put_u16_le(control + 4, writer->delay_cs);
+  control[6] = has_transparency ? (uint8_t)transparent_index : 0;
+  control[7] = 0;
+
+  uint8_t descriptor[10] = {0x2c};
+  put_u16_le(descriptor + 5, writer->width);
+  put_u16_le(descriptor + 7, writer->height);
+  descriptor[9] = (uint8_t)(0x80 | (table_bits - 1));
+
+  size_t table_size = (size_t)3 << table_bits;
+  writer->ok =
+      fwrite(control, 1, sizeof(control), writer->file) == sizeof(control) &&
+      fwrite(descriptor, 1, sizeof(descriptor), writer->file) ==
+          sizeof(descriptor) &&
+      fwrite(palette, 1, table_size, writer->file) == table_size &&
+      lzw_encode(writer->file, writer->indices,
+                 (size_t)writer->width * writer->height,
+                 table_bits < 2 ? 2 : table_bits);
+  return writer->ok;
+}
+
+bool gif_writer_finish(GifWriter *writer) {
+  if (writer->ok) {
+    uint8_t trailer = 0x3b;
+    writer->ok = fwrite(&trailer, 1, 1, writer->file) == 1;
+  }
+  free(writer->indices);
+  free(writer->histogram);
+  writer->indices = NULL;
+  writer->histogram = NULL;
+  return writer->ok;
+}
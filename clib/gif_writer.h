@@ -0,0 +1,31 @@
+// Animated GIF encoder for straight-alpha RGBA8 frames.
+//
+// Every frame gets its own median-cut palette (up to 255 colors) in a local
+// color table; pixels with alpha below 128 map to a reserved transparent index.
+
+#ifndef GIF_WRITER_H
+#define GIF_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct {
+  FILE *file;
+  uint16_t width;
+  uint16_t height;
+  uint16_t delay_cs;
+  uint8_t *indices;
+  uint32_t *histogram;
+  bool ok;
+} GifWriter;
+
+bool gif_writer_open(GifWriter *writer, FILE *file, uint16_t width,
+                     uint16_t height, uint16_t delay_cs);
+bool gif_writer_add_frame(GifWriter *writer, const uint8_t *rgba,
+                          size_t stride);
+// Writes the trailer and releases scratch memory. Does not close the file.
+bool gif_writer_finish(GifWriter *writer);
+
+#endif // GIF_WRITER_H
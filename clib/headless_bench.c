@@ -0,0 +1,304 @@
+// Benchmark driver for the headless embedder (POSIX only).
+//
+// Runs embeddedFlutterApp as a child process with `--bench <fixture>` (see
+// lib/src/benchmark.dart) and reads the `BENCH ...` lines it prints. Each
+// run is a fresh process, so every run measures a cold start; the measured
+// renders come after a warmup. Reported per fixture:
+//
+//   cold start      process start until the first image is written
+//   images/s        measured images over the time they took, pipelined
+//   p50/p95/p99     per-image latency, submit until written
+//   peak RSS        largest resident set of any run
+//   CPU s/image     user + system CPU of the measured renders (the whole
+//                   process where /proc is missing)
+//
+// Usage:
+//   headless_bench [--app <path>] [--fixture <name>]... [--runs N]
+//                  [--iterations N] [--warmup N] [--json]
+//
+// Without --fixture every fixture runs. --json prints one JSON object per
+// fixture, one per line, for dashboards and regression checks; the default
+// is a table. The app defaults to embeddedFlutterApp next to this binary.
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_FIXTURES 16
+
+static const char *const kDefaultFixtures[] = {"badge", "card", "page",
+                                               "grid"};
+
+typedef struct {
+  const char *fixture;
+  unsigned runs;
+  // Milliseconds, one per successful run.
+  double cold_start_ms[64];
+  unsigned cold_starts;
+  // Microseconds, over all runs.
+  uint64_t *latencies;
+  size_t latency_count;
+  size_t latency_capacity;
+  uint64_t images;
+  uint64_t measured_us;
+  double cpu_seconds;
+  long peak_rss_kb;
+  unsigned failed_runs;
+} FixtureResult;
+
+static double now_ms(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+// User + system CPU seconds of a running process, or a negative value when
+// /proc is not available.
+static double process_cpu_seconds(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return -1;
+  char line[1024];
+  bool ok = fgets(line, sizeof(line), file) != NULL;
+  fclose(file);
+  // The command name may contain spaces; the fields start after its ')'.
+  char *fields = ok ? strrchr(line, ')') : NULL;
+  unsigned long user = 0, system = 0;
+  if (!fields || sscanf(fields + 2,
+                        "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                        &user, &system) != 2)
+    return -1;
+  return (double)(user + system) / (double)sysconf(_SC_CLK_TCK);
+}
+
+static void add_latency(FixtureResult *result, uint64_t latency) {
+  if (result->latency_count == result->latency_capacity) {
+    size_t capacity =
+        result->latency_capacity ? result->latency_capacity * 2 : 1024;
+    uint64_t *latencies =
+        (uint64_t *)realloc(result->latencies, capacity * sizeof(uint64_t));
+    if (!latencies)
+      return;
+    result->latencies = latencies;
+    result->latency_capacity = capacity;
+  }
+  result->latencies[result->latency_count++] = latency;
+}
+
+static bool run_once(const char *app, FixtureResult *result,
+                     const char *iterations, const char *warmup) {
+  int output[2];
+  if (pipe(output) != 0)
+    return false;
+  double started = now_ms();
+  pid_t child = fork();
+  if (child < 0) {
+    close(output[0]);
+    close(output[1]);
+    return false;
+  }
+  if (child == 0) {
+    dup2(output[1], STDOUT_FILENO);
+    close(output[0]);
+    close(output[1]);
+    execl(app, app, "--bench", result->fixture, "--iterations", iterations,
+          "--warmup", warmup, (char *)NULL);
+    fprintf(stderr, "headless_bench: cannot run %s: %s\n", app,
+            strerror(errno));
+    _exit(127);
+  }
+  close(output[1]);
+
+  FILE *lines = fdopen(output[0], "r");
+  char line[512];
+  bool ready = false, done = false;
+  double cpu_at_warm = -1;
+  double cpu_measured = -1;
+  while (lines && fgets(line, sizeof(line), lines)) {
+    if (strncmp(line, "BENCH ", 6) != 0)
+      continue;
+    const char *event = line + 6;
+    unsigned long long a, b;
+    if (strncmp(event, "ready", 5) == 0) {
+      if (result->cold_starts < sizeof(result->cold_start_ms) / sizeof(double))
+        result->cold_start_ms[result->cold_starts++] = now_ms() - started;
+      ready = true;
+    } else if (strncmp(event, "warm-start", 10) == 0) {
+      cpu_at_warm = process_cpu_seconds(child);
+    } else if (sscanf(event, "latency %llu", &a) == 1) {
+      add_latency(result, a);
+    } else if (sscanf(event, "done %llu %llu", &a, &b) == 2) {
+      double cpu = process_cpu_seconds(child);
+      if (cpu_at_warm >= 0 && cpu >= 0)
+        cpu_measured = cpu - cpu_at_warm;
+      result->images += a;
+      result->measured_us += b;
+      done = true;
+    }
+  }
+  if (lines)
+    fclose(lines);
+  else
+    close(output[0]);
+
+  int status = 0;
+  struct rusage usage;
+  memset(&usage, 0, sizeof(usage));
+  while (wait4(child, &status, 0, &usage) < 0 && errno == EINTR) {
+  }
+#ifdef __APPLE__
+  long rss_kb = usage.ru_maxrss / 1024; // bytes on macOS
+#else
+  long rss_kb = usage.ru_maxrss;
+#endif
+  if (rss_kb > result->peak_rss_kb)
+    result->peak_rss_kb = rss_kb;
+  if (cpu_measured < 0)
+    cpu_measured = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+                   usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+  if (done)
+    result->cpu_seconds += cpu_measured;
+  return ready && done && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentile of sorted values, in milliseconds.
+static double percentile_ms(const FixtureResult *result, double p) {
+  if (result->latency_count == 0)
+    return 0;
+  size_t rank = (size_t)(p / 100.0 * (double)result->latency_count + 0.5);
+  if (rank < 1)
+    rank = 1;
+  if (rank > result->latency_count)
+    rank = result->latency_count;
+  return result->latencies[rank - 1] / 1e3;
+}
+
+static void report(FixtureResult *result, bool json) {
+  if (result->latency_count > 0)
+    qsort(result->latencies, result->latency_count, sizeof(uint64_t),
+          compare_u64);
+  qsort(result->cold_start_ms, result->cold_starts, sizeof(double),
+        compare_double);
+  double cold = result->cold_starts
+                    ? result->cold_start_ms[result->cold_starts / 2]
+                    : 0;
+  double rate = result->measured_us
+                    ? result->images * 1e6 / (double)result->measured_us
+                    : 0;
+  double cpu = result->images ? result->cpu_seconds / result->images : 0;
+  double rss_mb = result->peak_rss_kb / 1024.0;
+  if (json) {
+    printf("{\"fixture\":\"%s\",\"runs\":%u,\"failedRuns\":%u,"
+           "\"images\":%llu,\"coldStartMs\":%.1f,\"imagesPerSecond\":%.2f,"
+           "\"latencyMs\":{\"p50\":%.2f,\"p95\":%.2f,\"p99\":%.2f},"
+           "\"peakRssMb\":%.1f,\"cpuSecondsPerImage\":%.5f}\n",
+           result->fixture, result->runs, result->failed_runs,
+           (unsigned long long)result->images, cold, rate,
+           percentile_ms(result, 50), percentile_ms(result, 95),
+           percentile_ms(result, 99), rss_mb, cpu);
+  } else {
+    printf("%-8s %9.1f %9.2f %8.2f %8.2f %8.2f %9.1f %10.5f%s\n",
+           result->fixture, cold, rate, percentile_ms(result, 50),
+           percentile_ms(result, 95), percentile_ms(result, 99), rss_mb, cpu,
+           result->failed_runs ? "  (failed runs)" : "");
+  }
+  fflush(stdout);
+}
+
+static const char *default_app(const char *argv0) {
+  static char path[4096];
+  const char *slash = strrchr(argv0, '/');
+  if (!slash)
+    return "./embeddedFlutterApp";
+  snprintf(path, sizeof(path), "%.*s/embeddedFlutterApp",
+           (int)(slash - argv0), argv0);
+  return path;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: headless_bench [--app <path>] [--fixture <name>]... "
+          "[--runs N] [--iterations N] [--warmup N] [--json]\n");
+}
+
+int main(int argc, char **argv) {
+  const char *app = default_app(argv[0]);
+  const char *fixtures[MAX_FIXTURES];
+  size_t fixture_count = 0;
+  unsigned runs = 3;
+  const char *iterations = "200";
+  const char *warmup = "20";
+  bool json = false;
+  for (int i = 1; i < argc; ++i) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (has_value && strcmp(argv[i], "--app") == 0) {
+      app = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--fixture") == 0) {
+      if (fixture_count < MAX_FIXTURES)
+        fixtures[fixture_count++] = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--runs") == 0) {
+      runs = (unsigned)atoi(argv[++i]);
+    } else if (has_value && strcmp(argv[i], "--iterations") == 0) {
+      iterations = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--warmup") == 0) {
+      warmup = argv[++i];
+    } else {
+      usage();
+      return 64;
+    }
+  }
+  if (runs == 0 || runs > 64 || atoi(iterations) <= 0 || atoi(warmup) < 0) {
+    usage();
+    return 64;
+  }
+  if (fixture_count == 0) {
+    for (size_t i = 0; i < sizeof(kDefaultFixtures) / sizeof(char *); ++i)
+      fixtures[fixture_count++] = kDefaultFixtures[i];
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  if (!json)
+    printf("%-8s %9s %9s %8s %8s %8s %9s %10s\n", "fixture", "cold ms",
+           "images/s", "p50 ms", "p95 ms", "p99 ms", "peak MB", "CPU s/img");
+  fflush(stdout);
+  int exit_code = 0;
+  for (size_t f = 0; f < fixture_count; ++f) {
+    FixtureResult result;
+    memset(&result, 0, sizeof(result));
+    result.fixture = fixtures[f];
+    result.runs = runs;
+    for (unsigned run = 0; run < runs; ++run) {
+      if (!run_once(app, &result, iterations, warmup))
+        result.failed_runs++;
+    }
+    if (result.failed_runs)
+      exit_code = 1;
+    report(&result, json);
+    free(result.latencies);
+  }
+  return exit_code;
+}
@@ -0,0 +1,203 @@
+#include "image_patch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "channels.h"
+#include "png_writer.h"
+#include "work_queue.h"
+
+#define IMAGE_PATCH_CHANNEL "headless/png_patch"
+#define MAX_PATCH_SESSIONS 8
+// Requests copied for the worker; a session renders one patch at a time.
+#define MAX_QUEUED_REQUESTS 32
+
+enum {
+  kPatchOpOpen = 1,
+  kPatchOpPatch = 2,
+  kPatchOpClose = 3,
+};
+
+typedef struct {
+  bool active;
+  uint32_t id;
+  PngPatcher png;
+} PatchSession;
+
+typedef struct {
+  const FlutterPlatformMessageResponseHandle *response_handle;
+  size_t size;
+  uint8_t data[];
+} PatchRequest;
+
+// Only touched by the requests, which run in order on g_worker.
+static PatchSession g_sessions[MAX_PATCH_SESSIONS];
+static uint32_t g_next_session_id = 1;
+
+// A patch opens its target and encodes and writes the whole PNG before its
+// reply, so requests run off the platform thread.
+static WorkQueue g_worker;
+
+static PatchSession *find_session(uint32_t id) {
+  for (size_t i = 0; i < MAX_PATCH_SESSIONS; ++i) {
+    if (g_sessions[i].active && g_sessions[i].id == id)
+      return &g_sessions[i];
+  }
+  return NULL;
+}
+
+static void close_session(PatchSession *session) {
+  png_patcher_release(&session->png);
+  session->active = false;
+}
+
+static void handle_open(MessageReader *reader,
+                        const FlutterPlatformMessageResponseHandle *handle) {
+  uint32_t width = message_read_u32(reader);
+  uint32_t height = message_read_u32(reader);
+  if (!reader->ok || width == 0 || height == 0 || width > (1u << 24) ||
+      height > (1u << 24)) {
+    channels_respond_status(handle, kChannelStatusError,
+                            "malformed session request");
+    return;
+  }
+
+  PatchSession *session = NULL;
+  for (size_t i = 0; i < MAX_PATCH_SESSIONS && !session; ++i) {
+    if (!g_sessions[i].active)
+      session = &g_sessions[i];
+  }
+  if (!session) {
+    channels_respond_status(handle, kChannelStatusError,
+                            "too many open patch sessions");
+    return;
+  }
+  if (!png_patcher_init(&session->png, width, height)) {
+    channels_respond_status(handle, kChannelStatusError,
+                            "out of memory for patch session");
+    return;
+  }
+  session->active = true;
+  session->id = g_next_session_id++;
+
+  uint8_t reply[5];
+  reply[0] = kChannelStatusOk;
+  message_write_u32(reply + 1, session->id);
+  channels_respond(handle, reply, sizeof(reply));
+}
+
+static void handle_patch(MessageReader *reader,
+                         const FlutterPlatformMessageResponseHandle *handle) {
+  PatchSession *session = find_session(message_read_u32(reader));
+  uint32_t left = message_read_u32(reader);
+  uint32_t top = message_read_u32(reader);
+  uint32_t width = message_read_u32(reader);
+  uint32_t height = message_read_u32(reader);
+  char target[4096];
+  message_read_string(reader, target, sizeof(target));
+  if (!session) {
+    channels_respond_status(handle, kChannelStatusError, "unknown session");
+    return;
+  }
+  const uint8_t *rgba =
+      message_read_bytes(reader, (size_t)width * height * 4);
+  if (!reader->ok || !rgba ||
+      !png_patcher_apply(&session->png, left, top, width, height, rgba,
+                         (size_t)width * 4)) {
+    channels_respond_status(handle, kChannelStatusError,
+                            "patch does not fit the image");
+    return;
+  }
+
+  ByteSink sink;
+  char error[128];
+  if (!byte_sink_open(&sink, target, error, sizeof(error))) {
+    channels_respond_status(handle, kChannelStatusError, error);
+    return;
+  }
+  bool ok = png_patcher_write(&session->png, &sink);
+  uint64_t bytes = sink.bytes_written;
+  ok = byte_sink_close(&sink) && ok;
+  if (!ok) {
+    channels_respond_status(handle, kChannelStatusError,
+                            "cannot write to target");
+    return;
+  }
+  uint8_t reply[13];
+  reply[0] = kChannelStatusOk;
+  message_write_u64(reply + 1, bytes);
+  message_write_u32(reply + 9, session->png.bands_encoded);
+  channels_respond(handle, reply, sizeof(reply));
+}
+
+static void handle_close(MessageReader *reader,
+                         const FlutterPlatformMessageResponseHandle *handle) {
+  PatchSession *session = find_session(message_read_u32(reader));
+  if (!session) {
+    channels_respond_status(handle, kChannelStatusError, "unknown session");
+    return;
+  }
+  close_session(session);
+  channels_respond_status(handle, kChannelStatusOk, NULL);
+}
+
+static void run_request(void *argument) {
+  PatchRequest *request = (PatchRequest *)argument;
+  const FlutterPlatformMessageResponseHandle *handle = request->response_handle;
+  MessageReader reader = message_reader(request->data, request->size);
+  switch (message_read_u8(&reader)) {
+  case kPatchOpOpen:
+    handle_open(&reader, handle);
+    break;
+  case kPatchOpPatch:
+    handle_patch(&reader, handle);
+    break;
+  case kPatchOpClose:
+    handle_close(&reader, handle);
+    break;
+  default:
+    channels_respond_status(handle, kChannelStatusError,
+                            "unknown patch opcode");
+    break;
+  }
+  free(request);
+}
+
+static void handle_patch_message(const FlutterPlatformMessage *message,
+                                 void *user_data) {
+  (void)user_data;
+  // The message is only valid during this call.
+  PatchRequest *request =
+      (PatchRequest *)malloc(sizeof(PatchRequest) + message->message_size);
+  if (!request) {
+    channels_respond_status(message->response_handle, kChannelStatusError,
+                            "out of memory");
+    return;
+  }
+  request->response_handle = message->response_handle;
+  request->size = message->message_size;
+  memcpy(request->data, message->message, message->message_size);
+  if (!g_worker.started) {
+    run_request(request);
+    return;
+  }
+  if (!work_queue_post(&g_worker, run_request, request)) {
+    free(request);
+    channels_respond_status(message->response_handle, kChannelStatusError,
+                            "too many patch requests queued");
+  }
+}
+
+void image_patch_install(void) {
+  work_queue_start(&g_worker, "png-patch", MAX_QUEUED_REQUESTS);
+  channels_register(IMAGE_PATCH_CHANNEL, handle_patch_message, NULL);
+}
+
+void image_patch_shutdown(void) {
+  work_queue_stop(&g_worker);
+  for (size_t i = 0; i < MAX_PATCH_SESSIONS; ++i) {
+    if (g_sessions[i].active)
+      close_session(&g_sessions[i]);
+  }
+}
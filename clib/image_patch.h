@@ -0,0 +1,30 @@
+// Incremental PNG output for templates re-rendered with different data.
+//
+// `IncrementalRenderSession` keeps its widget tree mounted between renders
+// and rasterizes only the region its damage boundaries repainted. The
+// embedder keeps the previous image of each session, patches the new pixels
+// into it and re-encodes only the row bands they touch (see PngPatcher in
+// png_writer.h). Patches are encoded and written on a worker thread (see
+// work_queue.h), off the engine's platform thread.
+//
+// Channel "headless/png_patch", first byte is the opcode:
+//   1 open:  u32 width, u32 height. Replies with status and u32 session id.
+//            The session starts out fully transparent.
+//   2 patch: u32 session id, u32 left, u32 top, u32 width, u32 height,
+//            u16 length + UTF-8 target (see byte_sink.h),
+//            width * height * 4 bytes of straight-alpha RGBA.
+//            An empty rect writes the previous image again. Replies with
+//            status, u64 bytes written and u32 bands re-encoded.
+//   3 close: u32 session id. Replies with a status byte.
+// Error replies carry a UTF-8 reason after the status byte instead.
+
+#ifndef IMAGE_PATCH_H
+#define IMAGE_PATCH_H
+
+void image_patch_install(void);
+
+// Answers the requests still queued and releases sessions the Dart side
+// never closed. Call while the engine can still deliver replies.
+void image_patch_shutdown(void);
+
+#endif // IMAGE_PATCH_H
@@ -0,0 +1,209 @@
+#include "image_stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "channels.h"
+#include "png_writer.h"
+#include "work_queue.h"
+
+#define IMAGE_STREAM_CHANNEL "headless/png_stream"
+#define MAX_IMAGE_STREAMS 8
+// Requests copied for the worker; Dart waits for each band's reply, so this
+// is only reached by a client that does not.
+#define MAX_QUEUED_REQUESTS 32
+
+enum {
+  kStreamOpBegin = 1,
+  kStreamOpRows = 2,
+  kStreamOpFinish = 3,
+};
+
+typedef struct {
+  bool active;
+  uint32_t id;
+  ByteSink sink;
+  PngStream png;
+} ImageStream;
+
+typedef struct {
+  const FlutterPlatformMessageResponseHandle *response_handle;
+  size_t size;
+  uint8_t data[];
+} StreamRequest;
+
+// Only touched by the requests, which run in order on g_worker.
+static ImageStream g_streams[MAX_IMAGE_STREAMS];
+static uint32_t g_next_stream_id = 1;
+
+// Opening a `tcp:` target resolves and connects, and every band is
+// compressed and written before its reply, so requests run off the platform
+// thread.
+static WorkQueue g_worker;
+
+static ImageStream *find_stream(uint32_t id) {
+  for (size_t i = 0; i < MAX_IMAGE_STREAMS; ++i) {
+    if (g_streams[i].active && g_streams[i].id == id)
+      return &g_streams[i];
+  }
+  return NULL;
+}
+
+static bool close_stream(ImageStream *stream) {
+  bool ok = png_stream_finish(&stream->png);
+  ok = byte_sink_close(&stream->sink) && ok;
+  stream->active = false;
+  return ok;
+}
+
+static void handle_begin(MessageReader *reader,
+                         const FlutterPlatformMessageResponseHandle *handle) {
+  uint32_t width = message_read_u32(reader);
+  uint32_t height = message_read_u32(reader);
+  char target[4096];
+  message_read_string(reader, target, sizeof(target));
+  if (!reader->ok || width == 0 || height == 0 || width > (1u << 24)) {
+    channels_respond_status(handle, kChannelStatusError,
+                            "malformed stream request");
+    return;
+  }
+
+  ImageStream *stream = NULL;
+  for (size_t i = 0; i < MAX_IMAGE_STREAMS && !stream; ++i) {
+    if (!g_streams[i].active)
+      stream = &g_streams[i];
+  }
+  if (!stream) {
+    channels_respond_status(handle, kChannelStatusError,
+                            "too many open image streams");
+    return;
+  }
+
+  char error[128];
+  if (!byte_sink_open(&stream->sink, target, error, sizeof(error))) {
+    channels_respond_status(handle, kChannelStatusError, error);
+    return;
+  }
+  if (!png_stream_begin(&stream->png, &stream->sink, width, height)) {
+    byte_sink_close(&stream->sink);
+    channels_respond_status(handle, kChannelStatusError,
+                            "cannot start PNG encoder");
+    return;
+  }
+  stream->active = true;
+  stream->id = g_next_stream_id++;
+
+  uint8_t reply[5];
+  reply[0] = kChannelStatusOk;
+  message_write_u32(reply + 1, stream->id);
+  channels_respond(handle, reply, sizeof(reply));
+}
+
+static void handle_rows(MessageReader *reader,
+                        const FlutterPlatformMessageResponseHandle *handle) {
+  ImageStream *stream = find_stream(message_read_u32(reader));
+  uint32_t rows = message_read_u32(reader);
+  if (!stream) {
+    channels_respond_status(handle, kChannelStatusError, "unknown stream");
+    return;
+  }
+  size_t stride = (size_t)stream->png.width * 4;
+  const uint8_t *rgba = message_read_bytes(reader, stride * rows);
+  if (!rgba) {
+    channels_respond_status(handle, kChannelStatusError,
+                            "row data does not match the image width");
+    return;
+  }
+  if (!png_stream_append(&stream->png, rgba, stride, rows)) {
+    channels_respond_status(handle, kChannelStatusError,
+                            stream->sink.ok ? "too many rows"
+                                            : "cannot write to target");
+    return;
+  }
+  channels_respond_status(handle, kChannelStatusOk, NULL);
+}
+
+static void handle_finish(MessageReader *reader,
+                          const FlutterPlatformMessageResponseHandle *handle) {
+  ImageStream *stream = find_stream(message_read_u32(reader));
+  if (!stream) {
+    channels_respond_status(handle, kChannelStatusError, "unknown stream");
+    return;
+  }
+  bool complete = stream->png.rows_written == stream->png.height;
+  bool ok = png_stream_finish(&stream->png);
+  uint64_t bytes = stream->sink.bytes_written;
+  ok = byte_sink_close(&stream->sink) && ok;
+  stream->active = false;
+  if (!ok) {
+    channels_respond_status(handle, kChannelStatusError,
+                            complete ? "cannot write to target"
+                                     : "image is missing rows");
+    return;
+  }
+  uint8_t reply[9];
+  reply[0] = kChannelStatusOk;
+  message_write_u64(reply + 1, bytes);
+  channels_respond(handle, reply, sizeof(reply));
+}
+
+static void run_request(void *argument) {
+  StreamRequest *request = (StreamRequest *)argument;
+  const FlutterPlatformMessageResponseHandle *handle = request->response_handle;
+  MessageReader reader = message_reader(request->data, request->size);
+  switch (message_read_u8(&reader)) {
+  case kStreamOpBegin:
+    handle_begin(&reader, handle);
+    break;
+  case kStreamOpRows:
+    handle_rows(&reader, handle);
+    break;
+  case kStreamOpFinish:
+    handle_finish(&reader, handle);
+    break;
+  default:
+    channels_respond_status(handle, kChannelStatusError,
+                            "unknown stream opcode");
+    break;
+  }
+  free(request);
+}
+
+static void handle_stream_message(const FlutterPlatformMessage *message,
+                                  void *user_data) {
+  (void)user_data;
+  // The message is only valid during this call.
+  StreamRequest *request = (StreamRequest *)malloc(sizeof(StreamRequest) +
+                                                   message->message_size);
+  if (!request) {
+    channels_respond_status(message->response_handle, kChannelStatusError,
+                            "out of memory");
+    return;
+  }
+  request->response_handle = message->response_handle;
+  request->size = message->message_size;
+  memcpy(request->data, message->message, message->message_size);
+  if (!g_worker.started) {
+    run_request(request);
+    return;
+  }
+  if (!work_queue_post(&g_worker, run_request, request)) {
+    free(request);
+    channels_respond_status(message->response_handle, kChannelStatusError,
+                            "too many stream requests queued");
+  }
+}
+
+void image_stream_install(void) {
+  work_queue_start(&g_worker, "png-stream", MAX_QUEUED_REQUESTS);
+  channels_register(IMAGE_STREAM_CHANNEL, handle_stream_message, NULL);
+}
+
+void image_stream_shutdown(void) {
+  work_queue_stop(&g_worker);
+  for (size_t i = 0; i < MAX_IMAGE_STREAMS; ++i) {
+    if (g_streams[i].active)
+      close_stream(&g_streams[i]);
+  }
+}
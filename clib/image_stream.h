@@ -0,0 +1,28 @@
+// Streaming PNG output for images rasterized in bands.
+//
+// `HeadlessRender.writeImageFromWidget` sends each band of straight-alpha
+// RGBA rows as soon as it is rasterized. The embedder filters, compresses and
+// flushes it to the target as IDAT chunks while Dart renders the next band,
+// so a socket reader can start decoding before the image is complete. The
+// embedder does that on a worker thread (see work_queue.h), so a slow target
+// never holds up the engine's platform tasks.
+//
+// Channel "headless/png_stream", first byte is the opcode:
+//   1 begin:  u32 width, u32 height, u16 length + UTF-8 target (a file path,
+//             `tcp:<host>:<port>` or `unix:<path>`).
+//             Replies with status and u32 stream id.
+//   2 rows:   u32 stream id, u32 row count, row_count * width * 4 bytes.
+//             Replies with a status byte once the rows left the process.
+//   3 finish: u32 stream id. Replies with status and u64 bytes written.
+// Error replies carry a UTF-8 reason after the status byte instead.
+
+#ifndef IMAGE_STREAM_H
+#define IMAGE_STREAM_H
+
+void image_stream_install(void);
+
+// Answers the requests still queued and closes streams the Dart side never
+// finished. Call while the engine can still deliver replies.
+void image_stream_shutdown(void);
+
+#endif // IMAGE_STREAM_H
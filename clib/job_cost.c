@@ -0,0 +1,68 @@
+#include "job_cost.h"
+
+#include <stdio.h>
+
+#include "platform_thread.h"
+
+// Guarded by g_cost_mutex. The engine calls back on its own threads.
+static PlatformMutex g_cost_mutex = PLATFORM_MUTEX_INIT;
+static PlatformCpuClock g_ui_clock;
+static PlatformCpuClock g_raster_clock;
+static bool g_has_ui_clock;
+static bool g_has_raster_clock;
+
+static void remember_thread(FlutterNativeThreadType type, void *user_data) {
+  (void)user_data;
+  if (type != kFlutterNativeThreadTypeUI &&
+      type != kFlutterNativeThreadTypeRender)
+    return;
+  PlatformCpuClock clock;
+  if (!platform_cpu_clock_current(&clock))
+    return;
+  platform_mutex_lock(&g_cost_mutex);
+  if (type == kFlutterNativeThreadTypeUI && !g_has_ui_clock) {
+    g_ui_clock = clock;
+    g_has_ui_clock = true;
+  } else if (type == kFlutterNativeThreadTypeRender && !g_has_raster_clock) {
+    g_raster_clock = clock;
+    g_has_raster_clock = true;
+  }
+  platform_mutex_unlock(&g_cost_mutex);
+}
+
+void job_cost_attach(FlutterEngine engine) {
+  FlutterEngineResult result =
+      FlutterEnginePostCallbackOnAllNativeThreads(engine, remember_thread, NULL);
+  if (result != kSuccess)
+    fprintf(stderr, "Job cost: cannot reach the engine threads (%d)\n",
+            result);
+}
+
+void job_cost_engine_cpu(uint64_t *ui_nanos, uint64_t *raster_nanos) {
+  platform_mutex_lock(&g_cost_mutex);
+  *ui_nanos = g_has_ui_clock ? platform_cpu_clock_read(g_ui_clock) : 0;
+  *raster_nanos =
+      g_has_raster_clock ? platform_cpu_clock_read(g_raster_clock) : 0;
+  platform_mutex_unlock(&g_cost_mutex);
+}
+
+void job_cost_write(uint8_t *out, const JobCost *cost) {
+  const uint64_t fields[JOB_COST_SIZE / 8] = {
+      cost->ui_cpu_nanos,   cost->raster_cpu_nanos, cost->encode_cpu_nanos,
+      cost->output_cpu_nanos, cost->queued_nanos,   cost->encode_nanos,
+      cost->output_nanos,   cost->allocated_bytes,  cost->peak_surface_bytes};
+  for (size_t i = 0; i < JOB_COST_SIZE / 8; ++i)
+    message_write_u64(out + i * 8, fields[i]);
+}
+
+void job_cost_read(MessageReader *reader, JobCost *cost) {
+  cost->ui_cpu_nanos = message_read_u64(reader);
+  cost->raster_cpu_nanos = message_read_u64(reader);
+  cost->encode_cpu_nanos = message_read_u64(reader);
+  cost->output_cpu_nanos = message_read_u64(reader);
+  cost->queued_nanos = message_read_u64(reader);
+  cost->encode_nanos = message_read_u64(reader);
+  cost->output_nanos = message_read_u64(reader);
+  cost->allocated_bytes = message_read_u64(reader);
+  cost->peak_surface_bytes = message_read_u64(reader);
+}
@@ -0,0 +1,50 @@
+// What a render job cost, for billing and for finding expensive templates.
+//
+// The Dart side builds, lays out and rasterizes a job on the engine's UI and
+// raster threads before it reaches the embedder, so their CPU time is
+// measured between two snapshots: one taken when Dart starts the job (the
+// pipeline's `begin` op) and one taken when it submits it. The encode and
+// output stages run on the embedder's own workers and are measured on the
+// thread that does the work. Overlapping jobs share the UI and raster
+// threads; their CPU time is only exact while jobs are rendered one at a
+// time, as `BatchRunner` and `serveTemplates` do.
+//
+// On the wire a cost is nine little-endian u64s, in field order.
+
+#ifndef JOB_COST_H
+#define JOB_COST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "channels.h"
+
+#define JOB_COST_SIZE 72
+
+typedef struct {
+  // Thread CPU time.
+  uint64_t ui_cpu_nanos;
+  uint64_t raster_cpu_nanos;
+  uint64_t encode_cpu_nanos;
+  uint64_t output_cpu_nanos;
+  // Wall time in the embedder's stages: waiting for an encoder, encoding,
+  // and from encoded until written.
+  uint64_t queued_nanos;
+  uint64_t encode_nanos;
+  uint64_t output_nanos;
+  // Buffers the embedder allocated for the job, and the size of its largest
+  // pixel surface.
+  uint64_t allocated_bytes;
+  uint64_t peak_surface_bytes;
+} JobCost;
+
+// Learns which threads are the engine's UI and raster threads. Call once the
+// engine runs.
+void job_cost_attach(FlutterEngine engine);
+// CPU time the UI and raster threads used so far, 0 while unknown.
+void job_cost_engine_cpu(uint64_t *ui_nanos, uint64_t *raster_nanos);
+
+void job_cost_write(uint8_t *out, const JobCost *cost);
+void job_cost_read(MessageReader *reader, JobCost *cost);
+
+#endif // JOB_COST_H
@@ -0,0 +1,381 @@
+#include "log_ring.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "platform_thread.h"
+
+#define LOG_SLOTS 1024
+#define LOG_TAG_MAX 24
+// A record escaped as JSON: at most six bytes per message or tag byte.
+#define LOG_LINE_MAX 8192
+// Lost wakeups are possible, see log_ring_write; this bounds their delay.
+#define WRITER_IDLE_NS 50000000ull
+// How long log_ring_flush waits for the writer.
+#define FLUSH_TIMEOUT_NS 1000000000ull
+
+typedef struct {
+  // Same scheme as shm_ring.h: the slot is free for ticket t while
+  // `sequence` is t and holds ticket t's record once it is t + 1.
+  volatile uint64_t sequence;
+  uint64_t time_ms;
+  uint64_t job;
+  uint16_t length;
+  uint8_t severity;
+  bool truncated;
+  char tag[LOG_TAG_MAX];
+  char message[LOG_MESSAGE_MAX];
+} LogSlot;
+
+static const char *const kSeverityNames[] = {"debug", "info", "warning",
+                                             "error"};
+
+// Set by log_ring_install before the writer starts.
+static LogSlot *g_slots;
+static bool g_json;
+static uint64_t g_sample;
+static uint64_t g_rate;
+static PlatformThread g_writer;
+
+static volatile uint64_t g_running;
+static volatile uint64_t g_enqueue_ticket;
+static volatile uint64_t g_writer_sleeping;
+static volatile uint64_t g_sample_counter;
+static volatile uint64_t g_rate_second;
+static volatile uint64_t g_rate_count;
+static volatile uint64_t g_written;
+static volatile uint64_t g_dropped;
+static volatile uint64_t g_sampled;
+static volatile uint64_t g_rate_limited;
+
+// Only advanced by the writer; log_ring_flush reads it.
+static volatile uint64_t g_dequeue_ticket;
+
+// Only the writer sleeps on g_wake and log_ring_flush on g_drained;
+// producers never take the mutex.
+static PlatformMutex g_wake_mutex = PLATFORM_MUTEX_INIT;
+static PlatformCond g_wake = PLATFORM_COND_INIT;
+static PlatformCond g_drained = PLATFORM_COND_INIT;
+
+static uint64_t wall_time_ms(void) {
+  struct timespec now;
+  if (timespec_get(&now, TIME_UTC) != TIME_UTC)
+    return 0;
+  return (uint64_t)now.tv_sec * 1000u + (uint64_t)now.tv_nsec / 1000000u;
+}
+
+static bool admit(LogSeverity severity, uint64_t now_ms) {
+  if (g_sample > 1 && severity <= kLogInfo &&
+      platform_atomic_add(&g_sample_counter, 1) % g_sample != 0) {
+    platform_atomic_add(&g_sampled, 1);
+    return false;
+  }
+  if (g_rate > 0 && severity != kLogError) {
+    uint64_t second = now_ms / 1000;
+    uint64_t current = platform_atomic_load(&g_rate_second);
+    if (current != second &&
+        platform_atomic_compare_exchange(&g_rate_second, &current, second))
+      platform_atomic_store(&g_rate_count, 0);
+    if (platform_atomic_add(&g_rate_count, 1) >= g_rate) {
+      platform_atomic_add(&g_rate_limited, 1);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Cuts `text` to `limit` bytes without splitting a UTF-8 sequence.
+static size_t clip_utf8(const char *text, size_t limit, bool *truncated) {
+  size_t length = strlen(text);
+  *truncated = length > limit;
+  if (!*truncated)
+    return length;
+  length = limit;
+  while (length > 0 && ((unsigned char)text[length] & 0xC0) == 0x80)
+    length--;
+  return length;
+}
+
+static size_t append(char *out, size_t offset, const char *text,
+                     size_t length) {
+  if (length > LOG_LINE_MAX - offset)
+    length = LOG_LINE_MAX - offset;
+  memcpy(out + offset, text, length);
+  return offset + length;
+}
+
+static size_t append_json_string(char *out, size_t offset, const char *text,
+                                 size_t length) {
+  static const char kHex[] = "0123456789abcdef";
+  offset = append(out, offset, "\"", 1);
+  for (size_t i = 0; i < length && offset + 6 < LOG_LINE_MAX; ++i) {
+    unsigned char c = (unsigned char)text[i];
+    if (c == '"' || c == '\\') {
+      out[offset++] = '\\';
+      out[offset++] = (char)c;
+    } else if (c == '\n') {
+      offset = append(out, offset, "\\n", 2);
+    } else if (c == '\t') {
+      offset = append(out, offset, "\\t", 2);
+    } else if (c < 0x20) {
+      char escaped[6] = {'\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 15]};
+      offset = append(out, offset, escaped, sizeof(escaped));
+    } else {
+      out[offset++] = (char)c;
+    }
+  }
+  return append(out, offset, "\"", 1);
+}
+
+static void write_record(uint64_t time_ms, LogSeverity severity,
+                         const char *tag, uint64_t job, const char *message,
+                         size_t length, bool truncated) {
+  char line[LOG_LINE_MAX];
+  size_t offset;
+  FILE *stream = stdout;
+  if (g_json) {
+    offset = (size_t)snprintf(line, sizeof(line),
+                              "{\"time\":%llu,\"severity\":\"%s\",\"tag\":",
+                              (unsigned long long)time_ms,
+                              kSeverityNames[severity]);
+    offset = append_json_string(line, offset, tag, strlen(tag));
+    if (job) {
+      char field[32];
+      int field_length = snprintf(field, sizeof(field), ",\"job\":%llu",
+                                  (unsigned long long)job);
+      offset = append(line, offset, field, (size_t)field_length);
+    }
+    offset = append(line, offset, ",\"message\":", 11);
+    offset = append_json_string(line, offset, message, length);
+    if (truncated)
+      offset = append(line, offset, ",\"truncated\":true", 17);
+    offset = append(line, offset, "}", 1);
+  } else {
+    if (severity >= kLogWarning)
+      stream = stderr;
+    offset = (size_t)snprintf(line, sizeof(line), "[%s] ", tag);
+    if (job) {
+      char prefix[32];
+      int prefix_length = snprintf(prefix, sizeof(prefix), "job %llu: ",
+                                   (unsigned long long)job);
+      offset = append(line, offset, prefix, (size_t)prefix_length);
+    }
+    offset = append(line, offset, message, length);
+    if (truncated)
+      offset = append(line, offset, "...", 3);
+  }
+  // Leave room for the newline even when the line was cut.
+  if (offset == LOG_LINE_MAX)
+    offset--;
+  line[offset++] = '\n';
+  fwrite(line, 1, offset, stream);
+  platform_atomic_add(&g_written, 1);
+}
+
+void log_ring_write(LogSeverity severity, const char *tag, uint64_t job,
+                    const char *message) {
+  if (!tag)
+    tag = "";
+  if (!message)
+    message = "";
+  uint64_t now = wall_time_ms();
+  if (!admit(severity, now))
+    return;
+  bool truncated;
+  size_t length = clip_utf8(message, LOG_MESSAGE_MAX, &truncated);
+  if (!platform_atomic_load(&g_running)) {
+    write_record(now, severity, tag, job, message, length, truncated);
+    return;
+  }
+
+  uint64_t ticket = platform_atomic_load(&g_enqueue_ticket);
+  LogSlot *slot;
+  for (;;) {
+    slot = &g_slots[ticket % LOG_SLOTS];
+    uint64_t sequence = platform_atomic_load(&slot->sequence);
+    if (sequence == ticket) {
+      if (platform_atomic_compare_exchange(&g_enqueue_ticket, &ticket,
+                                           ticket + 1))
+        break;
+    } else if (sequence < ticket) {
+      // Full: the writer has not freed this slot from the previous lap.
+      platform_atomic_add(&g_dropped, 1);
+      return;
+    } else {
+      ticket = platform_atomic_load(&g_enqueue_ticket);
+    }
+  }
+  slot->time_ms = now;
+  slot->job = job;
+  slot->severity = (uint8_t)severity;
+  slot->truncated = truncated;
+  slot->length = (uint16_t)length;
+  memcpy(slot->message, message, length);
+  bool tag_truncated;
+  size_t tag_length = clip_utf8(tag, LOG_TAG_MAX - 1, &tag_truncated);
+  memcpy(slot->tag, tag, tag_length);
+  slot->tag[tag_length] = '\0';
+  platform_atomic_store(&slot->sequence, ticket + 1);
+
+  // Signalling without the mutex can race with the writer going to sleep;
+  // the writer's idle timeout picks such a record up.
+  if (platform_atomic_load(&g_writer_sleeping))
+    platform_cond_signal(&g_wake);
+}
+
+void log_ring_printf(LogSeverity severity, const char *tag, uint64_t job,
+                     const char *format, ...) {
+  char message[LOG_MESSAGE_MAX + 1];
+  va_list arguments;
+  va_start(arguments, format);
+  vsnprintf(message, sizeof(message), format, arguments);
+  va_end(arguments);
+  log_ring_write(severity, tag, job, message);
+}
+
+static bool record_ready(void) {
+  LogSlot *slot = &g_slots[g_dequeue_ticket % LOG_SLOTS];
+  return platform_atomic_load(&slot->sequence) == g_dequeue_ticket + 1;
+}
+
+static size_t drain(void) {
+  size_t count = 0;
+  while (record_ready()) {
+    LogSlot *slot = &g_slots[g_dequeue_ticket % LOG_SLOTS];
+    write_record(slot->time_ms, (LogSeverity)slot->severity, slot->tag,
+                 slot->job, slot->message, slot->length, slot->truncated);
+    platform_atomic_store(&slot->sequence, g_dequeue_ticket + LOG_SLOTS);
+    platform_atomic_store(&g_dequeue_ticket, g_dequeue_ticket + 1);
+    count++;
+  }
+  return count;
+}
+
+// At most once a second, and once more before the writer exits.
+static void report_losses(uint64_t *reported_dropped,
+                          uint64_t *reported_limited, uint64_t *reported_at,
+                          bool final) {
+  uint64_t dropped = platform_atomic_load(&g_dropped);
+  uint64_t limited = platform_atomic_load(&g_rate_limited);
+  if (dropped == *reported_dropped && limited == *reported_limited)
+    return;
+  uint64_t now = wall_time_ms();
+  if (!final && now - *reported_at < 1000)
+    return;
+  char message[128];
+  int length = snprintf(message, sizeof(message),
+                        "%llu records dropped (ring full), %llu rate limited",
+                        (unsigned long long)(dropped - *reported_dropped),
+                        (unsigned long long)(limited - *reported_limited));
+  write_record(now, kLogWarning, "log", 0, message, (size_t)length, false);
+  *reported_dropped = dropped;
+  *reported_limited = limited;
+  *reported_at = now;
+}
+
+static void writer_main(void *argument) {
+  (void)argument;
+  uint64_t reported_dropped = 0, reported_limited = 0, reported_at = 0;
+  for (;;) {
+    // Read before draining, so the last pass sees every record.
+    bool running = platform_atomic_load(&g_running) != 0;
+    size_t count = drain();
+    report_losses(&reported_dropped, &reported_limited, &reported_at,
+                  !running);
+    if (count > 0 || !running) {
+      fflush(stdout);
+      fflush(stderr);
+      platform_mutex_lock(&g_wake_mutex);
+      platform_cond_broadcast(&g_drained);
+      platform_mutex_unlock(&g_wake_mutex);
+    }
+    if (!running)
+      return;
+    if (count > 0)
+      continue;
+    platform_mutex_lock(&g_wake_mutex);
+    platform_atomic_store(&g_writer_sleeping, 1);
+    if (!record_ready() && platform_atomic_load(&g_running))
+      platform_cond_timed_wait(&g_wake, &g_wake_mutex, WRITER_IDLE_NS);
+    platform_atomic_store(&g_writer_sleeping, 0);
+    platform_mutex_unlock(&g_wake_mutex);
+  }
+}
+
+static uint64_t env_count(const char *name) {
+  const char *value = getenv(name);
+  if (!value || !*value)
+    return 0;
+  char *end;
+  unsigned long long count = strtoull(value, &end, 10);
+  if (*end != '\0') {
+    fprintf(stderr, "Ignoring %s=%s: not a count\n", name, value);
+    return 0;
+  }
+  return count;
+}
+
+void log_ring_install(void) {
+  const char *format = getenv("HEADLESS_LOG_FORMAT");
+  g_json = format && strcmp(format, "json") == 0;
+  g_sample = env_count("HEADLESS_LOG_SAMPLE");
+  g_rate = env_count("HEADLESS_LOG_RATE");
+
+  g_slots = (LogSlot *)calloc(LOG_SLOTS, sizeof(LogSlot));
+  if (!g_slots) {
+    fprintf(stderr, "Log ring: out of memory, logging synchronously\n");
+    return;
+  }
+  for (uint64_t i = 0; i < LOG_SLOTS; ++i)
+    g_slots[i].sequence = i;
+  platform_atomic_store(&g_running, 1);
+  if (!platform_thread_start(&g_writer, writer_main, NULL)) {
+    platform_atomic_store(&g_running, 0);
+    free(g_slots);
+    g_slots = NULL;
+    fprintf(stderr, "Log ring: cannot start the writer, logging "
+                    "synchronously\n");
+    return;
+  }
+  // Dart's exit() ends the process without going through main's cleanup.
+  atexit(log_ring_flush);
+}
+
+void log_ring_stats(LogRingStats *stats) {
+  stats->written = platform_atomic_load(&g_written);
+  stats->dropped = platform_atomic_load(&g_dropped);
+  stats->sampled = platform_atomic_load(&g_sampled);
+  stats->rate_limited = platform_atomic_load(&g_rate_limited);
+}
+
+void log_ring_flush(void) {
+  if (!platform_atomic_load(&g_running))
+    return;
+  // Records claimed after this point may or may not be written.
+  uint64_t target = platform_atomic_load(&g_enqueue_ticket);
+  uint64_t waited = 0;
+  platform_mutex_lock(&g_wake_mutex);
+  while (platform_atomic_load(&g_dequeue_ticket) < target &&
+         platform_atomic_load(&g_running) && waited < FLUSH_TIMEOUT_NS) {
+    platform_cond_signal(&g_wake);
+    platform_cond_timed_wait(&g_drained, &g_wake_mutex, WRITER_IDLE_NS);
+    waited += WRITER_IDLE_NS;
+  }
+  platform_mutex_unlock(&g_wake_mutex);
+}
+
+void log_ring_shutdown(void) {
+  if (!platform_atomic_load(&g_running))
+    return;
+  platform_mutex_lock(&g_wake_mutex);
+  platform_atomic_store(&g_running, 0);
+  platform_cond_signal(&g_wake);
+  platform_mutex_unlock(&g_wake_mutex);
+  platform_thread_join(g_writer);
+  free(g_slots);
+  g_slots = NULL;
+}
@@ -0,0 +1,74 @@
+// Asynchronous log output.
+//
+// Engine log messages (including Dart's `print`) and the embedder's own
+// messages from the render path are copied into a fixed ring of records and
+// written by a background thread, so a slow stdout (a full pipe, a
+// container log driver) never stalls the UI, raster or worker threads.
+// Any number of threads append without taking a lock; when the ring is full
+// the record is dropped and counted instead of waiting. The writer reports
+// drops once a second.
+//
+// Environment:
+//   HEADLESS_LOG_FORMAT=json  one JSON object per line on stdout:
+//                             {"time":<unix ms>,"severity":"info",
+//                              "tag":"flutter","job":12,"message":"..."}
+//                             `job` is left out when the record has none.
+//                             Otherwise records are written as
+//                             "[tag] message", warnings and errors to
+//                             stderr.
+//   HEADLESS_LOG_SAMPLE=N     keep one in N debug and info records.
+//   HEADLESS_LOG_RATE=N       keep at most N records per second; errors
+//                             are never rate limited.
+//
+// Messages longer than LOG_MESSAGE_MAX bytes are truncated. Before install
+// and after shutdown records are written synchronously. A process that ends
+// through exit() (Dart's `exit` does) still writes the records logged
+// before.
+
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <stdint.h>
+
+#define LOG_MESSAGE_MAX 1000
+
+typedef enum {
+  kLogDebug,
+  kLogInfo,
+  kLogWarning,
+  kLogError,
+} LogSeverity;
+
+typedef struct {
+  uint64_t written;
+  // Lost because the ring was full.
+  uint64_t dropped;
+  uint64_t sampled;
+  uint64_t rate_limited;
+} LogRingStats;
+
+void log_ring_install(void);
+
+// Appends a record; never blocks. `job` is a pipeline or template job id, 0
+// for none.
+void log_ring_write(LogSeverity severity, const char *tag, uint64_t job,
+                    const char *message);
+void log_ring_printf(LogSeverity severity, const char *tag, uint64_t job,
+                     const char *format, ...)
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((format(printf, 4, 5)))
+#endif
+    ;
+
+void log_ring_stats(LogRingStats *stats);
+
+// Waits, up to a second, until the writer has written every record
+// appended before the call. Safe while other threads still log; registered
+// with atexit by log_ring_install.
+void log_ring_flush(void);
+
+// Writes what is left in the ring and joins the writer. Call once the threads
+// that log are gone.
+void log_ring_shutdown(void);
+
+#endif // LOG_RING_H
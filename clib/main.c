@@ -27,24 +27,32 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "admission.h"
+#include "channels.h"
 #include "embedder.h"
+#include "file_writer.h"
+#include "frame_capture.h"
+#include "image_patch.h"
+#include "image_stream.h"
+#include "job_cost.h"
+#include "log_ring.h"
+#include "metrics.h"
+#include "pixel_kernels.h"
+#include "render_pipeline.h"
+#include "shm_ring.h"
+#include "task_queue.h"
+#include "template_jobs.h"
+#include "trace_events.h"
+#include "watchdog.h"
 
 #define NSEC_PER_MSEC 1000000ULL
 #define NSEC_PER_SEC 1000000000ULL
 
-typedef struct {
-  FlutterTask task;
-  uint64_t target_time_nanos;
-} ScheduledTask;
-
-static ScheduledTask *g_tasks = NULL;
-static size_t g_tasks_count = 0;
-static size_t g_tasks_capacity = 0;
+static TaskQueue g_task_queue;
 static FlutterEngine g_engine = NULL;
 static FlutterEngineAOTData g_aot_data = NULL;
 #ifdef _WIN32
 static DWORD g_main_thread_id;
-static HANDLE g_shutdown_event = NULL;
 #elif defined(__APPLE__)
 static void *g_aot_dylib = NULL; // dlopen handle for macOS
 static pthread_t g_main_thread;
@@ -69,77 +77,9 @@ static uint64_t monotonic_time_now_ns(void) {
 #endif
 }
 
-static bool ensure_capacity(size_t needed) {
-  if (needed <= g_tasks_capacity)
-    return true;
-  size_t new_capacity = g_tasks_capacity == 0 ? 16 : g_tasks_capacity * 2;
-  while (new_capacity < needed)
-    new_capacity *= 2;
-  ScheduledTask *updated =
-      (ScheduledTask *)realloc(g_tasks, new_capacity * sizeof(ScheduledTask));
-  if (!updated)
-    return false;
-  g_tasks = updated;
-  g_tasks_capacity = new_capacity;
-  return true;
-}
-
-static void push_task(const FlutterTask *task, uint64_t target_time_nanos) {
-  if (!ensure_capacity(g_tasks_count + 1)) {
-    fprintf(stderr, "Failed to grow task queue\n");
-    return;
-  }
-  size_t i = g_tasks_count;
-  // Insert keeping queue sorted by target time (smallest first).
-  while (i > 0 && g_tasks[i - 1].target_time_nanos > target_time_nanos) {
-    g_tasks[i] = g_tasks[i - 1];
-    --i;
-  }
-  g_tasks[i].task = *task;
-  g_tasks[i].target_time_nanos = target_time_nanos;
-  g_tasks_count++;
-}
-
-static bool pop_task(ScheduledTask *out) {
-  if (g_tasks_count == 0)
-    return false;
-  *out = g_tasks[0];
-  memmove(&g_tasks[0], &g_tasks[1],
-          (g_tasks_count - 1) * sizeof(ScheduledTask));
-  g_tasks_count--;
-  return true;
-}
-
-static void sleep_until(uint64_t target_time_nanos) {
-  uint64_t now = monotonic_time_now_ns();
-  if (target_time_nanos <= now)
-    return;
-  uint64_t delta = target_time_nanos - now;
-#ifdef _WIN32
-  DWORD ms = (DWORD)(delta / NSEC_PER_MSEC);
-  if (ms > 0) {
-    if (g_shutdown_event) {
-      WaitForSingleObject(g_shutdown_event, ms);
-    } else {
-      Sleep(ms);
-    }
-  }
-#else
-  struct timespec ts;
-  ts.tv_sec = delta / NSEC_PER_SEC;
-  ts.tv_nsec = delta % NSEC_PER_SEC;
-  nanosleep(&ts, NULL);
-#endif
-}
-
 static void handle_signal(int signo) {
   (void)signo;
   g_running = 0;
-#ifdef _WIN32
-  if (g_shutdown_event) {
-    SetEvent(g_shutdown_event);
-  }
-#endif
 }
 
 #ifdef _WIN32
@@ -151,9 +91,6 @@ static BOOL WINAPI console_handler(DWORD ctrl_type) {
   case CTRL_LOGOFF_EVENT:
   case CTRL_SHUTDOWN_EVENT:
     g_running = 0;
-    if (g_shutdown_event) {
-      SetEvent(g_shutdown_event);
-    }
     return TRUE;
   default:
     return FALSE;
@@ -164,7 +101,6 @@ static void install_signal_handlers(void) {
   if (GetConsoleWindow() == NULL) {
     AttachConsole(ATTACH_PARENT_PROCESS);
   }
-  g_shutdown_event = CreateEvent(NULL, TRUE, FALSE, NULL);
   SetConsoleCtrlHandler(console_handler, TRUE);
   HANDLE stdin_handle = GetStdHandle(STD_INPUT_HANDLE);
   if (stdin_handle != INVALID_HANDLE_VALUE) {
@@ -189,17 +125,23 @@ static void install_signal_handlers(void) {
 static void log_callback(const char *tag, const char *message,
                          void *user_data) {
   (void)user_data;
-  fprintf(stdout, "[%s] %s\n", tag ? tag : "flutter", message ? message : "");
+  log_ring_write(kLogInfo, tag ? tag : "flutter", 0, message);
 }
 
-// Headless embedder: frames are rendered into a software buffer that we simply
-// acknowledge without displaying.
+// Headless embedder: frames are rendered into a software buffer that is never
+// displayed. Frames are only consumed while a capture session is running.
 static bool surface_present_callback(void *user_data, const void *allocation,
                                      size_t row_bytes, size_t height) {
   (void)user_data;
-  (void)allocation;
-  (void)row_bytes;
-  (void)height;
+  // Only the raster thread presents.
+  static bool named = false;
+  if (!named) {
+    trace_thread_name("raster");
+    named = true;
+  }
+  TraceSpan span = trace_begin("Present");
+  frame_capture_present(allocation, row_bytes, height);
+  trace_end(span, 0);
   return true;
 }
 
@@ -215,7 +157,8 @@ static bool runs_task_on_current_thread(void *user_data) {
 static void post_flutter_task(FlutterTask task, uint64_t target_time_nanos,
                               void *user_data) {
   (void)user_data;
-  push_task(&task, target_time_nanos);
+  if (!task_queue_post(&g_task_queue, &task, target_time_nanos))
+    log_ring_write(kLogError, "embedder", 0, "Failed to grow task queue");
 }
 
 static bool file_exists(const char *path) {
@@ -309,12 +252,25 @@ static const char *get_executable_dir(const char *argv0) {
 
 // Cleanup function to ensure all resources are freed
 static void cleanup(char *assets_path, char *icu_path, char *aot_lib_path) {
+  metrics_shutdown();
+  // Their workers reply to Dart, so they stop before the engine.
+  frame_capture_shutdown();
+  image_patch_shutdown();
+  image_stream_shutdown();
   // Shutdown Flutter engine if running
   if (g_engine) {
+    // Outstanding pipeline jobs still reply to Dart, so drain them first.
+    render_pipeline_shutdown();
+    trace_events_set_engine_running(false);
     fprintf(stdout, "Shutting down Flutter engine...\n");
     FlutterEngineShutdown(g_engine);
     g_engine = NULL;
   }
+  file_writer_shutdown();
+  template_jobs_shutdown();
+  shm_ring_shutdown();
+  log_ring_shutdown();
+  trace_events_shutdown();
 
 #if defined(__APPLE__)
   if (g_aot_dylib) {
@@ -333,17 +289,7 @@ static void cleanup(char *assets_path, char *icu_path, char *aot_lib_path) {
   free(assets_path);
   free(icu_path);
   free(aot_lib_path);
-  free(g_tasks);
-  g_tasks = NULL;
-  g_tasks_count = 0;
-  g_tasks_capacity = 0;
-
-#ifdef _WIN32
-  if (g_shutdown_event) {
-    CloseHandle(g_shutdown_event);
-    g_shutdown_event = NULL;
-  }
-#endif
+  task_queue_destroy(&g_task_queue);
 }
 
 int main(int argc, char **argv) {
@@ -357,6 +303,7 @@ int main(int argc, char **argv) {
 #else
   g_main_thread = pthread_self();
 #endif
+  task_queue_init(&g_task_queue);
 
   install_signal_handlers();
 
@@ -492,6 +439,7 @@ int main(int argc, char **argv) {
   args.icu_data_path = icu_path;
   args.shutdown_dart_vm_when_done = true;
   args.log_message_callback = log_callback;
+  args.platform_message_callback = channels_dispatch;
   
   // Pass command-line arguments to Dart main(List<String> args)
   // Skip argv[0] (executable path) so only actual arguments are passed
@@ -521,6 +469,28 @@ int main(int argc, char **argv) {
   task_runners.platform_task_runner = &platform_task_runner;
   args.custom_task_runners = &task_runners;
 
+  log_ring_install();
+  watchdog_install();
+  trace_events_install();
+  file_writer_install();
+  frame_capture_install();
+  image_patch_install();
+  image_stream_install();
+  render_pipeline_install();
+  admission_install(&g_task_queue);
+  template_jobs_install();
+  shm_ring_install();
+  // The platform thread may sleep in shm_ring_idle instead.
+  task_queue_set_wake(&g_task_queue, shm_ring_wake);
+  metrics_install(&g_task_queue);
+
+  // The engine skips the first entry, like a program name.
+  const char *engine_argv[2] = {argv[0], trace_events_engine_switch()};
+  if (engine_argv[1]) {
+    args.command_line_argc = 2;
+    args.command_line_argv = engine_argv;
+  }
+
   FlutterEngineResult result =
       FlutterEngineRun(FLUTTER_ENGINE_VERSION, &config, &args, NULL, &g_engine);
   if (result != kSuccess) {
@@ -528,33 +498,38 @@ int main(int argc, char **argv) {
     exit_code = 1;
     goto cleanup_and_exit;
   }
+  channels_set_engine(g_engine);
+  trace_events_set_engine_running(true);
+  job_cost_attach(g_engine);
+  watchdog_attach(g_engine);
 
   fprintf(stdout, "Flutter engine started. Bundle path: %s\n", bundle_root);
   fprintf(stdout, "Dart entrypoint arguments: %d\n", argc > 1 ? argc - 1 : 0);
+  fprintf(stdout, "Pixel kernels: %s\n", pixel_kernels()->name);
 
   while (g_running) {
+    shm_ring_poll();
     ScheduledTask task;
-    if (!pop_task(&task)) {
-      // Idle briefly to avoid a tight loop.
-#ifdef _WIN32
-      if (g_shutdown_event) {
-        WaitForSingleObject(g_shutdown_event, 5);
-      } else {
-        Sleep(5);
-      }
-#else
-      struct timespec ts = {.tv_sec = 0, .tv_nsec = 5 * NSEC_PER_MSEC};
-      nanosleep(&ts, NULL);
-#endif
-      continue;
-    }
-
     uint64_t now = monotonic_time_now_ns();
-    if (task.target_time_nanos > now) {
-      sleep_until(task.target_time_nanos);
+    watchdog_poll(now);
+    if (task_queue_pop_due(&g_task_queue, now, &task)) {
+      TraceSpan span = trace_begin("RunTask");
+      FlutterEngineRunTask(g_engine, &task.task);
+      trace_end(span, 0);
+      continue;
     }
 
-    FlutterEngineRunTask(g_engine, &task.task);
+    // Sleep until the next task is due, at most 5 ms so that a signal is
+    // noticed promptly. A post that brings the deadline forward ends the
+    // wait early. With the shared-memory ring enabled the wait is on the
+    // ring instead, and a client signalling a job or such a post ends it
+    // early.
+    uint64_t wait =
+        task_queue_time_until_due(&g_task_queue, now, 5 * NSEC_PER_MSEC);
+    if (wait == 0)
+      continue;
+    if (!shm_ring_idle((int)((wait + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC)))
+      task_queue_wait(&g_task_queue, now, wait);
   }
 
 cleanup_and_exit:
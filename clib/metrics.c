@@ -0,0 +1,470 @@
+#include "metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "admission.h"
+#include "byte_sink.h"
+#include "embedder.h"
+#include "file_writer.h"
+#include "log_ring.h"
+#include "platform_thread.h"
+#include "render_pipeline.h"
+#include "template_jobs.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <psapi.h>
+typedef SOCKET SocketHandle;
+#define INVALID_SOCKET_HANDLE INVALID_SOCKET
+#define close_socket closesocket
+#else
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+typedef int SocketHandle;
+#define INVALID_SOCKET_HANDLE (-1)
+#define close_socket close
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+#define MAX_REQUEST_SIZE 4096
+#define HISTOGRAM_BUCKETS 14
+
+static const double kBucketSeconds[HISTOGRAM_BUCKETS] = {
+    0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+    0.1,    0.25,  0.5,    1,     2.5,  5,     10};
+
+static const char *const kJobKindNames[kMetricJobKindCount] = {"pipeline",
+                                                               "template"};
+static const char *const kStageNames[kMetricStageCount] = {
+    "queued", "encode", "output", "total", "template"};
+
+typedef struct {
+  // Non-cumulative; summed up when exported.
+  uint64_t buckets[HISTOGRAM_BUCKETS + 1];
+  uint64_t count;
+  uint64_t sum_nanos;
+} Histogram;
+
+// Set once by metrics_install, before any other thread starts.
+static bool g_enabled;
+static TaskQueue *g_tasks;
+static SocketHandle g_listener = INVALID_SOCKET_HANDLE;
+static char *g_unix_path;
+static PlatformThread g_server_thread;
+
+// Guarded by g_metrics_mutex.
+static PlatformMutex g_metrics_mutex = PLATFORM_MUTEX_INIT;
+static uint64_t g_started[kMetricJobKindCount];
+static uint64_t g_completed[kMetricJobKindCount];
+static uint64_t g_failed[kMetricJobKindCount];
+static Histogram g_stages[kMetricStageCount];
+static bool g_stopping;
+
+bool metrics_enabled(void) { return g_enabled; }
+
+void metrics_job_started(MetricJobKind kind) {
+  if (!g_enabled)
+    return;
+  platform_mutex_lock(&g_metrics_mutex);
+  g_started[kind]++;
+  platform_mutex_unlock(&g_metrics_mutex);
+}
+
+void metrics_job_finished(MetricJobKind kind, bool ok) {
+  if (!g_enabled)
+    return;
+  platform_mutex_lock(&g_metrics_mutex);
+  if (ok)
+    g_completed[kind]++;
+  else
+    g_failed[kind]++;
+  platform_mutex_unlock(&g_metrics_mutex);
+}
+
+void metrics_observe(MetricStage stage, uint64_t nanos) {
+  if (!g_enabled)
+    return;
+  double seconds = nanos / 1e9;
+  size_t bucket = 0;
+  while (bucket < HISTOGRAM_BUCKETS && seconds > kBucketSeconds[bucket])
+    bucket++;
+  platform_mutex_lock(&g_metrics_mutex);
+  Histogram *histogram = &g_stages[stage];
+  histogram->buckets[bucket]++;
+  histogram->count++;
+  histogram->sum_nanos += nanos;
+  platform_mutex_unlock(&g_metrics_mutex);
+}
+
+static uint64_t resident_bytes(void) {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (K32GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                              sizeof(counters)))
+    return counters.WorkingSetSize;
+  return 0;
+#elif defined(__APPLE__)
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info,
+                &count) == KERN_SUCCESS)
+    return info.resident_size;
+  return 0;
+#else
+  FILE *file = fopen("/proc/self/statm", "r");
+  if (!file)
+    return 0;
+  unsigned long long pages = 0, resident = 0;
+  int fields = fscanf(file, "%llu %llu", &pages, &resident);
+  fclose(file);
+  return fields == 2 ? resident * (uint64_t)sysconf(_SC_PAGESIZE) : 0;
+#endif
+}
+
+static void emit(ByteSink *out, const char *format, ...) {
+  char line[256];
+  va_list arguments;
+  va_start(arguments, format);
+  int length = vsnprintf(line, sizeof(line), format, arguments);
+  va_end(arguments);
+  if (length > 0)
+    byte_sink_write(out, line,
+                    (size_t)length < sizeof(line) ? (size_t)length
+                                                  : sizeof(line) - 1);
+}
+
+static void emit_header(ByteSink *out, const char *name, const char *type,
+                        const char *help) {
+  emit(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void emit_job_counter(ByteSink *out, const char *name,
+                             const char *help, const uint64_t *values) {
+  emit_header(out, name, "counter", help);
+  for (int kind = 0; kind < kMetricJobKindCount; ++kind)
+    emit(out, "%s{kind=\"%s\"} %llu\n", name, kJobKindNames[kind],
+         (unsigned long long)values[kind]);
+}
+
+static void render_metrics(ByteSink *out) {
+  uint64_t started[kMetricJobKindCount];
+  uint64_t completed[kMetricJobKindCount];
+  uint64_t failed[kMetricJobKindCount];
+  Histogram stages[kMetricStageCount];
+  platform_mutex_lock(&g_metrics_mutex);
+  memcpy(started, g_started, sizeof(started));
+  memcpy(completed, g_completed, sizeof(completed));
+  memcpy(failed, g_failed, sizeof(failed));
+  memcpy(stages, g_stages, sizeof(stages));
+  platform_mutex_unlock(&g_metrics_mutex);
+
+  emit_job_counter(out, "headless_jobs_started_total", "Jobs accepted.",
+                   started);
+  emit_job_counter(out, "headless_jobs_completed_total",
+                   "Jobs that wrote their output.", completed);
+  emit_job_counter(out, "headless_jobs_failed_total", "Jobs that failed.",
+                   failed);
+
+  emit_header(out, "headless_job_stage_seconds", "histogram",
+              "Time jobs spent in each stage.");
+  for (int stage = 0; stage < kMetricStageCount; ++stage) {
+    const Histogram *histogram = &stages[stage];
+    uint64_t cumulative = 0;
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket) {
+      cumulative += histogram->buckets[bucket];
+      emit(out, "headless_job_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} "
+                "%llu\n",
+           kStageNames[stage], kBucketSeconds[bucket],
+           (unsigned long long)cumulative);
+    }
+    emit(out,
+         "headless_job_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n",
+         kStageNames[stage], (unsigned long long)histogram->count);
+    emit(out, "headless_job_stage_seconds_sum{stage=\"%s\"} %.9f\n",
+         kStageNames[stage], histogram->sum_nanos / 1e9);
+    emit(out, "headless_job_stage_seconds_count{stage=\"%s\"} %llu\n",
+         kStageNames[stage], (unsigned long long)histogram->count);
+  }
+
+  uint64_t now = FlutterEngineGetCurrentTime();
+  emit_header(out, "headless_pending_tasks", "gauge",
+              "Tasks queued for the platform thread.");
+  emit(out, "headless_pending_tasks %zu\n", task_queue_size(g_tasks));
+  emit_header(out, "headless_oldest_task_age_seconds", "gauge",
+              "How long the earliest due platform task has waited.");
+  emit(out, "headless_oldest_task_age_seconds %.6f\n",
+       task_queue_overdue(g_tasks, now) / 1e9);
+
+  RenderPipelineStats pipeline;
+  render_pipeline_stats(&pipeline);
+  emit_header(out, "headless_pipeline_slots", "gauge",
+              "Pipeline queue slots and jobs in use.");
+  emit(out, "headless_pipeline_slots{queue=\"encode\"} %u\n",
+       pipeline.encode_queued);
+  emit(out, "headless_pipeline_slots{queue=\"output\"} %u\n",
+       pipeline.output_queued);
+  emit(out, "headless_pipeline_slots{queue=\"parked\"} %u\n",
+       pipeline.parked);
+  emit(out, "headless_pipeline_slots{queue=\"outstanding\"} %u\n",
+       pipeline.outstanding);
+  emit_header(out, "headless_pipeline_slot_capacity", "gauge",
+              "Pipeline queue sizes.");
+  emit(out, "headless_pipeline_slot_capacity{queue=\"encode\"} %u\n",
+       pipeline.encode_capacity);
+  emit(out, "headless_pipeline_slot_capacity{queue=\"output\"} %u\n",
+       pipeline.output_capacity);
+
+  static const char *const kPriorityNames[kJobPriorityCount] = {
+      "interactive", "batch"};
+  TemplateJobStats templates;
+  template_jobs_stats(&templates);
+  emit_header(out, "headless_template_jobs", "gauge",
+              "Template jobs waiting in the embedder or rendering, by "
+              "priority.");
+  for (int priority = 0; priority < kJobPriorityCount; ++priority) {
+    emit(out,
+         "headless_template_jobs{priority=\"%s\",state=\"pending\"} %u\n",
+         kPriorityNames[priority], templates.pending[priority]);
+    emit(out,
+         "headless_template_jobs{priority=\"%s\",state=\"in_flight\"} "
+         "%u\n",
+         kPriorityNames[priority], templates.in_flight[priority]);
+  }
+
+  static const char *const kVerdictNames[kAdmissionVerdictCount] = {
+      "accepted", "queue_full", "engine_busy"};
+  AdmissionStats admission;
+  admission_stats(&admission);
+  emit_header(out, "headless_template_admissions_total", "counter",
+              "Template jobs submitted, by admission verdict.");
+  for (int verdict = 0; verdict < kAdmissionVerdictCount; ++verdict)
+    emit(out, "headless_template_admissions_total{verdict=\"%s\"} %llu\n",
+         kVerdictNames[verdict],
+         (unsigned long long)admission.verdicts[verdict]);
+  emit_header(out, "headless_template_concurrency_limit", "gauge",
+              "Template jobs the adaptive limit lets render at once.");
+  emit(out, "headless_template_concurrency_limit %u\n",
+       admission.concurrency_limit);
+  emit_header(out, "headless_template_latency_seconds", "gauge",
+              "Moving average of template job latency, dispatch to reply.");
+  emit(out, "headless_template_latency_seconds %.6f\n",
+       admission.average_latency_nanos / 1e9);
+
+  FileWriterStats files;
+  file_writer_stats(&files);
+  emit_header(out, "headless_file_writes_total", "counter",
+              "Output files submitted.");
+  emit(out, "headless_file_writes_total %llu\n",
+       (unsigned long long)files.submitted);
+  emit_header(out, "headless_file_writes_failed_total", "counter",
+              "Output files that could not be written.");
+  emit(out, "headless_file_writes_failed_total %llu\n",
+       (unsigned long long)files.failed);
+  emit_header(out, "headless_file_write_bytes_total", "counter",
+              "Bytes written to output files.");
+  emit(out, "headless_file_write_bytes_total %llu\n",
+       (unsigned long long)files.bytes);
+  emit_header(out, "headless_file_writes_in_flight", "gauge",
+              "Output files submitted but not yet written.");
+  emit(out, "headless_file_writes_in_flight %u\n", files.in_flight);
+
+  LogRingStats logs;
+  log_ring_stats(&logs);
+  emit_header(out, "headless_log_records_total", "counter",
+              "Log records by outcome.");
+  emit(out, "headless_log_records_total{outcome=\"written\"} %llu\n",
+       (unsigned long long)logs.written);
+  emit(out, "headless_log_records_total{outcome=\"dropped\"} %llu\n",
+       (unsigned long long)logs.dropped);
+  emit(out, "headless_log_records_total{outcome=\"sampled\"} %llu\n",
+       (unsigned long long)logs.sampled);
+  emit(out, "headless_log_records_total{outcome=\"rate_limited\"} %llu\n",
+       (unsigned long long)logs.rate_limited);
+
+  emit_header(out, "process_resident_memory_bytes", "gauge",
+              "Resident memory size in bytes.");
+  emit(out, "process_resident_memory_bytes %llu\n",
+       (unsigned long long)resident_bytes());
+}
+
+static bool send_all(SocketHandle client, const uint8_t *data, size_t size) {
+  while (size > 0) {
+    int chunk = size > 1 << 30 ? 1 << 30 : (int)size;
+    int sent = (int)send(client, (const char *)data, chunk, MSG_NOSIGNAL);
+    if (sent <= 0)
+      return false;
+    data += sent;
+    size -= (size_t)sent;
+  }
+  return true;
+}
+
+// Every request gets the metrics, whatever its path; scrapers only GET.
+static void serve_client(SocketHandle client) {
+#ifdef _WIN32
+  DWORD timeout = 1000;
+#else
+  struct timeval timeout = {1, 0};
+#endif
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout,
+             sizeof(timeout));
+  char request[MAX_REQUEST_SIZE + 1];
+  size_t length = 0;
+  while (length < MAX_REQUEST_SIZE) {
+    int received = (int)recv(client, request + length,
+                             (int)(MAX_REQUEST_SIZE - length), 0);
+    if (received <= 0)
+      break;
+    length += (size_t)received;
+    request[length] = '\0';
+    if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+      break;
+  }
+
+  ByteSink body;
+  byte_sink_open_memory(&body);
+  render_metrics(&body);
+  char header[160];
+  int header_length = snprintf(
+      header, sizeof(header),
+      "HTTP/1.0 200 OK\r\n"
+      "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+      "Content-Length: %llu\r\n\r\n",
+      (unsigned long long)body.bytes_written);
+  if (body.ok && send_all(client, (const uint8_t *)header,
+                          (size_t)header_length))
+    send_all(client, body.memory, (size_t)body.bytes_written);
+  byte_sink_close(&body);
+  close_socket(client);
+}
+
+static void server_main(void *argument) {
+  (void)argument;
+  for (;;) {
+    platform_mutex_lock(&g_metrics_mutex);
+    bool stopping = g_stopping;
+    platform_mutex_unlock(&g_metrics_mutex);
+    if (stopping)
+      break;
+    // Wake up now and then to notice metrics_shutdown.
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(g_listener, &readable);
+    struct timeval timeout = {0, 200000};
+    if (select((int)g_listener + 1, &readable, NULL, NULL, &timeout) <= 0)
+      continue;
+    SocketHandle client = accept(g_listener, NULL, NULL);
+    if (client != INVALID_SOCKET_HANDLE)
+      serve_client(client);
+  }
+}
+
+static SocketHandle listen_loopback(int port) {
+#ifdef _WIN32
+  WSADATA data;
+  if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+    return INVALID_SOCKET_HANDLE;
+#endif
+  SocketHandle handle = socket(AF_INET, SOCK_STREAM, 0);
+  if (handle == INVALID_SOCKET_HANDLE)
+    return handle;
+  int on = 1;
+  setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons((unsigned short)port);
+  if (bind(handle, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(handle, 16) != 0) {
+    close_socket(handle);
+    return INVALID_SOCKET_HANDLE;
+  }
+  return handle;
+}
+
+#ifndef _WIN32
+static SocketHandle listen_unix(const char *path) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path))
+    return INVALID_SOCKET_HANDLE;
+  strcpy(address.sun_path, path);
+  SocketHandle handle = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (handle == INVALID_SOCKET_HANDLE)
+    return handle;
+  // A socket file left behind by an earlier run would fail the bind.
+  unlink(path);
+  if (bind(handle, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(handle, 16) != 0) {
+    close_socket(handle);
+    return INVALID_SOCKET_HANDLE;
+  }
+  return handle;
+}
+#endif
+
+void metrics_install(TaskQueue *tasks) {
+  const char *setting = getenv("HEADLESS_METRICS");
+  if (!setting || !*setting)
+    return;
+  g_tasks = tasks;
+#ifndef _WIN32
+  if (strncmp(setting, "unix:", 5) == 0) {
+    g_listener = listen_unix(setting + 5);
+    if (g_listener != INVALID_SOCKET_HANDLE)
+      g_unix_path = strdup(setting + 5);
+  } else
+#endif
+  {
+    int port = atoi(setting);
+    if (port > 0 && port < 65536)
+      g_listener = listen_loopback(port);
+  }
+  if (g_listener == INVALID_SOCKET_HANDLE) {
+    fprintf(stderr, "Metrics: cannot listen on %s\n", setting);
+    return;
+  }
+  if (!platform_thread_start(&g_server_thread, server_main, NULL)) {
+    fprintf(stderr, "Metrics: cannot start the server thread\n");
+    metrics_shutdown();
+    return;
+  }
+  g_enabled = true;
+  fprintf(stdout, "Metrics: serving on %s\n", setting);
+}
+
+void metrics_shutdown(void) {
+  if (g_listener == INVALID_SOCKET_HANDLE)
+    return;
+  if (g_enabled) {
+    platform_mutex_lock(&g_metrics_mutex);
+    g_stopping = true;
+    platform_mutex_unlock(&g_metrics_mutex);
+    platform_thread_join(g_server_thread);
+  }
+  close_socket(g_listener);
+  g_listener = INVALID_SOCKET_HANDLE;
+#ifndef _WIN32
+  if (g_unix_path) {
+    unlink(g_unix_path);
+    free(g_unix_path);
+    g_unix_path = NULL;
+  }
+#endif
+  g_enabled = false;
+}
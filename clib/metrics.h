@@ -0,0 +1,73 @@
+// Prometheus metrics for autoscaling and alerting.
+//
+// With HEADLESS_METRICS set, a server thread answers every HTTP request with
+// the current metrics in the Prometheus text format (version 0.0.4):
+//
+//   HEADLESS_METRICS=9464              listen on 127.0.0.1:9464
+//   HEADLESS_METRICS=unix:<path>       listen on a Unix socket (not Windows)
+//
+// Exported:
+//   headless_jobs_started_total, headless_jobs_completed_total and
+//   headless_jobs_failed_total, by kind (pipeline, template)
+//   headless_job_stage_seconds        histogram by stage: queued (submit to
+//                                     encode), encode, output (encoded to
+//                                     written), total, and template (a
+//                                     template job's round trip)
+//   headless_pending_tasks            platform tasks queued
+//   headless_oldest_task_age_seconds  how long the earliest due platform
+//                                     task has been waiting to run
+//   headless_pipeline_slots           used encode and output queue slots,
+//                                     parked and outstanding jobs, and
+//                                     headless_pipeline_slot_capacity
+//   headless_template_jobs            pending and in-flight template jobs
+//                                     by priority
+//   headless_template_admissions_total
+//                                     by verdict: accepted, queue_full,
+//                                     engine_busy (see admission.h)
+//   headless_template_concurrency_limit and
+//   headless_template_latency_seconds the adaptive limit and the average
+//                                     latency it follows
+//   headless_file_writes_*            see file_writer.h
+//   headless_log_records_total        by outcome: written, dropped (ring
+//                                     full), sampled, rate_limited
+//   process_resident_memory_bytes
+//
+// The Dart heap is not exported: the embedder API has no way to read it
+// without the VM service.
+//
+// Recording is thread-safe and costs a single flag check while the server is
+// off.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "task_queue.h"
+
+typedef enum {
+  kMetricJobPipeline,
+  kMetricJobTemplate,
+  kMetricJobKindCount,
+} MetricJobKind;
+
+typedef enum {
+  kMetricStageQueued,
+  kMetricStageEncode,
+  kMetricStageOutput,
+  kMetricStageTotal,
+  kMetricStageTemplate,
+  kMetricStageCount,
+} MetricStage;
+
+// `tasks` is the platform task queue, sampled on every scrape.
+void metrics_install(TaskQueue *tasks);
+void metrics_shutdown(void);
+
+bool metrics_enabled(void);
+void metrics_job_started(MetricJobKind kind);
+void metrics_job_finished(MetricJobKind kind, bool ok);
+void metrics_observe(MetricStage stage, uint64_t nanos);
+
+#endif // METRICS_H
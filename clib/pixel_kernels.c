@@ -0,0 +1,661 @@
+#include "pixel_kernels.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||           \
+    defined(_M_IX86)
+#define PIXEL_KERNELS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define PIXEL_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+// ---------------------------------------------------------------------------
+// Scalar reference
+
+// Exact round(x / 255) for x in [0, 255 * 255].
+static inline uint8_t div255(uint32_t x) {
+  x += 128;
+  return (uint8_t)((x + (x >> 8)) >> 8);
+}
+
+static inline uint8_t unpremultiply_channel(uint32_t c, uint32_t a) {
+  uint32_t value = (c * 255u + a / 2) / a;
+  return (uint8_t)(value > 255 ? 255 : value);
+}
+
+// `r_index` selects where red is read from: 0 for RGBA input, 2 for BGRA.
+static inline void unpremultiply_pixel(const uint8_t *src, uint8_t *dst,
+                                       int r_index) {
+  uint32_t a = src[3];
+  uint8_t r = src[r_index], g = src[1], b = src[2 - r_index];
+  if (a == 255) {
+    dst[0] = r;
+    dst[1] = g;
+    dst[2] = b;
+  } else if (a == 0) {
+    dst[0] = dst[1] = dst[2] = 0;
+  } else {
+    dst[0] = unpremultiply_channel(r, a);
+    dst[1] = unpremultiply_channel(g, a);
+    dst[2] = unpremultiply_channel(b, a);
+  }
+  dst[3] = (uint8_t)a;
+}
+
+static inline uint8_t gray_pixel(const uint8_t *src) {
+  return (uint8_t)((src[0] * 77u + src[1] * 150u + src[2] * 29u + 128) >> 8);
+}
+
+static void scalar_native_to_rgba(const uint8_t *src, uint8_t *dst,
+                                  size_t count) {
+  for (size_t i = 0; i < count; ++i, src += 4, dst += 4)
+    unpremultiply_pixel(src, dst, 2);
+}
+
+static void scalar_swizzle_rb(const uint8_t *src, uint8_t *dst, size_t count) {
+  for (size_t i = 0; i < count; ++i, src += 4, dst += 4) {
+    uint8_t r = src[0];
+    dst[0] = src[2];
+    dst[1] = src[1];
+    dst[2] = r;
+    dst[3] = src[3];
+  }
+}
+
+static void scalar_premultiply(const uint8_t *src, uint8_t *dst,
+                               size_t count) {
+  for (size_t i = 0; i < count; ++i, src += 4, dst += 4) {
+    uint32_t a = src[3];
+    dst[0] = div255(src[0] * a);
+    dst[1] = div255(src[1] * a);
+    dst[2] = div255(src[2] * a);
+    dst[3] = (uint8_t)a;
+  }
+}
+
+static void scalar_unpremultiply(const uint8_t *src, uint8_t *dst,
+                                 size_t count) {
+  for (size_t i = 0; i < count; ++i, src += 4, dst += 4)
+    unpremultiply_pixel(src, dst, 0);
+}
+
+static void scalar_strip_alpha(const uint8_t *src, uint8_t *dst,
+                               size_t count) {
+  for (size_t i = 0; i < count; ++i, src += 4, dst += 3) {
+    dst[0] = src[0];
+    dst[1] = src[1];
+    dst[2] = src[2];
+  }
+}
+
+static void scalar_to_gray8(const uint8_t *src, uint8_t *dst, size_t count) {
+  for (size_t i = 0; i < count; ++i, src += 4)
+    dst[i] = gray_pixel(src);
+}
+
+static inline uint32_t load_pixel(const uint8_t *pixel) {
+  uint32_t value;
+  memcpy(&value, pixel, sizeof(value));
+  return value;
+}
+
+static size_t scalar_first_mismatch(const uint8_t *pixels, size_t count,
+                                    uint32_t value, uint32_t mask) {
+  for (size_t i = 0; i < count; ++i) {
+    if ((load_pixel(pixels + i * 4) & mask) != value)
+      return i;
+  }
+  return count;
+}
+
+static size_t scalar_last_mismatch(const uint8_t *pixels, size_t count,
+                                   uint32_t value, uint32_t mask) {
+  for (size_t i = count; i-- > 0;) {
+    if ((load_pixel(pixels + i * 4) & mask) != value)
+      return i;
+  }
+  return count;
+}
+
+static const PixelKernels kScalarKernels = {
+    "scalar",
+    scalar_native_to_rgba,
+    scalar_swizzle_rb,
+    scalar_premultiply,
+    scalar_unpremultiply,
+    scalar_strip_alpha,
+    scalar_to_gray8,
+    scalar_first_mismatch,
+    scalar_last_mismatch,
+};
+
+// ---------------------------------------------------------------------------
+// SSE2 and AVX2
+
+#ifdef PIXEL_KERNELS_X86
+
+static inline __m128i sse2_swizzle(__m128i pixels) {
+  const __m128i ag = _mm_set1_epi32((int)0xff00ff00u);
+  const __m128i low = _mm_set1_epi32(0xff);
+  __m128i r_to_b = _mm_and_si128(_mm_srli_epi32(pixels, 16), low);
+  __m128i b_to_r = _mm_slli_epi32(_mm_and_si128(pixels, low), 16);
+  return _mm_or_si128(_mm_and_si128(pixels, ag), _mm_or_si128(r_to_b, b_to_r));
+}
+
+// Returns 1 when all four pixels are opaque, 0 when all are transparent and
+// -1 otherwise.
+static inline int sse2_alpha_class(__m128i pixels) {
+  const __m128i alpha = _mm_set1_epi32((int)0xff000000u);
+  __m128i a = _mm_and_si128(pixels, alpha);
+  if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, alpha)) == 0xffff)
+    return 1;
+  if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, _mm_setzero_si128())) == 0xffff)
+    return 0;
+  return -1;
+}
+
+static void sse2_unpremultiply_impl(const uint8_t *src, uint8_t *dst,
+                                    size_t count, bool swizzle) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i pixels = _mm_loadu_si128((const __m128i *)(src + i * 4));
+    int alpha = sse2_alpha_class(pixels);
+    if (alpha == 1) {
+      _mm_storeu_si128((__m128i *)(dst + i * 4),
+                       swizzle ? sse2_swizzle(pixels) : pixels);
+    } else if (alpha == 0) {
+      _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_setzero_si128());
+    } else {
+      for (size_t j = i; j < i + 4; ++j)
+        unpremultiply_pixel(src + j * 4, dst + j * 4, swizzle ? 2 : 0);
+    }
+  }
+  for (; i < count; ++i)
+    unpremultiply_pixel(src + i * 4, dst + i * 4, swizzle ? 2 : 0);
+}
+
+static void sse2_native_to_rgba(const uint8_t *src, uint8_t *dst,
+                                size_t count) {
+  sse2_unpremultiply_impl(src, dst, count, true);
+}
+
+static void sse2_unpremultiply(const uint8_t *src, uint8_t *dst,
+                               size_t count) {
+  sse2_unpremultiply_impl(src, dst, count, false);
+}
+
+static void sse2_swizzle_rb(const uint8_t *src, uint8_t *dst, size_t count) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i pixels = _mm_loadu_si128((const __m128i *)(src + i * 4));
+    _mm_storeu_si128((__m128i *)(dst + i * 4), sse2_swizzle(pixels));
+  }
+  scalar_swizzle_rb(src + i * 4, dst + i * 4, count - i);
+}
+
+// Multiplies the color channels of 16-bit lanes by their pixel's alpha.
+static inline __m128i sse2_premultiply_half(__m128i half) {
+  // Broadcast each pixel's alpha (lane 3) over its four lanes, and use 255
+  // for the alpha lane itself so alpha survives the multiply.
+  __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(half, 0xff), 0xff);
+  const __m128i alpha_lane = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+  a = _mm_or_si128(_mm_andnot_si128(alpha_lane, a),
+                   _mm_and_si128(alpha_lane, _mm_set1_epi16(255)));
+  __m128i x = _mm_add_epi16(_mm_mullo_epi16(half, a), _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static void sse2_premultiply(const uint8_t *src, uint8_t *dst, size_t count) {
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i pixels = _mm_loadu_si128((const __m128i *)(src + i * 4));
+    __m128i low = sse2_premultiply_half(_mm_unpacklo_epi8(pixels, zero));
+    __m128i high = sse2_premultiply_half(_mm_unpackhi_epi8(pixels, zero));
+    _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_packus_epi16(low, high));
+  }
+  scalar_premultiply(src + i * 4, dst + i * 4, count - i);
+}
+
+static void sse2_to_gray8(const uint8_t *src, uint8_t *dst, size_t count) {
+  const __m128i low = _mm_set1_epi32(0xff);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i sums[2];
+    for (int k = 0; k < 2; ++k) {
+      __m128i p = _mm_loadu_si128((const __m128i *)(src + (i + k * 4) * 4));
+      __m128i r = _mm_and_si128(p, low);
+      __m128i g = _mm_and_si128(_mm_srli_epi32(p, 8), low);
+      __m128i b = _mm_and_si128(_mm_srli_epi32(p, 16), low);
+      // Products fit in the low 16 bits of each 32-bit lane.
+      __m128i sum = _mm_add_epi32(
+          _mm_add_epi32(_mm_mullo_epi16(r, _mm_set1_epi32(77)),
+                        _mm_mullo_epi16(g, _mm_set1_epi32(150))),
+          _mm_add_epi32(_mm_mullo_epi16(b, _mm_set1_epi32(29)),
+                        _mm_set1_epi32(128)));
+      sums[k] = _mm_srli_epi32(sum, 8);
+    }
+    __m128i words = _mm_packs_epi32(sums[0], sums[1]);
+    _mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(words, words));
+  }
+  scalar_to_gray8(src + i * 4, dst + i, count - i);
+}
+
+static inline bool sse2_all_match(const uint8_t *pixels, __m128i value,
+                                  __m128i mask) {
+  __m128i p = _mm_and_si128(_mm_loadu_si128((const __m128i *)pixels), mask);
+  return _mm_movemask_epi8(_mm_cmpeq_epi32(p, value)) == 0xffff;
+}
+
+static size_t sse2_first_mismatch(const uint8_t *pixels, size_t count,
+                                  uint32_t value, uint32_t mask) {
+  const __m128i v = _mm_set1_epi32((int)value);
+  const __m128i m = _mm_set1_epi32((int)mask);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    if (!sse2_all_match(pixels + i * 4, v, m))
+      return i + scalar_first_mismatch(pixels + i * 4, 4, value, mask);
+  }
+  size_t tail = scalar_first_mismatch(pixels + i * 4, count - i, value, mask);
+  return i + tail;
+}
+
+static size_t sse2_last_mismatch(const uint8_t *pixels, size_t count,
+                                 uint32_t value, uint32_t mask) {
+  const __m128i v = _mm_set1_epi32((int)value);
+  const __m128i m = _mm_set1_epi32((int)mask);
+  size_t i = count;
+  for (; i >= 4; i -= 4) {
+    if (!sse2_all_match(pixels + (i - 4) * 4, v, m))
+      return i - 4 + scalar_last_mismatch(pixels + (i - 4) * 4, 4, value, mask);
+  }
+  size_t head = scalar_last_mismatch(pixels, i, value, mask);
+  return head == i ? count : head;
+}
+
+static const PixelKernels kSse2Kernels = {
+    "sse2",
+    sse2_native_to_rgba,
+    sse2_swizzle_rb,
+    sse2_premultiply,
+    sse2_unpremultiply,
+    scalar_strip_alpha,
+    sse2_to_gray8,
+    sse2_first_mismatch,
+    sse2_last_mismatch,
+};
+
+TARGET_AVX2 static inline __m256i avx2_swizzle(__m256i pixels) {
+  const __m256i order = _mm256_setr_epi8(
+      2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15, 2, 1, 0, 3, 6, 5,
+      4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+  return _mm256_shuffle_epi8(pixels, order);
+}
+
+TARGET_AVX2 static void avx2_unpremultiply_impl(const uint8_t *src,
+                                                uint8_t *dst, size_t count,
+                                                bool swizzle) {
+  const __m256i alpha = _mm256_set1_epi32((int)0xff000000u);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i pixels = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+    __m256i a = _mm256_and_si256(pixels, alpha);
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, alpha)) == -1) {
+      _mm256_storeu_si256((__m256i *)(dst + i * 4),
+                          swizzle ? avx2_swizzle(pixels) : pixels);
+    } else if (_mm256_testz_si256(a, a)) {
+      _mm256_storeu_si256((__m256i *)(dst + i * 4), _mm256_setzero_si256());
+    } else {
+      for (size_t j = i; j < i + 8; ++j)
+        unpremultiply_pixel(src + j * 4, dst + j * 4, swizzle ? 2 : 0);
+    }
+  }
+  for (; i < count; ++i)
+    unpremultiply_pixel(src + i * 4, dst + i * 4, swizzle ? 2 : 0);
+}
+
+TARGET_AVX2 static void avx2_native_to_rgba(const uint8_t *src, uint8_t *dst,
+                                            size_t count) {
+  avx2_unpremultiply_impl(src, dst, count, true);
+}
+
+TARGET_AVX2 static void avx2_unpremultiply(const uint8_t *src, uint8_t *dst,
+                                           size_t count) {
+  avx2_unpremultiply_impl(src, dst, count, false);
+}
+
+TARGET_AVX2 static void avx2_swizzle_rb(const uint8_t *src, uint8_t *dst,
+                                        size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i pixels = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+    _mm256_storeu_si256((__m256i *)(dst + i * 4), avx2_swizzle(pixels));
+  }
+  scalar_swizzle_rb(src + i * 4, dst + i * 4, count - i);
+}
+
+TARGET_AVX2 static void avx2_premultiply(const uint8_t *src, uint8_t *dst,
+                                         size_t count) {
+  // Per pixel: broadcast alpha over the color lanes, 255 in the alpha lane.
+  const __m256i spread = _mm256_setr_epi8(
+      6, -1, 6, -1, 6, -1, -1, -1, 14, -1, 14, -1, 14, -1, -1, -1, 6, -1, 6,
+      -1, 6, -1, -1, -1, 14, -1, 14, -1, 14, -1, -1, -1);
+  const __m256i alpha_lane = _mm256_set1_epi64x((long long)0x00ff000000000000ull);
+  const __m256i bias = _mm256_set1_epi16(128);
+  const __m256i zero = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i pixels = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+    __m256i halves[2] = {_mm256_unpacklo_epi8(pixels, zero),
+                         _mm256_unpackhi_epi8(pixels, zero)};
+    for (int k = 0; k < 2; ++k) {
+      __m256i a = _mm256_or_si256(_mm256_shuffle_epi8(halves[k], spread),
+                                  alpha_lane);
+      __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(halves[k], a), bias);
+      halves[k] = _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+    }
+    _mm256_storeu_si256((__m256i *)(dst + i * 4),
+                        _mm256_packus_epi16(halves[0], halves[1]));
+  }
+  scalar_premultiply(src + i * 4, dst + i * 4, count - i);
+}
+
+TARGET_AVX2 static void avx2_strip_alpha(const uint8_t *src, uint8_t *dst,
+                                         size_t count) {
+  const __m128i order =
+      _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  size_t i = 0;
+  // Each 16-byte store carries 12 useful bytes; keep it inside `dst`.
+  for (; i + 6 <= count; i += 4) {
+    __m128i pixels = _mm_loadu_si128((const __m128i *)(src + i * 4));
+    _mm_storeu_si128((__m128i *)(dst + i * 3), _mm_shuffle_epi8(pixels, order));
+  }
+  scalar_strip_alpha(src + i * 4, dst + i * 3, count - i);
+}
+
+TARGET_AVX2 static void avx2_to_gray8(const uint8_t *src, uint8_t *dst,
+                                      size_t count) {
+  // maddubs multiplies unsigned pixel bytes by signed weights and adds pairs:
+  // (77 R + 150 G) does not fit a signed byte weight, so G is split in two.
+  const __m256i weights_rg = _mm256_set1_epi32(0x004b004d); // R 77, G 75
+  const __m256i weights_gb = _mm256_set1_epi32(0x001d004b); // G 75, B 29
+  const __m256i pick_rg = _mm256_setr_epi8(
+      0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1, 0, -1, 1, -1,
+      4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1);
+  const __m256i pick_gb = _mm256_setr_epi8(
+      1, -1, 2, -1, 5, -1, 6, -1, 9, -1, 10, -1, 13, -1, 14, -1, 1, -1, 2, -1,
+      5, -1, 6, -1, 9, -1, 10, -1, 13, -1, 14, -1);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i pixels = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+    // 16-bit lanes: (R, G) and (G, B) per pixel, then per-pixel dot products.
+    __m256i rg = _mm256_madd_epi16(_mm256_shuffle_epi8(pixels, pick_rg),
+                                   weights_rg);
+    __m256i gb = _mm256_madd_epi16(_mm256_shuffle_epi8(pixels, pick_gb),
+                                   weights_gb);
+    __m256i sum = _mm256_add_epi32(_mm256_add_epi32(rg, gb),
+                                   _mm256_set1_epi32(128));
+    __m256i luma = _mm256_srli_epi32(sum, 8);
+    __m256i words = _mm256_packs_epi32(luma, luma);
+    __m256i bytes = _mm256_packus_epi16(words, words);
+    // Lanes hold pixels 0-3 and 4-7 in their low dwords.
+    uint32_t low = (uint32_t)_mm256_extract_epi32(bytes, 0);
+    uint32_t high = (uint32_t)_mm256_extract_epi32(bytes, 4);
+    memcpy(dst + i, &low, 4);
+    memcpy(dst + i + 4, &high, 4);
+  }
+  scalar_to_gray8(src + i * 4, dst + i, count - i);
+}
+
+TARGET_AVX2 static inline bool avx2_all_match(const uint8_t *pixels,
+                                              __m256i value, __m256i mask) {
+  __m256i p = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)pixels),
+                               mask);
+  return _mm256_movemask_epi8(_mm256_cmpeq_epi32(p, value)) == -1;
+}
+
+TARGET_AVX2 static size_t avx2_first_mismatch(const uint8_t *pixels,
+                                              size_t count, uint32_t value,
+                                              uint32_t mask) {
+  const __m256i v = _mm256_set1_epi32((int)value);
+  const __m256i m = _mm256_set1_epi32((int)mask);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    if (!avx2_all_match(pixels + i * 4, v, m))
+      return i + scalar_first_mismatch(pixels + i * 4, 8, value, mask);
+  }
+  size_t tail = scalar_first_mismatch(pixels + i * 4, count - i, value, mask);
+  return i + tail;
+}
+
+TARGET_AVX2 static size_t avx2_last_mismatch(const uint8_t *pixels,
+                                             size_t count, uint32_t value,
+                                             uint32_t mask) {
+  const __m256i v = _mm256_set1_epi32((int)value);
+  const __m256i m = _mm256_set1_epi32((int)mask);
+  size_t i = count;
+  for (; i >= 8; i -= 8) {
+    if (!avx2_all_match(pixels + (i - 8) * 4, v, m))
+      return i - 8 + scalar_last_mismatch(pixels + (i - 8) * 4, 8, value, mask);
+  }
+  size_t head = scalar_last_mismatch(pixels, i, value, mask);
+  return head == i ? count : head;
+}
+
+static const PixelKernels kAvx2Kernels = {
+    "avx2",
+    avx2_native_to_rgba,
+    avx2_swizzle_rb,
+    avx2_premultiply,
+    avx2_unpremultiply,
+    avx2_strip_alpha,
+    avx2_to_gray8,
+    avx2_first_mismatch,
+    avx2_last_mismatch,
+};
+
+static bool cpu_has_avx2(void) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+  // The OS must save the upper halves of the YMM registers.
+  if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+    return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // PIXEL_KERNELS_X86
+
+// ---------------------------------------------------------------------------
+// NEON
+
+#ifdef PIXEL_KERNELS_NEON
+
+static void neon_unpremultiply_impl(const uint8_t *src, uint8_t *dst,
+                                    size_t count, bool swizzle) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    uint8x16x4_t pixels = vld4q_u8(src + i * 4);
+    uint8x16_t a = pixels.val[3];
+    if (vminvq_u8(a) == 255) {
+      if (swizzle) {
+        uint8x16_t r = pixels.val[2];
+        pixels.val[2] = pixels.val[0];
+        pixels.val[0] = r;
+      }
+      vst4q_u8(dst + i * 4, pixels);
+    } else if (vmaxvq_u8(a) == 0) {
+      vst1q_u8(dst + i * 4, vdupq_n_u8(0));
+      vst1q_u8(dst + i * 4 + 16, vdupq_n_u8(0));
+      vst1q_u8(dst + i * 4 + 32, vdupq_n_u8(0));
+      vst1q_u8(dst + i * 4 + 48, vdupq_n_u8(0));
+    } else {
+      for (size_t j = i; j < i + 16; ++j)
+        unpremultiply_pixel(src + j * 4, dst + j * 4, swizzle ? 2 : 0);
+    }
+  }
+  for (; i < count; ++i)
+    unpremultiply_pixel(src + i * 4, dst + i * 4, swizzle ? 2 : 0);
+}
+
+static void neon_native_to_rgba(const uint8_t *src, uint8_t *dst,
+                                size_t count) {
+  neon_unpremultiply_impl(src, dst, count, true);
+}
+
+static void neon_unpremultiply(const uint8_t *src, uint8_t *dst,
+                               size_t count) {
+  neon_unpremultiply_impl(src, dst, count, false);
+}
+
+static void neon_swizzle_rb(const uint8_t *src, uint8_t *dst, size_t count) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    uint8x16x4_t pixels = vld4q_u8(src + i * 4);
+    uint8x16_t r = pixels.val[2];
+    pixels.val[2] = pixels.val[0];
+    pixels.val[0] = r;
+    vst4q_u8(dst + i * 4, pixels);
+  }
+  scalar_swizzle_rb(src + i * 4, dst + i * 4, count - i);
+}
+
+// Exact round(c * a / 255), matching div255.
+static inline uint8x8_t neon_mul_div255(uint8x8_t c, uint8x8_t a) {
+  uint16x8_t x = vmull_u8(c, a);
+  return vrshrn_n_u16(vrsraq_n_u16(x, x, 8), 8);
+}
+
+static void neon_premultiply(const uint8_t *src, uint8_t *dst, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    uint8x8x4_t pixels = vld4_u8(src + i * 4);
+    pixels.val[0] = neon_mul_div255(pixels.val[0], pixels.val[3]);
+    pixels.val[1] = neon_mul_div255(pixels.val[1], pixels.val[3]);
+    pixels.val[2] = neon_mul_div255(pixels.val[2], pixels.val[3]);
+    vst4_u8(dst + i * 4, pixels);
+  }
+  scalar_premultiply(src + i * 4, dst + i * 4, count - i);
+}
+
+static void neon_strip_alpha(const uint8_t *src, uint8_t *dst, size_t count) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    uint8x16x4_t pixels = vld4q_u8(src + i * 4);
+    uint8x16x3_t rgb = {{pixels.val[0], pixels.val[1], pixels.val[2]}};
+    vst3q_u8(dst + i * 3, rgb);
+  }
+  scalar_strip_alpha(src + i * 4, dst + i * 3, count - i);
+}
+
+static void neon_to_gray8(const uint8_t *src, uint8_t *dst, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    uint8x8x4_t pixels = vld4_u8(src + i * 4);
+    uint16x8_t sum = vmull_u8(pixels.val[0], vdup_n_u8(77));
+    sum = vmlal_u8(sum, pixels.val[1], vdup_n_u8(150));
+    sum = vmlal_u8(sum, pixels.val[2], vdup_n_u8(29));
+    vst1_u8(dst + i, vrshrn_n_u16(sum, 8));
+  }
+  scalar_to_gray8(src + i * 4, dst + i, count - i);
+}
+
+static inline bool neon_all_match(const uint8_t *pixels, uint32x4_t value,
+                                  uint32x4_t mask) {
+  uint32x4_t p = vandq_u32(vld1q_u32((const uint32_t *)(const void *)pixels),
+                           mask);
+  return vminvq_u32(vceqq_u32(p, value)) == UINT32_MAX;
+}
+
+static size_t neon_first_mismatch(const uint8_t *pixels, size_t count,
+                                  uint32_t value, uint32_t mask) {
+  const uint32x4_t v = vdupq_n_u32(value);
+  const uint32x4_t m = vdupq_n_u32(mask);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    if (!neon_all_match(pixels + i * 4, v, m))
+      return i + scalar_first_mismatch(pixels + i * 4, 4, value, mask);
+  }
+  size_t tail = scalar_first_mismatch(pixels + i * 4, count - i, value, mask);
+  return i + tail;
+}
+
+static size_t neon_last_mismatch(const uint8_t *pixels, size_t count,
+                                 uint32_t value, uint32_t mask) {
+  const uint32x4_t v = vdupq_n_u32(value);
+  const uint32x4_t m = vdupq_n_u32(mask);
+  size_t i = count;
+  for (; i >= 4; i -= 4) {
+    if (!neon_all_match(pixels + (i - 4) * 4, v, m))
+      return i - 4 + scalar_last_mismatch(pixels + (i - 4) * 4, 4, value, mask);
+  }
+  size_t head = scalar_last_mismatch(pixels, i, value, mask);
+  return head == i ? count : head;
+}
+
+static const PixelKernels kNeonKernels = {
+    "neon",
+    neon_native_to_rgba,
+    neon_swizzle_rb,
+    neon_premultiply,
+    neon_unpremultiply,
+    neon_strip_alpha,
+    neon_to_gray8,
+    neon_first_mismatch,
+    neon_last_mismatch,
+};
+
+#endif // PIXEL_KERNELS_NEON
+
+// ---------------------------------------------------------------------------
+// Dispatch
+
+static const PixelKernels *select_kernels(void) {
+  const char *forced = getenv("HEADLESS_PIXEL_KERNELS");
+  if (forced && strcmp(forced, "scalar") == 0)
+    return &kScalarKernels;
+#if defined(PIXEL_KERNELS_X86)
+  // SSE2 is part of the x86-64 baseline.
+  if (forced && strcmp(forced, "sse2") == 0)
+    return &kSse2Kernels;
+  return cpu_has_avx2() ? &kAvx2Kernels : &kSse2Kernels;
+#elif defined(PIXEL_KERNELS_NEON)
+  // NEON is mandatory on arm64.
+  return &kNeonKernels;
+#else
+  return &kScalarKernels;
+#endif
+}
+
+const PixelKernels *pixel_kernels(void) {
+  // Selection is idempotent, so a racing first call just repeats it.
+  static const PixelKernels *volatile selected = NULL;
+  const PixelKernels *kernels = selected;
+  if (!kernels) {
+    kernels = select_kernels();
+    selected = kernels;
+  }
+  return kernels;
+}
+
+const PixelKernels *pixel_kernels_scalar(void) { return &kScalarKernels; }
@@ -0,0 +1,49 @@
+// Pixel-format conversion kernels for 32-bit pixels.
+//
+// The software surface delivers kN32 pixels, which are premultiplied BGRA on
+// the little-endian desktop targets, while encoders want straight-alpha RGBA
+// (or RGB/gray). Every kernel has a scalar version plus SSE2 and AVX2 (x86)
+// or NEON (arm64) versions; `pixel_kernels()` picks the best set the CPU
+// supports the first time it is called. Setting HEADLESS_PIXEL_KERNELS to
+// `scalar`, `sse2` or `avx2` overrides the choice when that set is usable.
+//
+// All vector paths produce exactly the scalar results. Unpremultiplying is
+// vectorized for runs of fully opaque or fully transparent pixels, which is
+// what UI content mostly consists of, and falls back to per-pixel division
+// for translucent ones.
+
+#ifndef PIXEL_KERNELS_H
+#define PIXEL_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  const char *name;
+  // Premultiplied BGRA to straight-alpha RGBA, the capture hot path.
+  void (*native_to_rgba)(const uint8_t *src, uint8_t *dst, size_t count);
+  // Swaps the R and B channels (BGRA <-> RGBA).
+  void (*swizzle_rb)(const uint8_t *src, uint8_t *dst, size_t count);
+  void (*premultiply)(const uint8_t *src, uint8_t *dst, size_t count);
+  void (*unpremultiply)(const uint8_t *src, uint8_t *dst, size_t count);
+  // RGBA to RGB; `dst` holds `count * 3` bytes.
+  void (*strip_alpha)(const uint8_t *src, uint8_t *dst, size_t count);
+  // RGBA to BT.601 luma; `dst` holds `count` bytes. Alpha is ignored.
+  void (*to_gray8)(const uint8_t *src, uint8_t *dst, size_t count);
+  // Index of the first (last) pixel whose bits under `mask` differ from
+  // `value`, or `count` when every pixel matches. Pixels are compared as
+  // 32-bit words in memory order; `value` must already be masked.
+  size_t (*first_mismatch)(const uint8_t *pixels, size_t count, uint32_t value,
+                           uint32_t mask);
+  size_t (*last_mismatch)(const uint8_t *pixels, size_t count, uint32_t value,
+                          uint32_t mask);
+} PixelKernels;
+
+// `count` is in pixels. `src` and `dst` may be the same buffer for the
+// 4-byte to 4-byte kernels; otherwise they must not overlap.
+const PixelKernels *pixel_kernels(void);
+
+// The portable reference implementation, regardless of the CPU.
+const PixelKernels *pixel_kernels_scalar(void);
+
+#endif // PIXEL_KERNELS_H
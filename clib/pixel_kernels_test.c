@@ -0,0 +1,196 @@
+// Checks the vector pixel kernels against the scalar reference (see
+// pixel_kernels.h), run without the engine.
+//
+// Every kernel of `pixel_kernels()` runs over pseudo-random buffers of
+// random length, so the vector loops and their scalar tails both run, and
+// starting at random pixel offsets. The 4-byte to 4-byte kernels also run in
+// place. The alpha channel is drawn from mixes that steer the
+// unpremultiply fast paths: all opaque, all transparent, runs of both with
+// translucent pixels in between, and uniformly random, both as valid
+// premultiplied pixels and with colour above alpha. The mismatch searches get
+// buffers that match under a random mask except for up to two pixels.
+//
+// ctest runs it once per HEADLESS_PIXEL_KERNELS value; the kernels that
+// value selects on this CPU are named in the output.
+//
+// Usage:
+//   pixel_kernels_test [--buffers N] [--seed N]
+//
+// Exits with 1 on the first difference.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pixel_kernels.h"
+
+#define DEFAULT_BUFFERS 20000
+#define MAX_PIXELS 300
+#define MAX_OFFSET 7
+
+enum {
+  kAlphaOpaque,
+  kAlphaTransparent,
+  kAlphaRuns,
+  kAlphaRandom,
+  kAlphaModeCount,
+};
+
+static const char *const kAlphaModeNames[] = {"opaque", "transparent", "runs",
+                                              "random"};
+
+static uint64_t g_state = 0x9e3779b97f4a7c15ull;
+
+// xorshift64*, so every platform sees the same buffers for a seed.
+static uint32_t next_random(void) {
+  g_state ^= g_state >> 12;
+  g_state ^= g_state << 25;
+  g_state ^= g_state >> 27;
+  return (uint32_t)((g_state * 0x2545f4914f6cdd1dull) >> 32);
+}
+
+static uint8_t random_alpha(int mode, size_t index) {
+  switch (mode) {
+  case kAlphaOpaque:
+    return 255;
+  case kAlphaTransparent:
+    return 0;
+  case kAlphaRuns:
+    // Runs of 0 to 15 pixels, with the odd translucent pixel.
+    if (next_random() % 16 == 0)
+      return (uint8_t)(1 + next_random() % 254);
+    return (index / (4 + next_random() % 12)) % 2 ? 255 : 0;
+  default:
+    return (uint8_t)next_random();
+  }
+}
+
+static void fill_pixels(uint8_t *pixels, size_t count, int mode,
+                        bool premultiplied) {
+  for (size_t i = 0; i < count; ++i) {
+    uint8_t alpha = random_alpha(mode, i);
+    for (int c = 0; c < 3; ++c) {
+      uint32_t value = next_random() & 0xff;
+      pixels[i * 4 + c] =
+          (uint8_t)(premultiplied ? value * alpha / 255 : value);
+    }
+    pixels[i * 4 + 3] = alpha;
+  }
+}
+
+typedef void (*ConvertFunction)(const uint8_t *src, uint8_t *dst,
+                                size_t count);
+
+static void fail(const char *kernel, const char *reason, size_t count,
+                 int mode, size_t at) {
+  fprintf(stderr,
+          "%s %s: %s for %zu pixels, %s alpha, first difference at byte "
+          "%zu\n",
+          pixel_kernels()->name, kernel, reason, count,
+          kAlphaModeNames[mode], at);
+  exit(1);
+}
+
+static size_t first_difference(const uint8_t *a, const uint8_t *b,
+                               size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    if (a[i] != b[i])
+      return i;
+  }
+  return size;
+}
+
+static void check_convert(const char *name, ConvertFunction vector,
+                          ConvertFunction scalar, const uint8_t *src,
+                          size_t count, size_t dst_bytes, bool in_place,
+                          int mode) {
+  // One pixel of slack on each side catches writes past either end.
+  size_t size = count * dst_bytes;
+  uint8_t *expected = (uint8_t *)malloc(size + 8);
+  uint8_t *actual = (uint8_t *)malloc(size + 8);
+  memset(expected, 0xa5, size + 8);
+  memset(actual, 0xa5, size + 8);
+  scalar(src, expected + 4, count);
+  vector(src, actual + 4, count);
+  size_t at = first_difference(expected, actual, size + 8);
+  if (at != size + 8)
+    fail(name, "differs from scalar", count, mode, at);
+
+  if (in_place) {
+    memcpy(actual + 4, src, size);
+    vector(actual + 4, actual + 4, count);
+    at = first_difference(expected, actual, size + 8);
+    if (at != size + 8)
+      fail(name, "differs in place", count, mode, at);
+  }
+  free(expected);
+  free(actual);
+}
+
+static void check_mismatch(const PixelKernels *kernels,
+                           const PixelKernels *scalar, uint8_t *pixels,
+                           size_t count, int mode) {
+  static const uint32_t kMasks[] = {0xffffffffu, 0xff000000u, 0x00ffffffu,
+                                    0x0000ff00u};
+  uint32_t mask = kMasks[next_random() % 4];
+  uint32_t value = next_random() & mask;
+  // Bits outside the mask are random, so only masked bits may matter.
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t pixel = (next_random() & ~mask) | value;
+    memcpy(pixels + i * 4, &pixel, 4);
+  }
+  int mismatches = (int)(next_random() % 3);
+  for (int m = 0; m < mismatches && count > 0; ++m) {
+    size_t index = next_random() % count;
+    uint32_t pixel;
+    memcpy(&pixel, pixels + index * 4, 4);
+    pixel ^= mask & (1u << (next_random() % 32));
+    memcpy(pixels + index * 4, &pixel, 4);
+  }
+  if (kernels->first_mismatch(pixels, count, value, mask) !=
+      scalar->first_mismatch(pixels, count, value, mask))
+    fail("first_mismatch", "differs from scalar", count, mode, 0);
+  if (kernels->last_mismatch(pixels, count, value, mask) !=
+      scalar->last_mismatch(pixels, count, value, mask))
+    fail("last_mismatch", "differs from scalar", count, mode, 0);
+}
+
+int main(int argc, char **argv) {
+  unsigned long buffers = DEFAULT_BUFFERS;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--buffers") == 0)
+      buffers = strtoul(argv[i + 1], NULL, 10);
+    else if (strcmp(argv[i], "--seed") == 0)
+      g_state = strtoull(argv[i + 1], NULL, 10) | 1;
+  }
+
+  const PixelKernels *kernels = pixel_kernels();
+  const PixelKernels *scalar = pixel_kernels_scalar();
+  uint8_t *storage = (uint8_t *)malloc((MAX_PIXELS + MAX_OFFSET) * 4);
+  for (unsigned long n = 0; n < buffers; ++n) {
+    size_t count = next_random() % (MAX_PIXELS + 1);
+    uint8_t *src = storage + (next_random() % (MAX_OFFSET + 1)) * 4;
+    int mode = (int)(n % kAlphaModeCount);
+    fill_pixels(src, count, mode, next_random() % 4 != 0);
+
+    check_convert("native_to_rgba", kernels->native_to_rgba,
+                  scalar->native_to_rgba, src, count, 4, true, mode);
+    check_convert("swizzle_rb", kernels->swizzle_rb, scalar->swizzle_rb, src,
+                  count, 4, true, mode);
+    check_convert("premultiply", kernels->premultiply, scalar->premultiply,
+                  src, count, 4, true, mode);
+    check_convert("unpremultiply", kernels->unpremultiply,
+                  scalar->unpremultiply, src, count, 4, true, mode);
+    check_convert("strip_alpha", kernels->strip_alpha, scalar->strip_alpha,
+                  src, count, 3, false, mode);
+    check_convert("to_gray8", kernels->to_gray8, scalar->to_gray8, src, count,
+                  1, false, mode);
+    check_mismatch(kernels, scalar, src, count, mode);
+  }
+  free(storage);
+  printf("pixel_kernels_test: %s matches scalar over %lu buffers\n",
+         kernels->name, buffers);
+  return 0;
+}
@@ -0,0 +1,307 @@
+// Thin portability layer over Win32 and pthread threads and synchronization
+// primitives, shared by the embedder subsystems that run off the platform
+// thread.
+
+#ifndef PLATFORM_THREAD_H
+#define PLATFORM_THREAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+#endif
+
+#ifdef _WIN32
+typedef SRWLOCK PlatformMutex;
+#define PLATFORM_MUTEX_INIT SRWLOCK_INIT
+
+static inline void platform_mutex_init(PlatformMutex *mutex) {
+  InitializeSRWLock(mutex);
+}
+static inline void platform_mutex_destroy(PlatformMutex *mutex) {
+  (void)mutex;
+}
+static inline void platform_mutex_lock(PlatformMutex *mutex) {
+  AcquireSRWLockExclusive(mutex);
+}
+static inline void platform_mutex_unlock(PlatformMutex *mutex) {
+  ReleaseSRWLockExclusive(mutex);
+}
+
+typedef CONDITION_VARIABLE PlatformCond;
+#define PLATFORM_COND_INIT CONDITION_VARIABLE_INIT
+
+static inline void platform_cond_init(PlatformCond *cond) {
+  InitializeConditionVariable(cond);
+}
+static inline void platform_cond_destroy(PlatformCond *cond) { (void)cond; }
+static inline void platform_cond_wait(PlatformCond *cond, PlatformMutex *mutex) {
+  SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+}
+// Waits at most `timeout_ns`, rounded up to whole milliseconds.
+static inline void platform_cond_timed_wait(PlatformCond *cond,
+                                            PlatformMutex *mutex,
+                                            uint64_t timeout_ns) {
+  DWORD milliseconds = (DWORD)((timeout_ns + 999999) / 1000000);
+  SleepConditionVariableSRW(cond, mutex, milliseconds, 0);
+}
+static inline void platform_cond_signal(PlatformCond *cond) {
+  WakeConditionVariable(cond);
+}
+static inline void platform_cond_broadcast(PlatformCond *cond) {
+  WakeAllConditionVariable(cond);
+}
+
+typedef HANDLE PlatformThread;
+typedef void (*PlatformThreadMain)(void *argument);
+
+typedef struct {
+  PlatformThreadMain main;
+  void *argument;
+} PlatformThreadStart;
+
+static inline DWORD WINAPI platform_thread_trampoline(LPVOID parameter) {
+  PlatformThreadStart start = *(PlatformThreadStart *)parameter;
+  HeapFree(GetProcessHeap(), 0, parameter);
+  start.main(start.argument);
+  return 0;
+}
+
+static inline bool platform_thread_start(PlatformThread *thread,
+                                         PlatformThreadMain main,
+                                         void *argument) {
+  PlatformThreadStart *start = (PlatformThreadStart *)HeapAlloc(
+      GetProcessHeap(), 0, sizeof(PlatformThreadStart));
+  if (!start)
+    return false;
+  start->main = main;
+  start->argument = argument;
+  *thread = CreateThread(NULL, 0, platform_thread_trampoline, start, 0, NULL);
+  if (!*thread) {
+    HeapFree(GetProcessHeap(), 0, start);
+    return false;
+  }
+  return true;
+}
+static inline void platform_thread_join(PlatformThread thread) {
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+static inline unsigned platform_cpu_count(void) {
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+static inline uint64_t platform_thread_times_nanos(HANDLE thread) {
+  FILETIME created, exited, kernel, user;
+  if (!GetThreadTimes(thread, &created, &exited, &kernel, &user))
+    return 0;
+  uint64_t ticks =
+      (((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+      (((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime);
+  return ticks * 100;
+}
+
+// CPU time of one thread, readable from any other thread.
+typedef HANDLE PlatformCpuClock;
+
+static inline bool platform_cpu_clock_current(PlatformCpuClock *clock) {
+  *clock = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE,
+                      GetCurrentThreadId());
+  return *clock != NULL;
+}
+static inline uint64_t platform_cpu_clock_read(PlatformCpuClock clock) {
+  return platform_thread_times_nanos(clock);
+}
+// CPU time the calling thread used so far.
+static inline uint64_t platform_thread_cpu_nanos(void) {
+  return platform_thread_times_nanos(GetCurrentThread());
+}
+#else
+typedef pthread_mutex_t PlatformMutex;
+#define PLATFORM_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+
+static inline void platform_mutex_init(PlatformMutex *mutex) {
+  pthread_mutex_init(mutex, NULL);
+}
+static inline void platform_mutex_destroy(PlatformMutex *mutex) {
+  pthread_mutex_destroy(mutex);
+}
+static inline void platform_mutex_lock(PlatformMutex *mutex) {
+  pthread_mutex_lock(mutex);
+}
+static inline void platform_mutex_unlock(PlatformMutex *mutex) {
+  pthread_mutex_unlock(mutex);
+}
+
+typedef pthread_cond_t PlatformCond;
+#define PLATFORM_COND_INIT PTHREAD_COND_INITIALIZER
+
+static inline void platform_cond_init(PlatformCond *cond) {
+  pthread_cond_init(cond, NULL);
+}
+static inline void platform_cond_destroy(PlatformCond *cond) {
+  pthread_cond_destroy(cond);
+}
+static inline void platform_cond_wait(PlatformCond *cond, PlatformMutex *mutex) {
+  pthread_cond_wait(cond, mutex);
+}
+// Waits at most `timeout_ns`. The deadline is taken on the realtime clock
+// the condition uses by default, which is fine for short waits.
+static inline void platform_cond_timed_wait(PlatformCond *cond,
+                                            PlatformMutex *mutex,
+                                            uint64_t timeout_ns) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  uint64_t nanos = (uint64_t)deadline.tv_nsec + timeout_ns % 1000000000u;
+  deadline.tv_sec += (time_t)(timeout_ns / 1000000000u + nanos / 1000000000u);
+  deadline.tv_nsec = (long)(nanos % 1000000000u);
+  pthread_cond_timedwait(cond, mutex, &deadline);
+}
+static inline void platform_cond_signal(PlatformCond *cond) {
+  pthread_cond_signal(cond);
+}
+static inline void platform_cond_broadcast(PlatformCond *cond) {
+  pthread_cond_broadcast(cond);
+}
+
+typedef pthread_t PlatformThread;
+typedef void (*PlatformThreadMain)(void *argument);
+
+typedef struct {
+  PlatformThreadMain main;
+  void *argument;
+} PlatformThreadStart;
+
+static inline void *platform_thread_trampoline(void *parameter) {
+  PlatformThreadStart start = *(PlatformThreadStart *)parameter;
+  free(parameter);
+  start.main(start.argument);
+  return NULL;
+}
+
+static inline bool platform_thread_start(PlatformThread *thread,
+                                         PlatformThreadMain main,
+                                         void *argument) {
+  PlatformThreadStart *start =
+      (PlatformThreadStart *)malloc(sizeof(PlatformThreadStart));
+  if (!start)
+    return false;
+  start->main = main;
+  start->argument = argument;
+  if (pthread_create(thread, NULL, platform_thread_trampoline, start) != 0) {
+    free(start);
+    return false;
+  }
+  return true;
+}
+static inline void platform_thread_join(PlatformThread thread) {
+  pthread_join(thread, NULL);
+}
+
+static inline unsigned platform_cpu_count(void) {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (unsigned)count : 1;
+}
+
+// CPU time of one thread, readable from any other thread.
+#ifdef __APPLE__
+typedef mach_port_t PlatformCpuClock;
+
+static inline bool platform_cpu_clock_current(PlatformCpuClock *clock) {
+  *clock = pthread_mach_thread_np(pthread_self());
+  return *clock != MACH_PORT_NULL;
+}
+static inline uint64_t platform_cpu_clock_read(PlatformCpuClock clock) {
+  thread_basic_info_data_t info;
+  mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+  if (thread_info(clock, THREAD_BASIC_INFO, (thread_info_t)&info, &count) !=
+      KERN_SUCCESS)
+    return 0;
+  return ((uint64_t)info.user_time.seconds + info.system_time.seconds) *
+             1000000000u +
+         ((uint64_t)info.user_time.microseconds +
+          info.system_time.microseconds) *
+             1000u;
+}
+#else
+typedef clockid_t PlatformCpuClock;
+
+static inline bool platform_cpu_clock_current(PlatformCpuClock *clock) {
+  return pthread_getcpuclockid(pthread_self(), clock) == 0;
+}
+static inline uint64_t platform_cpu_clock_read(PlatformCpuClock clock) {
+  struct timespec time;
+  if (clock_gettime(clock, &time) != 0)
+    return 0;
+  return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+#endif
+// CPU time the calling thread used so far.
+static inline uint64_t platform_thread_cpu_nanos(void) {
+  struct timespec time;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0)
+    return 0;
+  return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+#endif
+
+// Sequentially consistent 64-bit atomics, for the few structures that must
+// not take a lock.
+static inline uint64_t platform_atomic_load(volatile uint64_t *value) {
+#ifdef _WIN32
+  return (uint64_t)InterlockedOr64((volatile LONG64 *)value, 0);
+#else
+  return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+static inline void platform_atomic_store(volatile uint64_t *value,
+                                         uint64_t desired) {
+#ifdef _WIN32
+  InterlockedExchange64((volatile LONG64 *)value, (LONG64)desired);
+#else
+  __atomic_store_n(value, desired, __ATOMIC_SEQ_CST);
+#endif
+}
+// Returns the previous value.
+static inline uint64_t platform_atomic_add(volatile uint64_t *value,
+                                           uint64_t delta) {
+#ifdef _WIN32
+  return (uint64_t)InterlockedExchangeAdd64((volatile LONG64 *)value,
+                                            (LONG64)delta);
+#else
+  return __atomic_fetch_add(value, delta, __ATOMIC_SEQ_CST);
+#endif
+}
+// On failure `*expected` is updated to the current value.
+static inline bool platform_atomic_compare_exchange(volatile uint64_t *value,
+                                                    uint64_t *expected,
+                                                    uint64_t desired) {
+#ifdef _WIN32
+  uint64_t previous = (uint64_t)InterlockedCompareExchange64(
+      (volatile LONG64 *)value, (LONG64)desired, (LONG64)*expected);
+  if (previous == *expected)
+    return true;
+  *expected = previous;
+  return false;
+#else
+  return __atomic_compare_exchange_n(value, expected, desired, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+#endif // PLATFORM_THREAD_H
@@ -0,0 +1,709 @@
+#include "png_writer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HEADLESS_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+static const uint8_t kPngSignature[8] = {0x89, 'P',  'N',  'G',
+                                         '\r', '\n', 0x1a, '\n'};
+
+uint32_t png_crc32(uint32_t crc, const uint8_t *data, size_t size) {
+#ifdef HEADLESS_HAVE_ZLIB
+  // zlib treats a NULL buffer as a request for the initial value.
+  return size == 0 ? crc : (uint32_t)crc32(crc, data, (uInt)size);
+#else
+  static const uint32_t kNibbleTable[16] = {
+      0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+      0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+      0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i) {
+    crc ^= data[i];
+    crc = kNibbleTable[crc & 0x0f] ^ (crc >> 4);
+    crc = kNibbleTable[crc & 0x0f] ^ (crc >> 4);
+  }
+  return ~crc;
+#endif
+}
+
+static void put_u32_be(uint8_t *out, uint32_t value) {
+  out[0] = (uint8_t)(value >> 24);
+  out[1] = (uint8_t)(value >> 16);
+  out[2] = (uint8_t)(value >> 8);
+  out[3] = (uint8_t)value;
+}
+
+static void put_u16_be(uint8_t *out, uint16_t value) {
+  out[0] = (uint8_t)(value >> 8);
+  out[1] = (uint8_t)value;
+}
+
+typedef bool (*ChunkWrite)(void *context, const void *data, size_t size);
+
+static bool file_write(void *context, const void *data, size_t size) {
+  return size == 0 || fwrite(data, 1, size, (FILE *)context) == size;
+}
+
+// Writes one chunk. `prefix` (e.g. the fdAT sequence number) is checksummed
+// and counted as part of the chunk data.
+static bool emit_chunk(ChunkWrite write, void *context, const char type[4],
+                       const uint8_t *prefix, size_t prefix_size,
+                       const uint8_t *data, size_t size) {
+  uint8_t header[8];
+  put_u32_be(header, (uint32_t)(prefix_size + size));
+  memcpy(header + 4, type, 4);
+  uint32_t crc = png_crc32(0, header + 4, 4);
+  crc = png_crc32(crc, prefix, prefix_size);
+  crc = png_crc32(crc, data, size);
+  uint8_t trailer[4];
+  put_u32_be(trailer, crc);
+  return write(context, header, 8) && write(context, prefix, prefix_size) &&
+         write(context, data, size) && write(context, trailer, 4);
+}
+
+static bool write_chunk(PngWriter *writer, const char type[4],
+                        const uint8_t *prefix, size_t prefix_size,
+                        const uint8_t *data, size_t size) {
+  bool ok = emit_chunk(file_write, writer->file, type, prefix, prefix_size,
+                       data, size);
+  if (!ok)
+    writer->ok = false;
+  return ok;
+}
+
+static void fill_ihdr(uint8_t ihdr[13], uint32_t width, uint32_t height) {
+  put_u32_be(ihdr, width);
+  put_u32_be(ihdr + 4, height);
+  ihdr[8] = 8; // bit depth
+  ihdr[9] = 6; // RGBA
+  ihdr[10] = 0;
+  ihdr[11] = 0;
+  ihdr[12] = 0;
+}
+
+static uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+  int p = (int)a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+  if (pa <= pb && pa <= pc)
+    return a;
+  return pb <= pc ? b : c;
+}
+
+// Filters one row with every PNG filter type and keeps the one with the
+// smallest sum of absolute residuals (the libpng heuristic).
+static void filter_row(const uint8_t *row, const uint8_t *prior, size_t size,
+                       uint8_t *out, uint8_t *scratch) {
+  static const size_t bpp = 4;
+  uint32_t best_sum = UINT32_MAX;
+  for (uint8_t type = 0; type < 5; ++type) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < size; ++i) {
+      uint8_t left = i >= bpp ? row[i - bpp] : 0;
+      uint8_t up = prior ? prior[i] : 0;
+      uint8_t up_left = (prior && i >= bpp) ? prior[i - bpp] : 0;
+      uint8_t value;
+      switch (type) {
+      case 0:
+        value = row[i];
+        break;
+      case 1:
+        value = (uint8_t)(row[i] - left);
+        break;
+      case 2:
+        value = (uint8_t)(row[i] - up);
+        break;
+      case 3:
+        value = (uint8_t)(row[i] - ((left + up) >> 1));
+        break;
+      default:
+        value = (uint8_t)(row[i] - paeth(left, up, up_left));
+        break;
+      }
+      scratch[i] = value;
+      sum += value < 128 ? value : 256 - value;
+    }
+    if (sum < best_sum) {
+      best_sum = sum;
+      out[0] = type;
+      memcpy(out + 1, scratch, size);
+    }
+  }
+}
+
+static bool deflate_buffer(const uint8_t *in, size_t size, uint8_t **out,
+                           size_t *out_size) {
+#ifdef HEADLESS_HAVE_ZLIB
+  uLongf bound = compressBound((uLong)size);
+  uint8_t *buffer = (uint8_t *)malloc(bound);
+  if (!buffer)
+    return false;
+  if (compress2(buffer, &bound, in, (uLong)size, 6) != Z_OK) {
+    free(buffer);
+    return false;
+  }
+  *out = buffer;
+  *out_size = bound;
+  return true;
+#else
+  // zlib header, stored blocks of at most 65535 bytes, adler32 trailer.
+  size_t blocks = size / 65535 + 1;
+  uint8_t *buffer = (uint8_t *)malloc(2 + size + blocks * 5 + 4);
+  if (!buffer)
+    return false;
+  uint8_t *cursor = buffer;
+  *cursor++ = 0x78;
+  *cursor++ = 0x01;
+  size_t remaining = size;
+  const uint8_t *source = in;
+  do {
+    uint16_t length = remaining > 65535 ? 65535 : (uint16_t)remaining;
+    remaining -= length;
+    *cursor++ = remaining == 0 ? 1 : 0;
+    *cursor++ = (uint8_t)length;
+    *cursor++ = (uint8_t)(length >> 8);
+    *cursor++ = (uint8_t)~length;
+    *cursor++ = (uint8_t)(~length >> 8);
+    memcpy(cursor, source, length);
+    cursor += length;
+    source += length;
+  } while (remaining > 0);
+  uint32_t a = 1, b = 0;
+  for (size_t i = 0; i < size; ++i) {
+    a = (a + in[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  put_u32_be(cursor, (b << 16) | a);
+  cursor += 4;
+  *out = buffer;
+  *out_size = (size_t)(cursor - buffer);
+  return true;
+#endif
+}
+
+bool png_writer_open(PngWriter *writer, FILE *file, uint32_t width,
+                     uint32_t height, uint32_t frame_count, uint16_t delay_num,
+                     uint16_t delay_den) {
+  memset(writer, 0, sizeof(*writer));
+  writer->file = file;
+  writer->width = width;
+  writer->height = height;
+  writer->frame_count = frame_count;
+  writer->delay_num = delay_num;
+  writer->delay_den = delay_den;
+  writer->ok = true;
+  writer->filtered = (uint8_t *)malloc(((size_t)width * 4 + 1) * height +
+                                       (size_t)width * 4);
+  if (!writer->filtered) {
+    writer->ok = false;
+    return false;
+  }
+
+  if (fwrite(kPngSignature, 1, sizeof(kPngSignature), file) !=
+      sizeof(kPngSignature)) {
+    writer->ok = false;
+    return false;
+  }
+
+  uint8_t ihdr[13];
+  fill_ihdr(ihdr, width, height);
+  write_chunk(writer, "IHDR", NULL, 0, ihdr, sizeof(ihdr));
+
+  if (frame_count > 0) {
+    uint8_t actl[8];
+    put_u32_be(actl, frame_count);
+    put_u32_be(actl + 4, 0); // loop forever
+    write_chunk(writer, "acTL", NULL, 0, actl, sizeof(actl));
+  }
+  return writer->ok;
+}
+
+bool png_writer_add_frame(PngWriter *writer, const uint8_t *rgba,
+                          size_t stride) {
+  if (!writer->ok)
+    return false;
+  uint32_t allowed = writer->frame_count > 0 ? writer->frame_count : 1;
+  if (writer->frames_written >= allowed)
+    return false;
+
+  size_t row_size = (size_t)writer->width * 4;
+  uint8_t *scratch = writer->filtered + (row_size + 1) * writer->height;
+  for (uint32_t y = 0; y < writer->height; ++y) {
+    const uint8_t *row = rgba + (size_t)y * stride;
+    const uint8_t *prior = y > 0 ? row - stride : NULL;
+    filter_row(row, prior, row_size, writer->filtered + y * (row_size + 1),
+               scratch);
+  }
+
+  uint8_t *compressed = NULL;
+  size_t compressed_size = 0;
+  if (!deflate_buffer(writer->filtered, (row_size + 1) * writer->height,
+                      &compressed, &compressed_size)) {
+    writer->ok = false;
+    return false;
+  }
+
+  if (writer->frame_count > 0) {
+    uint8_t fctl[26];
+    put_u32_be(fctl, writer->sequence++);
+    put_u32_be(fctl + 4, writer->width);
+    put_u32_be(fctl + 8, writer->height);
+    put_u32_be(fctl + 12, 0);
+    put_u32_be(fctl + 16, 0);
+    put_u16_be(fctl + 20, writer->delay_num);
+    put_u16_be(fctl + 22, writer->delay_den);
+    fctl[24] = 0; // dispose: none
+    fctl[25] = 0; // blend: source
+    write_chunk(writer, "fcTL", NULL, 0, fctl, sizeof(fctl));
+  }
+
+  if (writer->frames_written == 0) {
+    write_chunk(writer, "IDAT", NULL, 0, compressed, compressed_size);
+  } else {
+    uint8_t sequence[4];
+    put_u32_be(sequence, writer->sequence++);
+    write_chunk(writer, "fdAT", sequence, sizeof(sequence), compressed,
+                compressed_size);
+  }
+  free(compressed);
+  writer->frames_written++;
+  return writer->ok;
+}
+
+bool png_writer_finish(PngWriter *writer) {
+  if (writer->ok)
+    write_chunk(writer, "IEND", NULL, 0, NULL, 0);
+  free(writer->filtered);
+  writer->filtered = NULL;
+  return writer->ok;
+}
+
+#define PNG_STREAM_IDAT_SIZE (64 * 1024)
+
+struct PngStreamDeflate {
+#ifdef HEADLESS_HAVE_ZLIB
+  z_stream zlib;
+#else
+  uint32_t adler_a;
+  uint32_t adler_b;
+#endif
+};
+
+static bool sink_write(void *context, const void *data, size_t size) {
+  return size == 0 || byte_sink_write((ByteSink *)context, data, size);
+}
+
+static bool stream_flush_idat(PngStream *stream) {
+  if (stream->pending_size == 0 || !stream->ok)
+    return stream->ok;
+  stream->ok = emit_chunk(sink_write, stream->sink, "IDAT", NULL, 0,
+                          stream->pending, stream->pending_size);
+  stream->pending_size = 0;
+  return stream->ok;
+}
+
+#ifdef HEADLESS_HAVE_ZLIB
+// Runs deflate until it has consumed its input and produced everything the
+// flush mode asks for, cutting IDAT chunks whenever the buffer fills up.
+static bool stream_deflate(PngStream *stream, const uint8_t *data, size_t size,
+                           int flush) {
+  z_stream *zlib = &stream->deflate->zlib;
+  zlib->next_in = (Bytef *)data;
+  zlib->avail_in = (uInt)size;
+  for (;;) {
+    zlib->next_out = stream->pending + stream->pending_size;
+    zlib->avail_out = (uInt)(PNG_STREAM_IDAT_SIZE - stream->pending_size);
+    int status = deflate(zlib, flush);
+    if (status == Z_STREAM_ERROR)
+      return stream->ok = false;
+    stream->pending_size = PNG_STREAM_IDAT_SIZE - zlib->avail_out;
+    bool done = flush == Z_FINISH ? status == Z_STREAM_END
+                                  : zlib->avail_out != 0;
+    if (stream->pending_size == PNG_STREAM_IDAT_SIZE &&
+        !stream_flush_idat(stream))
+      return false;
+    if (done)
+      return true;
+  }
+}
+#else
+static bool stream_emit(PngStream *stream, const uint8_t *data, size_t size) {
+  while (size > 0) {
+    size_t room = PNG_STREAM_IDAT_SIZE - stream->pending_size;
+    size_t length = size < room ? size : room;
+    memcpy(stream->pending + stream->pending_size, data, length);
+    stream->pending_size += length;
+    data += length;
+    size -= length;
+    if (stream->pending_size == PNG_STREAM_IDAT_SIZE &&
+        !stream_flush_idat(stream))
+      return false;
+  }
+  return true;
+}
+
+// Non-final stored blocks; the final (empty) block is written on finish.
+static bool stream_store(PngStream *stream, const uint8_t *data, size_t size) {
+  PngStreamDeflate *state = stream->deflate;
+  for (size_t i = 0; i < size; ++i) {
+    state->adler_a = (state->adler_a + data[i]) % 65521;
+    state->adler_b = (state->adler_b + state->adler_a) % 65521;
+  }
+  while (size > 0) {
+    uint16_t length = size > 65535 ? 65535 : (uint16_t)size;
+    uint8_t header[5] = {0, (uint8_t)length, (uint8_t)(length >> 8),
+                         (uint8_t)~length, (uint8_t)(~length >> 8)};
+    if (!stream_emit(stream, header, sizeof(header)) ||
+        !stream_emit(stream, data, length))
+      return false;
+    data += length;
+    size -= length;
+  }
+  return true;
+}
+#endif
+
+static void stream_release(PngStream *stream) {
+#ifdef HEADLESS_HAVE_ZLIB
+  if (stream->deflate)
+    deflateEnd(&stream->deflate->zlib);
+#endif
+  free(stream->deflate);
+  free(stream->previous_row);
+  free(stream->filtered);
+  free(stream->pending);
+  stream->deflate = NULL;
+  stream->previous_row = NULL;
+  stream->filtered = NULL;
+  stream->pending = NULL;
+}
+
+bool png_stream_begin(PngStream *stream, ByteSink *sink, uint32_t width,
+                      uint32_t height) {
+  memset(stream, 0, sizeof(*stream));
+  stream->sink = sink;
+  stream->width = width;
+  stream->height = height;
+  stream->previous_row = (uint8_t *)malloc((size_t)width * 4);
+  stream->pending = (uint8_t *)malloc(PNG_STREAM_IDAT_SIZE);
+  stream->deflate = (PngStreamDeflate *)calloc(1, sizeof(PngStreamDeflate));
+  if (width == 0 || height == 0 || !stream->previous_row || !stream->pending ||
+      !stream->deflate) {
+    stream_release(stream);
+    return false;
+  }
+#ifdef HEADLESS_HAVE_ZLIB
+  if (deflateInit(&stream->deflate->zlib, 6) != Z_OK) {
+    free(stream->deflate);
+    stream->deflate = NULL;
+    stream_release(stream);
+    return false;
+  }
+#else
+  stream->deflate->adler_a = 1;
+  stream->pending[0] = 0x78;
+  stream->pending[1] = 0x01;
+  stream->pending_size = 2;
+#endif
+  stream->ok = true;
+
+  uint8_t ihdr[13];
+  fill_ihdr(ihdr, width, height);
+  stream->ok = sink_write(sink, kPngSignature, sizeof(kPngSignature)) &&
+               emit_chunk(sink_write, sink, "IHDR", NULL, 0, ihdr,
+                          sizeof(ihdr));
+  if (!stream->ok)
+    stream_release(stream);
+  return stream->ok;
+}
+
+bool png_stream_append(PngStream *stream, const uint8_t *rgba, size_t stride,
+                       uint32_t rows) {
+  if (!stream->ok)
+    return false;
+  if (rows > stream->height - stream->rows_written) {
+    stream->ok = false;
+    return false;
+  }
+  if (rows == 0)
+    return true;
+
+  size_t row_size = (size_t)stream->width * 4;
+  size_t needed = (row_size + 1) * rows + row_size;
+  if (needed > stream->filtered_capacity) {
+    uint8_t *filtered = (uint8_t *)realloc(stream->filtered, needed);
+    if (!filtered) {
+      stream->ok = false;
+      return false;
+    }
+    stream->filtered = filtered;
+    stream->filtered_capacity = needed;
+  }
+
+  uint8_t *scratch = stream->filtered + (row_size + 1) * rows;
+  for (uint32_t y = 0; y < rows; ++y) {
+    const uint8_t *row = rgba + (size_t)y * stride;
+    const uint8_t *prior = y > 0 ? row - stride
+                           : stream->rows_written > 0 ? stream->previous_row
+                                                      : NULL;
+    filter_row(row, prior, row_size, stream->filtered + y * (row_size + 1),
+               scratch);
+  }
+  memcpy(stream->previous_row, rgba + (size_t)(rows - 1) * stride, row_size);
+  stream->rows_written += rows;
+
+  size_t size = (row_size + 1) * rows;
+#ifdef HEADLESS_HAVE_ZLIB
+  // A sync flush ends the band on a byte boundary so everything compressed
+  // so far can leave now; it costs a few bytes per band.
+  bool ok = stream_deflate(stream, stream->filtered, size, Z_SYNC_FLUSH);
+#else
+  bool ok = stream_store(stream, stream->filtered, size);
+#endif
+  return ok && stream_flush_idat(stream) && byte_sink_flush(stream->sink) &&
+         stream->ok;
+}
+
+bool png_stream_finish(PngStream *stream) {
+  bool ok = stream->ok && stream->rows_written == stream->height;
+  if (ok) {
+#ifdef HEADLESS_HAVE_ZLIB
+    ok = stream_deflate(stream, NULL, 0, Z_FINISH);
+#else
+    uint8_t trailer[9] = {1, 0, 0, 0xff, 0xff};
+    put_u32_be(trailer + 5,
+               (stream->deflate->adler_b << 16) | stream->deflate->adler_a);
+    ok = stream_emit(stream, trailer, sizeof(trailer));
+#endif
+    ok = ok && stream_flush_idat(stream) &&
+         emit_chunk(sink_write, stream->sink, "IEND", NULL, 0, NULL, 0) &&
+         byte_sink_flush(stream->sink);
+  }
+  stream_release(stream);
+  stream->ok = false;
+  return ok;
+}
+
+#define PNG_PATCH_BAND_ROWS 16
+
+struct PngPatchBand {
+  uint8_t *data;
+  size_t size;
+  size_t capacity;
+  // Adler-32 and length of the band's filtered (uncompressed) bytes, which
+  // is all the zlib trailer needs from it.
+  uint32_t adler;
+  size_t input_size;
+  bool dirty;
+};
+
+static uint32_t adler32_update(uint32_t adler, const uint8_t *data,
+                               size_t size) {
+#ifdef HEADLESS_HAVE_ZLIB
+  return size == 0 ? adler : (uint32_t)adler32(adler, data, (uInt)size);
+#else
+  uint32_t a = adler & 0xffff, b = adler >> 16;
+  for (size_t i = 0; i < size; ++i) {
+    a = (a + data[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  return (b << 16) | a;
+#endif
+}
+
+// Checksum of the concatenation of two inputs from their own checksums and
+// the length of the second (zlib's adler32_combine).
+static uint32_t adler32_join(uint32_t first, uint32_t second,
+                             size_t second_size) {
+  const uint32_t base = 65521;
+  uint32_t remainder = (uint32_t)(second_size % base);
+  uint32_t sum1 = first & 0xffff;
+  uint32_t sum2 = (uint32_t)(((uint64_t)remainder * sum1) % base);
+  sum1 += (second & 0xffff) + base - 1;
+  sum2 += (first >> 16) + (second >> 16) + base - remainder;
+  if (sum1 >= base)
+    sum1 -= base;
+  if (sum1 >= base)
+    sum1 -= base;
+  if (sum2 >= base << 1)
+    sum2 -= base << 1;
+  if (sum2 >= base)
+    sum2 -= base;
+  return (sum2 << 16) | sum1;
+}
+
+static bool patch_reserve(PngPatchBand *band, size_t size) {
+  if (size <= band->capacity)
+    return true;
+  uint8_t *data = (uint8_t *)realloc(band->data, size);
+  if (!data)
+    return false;
+  band->data = data;
+  band->capacity = size;
+  return true;
+}
+
+static bool patch_encode_band(PngPatcher *patcher, uint32_t index) {
+  PngPatchBand *band = &patcher->bands[index];
+  size_t row_size = (size_t)patcher->width * 4;
+  uint32_t top = index * PNG_PATCH_BAND_ROWS;
+  uint32_t rows = patcher->height - top < PNG_PATCH_BAND_ROWS
+                      ? patcher->height - top
+                      : PNG_PATCH_BAND_ROWS;
+
+  uint8_t *scratch = patcher->filtered + (row_size + 1) * PNG_PATCH_BAND_ROWS;
+  for (uint32_t y = 0; y < rows; ++y) {
+    const uint8_t *row = patcher->rgba + (size_t)(top + y) * row_size;
+    filter_row(row, top + y > 0 ? row - row_size : NULL, row_size,
+               patcher->filtered + y * (row_size + 1), scratch);
+  }
+  size_t size = (row_size + 1) * rows;
+  band->adler = adler32_update(1, patcher->filtered, size);
+  band->input_size = size;
+
+#ifdef HEADLESS_HAVE_ZLIB
+  // A raw deflate stream reset per band and cut with a full flush does not
+  // refer back to earlier bands, which is what makes bands reusable.
+  z_stream *zlib = &patcher->deflate->zlib;
+  size_t bound = deflateBound(zlib, (uLong)size) + 16;
+  if (!patch_reserve(band, bound) || deflateReset(zlib) != Z_OK)
+    return false;
+  zlib->next_in = patcher->filtered;
+  zlib->avail_in = (uInt)size;
+  zlib->next_out = band->data;
+  zlib->avail_out = (uInt)bound;
+  if (deflate(zlib, Z_FULL_FLUSH) != Z_OK || zlib->avail_in != 0 ||
+      zlib->avail_out == 0)
+    return false;
+  band->size = bound - zlib->avail_out;
+#else
+  size_t blocks = (size + 65534) / 65535;
+  if (!patch_reserve(band, size + blocks * 5))
+    return false;
+  uint8_t *cursor = band->data;
+  const uint8_t *source = patcher->filtered;
+  for (size_t remaining = size; remaining > 0;) {
+    uint16_t length = remaining > 65535 ? 65535 : (uint16_t)remaining;
+    *cursor++ = 0;
+    *cursor++ = (uint8_t)length;
+    *cursor++ = (uint8_t)(length >> 8);
+    *cursor++ = (uint8_t)~length;
+    *cursor++ = (uint8_t)(~length >> 8);
+    memcpy(cursor, source, length);
+    cursor += length;
+    source += length;
+    remaining -= length;
+  }
+  band->size = (size_t)(cursor - band->data);
+#endif
+  band->dirty = false;
+  return true;
+}
+
+bool png_patcher_init(PngPatcher *patcher, uint32_t width, uint32_t height) {
+  memset(patcher, 0, sizeof(*patcher));
+  if (width == 0 || height == 0)
+    return false;
+  patcher->width = width;
+  patcher->height = height;
+  patcher->band_count = (height + PNG_PATCH_BAND_ROWS - 1) / PNG_PATCH_BAND_ROWS;
+  size_t row_size = (size_t)width * 4;
+  patcher->rgba = (uint8_t *)calloc(height, row_size);
+  patcher->bands =
+      (PngPatchBand *)calloc(patcher->band_count, sizeof(PngPatchBand));
+  patcher->filtered =
+      (uint8_t *)malloc((row_size + 1) * PNG_PATCH_BAND_ROWS + row_size);
+  patcher->deflate = (PngStreamDeflate *)calloc(1, sizeof(PngStreamDeflate));
+  bool ok = patcher->rgba && patcher->bands && patcher->filtered &&
+            patcher->deflate;
+#ifdef HEADLESS_HAVE_ZLIB
+  if (ok && deflateInit2(&patcher->deflate->zlib, 6, Z_DEFLATED, -15, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+    free(patcher->deflate);
+    patcher->deflate = NULL;
+    ok = false;
+  }
+#endif
+  if (!ok) {
+    png_patcher_release(patcher);
+    return false;
+  }
+  for (uint32_t i = 0; i < patcher->band_count; ++i)
+    patcher->bands[i].dirty = true;
+  return true;
+}
+
+bool png_patcher_apply(PngPatcher *patcher, uint32_t x, uint32_t y,
+                       uint32_t width, uint32_t height, const uint8_t *rgba,
+                       size_t stride) {
+  if (x > patcher->width || width > patcher->width - x || y > patcher->height ||
+      height > patcher->height - y)
+    return false;
+  if (width == 0 || height == 0)
+    return true;
+  size_t row_size = (size_t)patcher->width * 4;
+  for (uint32_t row = 0; row < height; ++row) {
+    memcpy(patcher->rgba + (size_t)(y + row) * row_size + (size_t)x * 4,
+           rgba + (size_t)row * stride, (size_t)width * 4);
+  }
+  // Row y + height is filtered against the last patched row.
+  uint32_t first = y / PNG_PATCH_BAND_ROWS;
+  uint32_t last = (y + height) / PNG_PATCH_BAND_ROWS;
+  if (last >= patcher->band_count)
+    last = patcher->band_count - 1;
+  for (uint32_t i = first; i <= last; ++i)
+    patcher->bands[i].dirty = true;
+  return true;
+}
+
+bool png_patcher_write(PngPatcher *patcher, ByteSink *sink) {
+  if (!patcher->rgba)
+    return false;
+  patcher->bands_encoded = 0;
+  uint32_t adler = 1;
+  for (uint32_t i = 0; i < patcher->band_count; ++i) {
+    PngPatchBand *band = &patcher->bands[i];
+    if (band->dirty) {
+      if (!patch_encode_band(patcher, i))
+        return false;
+      patcher->bands_encoded++;
+    }
+    adler = adler32_join(adler, band->adler, band->input_size);
+  }
+
+  uint8_t ihdr[13];
+  fill_ihdr(ihdr, patcher->width, patcher->height);
+  static const uint8_t kZlibHeader[2] = {0x78, 0x01};
+  bool ok = sink_write(sink, kPngSignature, sizeof(kPngSignature)) &&
+            emit_chunk(sink_write, sink, "IHDR", NULL, 0, ihdr, sizeof(ihdr));
+  for (uint32_t i = 0; ok && i < patcher->band_count; ++i) {
+    ok = emit_chunk(sink_write, sink, "IDAT", i == 0 ? kZlibHeader : NULL,
+                    i == 0 ? sizeof(kZlibHeader) : 0, patcher->bands[i].data,
+                    patcher->bands[i].size);
+  }
+  // An empty final stored block ends the deflate stream.
+  uint8_t trailer[9] = {1, 0, 0, 0xff, 0xff};
+  put_u32_be(trailer + 5, adler);
+  return ok &&
+         emit_chunk(sink_write, sink, "IDAT", NULL, 0, trailer,
+                    sizeof(trailer)) &&
+         emit_chunk(sink_write, sink, "IEND", NULL, 0, NULL, 0);
+}
+
+void png_patcher_release(PngPatcher *patcher) {
+#ifdef HEADLESS_HAVE_ZLIB
+  if (patcher->deflate)
+    deflateEnd(&patcher->deflate->zlib);
+#endif
+  for (uint32_t i = 0; patcher->bands && i < patcher->band_count; ++i)
+    free(patcher->bands[i].data);
+  free(patcher->deflate);
+  free(patcher->bands);
+  free(patcher->filtered);
+  free(patcher->rgba);
+  memset(patcher, 0, sizeof(*patcher));
+}
@@ -0,0 +1,102 @@
+// PNG and animated PNG (APNG) encoder for straight-alpha RGBA8 frames.
+//
+// Deflate goes through zlib when the build found it (HEADLESS_HAVE_ZLIB) and
+// falls back to stored (uncompressed) deflate blocks otherwise, so the output
+// is always a valid PNG.
+
+#ifndef PNG_WRITER_H
+#define PNG_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "byte_sink.h"
+
+typedef struct {
+  FILE *file;
+  uint32_t width;
+  uint32_t height;
+  // Number of frames announced in acTL; 0 writes a plain, single-frame PNG.
+  uint32_t frame_count;
+  uint32_t frames_written;
+  uint32_t sequence;
+  uint16_t delay_num;
+  uint16_t delay_den;
+  uint8_t *filtered;
+  bool ok;
+} PngWriter;
+
+bool png_writer_open(PngWriter *writer, FILE *file, uint32_t width,
+                     uint32_t height, uint32_t frame_count, uint16_t delay_num,
+                     uint16_t delay_den);
+bool png_writer_add_frame(PngWriter *writer, const uint8_t *rgba,
+                          size_t stride);
+// Writes IEND and releases scratch memory. Does not close the file.
+bool png_writer_finish(PngWriter *writer);
+
+// Row-wise PNG encoder for outputs rendered in bands. Each append filters and
+// compresses its rows, then flushes the compressed data to the sink as IDAT
+// chunks, so a reader sees the top of the image while later bands are still
+// being rendered. Only one band and a 64KB output buffer are held at a time.
+typedef struct PngStreamDeflate PngStreamDeflate;
+
+typedef struct {
+  ByteSink *sink;
+  uint32_t width;
+  uint32_t height;
+  uint32_t rows_written;
+  // Last row of the previous band, the "prior" row for filtering.
+  uint8_t *previous_row;
+  uint8_t *filtered;
+  size_t filtered_capacity;
+  uint8_t *pending;
+  size_t pending_size;
+  PngStreamDeflate *deflate;
+  bool ok;
+} PngStream;
+
+bool png_stream_begin(PngStream *stream, ByteSink *sink, uint32_t width,
+                      uint32_t height);
+bool png_stream_append(PngStream *stream, const uint8_t *rgba, size_t stride,
+                       uint32_t rows);
+// Writes the trailing IDAT and IEND once every row arrived, then releases the
+// encoder. Returns false for short images. Does not close the sink.
+bool png_stream_finish(PngStream *stream);
+
+// PNG encoder for a sequence of images that differ from each other in a few
+// places, such as the same card rendered for different users. It keeps the
+// last image together with its compressed row bands. Each band is filtered
+// and deflated independently and ends on a full flush, so a band whose rows
+// did not change is reused byte for byte and only the patched bands (plus
+// the band below them, whose first row is filtered against a patched one)
+// are encoded again.
+typedef struct PngPatchBand PngPatchBand;
+
+typedef struct {
+  uint32_t width;
+  uint32_t height;
+  uint8_t *rgba;
+  PngPatchBand *bands;
+  uint32_t band_count;
+  // Bands encoded again by the last `png_patcher_write`.
+  uint32_t bands_encoded;
+  uint8_t *filtered;
+  PngStreamDeflate *deflate;
+} PngPatcher;
+
+// Starts with a fully transparent image.
+bool png_patcher_init(PngPatcher *patcher, uint32_t width, uint32_t height);
+// Copies `width` x `height` RGBA pixels to (x, y) of the kept image. Fails
+// when the rect does not fit.
+bool png_patcher_apply(PngPatcher *patcher, uint32_t x, uint32_t y,
+                       uint32_t width, uint32_t height, const uint8_t *rgba,
+                       size_t stride);
+// Writes the kept image as a complete PNG. Does not flush or close the sink.
+bool png_patcher_write(PngPatcher *patcher, ByteSink *sink);
+void png_patcher_release(PngPatcher *patcher);
+
+uint32_t png_crc32(uint32_t crc, const uint8_t *data, size_t size);
+
+#endif // PNG_WRITER_H
@@ -0,0 +1,588 @@
+#include "render_pipeline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "auto_crop.h"
+#include "byte_sink.h"
+#include "channels.h"
+#include "file_writer.h"
+#include "job_cost.h"
+#include "log_ring.h"
+#include "metrics.h"
+#include "platform_thread.h"
+#include "png_writer.h"
+#include "trace_events.h"
+
+#define PIPELINE_CHANNEL "headless/pipeline"
+#define ENCODE_QUEUE_CAPACITY 4
+#define OUTPUT_QUEUE_CAPACITY 8
+#define MAX_ENCODE_WORKERS 4
+#define MAX_OUTPUT_WORKERS 8
+#define DEFAULT_OUTPUT_WORKERS 4
+
+enum {
+  kPipelineOpSubmit = 1,
+  kPipelineOpWait = 2,
+  kPipelineOpBegin = 3,
+};
+
+enum {
+  kOutputFormatPng = 0,
+  kOutputFormatRaw = 1,
+};
+
+enum {
+  kJobFlagAutoCrop = 1 << 0,
+};
+
+typedef struct PipelineJob {
+  uint32_t id;
+  uint32_t width;
+  uint32_t height;
+  uint8_t format;
+  uint8_t flags;
+  uint8_t background[4];
+  // Region of the submitted image that is written out.
+  CropRect rect;
+  char *target;
+  uint8_t *rgba;
+  // Encoded output, handed from the encode to the output stage.
+  ByteSink encoded;
+  uint64_t bytes_written;
+  bool done;
+  bool ok;
+  char error[96];
+  // Engine clock, for the stage latencies in metrics.h.
+  uint64_t submitted_at;
+  uint64_t encoded_at;
+  JobCost cost;
+  // Deferred `submit` reply while the job waits for an encode queue slot.
+  const FlutterPlatformMessageResponseHandle *admit_handle;
+  const FlutterPlatformMessageResponseHandle *waiter;
+  struct PipelineJob *next_parked;
+  struct PipelineJob *next_job;
+} PipelineJob;
+
+typedef struct {
+  PipelineJob *slots[ENCODE_QUEUE_CAPACITY > OUTPUT_QUEUE_CAPACITY
+                         ? ENCODE_QUEUE_CAPACITY
+                         : OUTPUT_QUEUE_CAPACITY];
+  size_t capacity;
+  size_t head;
+  size_t count;
+  PlatformCond not_empty;
+  PlatformCond not_full;
+} JobQueue;
+
+// Everything below is guarded by g_pipeline_mutex.
+static PlatformMutex g_pipeline_mutex = PLATFORM_MUTEX_INIT;
+static JobQueue g_encode_queue;
+static JobQueue g_output_queue;
+// Jobs waiting for room in the encode queue, oldest first.
+static PipelineJob *g_parked_head;
+static PipelineJob *g_parked_tail;
+// Every job whose result has not been collected by a `wait` yet.
+static PipelineJob *g_jobs;
+static uint32_t g_next_job_id = 1;
+static bool g_stopping;
+static bool g_started;
+
+static PlatformThread g_encode_threads[MAX_ENCODE_WORKERS];
+static unsigned g_encode_thread_count;
+// Writes mostly wait on the disk or the network, so several run at once.
+static PlatformThread g_output_threads[MAX_OUTPUT_WORKERS];
+static unsigned g_output_thread_count;
+
+static void queue_init(JobQueue *queue, size_t capacity) {
+  memset(queue, 0, sizeof(*queue));
+  queue->capacity = capacity;
+  platform_cond_init(&queue->not_empty);
+  platform_cond_init(&queue->not_full);
+}
+
+static void queue_push(JobQueue *queue, PipelineJob *job) {
+  queue->slots[(queue->head + queue->count) % queue->capacity] = job;
+  queue->count++;
+  platform_cond_signal(&queue->not_empty);
+}
+
+static PipelineJob *queue_pop(JobQueue *queue) {
+  PipelineJob *job = queue->slots[queue->head];
+  queue->head = (queue->head + 1) % queue->capacity;
+  queue->count--;
+  platform_cond_signal(&queue->not_full);
+  return job;
+}
+
+static void free_job(PipelineJob *job) {
+  byte_sink_close(&job->encoded);
+  free(job->rgba);
+  free(job->target);
+  free(job);
+}
+
+// Must be called with the pipeline mutex held.
+static void unlink_job(PipelineJob *job) {
+  for (PipelineJob **link = &g_jobs; *link; link = &(*link)->next_job) {
+    if (*link == job) {
+      *link = job->next_job;
+      return;
+    }
+  }
+}
+
+static void respond_result(const FlutterPlatformMessageResponseHandle *handle,
+                           const PipelineJob *job) {
+  if (!job->ok) {
+    channels_respond_status(handle, kChannelStatusError, job->error);
+    return;
+  }
+  uint8_t reply[25 + JOB_COST_SIZE];
+  reply[0] = kChannelStatusOk;
+  message_write_u64(reply + 1, job->bytes_written);
+  message_write_u32(reply + 9, job->rect.left);
+  message_write_u32(reply + 13, job->rect.top);
+  message_write_u32(reply + 17, job->rect.width);
+  message_write_u32(reply + 21, job->rect.height);
+  job_cost_write(reply + 25, &job->cost);
+  channels_respond(handle, reply, sizeof(reply));
+}
+
+static void respond_admitted(const FlutterPlatformMessageResponseHandle *handle,
+                             uint32_t id) {
+  uint8_t reply[5];
+  reply[0] = kChannelStatusOk;
+  message_write_u32(reply + 1, id);
+  channels_respond(handle, reply, sizeof(reply));
+}
+
+static void fail_job(PipelineJob *job, const char *reason) {
+  job->ok = false;
+  snprintf(job->error, sizeof(job->error), "%s", reason);
+}
+
+static void encode_job(PipelineJob *job) {
+  size_t stride = (size_t)job->width * 4;
+  job->rect.width = job->width;
+  job->rect.height = job->height;
+  if (job->flags & kJobFlagAutoCrop) {
+    auto_crop_bounds(job->rgba, stride, job->width, job->height,
+                     job->background, &job->rect);
+  }
+  const uint8_t *pixels = auto_crop_view(job->rgba, stride, job->rect);
+
+  if (job->format == kOutputFormatRaw) {
+    // Raw output is the submitted buffer itself; hand it over without a copy,
+    // packing the cropped rows to the front first.
+    size_t row_size = (size_t)job->rect.width * 4;
+    if (row_size != stride || pixels != job->rgba) {
+      for (uint32_t y = 0; y < job->rect.height; ++y)
+        memmove(job->rgba + y * row_size, pixels + y * stride, row_size);
+    }
+    byte_sink_open_memory(&job->encoded);
+    job->encoded.memory = job->rgba;
+    job->encoded.memory_capacity = (size_t)job->width * job->height * 4;
+    job->encoded.bytes_written = row_size * job->rect.height;
+    job->rgba = NULL;
+    return;
+  }
+
+  byte_sink_open_memory(&job->encoded);
+  PngStream png;
+  bool ok = png_stream_begin(&png, &job->encoded, job->rect.width,
+                             job->rect.height) &&
+            png_stream_append(&png, pixels, stride, job->rect.height);
+  ok = png_stream_finish(&png) && ok;
+  free(job->rgba);
+  job->rgba = NULL;
+  if (!ok)
+    fail_job(job, "cannot encode PNG");
+}
+
+static void output_job(PipelineJob *job) {
+  if (!job->ok)
+    return;
+  ByteSink sink;
+  char error[96];
+  if (!byte_sink_open(&sink, job->target, error, sizeof(error))) {
+    fail_job(job, error);
+    return;
+  }
+  byte_sink_write(&sink, job->encoded.memory, (size_t)job->encoded.bytes_written);
+  job->bytes_written = sink.bytes_written;
+  if (!byte_sink_close(&sink))
+    fail_job(job, "cannot write to target");
+}
+
+// Runs once the output stage is done with `job`, on an output worker or on
+// the file writer's thread.
+static void finish_job(PipelineJob *job) {
+  byte_sink_close(&job->encoded);
+  trace_async_end("Job", job->id);
+  uint64_t now = FlutterEngineGetCurrentTime();
+  job->cost.output_nanos = now - job->encoded_at;
+  metrics_observe(kMetricStageOutput, job->cost.output_nanos);
+  metrics_observe(kMetricStageTotal, now - job->submitted_at);
+  metrics_job_finished(kMetricJobPipeline, job->ok);
+  if (!job->ok)
+    log_ring_write(kLogWarning, "pipeline", job->id, job->error);
+
+  platform_mutex_lock(&g_pipeline_mutex);
+  job->done = true;
+  const FlutterPlatformMessageResponseHandle *waiter = job->waiter;
+  if (waiter)
+    unlink_job(job);
+  platform_mutex_unlock(&g_pipeline_mutex);
+
+  if (waiter) {
+    respond_result(waiter, job);
+    free_job(job);
+  }
+}
+
+static void handle_file_written(bool ok, uint64_t bytes, const char *error,
+                                void *user_data) {
+  PipelineJob *job = (PipelineJob *)user_data;
+  job->bytes_written = bytes;
+  if (!ok)
+    fail_job(job, error);
+  finish_job(job);
+}
+
+static void encode_worker(void *argument) {
+  (void)argument;
+  trace_thread_name("encode");
+  platform_mutex_lock(&g_pipeline_mutex);
+  for (;;) {
+    while (g_encode_queue.count == 0 && !g_stopping)
+      platform_cond_wait(&g_encode_queue.not_empty, &g_pipeline_mutex);
+    if (g_encode_queue.count == 0)
+      break;
+    PipelineJob *job = queue_pop(&g_encode_queue);
+
+    // A slot just opened up: admit the oldest parked job.
+    const FlutterPlatformMessageResponseHandle *admit = NULL;
+    uint32_t admitted_id = 0;
+    if (g_parked_head) {
+      PipelineJob *parked = g_parked_head;
+      g_parked_head = parked->next_parked;
+      if (!g_parked_head)
+        g_parked_tail = NULL;
+      admit = parked->admit_handle;
+      admitted_id = parked->id;
+      parked->admit_handle = NULL;
+      queue_push(&g_encode_queue, parked);
+    }
+    platform_mutex_unlock(&g_pipeline_mutex);
+
+    if (admit)
+      respond_admitted(admit, admitted_id);
+    TraceSpan span = trace_begin("Encode");
+    uint64_t encode_started = FlutterEngineGetCurrentTime();
+    uint64_t cpu_started = platform_thread_cpu_nanos();
+    encode_job(job);
+    job->cost.encode_cpu_nanos = platform_thread_cpu_nanos() - cpu_started;
+    job->encoded_at = FlutterEngineGetCurrentTime();
+    trace_end(span, job->id);
+    job->cost.queued_nanos = encode_started - job->submitted_at;
+    job->cost.encode_nanos = job->encoded_at - encode_started;
+    // PNG output is a new buffer; raw output reuses the submitted one.
+    if (job->format == kOutputFormatPng)
+      job->cost.allocated_bytes += job->encoded.memory_capacity;
+    metrics_observe(kMetricStageQueued, job->cost.queued_nanos);
+    metrics_observe(kMetricStageEncode, job->cost.encode_nanos);
+
+    platform_mutex_lock(&g_pipeline_mutex);
+    while (g_output_queue.count == g_output_queue.capacity)
+      platform_cond_wait(&g_output_queue.not_full, &g_pipeline_mutex);
+    queue_push(&g_output_queue, job);
+  }
+  platform_mutex_unlock(&g_pipeline_mutex);
+}
+
+static void output_worker(void *argument) {
+  (void)argument;
+  trace_thread_name("output");
+  platform_mutex_lock(&g_pipeline_mutex);
+  for (;;) {
+    // Stop only once the encoders are gone and nothing is left to write.
+    while (g_output_queue.count == 0 &&
+           !(g_stopping && g_encode_thread_count == 0))
+      platform_cond_wait(&g_output_queue.not_empty, &g_pipeline_mutex);
+    if (g_output_queue.count == 0)
+      break;
+    PipelineJob *job = queue_pop(&g_output_queue);
+    platform_mutex_unlock(&g_pipeline_mutex);
+
+    // Files go to the asynchronous writer, which finishes the job once the
+    // data is on disk; sockets and other sinks are written here. The
+    // writer's own thread is not charged to the job.
+    job->cost.output_cpu_nanos = platform_thread_cpu_nanos();
+    if (job->ok && byte_sink_is_file_target(job->target)) {
+      // Blocks while the writer has too many files in flight. The job may
+      // be finished and freed once this returns.
+      uint32_t id = job->id;
+      job->cost.output_cpu_nanos =
+          platform_thread_cpu_nanos() - job->cost.output_cpu_nanos;
+      TraceSpan span = trace_begin("SubmitWrite");
+      file_writer_write(job->target, job->encoded.memory,
+                        (size_t)job->encoded.bytes_written,
+                        handle_file_written, job);
+      trace_end(span, id);
+    } else {
+      TraceSpan span = trace_begin("Output");
+      output_job(job);
+      trace_end(span, job->id);
+      job->cost.output_cpu_nanos =
+          platform_thread_cpu_nanos() - job->cost.output_cpu_nanos;
+      finish_job(job);
+    }
+    platform_mutex_lock(&g_pipeline_mutex);
+  }
+  platform_mutex_unlock(&g_pipeline_mutex);
+}
+
+// Must be called with the pipeline mutex held.
+static bool start_workers(void) {
+  if (g_started)
+    return true;
+  queue_init(&g_encode_queue, ENCODE_QUEUE_CAPACITY);
+  queue_init(&g_output_queue, OUTPUT_QUEUE_CAPACITY);
+
+  // Leave a core each to the UI and raster threads.
+  unsigned cpus = platform_cpu_count();
+  unsigned encoders = cpus > 3 ? cpus - 2 : 1;
+  if (encoders > MAX_ENCODE_WORKERS)
+    encoders = MAX_ENCODE_WORKERS;
+  for (unsigned i = 0; i < encoders; ++i) {
+    if (!platform_thread_start(&g_encode_threads[g_encode_thread_count],
+                               encode_worker, NULL))
+      break;
+    g_encode_thread_count++;
+  }
+  unsigned writers = DEFAULT_OUTPUT_WORKERS;
+  const char *override = getenv("HEADLESS_OUTPUT_THREADS");
+  if (override && atoi(override) > 0)
+    writers = (unsigned)atoi(override);
+  if (writers > MAX_OUTPUT_WORKERS)
+    writers = MAX_OUTPUT_WORKERS;
+  for (unsigned i = 0; g_encode_thread_count > 0 && i < writers; ++i) {
+    if (!platform_thread_start(&g_output_threads[g_output_thread_count],
+                               output_worker, NULL))
+      break;
+    g_output_thread_count++;
+  }
+  if (g_encode_thread_count == 0 || g_output_thread_count == 0) {
+    g_stopping = true;
+    platform_cond_broadcast(&g_encode_queue.not_empty);
+    return false;
+  }
+  g_started = true;
+  return true;
+}
+
+static void handle_submit(MessageReader *reader,
+                          const FlutterPlatformMessageResponseHandle *handle) {
+  uint32_t width = message_read_u32(reader);
+  uint32_t height = message_read_u32(reader);
+  uint8_t format = message_read_u8(reader);
+  uint8_t flags = message_read_u8(reader);
+  const uint8_t *background = message_read_bytes(reader, 4);
+  char target[4096];
+  message_read_string(reader, target, sizeof(target));
+  size_t size = (size_t)width * height * 4;
+  const uint8_t *rgba = message_read_bytes(reader, size);
+  // Optional: the engine CPU times the `begin` op returned for this job.
+  uint64_t ui_begin = 0, raster_begin = 0;
+  if (reader->ok && reader->size - reader->offset >= 16) {
+    ui_begin = message_read_u64(reader);
+    raster_begin = message_read_u64(reader);
+  }
+  if (!reader->ok || !rgba || width == 0 || height == 0 ||
+      format > kOutputFormatRaw) {
+    channels_respond_status(handle, kChannelStatusError,
+                            "malformed pipeline job");
+    return;
+  }
+
+  // The message buffer only lives for this call.
+  PipelineJob *job = (PipelineJob *)calloc(1, sizeof(PipelineJob));
+  if (job) {
+    job->rgba = (uint8_t *)malloc(size);
+    job->target = (char *)malloc(strlen(target) + 1);
+  }
+  if (!job || !job->rgba || !job->target) {
+    if (job)
+      free_job(job);
+    channels_respond_status(handle, kChannelStatusError,
+                            "out of memory for pipeline job");
+    return;
+  }
+  memcpy(job->rgba, rgba, size);
+  strcpy(job->target, target);
+  job->width = width;
+  job->height = height;
+  job->format = format;
+  job->flags = flags;
+  memcpy(job->background, background, 4);
+  job->ok = true;
+  job->submitted_at = FlutterEngineGetCurrentTime();
+  job->cost.allocated_bytes = size;
+  job->cost.peak_surface_bytes = size;
+  uint64_t ui_now, raster_now;
+  job_cost_engine_cpu(&ui_now, &raster_now);
+  if (ui_begin && ui_now >= ui_begin)
+    job->cost.ui_cpu_nanos = ui_now - ui_begin;
+  if (raster_begin && raster_now >= raster_begin)
+    job->cost.raster_cpu_nanos = raster_now - raster_begin;
+
+  platform_mutex_lock(&g_pipeline_mutex);
+  if (g_stopping || !start_workers()) {
+    platform_mutex_unlock(&g_pipeline_mutex);
+    free_job(job);
+    channels_respond_status(handle, kChannelStatusError,
+                            "pipeline workers are not running");
+    return;
+  }
+  job->id = g_next_job_id++;
+  trace_async_begin("Job", job->id);
+  metrics_job_started(kMetricJobPipeline);
+  job->next_job = g_jobs;
+  g_jobs = job;
+  bool admitted = g_encode_queue.count < g_encode_queue.capacity;
+  if (admitted) {
+    queue_push(&g_encode_queue, job);
+  } else {
+    job->admit_handle = handle;
+    if (g_parked_tail)
+      g_parked_tail->next_parked = job;
+    else
+      g_parked_head = job;
+    g_parked_tail = job;
+  }
+  uint32_t id = job->id;
+  platform_mutex_unlock(&g_pipeline_mutex);
+
+  if (admitted)
+    respond_admitted(handle, id);
+  else
+    trace_instant("JobParked", id);
+}
+
+static void handle_wait(MessageReader *reader,
+                        const FlutterPlatformMessageResponseHandle *handle) {
+  uint32_t id = message_read_u32(reader);
+  platform_mutex_lock(&g_pipeline_mutex);
+  PipelineJob *job = g_jobs;
+  while (job && job->id != id)
+    job = job->next_job;
+  if (!job || job->waiter) {
+    platform_mutex_unlock(&g_pipeline_mutex);
+    channels_respond_status(handle, kChannelStatusError, "unknown job");
+    return;
+  }
+  if (!job->done) {
+    job->waiter = handle;
+    platform_mutex_unlock(&g_pipeline_mutex);
+    return;
+  }
+  unlink_job(job);
+  platform_mutex_unlock(&g_pipeline_mutex);
+  respond_result(handle, job);
+  free_job(job);
+}
+
+static void handle_begin(const FlutterPlatformMessageResponseHandle *handle) {
+  uint8_t reply[17];
+  uint64_t ui_nanos, raster_nanos;
+  job_cost_engine_cpu(&ui_nanos, &raster_nanos);
+  reply[0] = kChannelStatusOk;
+  message_write_u64(reply + 1, ui_nanos);
+  message_write_u64(reply + 9, raster_nanos);
+  channels_respond(handle, reply, sizeof(reply));
+}
+
+static void handle_pipeline_message(const FlutterPlatformMessage *message,
+                                    void *user_data) {
+  (void)user_data;
+  MessageReader reader = message_reader(message->message, message->message_size);
+  switch (message_read_u8(&reader)) {
+  case kPipelineOpSubmit:
+    handle_submit(&reader, message->response_handle);
+    break;
+  case kPipelineOpWait:
+    handle_wait(&reader, message->response_handle);
+    break;
+  case kPipelineOpBegin:
+    handle_begin(message->response_handle);
+    break;
+  default:
+    channels_respond_status(message->response_handle, kChannelStatusError,
+                            "unknown pipeline opcode");
+    break;
+  }
+}
+
+void render_pipeline_install(void) {
+  channels_register(PIPELINE_CHANNEL, handle_pipeline_message, NULL);
+}
+
+void render_pipeline_stats(RenderPipelineStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->encode_capacity = ENCODE_QUEUE_CAPACITY;
+  stats->output_capacity = OUTPUT_QUEUE_CAPACITY;
+  platform_mutex_lock(&g_pipeline_mutex);
+  if (g_started) {
+    stats->encode_queued = (uint32_t)g_encode_queue.count;
+    stats->output_queued = (uint32_t)g_output_queue.count;
+  }
+  for (PipelineJob *job = g_parked_head; job; job = job->next_parked)
+    stats->parked++;
+  for (PipelineJob *job = g_jobs; job; job = job->next_job)
+    stats->outstanding++;
+  platform_mutex_unlock(&g_pipeline_mutex);
+}
+
+void render_pipeline_shutdown(void) {
+  platform_mutex_lock(&g_pipeline_mutex);
+  if (!g_started) {
+    platform_mutex_unlock(&g_pipeline_mutex);
+    return;
+  }
+  // Parked jobs were never admitted; fail them so their senders hear back.
+  PipelineJob *parked = g_parked_head;
+  g_parked_head = g_parked_tail = NULL;
+  g_stopping = true;
+  platform_cond_broadcast(&g_encode_queue.not_empty);
+  platform_mutex_unlock(&g_pipeline_mutex);
+
+  for (; parked; parked = parked->next_parked) {
+    fail_job(parked, "pipeline is shutting down");
+    trace_async_end("Job", parked->id);
+    metrics_job_finished(kMetricJobPipeline, false);
+    channels_respond_status(parked->admit_handle, kChannelStatusError,
+                            parked->error);
+  }
+
+  for (unsigned i = 0; i < g_encode_thread_count; ++i)
+    platform_thread_join(g_encode_threads[i]);
+  platform_mutex_lock(&g_pipeline_mutex);
+  g_encode_thread_count = 0;
+  platform_cond_broadcast(&g_output_queue.not_empty);
+  platform_mutex_unlock(&g_pipeline_mutex);
+  for (unsigned i = 0; i < g_output_thread_count; ++i)
+    platform_thread_join(g_output_threads[i]);
+  g_output_thread_count = 0;
+  file_writer_drain();
+
+  while (g_jobs) {
+    PipelineJob *job = g_jobs;
+    g_jobs = job->next_job;
+    if (job->waiter)
+      respond_result(job->waiter, job);
+    free_job(job);
+  }
+  g_started = false;
+}
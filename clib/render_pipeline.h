@@ -0,0 +1,60 @@
+// Pipelined execution of render jobs.
+//
+// A job goes through four stages: build/layout and raster run in the engine
+// (the UI isolate and the raster thread), encode and output run on worker
+// threads owned by this module. Jobs move between the native stages through
+// bounded queues, so while job N is compressed and written the UI isolate is
+// already building job N+1, and throughput is set by the slowest stage
+// rather than by the sum of all of them. The output stage is a pool of
+// writers (HEADLESS_OUTPUT_THREADS, default 4, at most 8), so slow targets
+// overlap instead of queueing behind each other; jobs may therefore finish
+// out of submission order. File targets are handed on to the file writer
+// (see file_writer.h), which keeps disk I/O off the writers where io_uring
+// is available.
+//
+// When the encode queue is full, `submit` is not answered until a slot frees
+// up. The Dart side waits for that reply before submitting the next job,
+// which is the pipeline's backpressure; the platform thread never blocks.
+//
+// Channel "headless/pipeline", first byte is the opcode:
+//   1 submit: u32 width, u32 height, u8 format (0 PNG, 1 raw RGBA),
+//             u8 flags (bit 0: auto-crop), u8[4] background RGBA,
+//             u16 length + UTF-8 target (see byte_sink.h),
+//             width * height * 4 bytes of straight-alpha RGBA, optionally
+//             followed by the two u64s a `begin` replied with.
+//             Replies with status and u32 job id once the job is queued.
+//   2 wait:   u32 job id. Replies with status, u64 bytes written, the
+//             written rect as u32 left, top, width, height and the job's
+//             cost (see job_cost.h) once the job left the output stage.
+//   3 begin:  Replies with status and the CPU time the engine's UI and
+//             raster threads used so far, as two u64 nanoseconds.
+// Error replies carry a UTF-8 reason after the status byte instead.
+//
+// Auto-cropped jobs are trimmed to the pixels that differ from the
+// background in the encode stage (see auto_crop.h); an image that is all
+// background becomes its top-left pixel.
+
+#ifndef RENDER_PIPELINE_H
+#define RENDER_PIPELINE_H
+
+#include <stdint.h>
+
+typedef struct {
+  uint32_t encode_queued;
+  uint32_t encode_capacity;
+  uint32_t output_queued;
+  uint32_t output_capacity;
+  // Submitted jobs waiting for room in the encode queue.
+  uint32_t parked;
+  // Jobs whose result has not been collected by a `wait` yet.
+  uint32_t outstanding;
+} RenderPipelineStats;
+
+void render_pipeline_install(void);
+void render_pipeline_stats(RenderPipelineStats *stats);
+
+// Drains queued jobs and joins the workers. Must run while the engine is
+// still alive so outstanding replies can be delivered.
+void render_pipeline_shutdown(void);
+
+#endif // RENDER_PIPELINE_H
@@ -0,0 +1,307 @@
+#ifdef __linux__
+// memfd_create flags and accept4.
+#define _GNU_SOURCE
+#endif
+
+#include "shm_ring.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+
+#include "byte_sink.h"
+#include "template_jobs.h"
+
+#define SHM_DEFAULT_SLOTS 16
+#define SHM_DEFAULT_RESULT_MB 16
+#define SHM_DEFAULT_SOCKET_MODE 0600
+
+static ShmRing *g_ring = NULL;
+static int g_memfd = -1;
+static int g_eventfd = -1;
+static int g_listen_fd = -1;
+static char g_socket_path[108];
+
+static unsigned long env_number(const char *name, unsigned long fallback,
+                                unsigned long max) {
+  const char *value = getenv(name);
+  char *end;
+  unsigned long number = value ? strtoul(value, &end, 10) : 0;
+  if (!value || *end != '\0' || number == 0 || number > max)
+    return fallback;
+  return number;
+}
+
+static uint8_t *slot_buffer(uint32_t index) {
+  return (uint8_t *)g_ring + g_ring->results_offset +
+         (size_t)index * g_ring->result_capacity;
+}
+
+// Runs on the output worker that writes the job.
+static bool open_slot_sink(ByteSink *sink, const char *rest, char *error,
+                           size_t error_size) {
+  char *end;
+  unsigned long index = strtoul(rest, &end, 10);
+  if (!g_ring || *rest == '\0' || *end != '\0' ||
+      index >= g_ring->slot_count) {
+    snprintf(error, error_size, "unknown shared-memory slot");
+    return false;
+  }
+  byte_sink_open_buffer(sink, slot_buffer((uint32_t)index),
+                        (size_t)g_ring->result_capacity);
+  return true;
+}
+
+static void finish_slot(uint32_t index, uint32_t state, uint64_t size) {
+  ShmRingSlot *slot = &g_ring->slots[index];
+  slot->result_size = size;
+  __atomic_store_n(&slot->state, state, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &slot->state, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+static void fail_slot(uint32_t index, const char *reason) {
+  size_t length = strlen(reason);
+  if (length > g_ring->result_capacity)
+    length = (size_t)g_ring->result_capacity;
+  memcpy(slot_buffer(index), reason, length);
+  finish_slot(index, kShmSlotFailed, length);
+}
+
+// The slot layout has no room for the job's cost; it is dropped here.
+static void handle_slot_done(bool ok, uint64_t bytes, uint32_t width,
+                             uint32_t height, const JobCost *cost,
+                             const char *error, void *user_data) {
+  (void)cost;
+  uint32_t index = (uint32_t)(uintptr_t)user_data;
+  if (!g_ring)
+    return;
+  if (!ok) {
+    fail_slot(index, error);
+    return;
+  }
+  g_ring->slots[index].result_width = width;
+  g_ring->slots[index].result_height = height;
+  finish_slot(index, kShmSlotDone, bytes);
+}
+
+void shm_ring_poll(void) {
+  if (!g_ring)
+    return;
+  for (;;) {
+    uint64_t ticket = g_ring->dequeue_ticket;
+    uint32_t index = (uint32_t)(ticket % g_ring->slot_count);
+    ShmRingSlot *slot = &g_ring->slots[index];
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != ticket + 1)
+      return;
+    g_ring->dequeue_ticket = ticket + 1;
+
+    __atomic_store_n(&slot->state, kShmSlotRendering, __ATOMIC_RELAXED);
+    uint32_t params_size = slot->params_size;
+    if (params_size > SHM_RING_PARAMS_MAX || slot->format > 1 ||
+        slot->priority >= kJobPriorityCount) {
+      fail_slot(index, "malformed job");
+      continue;
+    }
+    char target[32];
+    snprintf(target, sizeof(target), "shm:%u", index);
+    // The parameters are copied, so a misbehaving client cannot change them
+    // while the job runs.
+    uint32_t retry_after_ms;
+    if (!template_job_send(slot->template_id, slot->format,
+                           (JobPriority)slot->priority, target,
+                           slot->params, params_size, handle_slot_done,
+                           (void *)(uintptr_t)index, &retry_after_ms)) {
+      slot->retry_after_ms = retry_after_ms;
+      fail_slot(index, retry_after_ms > 0 ? "engine overloaded"
+                                          : "cannot queue template job");
+    }
+  }
+}
+
+static void serve_connections(void) {
+  for (;;) {
+    int client = accept4(g_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client < 0)
+      return;
+    int fds[2] = {g_memfd, g_eventfd};
+    char byte = 0;
+    struct iovec iov = {&byte, 1};
+    union {
+      struct cmsghdr header;
+      char buffer[CMSG_SPACE(sizeof(fds))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+    if (sendmsg(client, &message, MSG_NOSIGNAL) != 1)
+      fprintf(stderr, "Shared-memory ring: cannot hand out the ring: %s\n",
+              strerror(errno));
+    close(client);
+  }
+}
+
+bool shm_ring_idle(int timeout_ms) {
+  if (!g_ring)
+    return false;
+  struct pollfd fds[2] = {{g_eventfd, POLLIN, 0}, {g_listen_fd, POLLIN, 0}};
+  if (poll(fds, 2, timeout_ms) > 0) {
+    if (fds[0].revents & POLLIN) {
+      uint64_t count;
+      ssize_t drained = read(g_eventfd, &count, sizeof(count));
+      (void)drained;
+    }
+    if (fds[1].revents & POLLIN)
+      serve_connections();
+  }
+  shm_ring_poll();
+  return true;
+}
+
+void shm_ring_wake(void) {
+  if (g_eventfd < 0)
+    return;
+  uint64_t one = 1;
+  ssize_t written = write(g_eventfd, &one, sizeof(one));
+  (void)written;
+}
+
+void shm_ring_install(void) {
+  const char *path = getenv("HEADLESS_SHM_RING");
+  if (!path || *path == '\0')
+    return;
+  if (strlen(path) >= sizeof(g_socket_path)) {
+    fprintf(stderr, "Shared-memory ring: socket path is too long\n");
+    return;
+  }
+  uint32_t slots = (uint32_t)env_number("HEADLESS_SHM_SLOTS",
+                                        SHM_DEFAULT_SLOTS, 1024);
+  uint64_t capacity =
+      (uint64_t)env_number("HEADLESS_SHM_RESULT_MB", SHM_DEFAULT_RESULT_MB,
+                           4096) << 20;
+  size_t header = sizeof(ShmRing) + (size_t)slots * sizeof(ShmRingSlot);
+  size_t results_offset = (header + 4095) & ~(size_t)4095;
+  size_t size = results_offset + (size_t)slots * capacity;
+
+  g_memfd = (int)syscall(SYS_memfd_create, "headless-ring", MFD_CLOEXEC);
+  if (g_memfd < 0 || ftruncate(g_memfd, (off_t)size) != 0) {
+    fprintf(stderr, "Shared-memory ring: cannot create memfd: %s\n",
+            strerror(errno));
+    shm_ring_shutdown();
+    return;
+  }
+  void *mapping =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, g_memfd, 0);
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "Shared-memory ring: cannot map memfd: %s\n",
+            strerror(errno));
+    shm_ring_shutdown();
+    return;
+  }
+  g_ring = (ShmRing *)mapping;
+  g_ring->slot_count = slots;
+  g_ring->result_capacity = capacity;
+  g_ring->results_offset = results_offset;
+  g_ring->mapping_size = size;
+  for (uint32_t i = 0; i < slots; ++i)
+    g_ring->slots[i].sequence = i;
+  g_ring->version = SHM_RING_VERSION;
+  __atomic_store_n(&g_ring->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+
+  g_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  g_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path, path, strlen(path));
+  unlink(path);
+  snprintf(g_socket_path, sizeof(g_socket_path), "%s", path);
+  // Restricted before listen, so nobody connects while it is still open to
+  // everyone the umask lets in.
+  const char *mode_value = getenv("HEADLESS_SHM_MODE");
+  if (mode_value && *mode_value == '\0')
+    mode_value = NULL;
+  char *mode_end = NULL;
+  unsigned long mode =
+      mode_value ? strtoul(mode_value, &mode_end, 8) : SHM_DEFAULT_SOCKET_MODE;
+  if (mode_value && (*mode_end != '\0' || mode > 0777)) {
+    fprintf(stderr, "Ignoring HEADLESS_SHM_MODE=%s: not an octal mode\n",
+            mode_value);
+    mode = SHM_DEFAULT_SOCKET_MODE;
+  }
+  if (g_eventfd < 0 || g_listen_fd < 0 ||
+      bind(g_listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      chmod(path, (mode_t)mode) != 0 || listen(g_listen_fd, 16) != 0) {
+    fprintf(stderr, "Shared-memory ring: cannot listen on %s: %s\n", path,
+            strerror(errno));
+    shm_ring_shutdown();
+    return;
+  }
+  byte_sink_register_scheme("shm", open_slot_sink);
+  fprintf(stdout, "Shared-memory ring: %s (%u slots of %llu MB)\n", path,
+          slots, (unsigned long long)(capacity >> 20));
+}
+
+void shm_ring_abandon(const char *reason) {
+  if (!g_ring)
+    return;
+  // Pairs with the check in shm_ring_submit_with_priority: either the client
+  // sees the ring closed, or this sees its slot queued.
+  __atomic_store_n(&g_ring->closed, 1, __ATOMIC_SEQ_CST);
+  for (uint32_t i = 0; i < g_ring->slot_count; ++i) {
+    uint32_t state = __atomic_load_n(&g_ring->slots[i].state, __ATOMIC_SEQ_CST);
+    if (state == kShmSlotQueued || state == kShmSlotRendering)
+      fail_slot(i, reason);
+  }
+}
+
+void shm_ring_shutdown(void) {
+  // Clients blocked in shm_ring_wait would otherwise wait forever.
+  shm_ring_abandon("shutting down");
+  if (g_listen_fd >= 0) {
+    close(g_listen_fd);
+    if (g_socket_path[0])
+      unlink(g_socket_path);
+  }
+  if (g_eventfd >= 0)
+    close(g_eventfd);
+  if (g_ring)
+    munmap(g_ring, (size_t)g_ring->mapping_size);
+  if (g_memfd >= 0)
+    close(g_memfd);
+  g_ring = NULL;
+  g_listen_fd = g_eventfd = g_memfd = -1;
+  g_socket_path[0] = '\0';
+}
+
+#else
+
+void shm_ring_install(void) {}
+
+void shm_ring_poll(void) {}
+
+bool shm_ring_idle(int timeout_ms) {
+  (void)timeout_ms;
+  return false;
+}
+
+void shm_ring_wake(void) {}
+
+void shm_ring_abandon(const char *reason) { (void)reason; }
+
+void shm_ring_shutdown(void) {}
+
+#endif // __linux__
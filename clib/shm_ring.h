@@ -0,0 +1,261 @@
+// Shared-memory job transport for clients on the same host (Linux only).
+//
+// Setting HEADLESS_SHM_RING to a socket path enables it. The embedder then
+// creates a memfd holding a ring of job slots followed by one result buffer
+// per slot, and hands the memfd and an eventfd to every client that connects
+// to the socket (SCM_RIGHTS). A client maps the memfd, claims a slot, writes
+// a job into it and signals the eventfd. The embedder runs the job as a
+// template job (see template_jobs.h) whose output stage writes straight into
+// the slot's result buffer, then marks the slot done and wakes the client
+// through a futex on the slot's state word. No image byte crosses a socket.
+//
+// The ring is a bounded multi-producer queue. Every slot carries a sequence
+// number: a slot whose sequence equals a ticket is free for that ticket,
+// `ticket + 1` marks it queued for the embedder, and the client hands it
+// back by setting `ticket + slot_count` once it consumed the result. The
+// client side needs nothing but this header; see `shm_ring_connect` and the
+// helpers after it.
+//
+// HEADLESS_SHM_SLOTS (default 16) and HEADLESS_SHM_RESULT_MB (default 16,
+// per slot) size the ring. Jobs rendered into a slot use the target
+// `shm:<slot>`, which only the embedder opens.
+//
+// Whoever can connect to the socket can write into the ring, so the socket
+// is only accessible to the embedder's user unless HEADLESS_SHM_MODE (octal,
+// default 600) says otherwise.
+//
+// When the embedder goes away it closes the ring: it sets `closed` and fails
+// every job still queued or rendering. Submitting into a closed ring fails.
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SHM_RING_MAGIC 0x474e5248u // "HRNG"
+#define SHM_RING_VERSION 3
+#define SHM_RING_PARAMS_MAX 2048
+
+enum {
+  kShmSlotIdle = 0,
+  kShmSlotQueued = 1,
+  kShmSlotRendering = 2,
+  kShmSlotDone = 3,
+  kShmSlotFailed = 4,
+};
+
+typedef struct {
+  uint64_t sequence;
+  // One of the kShmSlot* states; also the futex clients wait on.
+  uint32_t state;
+  uint32_t template_id;
+  uint32_t params_size;
+  // 0 PNG, 1 raw straight-alpha RGBA.
+  uint8_t format;
+  // A JobPriority of template_jobs.h: 0 interactive, 1 batch.
+  uint8_t priority;
+  uint8_t reserved[2];
+  // Bytes in the result buffer: the output, or a UTF-8 reason on failure.
+  uint64_t result_size;
+  uint32_t result_width;
+  uint32_t result_height;
+  // On failure, when the engine refused the job for being overloaded: how
+  // many milliseconds to wait before submitting again (see admission.h).
+  // 0 when retrying will not help.
+  uint32_t retry_after_ms;
+  // Template parameters in the encoding of template_jobs.h.
+  uint8_t params[SHM_RING_PARAMS_MAX];
+} ShmRingSlot;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slot_count;
+  // Set once the embedder no longer serves the ring.
+  uint32_t closed;
+  uint64_t result_capacity;
+  // From the start of the mapping; slot i's buffer is at
+  // `results_offset + i * result_capacity`.
+  uint64_t results_offset;
+  uint64_t mapping_size;
+  uint8_t padding0[24];
+  // Shared by the clients; on its own cache line.
+  uint64_t enqueue_ticket;
+  uint8_t padding1[56];
+  // Only advanced by the embedder.
+  uint64_t dequeue_ticket;
+  uint8_t padding2[56];
+  ShmRingSlot slots[];
+} ShmRing;
+
+// Embedder side. All of these run on the platform thread.
+void shm_ring_install(void);
+// Hands queued slots to the template job dispatcher. Cheap when idle.
+void shm_ring_poll(void);
+// Waits up to `timeout_ms` for clients to connect or signal new jobs and
+// serves them. Returns false, without waiting, when the ring is disabled.
+bool shm_ring_idle(int timeout_ms);
+// Ends a wait in shm_ring_idle early. Safe from any thread.
+void shm_ring_wake(void);
+// Closes the ring and fails every queued or running job with `reason`, for
+// when the engine is about to go away without finishing them (see
+// watchdog.h).
+void shm_ring_abandon(const char *reason);
+void shm_ring_shutdown(void);
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Client side: connects to the embedder's socket and maps the ring. On
+// success `notify_fd` receives the eventfd that `shm_ring_submit` signals.
+static inline ShmRing *shm_ring_connect(const char *path, int *notify_fd) {
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0)
+    return NULL;
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+  if (connect(sock, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    close(sock);
+    return NULL;
+  }
+  char byte;
+  struct iovec iov = {&byte, 1};
+  union {
+    struct cmsghdr header;
+    char buffer[CMSG_SPACE(2 * sizeof(int))];
+  } control;
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+  ssize_t received = recvmsg(sock, &message, MSG_CMSG_CLOEXEC);
+  close(sock);
+  struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+  if (received != 1 || !header || header->cmsg_type != SCM_RIGHTS ||
+      header->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+    return NULL;
+  int fds[2];
+  memcpy(fds, CMSG_DATA(header), sizeof(fds));
+
+  struct stat info;
+  void *mapping = MAP_FAILED;
+  if (fstat(fds[0], &info) == 0 && (size_t)info.st_size >= sizeof(ShmRing))
+    mapping = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fds[0], 0);
+  close(fds[0]);
+  ShmRing *ring = (ShmRing *)mapping;
+  if (mapping == MAP_FAILED || ring->magic != SHM_RING_MAGIC ||
+      ring->version != SHM_RING_VERSION) {
+    if (mapping != MAP_FAILED)
+      munmap(mapping, (size_t)info.st_size);
+    close(fds[1]);
+    return NULL;
+  }
+  *notify_fd = fds[1];
+  return ring;
+}
+
+static inline void shm_ring_disconnect(ShmRing *ring, int notify_fd) {
+  close(notify_fd);
+  munmap(ring, (size_t)ring->mapping_size);
+}
+
+// Queues a job and returns its slot, or -1 when the ring is full or closed,
+// or the parameters do not fit.
+static inline int shm_ring_submit_with_priority(ShmRing *ring, int notify_fd,
+                                                uint32_t template_id,
+                                                uint8_t format,
+                                                uint8_t priority,
+                                                const void *params,
+                                                uint32_t params_size) {
+  if (params_size > SHM_RING_PARAMS_MAX ||
+      __atomic_load_n(&ring->closed, __ATOMIC_SEQ_CST))
+    return -1;
+  uint64_t ticket = __atomic_load_n(&ring->enqueue_ticket, __ATOMIC_RELAXED);
+  ShmRingSlot *slot;
+  for (;;) {
+    slot = &ring->slots[ticket % ring->slot_count];
+    uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    if (sequence == ticket) {
+      if (__atomic_compare_exchange_n(&ring->enqueue_ticket, &ticket,
+                                      ticket + 1, true, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED))
+        break;
+    } else if (sequence < ticket) {
+      return -1;
+    } else {
+      ticket = __atomic_load_n(&ring->enqueue_ticket, __ATOMIC_RELAXED);
+    }
+  }
+  slot->template_id = template_id;
+  slot->format = format;
+  slot->priority = priority;
+  slot->params_size = params_size;
+  if (params_size > 0)
+    memcpy(slot->params, params, params_size);
+  slot->result_size = 0;
+  slot->retry_after_ms = 0;
+  __atomic_store_n(&slot->state, kShmSlotQueued, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&slot->sequence, ticket + 1, __ATOMIC_RELEASE);
+  // The embedder sets `closed` before failing the queued slots; a ring
+  // closed in between did not see this one, so it is failed here.
+  uint32_t queued = kShmSlotQueued;
+  if (__atomic_load_n(&ring->closed, __ATOMIC_SEQ_CST) &&
+      __atomic_compare_exchange_n(&slot->state, &queued, kShmSlotFailed,
+                                  false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    return -1;
+  uint64_t one = 1;
+  ssize_t written = write(notify_fd, &one, sizeof(one));
+  (void)written;
+  return (int)(ticket % ring->slot_count);
+}
+
+static inline int shm_ring_submit(ShmRing *ring, int notify_fd,
+                                  uint32_t template_id, uint8_t format,
+                                  const void *params, uint32_t params_size) {
+  return shm_ring_submit_with_priority(ring, notify_fd, template_id, format, 0,
+                                       params, params_size);
+}
+
+// Blocks until the job in `slot` finished; returns whether it succeeded.
+static inline bool shm_ring_wait(ShmRing *ring, int slot) {
+  uint32_t *state = &ring->slots[slot].state;
+  for (;;) {
+    uint32_t value = __atomic_load_n(state, __ATOMIC_ACQUIRE);
+    if (value == kShmSlotDone || value == kShmSlotFailed)
+      return value == kShmSlotDone;
+    syscall(SYS_futex, state, FUTEX_WAIT, value, NULL, NULL, 0);
+  }
+}
+
+// The output (or failure reason) of a finished job, valid until release.
+static inline const uint8_t *shm_ring_result(const ShmRing *ring, int slot,
+                                             size_t *size) {
+  *size = (size_t)ring->slots[slot].result_size;
+  return (const uint8_t *)ring + ring->results_offset +
+         (size_t)slot * ring->result_capacity;
+}
+
+static inline void shm_ring_release(ShmRing *ring, int slot) {
+  ShmRingSlot *entry = &ring->slots[slot];
+  uint64_t sequence = __atomic_load_n(&entry->sequence, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->state, kShmSlotIdle, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->sequence, sequence - 1 + ring->slot_count,
+                   __ATOMIC_RELEASE);
+}
+#endif // __linux__
+
+#endif // SHM_RING_H
@@ -0,0 +1,321 @@
+#include "standard_codec.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Container nesting is bounded so hostile input cannot exhaust the stack.
+#define STD_MAX_DEPTH 64
+
+static size_t element_size(StdValueType type) {
+  switch (type) {
+  case kStdUint8List:
+    return 1;
+  case kStdInt32List:
+  case kStdFloat32List:
+    return 4;
+  case kStdInt64List:
+  case kStdFloat64List:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+StdReader std_reader(const uint8_t *data, size_t size) {
+  StdReader reader = {data, size, 0, true};
+  return reader;
+}
+
+static const uint8_t *read_bytes(StdReader *reader, size_t count) {
+  if (!reader->ok || reader->size - reader->offset < count) {
+    reader->ok = false;
+    return NULL;
+  }
+  const uint8_t *bytes = reader->data + reader->offset;
+  reader->offset += count;
+  return bytes;
+}
+
+static uint64_t read_le(StdReader *reader, size_t count) {
+  const uint8_t *bytes = read_bytes(reader, count);
+  uint64_t value = 0;
+  for (size_t i = count; bytes && i > 0; --i)
+    value = (value << 8) | bytes[i - 1];
+  return value;
+}
+
+// Alignment is relative to the start of the message.
+static void read_align(StdReader *reader, size_t alignment) {
+  size_t padding = (alignment - reader->offset % alignment) % alignment;
+  read_bytes(reader, padding);
+}
+
+static size_t read_size(StdReader *reader) {
+  const uint8_t *first = read_bytes(reader, 1);
+  if (!first)
+    return 0;
+  if (*first < 254)
+    return *first;
+  return (size_t)read_le(reader, *first == 254 ? 2 : 4);
+}
+
+bool std_read_value(StdReader *reader, StdValue *out) {
+  const uint8_t *tag = read_bytes(reader, 1);
+  if (!tag)
+    return false;
+  memset(out, 0, sizeof(*out));
+  out->type = (StdValueType)*tag;
+  switch (out->type) {
+  case kStdNull:
+    break;
+  case kStdTrue:
+  case kStdFalse:
+    out->as.boolean = out->type == kStdTrue;
+    break;
+  case kStdInt32:
+    out->as.integer = (int32_t)(uint32_t)read_le(reader, 4);
+    break;
+  case kStdInt64:
+    out->as.integer = (int64_t)read_le(reader, 8);
+    break;
+  case kStdFloat64: {
+    read_align(reader, 8);
+    uint64_t bits = read_le(reader, 8);
+    memcpy(&out->as.float64, &bits, sizeof(bits));
+    break;
+  }
+  case kStdLargeInt:
+  case kStdString: {
+    size_t length = read_size(reader);
+    out->as.string.data = (const char *)read_bytes(reader, length);
+    out->as.string.length = length;
+    break;
+  }
+  case kStdUint8List:
+  case kStdInt32List:
+  case kStdInt64List:
+  case kStdFloat32List:
+  case kStdFloat64List: {
+    size_t count = read_size(reader);
+    size_t size = element_size(out->type);
+    read_align(reader, size);
+    if (reader->ok && count > (reader->size - reader->offset) / size) {
+      reader->ok = false;
+      break;
+    }
+    out->as.typed.data = read_bytes(reader, count * size);
+    out->as.typed.count = count;
+    break;
+  }
+  case kStdList:
+  case kStdMap:
+    out->as.count = read_size(reader);
+    break;
+  default:
+    reader->ok = false;
+    break;
+  }
+  return reader->ok;
+}
+
+static bool skip_value(StdReader *reader, int depth) {
+  StdValue value;
+  if (depth > STD_MAX_DEPTH) {
+    reader->ok = false;
+    return false;
+  }
+  if (!std_read_value(reader, &value))
+    return false;
+  if (value.type != kStdList && value.type != kStdMap)
+    return true;
+  size_t children = value.type == kStdMap ? value.as.count * 2 : value.as.count;
+  // Every element takes at least one byte, which bounds bogus counts.
+  if (children > reader->size - reader->offset) {
+    reader->ok = false;
+    return false;
+  }
+  for (size_t i = 0; i < children; ++i) {
+    if (!skip_value(reader, depth + 1))
+      return false;
+  }
+  return true;
+}
+
+bool std_skip_value(StdReader *reader) { return skip_value(reader, 0); }
+
+void std_writer_init(StdWriter *writer) {
+  memset(writer, 0, sizeof(*writer));
+  writer->ok = true;
+}
+
+void std_writer_release(StdWriter *writer) {
+  free(writer->data);
+  memset(writer, 0, sizeof(*writer));
+}
+
+static uint8_t *write_grow(StdWriter *writer, size_t count) {
+  if (!writer->ok)
+    return NULL;
+  if (writer->capacity - writer->size < count) {
+    size_t capacity = writer->capacity == 0 ? 256 : writer->capacity * 2;
+    while (capacity - writer->size < count) {
+      if (capacity > SIZE_MAX / 2) {
+        writer->ok = false;
+        return NULL;
+      }
+      capacity *= 2;
+    }
+    uint8_t *data = (uint8_t *)realloc(writer->data, capacity);
+    if (!data) {
+      writer->ok = false;
+      return NULL;
+    }
+    writer->data = data;
+    writer->capacity = capacity;
+  }
+  uint8_t *out = writer->data + writer->size;
+  writer->size += count;
+  return out;
+}
+
+static void write_le(StdWriter *writer, uint64_t value, size_t count) {
+  uint8_t *out = write_grow(writer, count);
+  for (size_t i = 0; out && i < count; ++i)
+    out[i] = (uint8_t)(value >> (8 * i));
+}
+
+static void write_tag(StdWriter *writer, StdValueType type) {
+  write_le(writer, (uint64_t)type, 1);
+}
+
+static void write_align(StdWriter *writer, size_t alignment) {
+  size_t padding = (alignment - writer->size % alignment) % alignment;
+  uint8_t *out = write_grow(writer, padding);
+  if (out && padding > 0)
+    memset(out, 0, padding);
+}
+
+static void write_size(StdWriter *writer, size_t size) {
+  if (size < 254) {
+    write_le(writer, size, 1);
+  } else if (size <= 0xffff) {
+    write_le(writer, 254, 1);
+    write_le(writer, size, 2);
+  } else {
+    write_le(writer, 255, 1);
+    write_le(writer, size, 4);
+  }
+}
+
+void std_write_null(StdWriter *writer) { write_tag(writer, kStdNull); }
+
+void std_write_bool(StdWriter *writer, bool value) {
+  write_tag(writer, value ? kStdTrue : kStdFalse);
+}
+
+void std_write_int(StdWriter *writer, int64_t value) {
+  if (value >= INT32_MIN && value <= INT32_MAX) {
+    write_tag(writer, kStdInt32);
+    write_le(writer, (uint32_t)(int32_t)value, 4);
+  } else {
+    write_tag(writer, kStdInt64);
+    write_le(writer, (uint64_t)value, 8);
+  }
+}
+
+void std_write_float64(StdWriter *writer, double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  write_tag(writer, kStdFloat64);
+  write_align(writer, 8);
+  write_le(writer, bits, 8);
+}
+
+void std_write_string(StdWriter *writer, const char *utf8, size_t length) {
+  write_tag(writer, kStdString);
+  write_size(writer, length);
+  uint8_t *out = write_grow(writer, length);
+  if (out && length > 0)
+    memcpy(out, utf8, length);
+}
+
+void *std_write_list_reserve(StdWriter *writer, StdValueType type,
+                             size_t count) {
+  size_t size = element_size(type);
+  if (size == 0 || count > UINT32_MAX) {
+    writer->ok = false;
+    return NULL;
+  }
+  write_tag(writer, type);
+  write_size(writer, count);
+  write_align(writer, size);
+  return write_grow(writer, count * size);
+}
+
+static void write_typed(StdWriter *writer, StdValueType type, const void *data,
+                        size_t count) {
+  void *out = std_write_list_reserve(writer, type, count);
+  if (out && count > 0)
+    memcpy(out, data, count * element_size(type));
+}
+
+void std_write_uint8_list(StdWriter *writer, const uint8_t *data,
+                          size_t count) {
+  write_typed(writer, kStdUint8List, data, count);
+}
+
+void std_write_int32_list(StdWriter *writer, const int32_t *data,
+                          size_t count) {
+  write_typed(writer, kStdInt32List, data, count);
+}
+
+void std_write_int64_list(StdWriter *writer, const int64_t *data,
+                          size_t count) {
+  write_typed(writer, kStdInt64List, data, count);
+}
+
+void std_write_float32_list(StdWriter *writer, const float *data,
+                            size_t count) {
+  write_typed(writer, kStdFloat32List, data, count);
+}
+
+void std_write_float64_list(StdWriter *writer, const double *data,
+                            size_t count) {
+  write_typed(writer, kStdFloat64List, data, count);
+}
+
+void std_write_list_header(StdWriter *writer, size_t count) {
+  write_tag(writer, kStdList);
+  write_size(writer, count);
+}
+
+void std_write_map_header(StdWriter *writer, size_t count) {
+  write_tag(writer, kStdMap);
+  write_size(writer, count);
+}
+
+bool std_read_method_call(StdReader *reader, StdValue *method,
+                          StdValue *arguments) {
+  if (!std_read_value(reader, method))
+    return false;
+  if (method->type != kStdString) {
+    reader->ok = false;
+    return false;
+  }
+  return std_read_value(reader, arguments);
+}
+
+void std_write_success_envelope(StdWriter *writer) {
+  write_le(writer, 0, 1);
+}
+
+void std_write_error_envelope(StdWriter *writer, const char *code,
+                              const char *message) {
+  write_le(writer, 1, 1);
+  std_write_string(writer, code, strlen(code));
+  if (message)
+    std_write_string(writer, message, strlen(message));
+  else
+    std_write_null(writer);
+  std_write_null(writer);
+}
@@ -0,0 +1,125 @@
+// Flutter's StandardMessageCodec (and the StandardMethodCodec envelopes on
+// top of it), for channels whose Dart side uses the standard codecs.
+//
+// Decoding is a pull parser over the message buffer and never allocates:
+// strings and typed lists are returned as views into the message, and lists
+// and maps only report their length, after which their elements are read
+// with further `std_read_value` calls. The codec aligns typed list payloads
+// to their element size, so the views can be used as `int32_t *`, `double *`
+// etc. directly as long as the message buffer itself is 8-byte aligned,
+// which engine-allocated buffers are.
+//
+// Encoding appends to a growable buffer. `std_write_*_list_reserve` returns
+// the (aligned) space for a typed list inside the message, so large payloads
+// such as pixels can be produced in place instead of being built elsewhere
+// and copied in.
+
+#ifndef STANDARD_CODEC_H
+#define STANDARD_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+  kStdNull = 0,
+  kStdTrue = 1,
+  kStdFalse = 2,
+  kStdInt32 = 3,
+  kStdInt64 = 4,
+  // Hex string of an integer beyond 64 bits; no longer written by Dart.
+  kStdLargeInt = 5,
+  kStdFloat64 = 6,
+  kStdString = 7,
+  kStdUint8List = 8,
+  kStdInt32List = 9,
+  kStdInt64List = 10,
+  kStdFloat64List = 11,
+  kStdList = 12,
+  kStdMap = 13,
+  kStdFloat32List = 14,
+} StdValueType;
+
+typedef struct {
+  StdValueType type;
+  union {
+    bool boolean;
+    // kStdInt32 and kStdInt64.
+    int64_t integer;
+    double float64;
+    // kStdString and kStdLargeInt. Not NUL-terminated.
+    struct {
+      const char *data;
+      size_t length;
+    } string;
+    // Typed lists; `count` is in elements.
+    struct {
+      const void *data;
+      size_t count;
+    } typed;
+    // kStdList: `count` elements follow. kStdMap: `count` key/value pairs
+    // follow, key first.
+    size_t count;
+  } as;
+} StdValue;
+
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  size_t offset;
+  bool ok;
+} StdReader;
+
+StdReader std_reader(const uint8_t *data, size_t size);
+// Reads the next value. Returns false (and clears `ok`) on malformed input.
+bool std_read_value(StdReader *reader, StdValue *out);
+// Skips the next value including the elements of lists and maps.
+bool std_skip_value(StdReader *reader);
+
+typedef struct {
+  uint8_t *data;
+  size_t size;
+  size_t capacity;
+  // Cleared when a write ran out of memory.
+  bool ok;
+} StdWriter;
+
+void std_writer_init(StdWriter *writer);
+void std_writer_release(StdWriter *writer);
+
+void std_write_null(StdWriter *writer);
+void std_write_bool(StdWriter *writer, bool value);
+// Written as int32 when it fits, like the Dart encoder.
+void std_write_int(StdWriter *writer, int64_t value);
+void std_write_float64(StdWriter *writer, double value);
+void std_write_string(StdWriter *writer, const char *utf8, size_t length);
+void std_write_uint8_list(StdWriter *writer, const uint8_t *data,
+                          size_t count);
+void std_write_int32_list(StdWriter *writer, const int32_t *data,
+                          size_t count);
+void std_write_int64_list(StdWriter *writer, const int64_t *data,
+                          size_t count);
+void std_write_float32_list(StdWriter *writer, const float *data,
+                            size_t count);
+void std_write_float64_list(StdWriter *writer, const double *data,
+                            size_t count);
+// Follow with `count` values (lists) or `count` key/value pairs (maps).
+void std_write_list_header(StdWriter *writer, size_t count);
+void std_write_map_header(StdWriter *writer, size_t count);
+
+// Writes a typed list header and returns room for `count` elements to be
+// filled in place, or NULL when out of memory. The pointer is only valid
+// until the next write.
+void *std_write_list_reserve(StdWriter *writer, StdValueType type,
+                             size_t count);
+
+// StandardMethodCodec: a call is the method name (a string) followed by the
+// arguments.
+bool std_read_method_call(StdReader *reader, StdValue *method,
+                          StdValue *arguments);
+// A success envelope is 0 followed by the result; follow with one value.
+void std_write_success_envelope(StdWriter *writer);
+void std_write_error_envelope(StdWriter *writer, const char *code,
+                              const char *message);
+
+#endif // STANDARD_CODEC_H
@@ -0,0 +1,231 @@
+// Round-trip test for the StandardMessageCodec port (see standard_codec.h),
+// run without the engine.
+//
+// test/fixtures/standard_codec_message.bin holds the bytes Dart's
+// StandardMessageCodec writes for the list below; test/src/
+// standard_codec_test.dart checks that it still does. This test decodes the
+// fixture, checks every value, skips over it as a whole, and encodes the same
+// values again, which must give the fixture byte for byte. The list covers
+// every type the Dart side writes, the padding in front of float64 values
+// and typed lists, and sizes with one, three (254) and five (255) byte
+// prefixes:
+//
+//   [null, true, false, 7, -1, 2^31, -2^40, 1.5, 'héllo', 'a' * 253,
+//    'b' * 254, Uint8List(65536) of i & 0xff, Int32List [1, -2, 3],
+//    Int64List [2^40, -5], Float32List [0.5, -2.25],
+//    Float64List [pi, -0.0], {'k': 1, 2: [true]}, 2.0]
+//
+// Usage:
+//   standard_codec_test FIXTURE
+//
+// Exits with 1 on the first mismatch.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "standard_codec.h"
+
+#define LARGE_LIST_SIZE 65536
+
+static const char kHello[] = "h\xc3\xa9llo";
+static const int32_t kInt32s[] = {1, -2, 3};
+static const int64_t kInt64s[] = {1ll << 40, -5};
+static const float kFloat32s[] = {0.5f, -2.25f};
+static const double kFloat64s[] = {3.141592653589793, -0.0};
+
+static const char *g_fixture_path;
+
+static void fail(const char *what, size_t offset) {
+  fprintf(stderr, "%s: %s at byte %zu\n", g_fixture_path, what, offset);
+  exit(1);
+}
+
+static uint8_t *read_fixture(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror(path);
+    exit(1);
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  // malloc'd, so 8-byte aligned like the engine's message buffers.
+  uint8_t *data = (uint8_t *)malloc(length > 0 ? (size_t)length : 1);
+  if (!data || length <= 0 ||
+      fread(data, 1, (size_t)length, file) != (size_t)length) {
+    fprintf(stderr, "%s: cannot read\n", path);
+    exit(1);
+  }
+  fclose(file);
+  *size = (size_t)length;
+  return data;
+}
+
+static StdValue expect_type(StdReader *reader, StdValueType type) {
+  StdValue value;
+  size_t offset = reader->offset;
+  if (!std_read_value(reader, &value))
+    fail("malformed value", offset);
+  if (value.type != type)
+    fail("unexpected type", offset);
+  return value;
+}
+
+static void expect_int(StdReader *reader, StdValueType type, int64_t expected) {
+  size_t offset = reader->offset;
+  if (expect_type(reader, type).as.integer != expected)
+    fail("wrong integer", offset);
+}
+
+static void expect_float64(StdReader *reader, double expected) {
+  size_t offset = reader->offset;
+  StdValue value = expect_type(reader, kStdFloat64);
+  if (memcmp(&value.as.float64, &expected, sizeof(expected)) != 0)
+    fail("wrong float64", offset);
+  // The payload ends the value and starts at a multiple of 8.
+  if ((reader->offset - 8) % 8 != 0)
+    fail("float64 not aligned", offset);
+}
+
+static void expect_string(StdReader *reader, const char *expected,
+                          size_t length) {
+  size_t offset = reader->offset;
+  StdValue value = expect_type(reader, kStdString);
+  if (value.as.string.length != length ||
+      memcmp(value.as.string.data, expected, length) != 0)
+    fail("wrong string", offset);
+}
+
+static void expect_repeated(StdReader *reader, char c, size_t length) {
+  char *expected = (char *)malloc(length);
+  memset(expected, c, length);
+  expect_string(reader, expected, length);
+  free(expected);
+}
+
+static void expect_typed(StdReader *reader, StdValueType type,
+                         const void *expected, size_t count,
+                         size_t element_size) {
+  size_t offset = reader->offset;
+  StdValue value = expect_type(reader, type);
+  if (value.as.typed.count != count ||
+      memcmp(value.as.typed.data, expected, count * element_size) != 0)
+    fail("wrong typed list", offset);
+  // The views are meant to be used as element pointers directly.
+  if ((uintptr_t)value.as.typed.data % element_size != 0)
+    fail("typed list not aligned", offset);
+}
+
+static uint8_t *large_list(void) {
+  uint8_t *bytes = (uint8_t *)malloc(LARGE_LIST_SIZE);
+  for (size_t i = 0; i < LARGE_LIST_SIZE; ++i)
+    bytes[i] = (uint8_t)i;
+  return bytes;
+}
+
+static void check_decode(const uint8_t *data, size_t size) {
+  uint8_t *bytes = large_list();
+  StdReader reader = std_reader(data, size);
+  if (expect_type(&reader, kStdList).as.count != 18)
+    fail("wrong list length", 0);
+  expect_type(&reader, kStdNull);
+  if (!expect_type(&reader, kStdTrue).as.boolean ||
+      expect_type(&reader, kStdFalse).as.boolean)
+    fail("wrong bool", reader.offset);
+  expect_int(&reader, kStdInt32, 7);
+  expect_int(&reader, kStdInt32, -1);
+  expect_int(&reader, kStdInt64, 2147483648ll);
+  expect_int(&reader, kStdInt64, -(1ll << 40));
+  expect_float64(&reader, 1.5);
+  expect_string(&reader, kHello, sizeof(kHello) - 1);
+  expect_repeated(&reader, 'a', 253);
+  expect_repeated(&reader, 'b', 254);
+  expect_typed(&reader, kStdUint8List, bytes, LARGE_LIST_SIZE, 1);
+  expect_typed(&reader, kStdInt32List, kInt32s, 3, sizeof(int32_t));
+  expect_typed(&reader, kStdInt64List, kInt64s, 2, sizeof(int64_t));
+  expect_typed(&reader, kStdFloat32List, kFloat32s, 2, sizeof(float));
+  expect_typed(&reader, kStdFloat64List, kFloat64s, 2, sizeof(double));
+  if (expect_type(&reader, kStdMap).as.count != 2)
+    fail("wrong map length", reader.offset);
+  expect_string(&reader, "k", 1);
+  expect_int(&reader, kStdInt32, 1);
+  expect_int(&reader, kStdInt32, 2);
+  if (expect_type(&reader, kStdList).as.count != 1)
+    fail("wrong list length", reader.offset);
+  expect_type(&reader, kStdTrue);
+  expect_float64(&reader, 2.0);
+  if (reader.offset != size)
+    fail("trailing bytes", reader.offset);
+  free(bytes);
+
+  reader = std_reader(data, size);
+  if (!std_skip_value(&reader) || reader.offset != size)
+    fail("skip stopped early", reader.offset);
+}
+
+static void check_encode(const uint8_t *data, size_t size) {
+  uint8_t *bytes = large_list();
+  char repeated[254];
+  StdWriter writer;
+  std_writer_init(&writer);
+  std_write_list_header(&writer, 18);
+  std_write_null(&writer);
+  std_write_bool(&writer, true);
+  std_write_bool(&writer, false);
+  std_write_int(&writer, 7);
+  std_write_int(&writer, -1);
+  std_write_int(&writer, 2147483648ll);
+  std_write_int(&writer, -(1ll << 40));
+  std_write_float64(&writer, 1.5);
+  std_write_string(&writer, kHello, sizeof(kHello) - 1);
+  memset(repeated, 'a', 253);
+  std_write_string(&writer, repeated, 253);
+  memset(repeated, 'b', 254);
+  std_write_string(&writer, repeated, 254);
+  std_write_uint8_list(&writer, bytes, LARGE_LIST_SIZE);
+  std_write_int32_list(&writer, kInt32s, 3);
+  std_write_int64_list(&writer, kInt64s, 2);
+  std_write_float32_list(&writer, kFloat32s, 2);
+  // Filled in place, as a pixel producer would.
+  double *doubles =
+      (double *)std_write_list_reserve(&writer, kStdFloat64List, 2);
+  if (doubles)
+    memcpy(doubles, kFloat64s, sizeof(kFloat64s));
+  std_write_map_header(&writer, 2);
+  std_write_string(&writer, "k", 1);
+  std_write_int(&writer, 1);
+  std_write_int(&writer, 2);
+  std_write_list_header(&writer, 1);
+  std_write_bool(&writer, true);
+  std_write_float64(&writer, 2.0);
+  free(bytes);
+
+  if (!writer.ok)
+    fail("out of memory while encoding", writer.size);
+  size_t common = writer.size < size ? writer.size : size;
+  for (size_t i = 0; i < common; ++i) {
+    if (writer.data[i] != data[i])
+      fail("encoding differs", i);
+  }
+  if (writer.size != size)
+    fail("encoding has a different length", common);
+  std_writer_release(&writer);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: standard_codec_test FIXTURE\n");
+    return 1;
+  }
+  g_fixture_path = argv[1];
+  size_t size;
+  uint8_t *data = read_fixture(g_fixture_path, &size);
+  check_decode(data, size);
+  check_encode(data, size);
+  free(data);
+  printf("standard_codec_test: %zu bytes decoded and re-encoded\n", size);
+  return 0;
+}
@@ -0,0 +1,147 @@
+#include "task_queue.h"
+
+#include <stdlib.h>
+
+static bool runs_before(const ScheduledTask *a, const ScheduledTask *b) {
+  if (a->target_time_nanos != b->target_time_nanos)
+    return a->target_time_nanos < b->target_time_nanos;
+  return a->sequence < b->sequence;
+}
+
+static void sift_up(ScheduledTask *heap, size_t index) {
+  ScheduledTask item = heap[index];
+  while (index > 0) {
+    size_t parent = (index - 1) / 2;
+    if (!runs_before(&item, &heap[parent]))
+      break;
+    heap[index] = heap[parent];
+    index = parent;
+  }
+  heap[index] = item;
+}
+
+static void sift_down(ScheduledTask *heap, size_t count, size_t index) {
+  ScheduledTask item = heap[index];
+  for (;;) {
+    size_t child = 2 * index + 1;
+    if (child >= count)
+      break;
+    if (child + 1 < count && runs_before(&heap[child + 1], &heap[child]))
+      child++;
+    if (!runs_before(&heap[child], &item))
+      break;
+    heap[index] = heap[child];
+    index = child;
+  }
+  heap[index] = item;
+}
+
+void task_queue_init(TaskQueue *queue) {
+  platform_mutex_init(&queue->mutex);
+  platform_cond_init(&queue->earlier_deadline);
+  queue->heap = NULL;
+  queue->count = 0;
+  queue->capacity = 0;
+  queue->next_sequence = 0;
+  queue->wake = NULL;
+}
+
+void task_queue_destroy(TaskQueue *queue) {
+  free(queue->heap);
+  queue->heap = NULL;
+  queue->count = queue->capacity = 0;
+  platform_cond_destroy(&queue->earlier_deadline);
+  platform_mutex_destroy(&queue->mutex);
+}
+
+void task_queue_set_wake(TaskQueue *queue, void (*wake)(void)) {
+  queue->wake = wake;
+}
+
+bool task_queue_post(TaskQueue *queue, const FlutterTask *task,
+                     uint64_t target_time_nanos) {
+  platform_mutex_lock(&queue->mutex);
+  if (queue->count == queue->capacity) {
+    size_t capacity = queue->capacity ? queue->capacity * 2 : 64;
+    ScheduledTask *heap =
+        (ScheduledTask *)realloc(queue->heap, capacity * sizeof(ScheduledTask));
+    if (!heap) {
+      platform_mutex_unlock(&queue->mutex);
+      return false;
+    }
+    queue->heap = heap;
+    queue->capacity = capacity;
+  }
+  size_t index = queue->count++;
+  queue->heap[index].task = *task;
+  queue->heap[index].target_time_nanos = target_time_nanos;
+  queue->heap[index].sequence = queue->next_sequence++;
+  sift_up(queue->heap, index);
+  // Only a new earliest task changes how long the platform thread sleeps.
+  bool earliest = queue->heap[0].sequence == queue->next_sequence - 1;
+  platform_mutex_unlock(&queue->mutex);
+  if (earliest) {
+    platform_cond_signal(&queue->earlier_deadline);
+    if (queue->wake)
+      queue->wake();
+  }
+  return true;
+}
+
+bool task_queue_pop_due(TaskQueue *queue, uint64_t now_nanos,
+                        ScheduledTask *out) {
+  platform_mutex_lock(&queue->mutex);
+  bool due = queue->count > 0 && queue->heap[0].target_time_nanos <= now_nanos;
+  if (due) {
+    *out = queue->heap[0];
+    queue->heap[0] = queue->heap[--queue->count];
+    if (queue->count > 0)
+      sift_down(queue->heap, queue->count, 0);
+  }
+  platform_mutex_unlock(&queue->mutex);
+  return due;
+}
+
+static uint64_t time_until_due_locked(TaskQueue *queue, uint64_t now_nanos,
+                                      uint64_t max_wait_nanos) {
+  if (queue->count == 0)
+    return max_wait_nanos;
+  uint64_t target = queue->heap[0].target_time_nanos;
+  if (target <= now_nanos)
+    return 0;
+  return target - now_nanos < max_wait_nanos ? target - now_nanos
+                                             : max_wait_nanos;
+}
+
+uint64_t task_queue_time_until_due(TaskQueue *queue, uint64_t now_nanos,
+                                   uint64_t max_wait_nanos) {
+  platform_mutex_lock(&queue->mutex);
+  uint64_t wait = time_until_due_locked(queue, now_nanos, max_wait_nanos);
+  platform_mutex_unlock(&queue->mutex);
+  return wait;
+}
+
+void task_queue_wait(TaskQueue *queue, uint64_t now_nanos,
+                     uint64_t max_wait_nanos) {
+  platform_mutex_lock(&queue->mutex);
+  uint64_t wait = time_until_due_locked(queue, now_nanos, max_wait_nanos);
+  if (wait > 0)
+    platform_cond_timed_wait(&queue->earlier_deadline, &queue->mutex, wait);
+  platform_mutex_unlock(&queue->mutex);
+}
+
+size_t task_queue_size(TaskQueue *queue) {
+  platform_mutex_lock(&queue->mutex);
+  size_t count = queue->count;
+  platform_mutex_unlock(&queue->mutex);
+  return count;
+}
+
+uint64_t task_queue_overdue(TaskQueue *queue, uint64_t now_nanos) {
+  platform_mutex_lock(&queue->mutex);
+  uint64_t overdue = 0;
+  if (queue->count > 0 && queue->heap[0].target_time_nanos < now_nanos)
+    overdue = now_nanos - queue->heap[0].target_time_nanos;
+  platform_mutex_unlock(&queue->mutex);
+  return overdue;
+}
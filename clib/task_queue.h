@@ -0,0 +1,66 @@
+// Queue of the tasks the engine posts to the platform task runner.
+//
+// The engine posts from any of its threads (UI, raster, IO) while the
+// platform thread pops and runs them, so every call is thread-safe. Tasks
+// live in a binary min-heap ordered by target time, ties in posting order,
+// so posting and popping stay O(log n) with tens of thousands of delayed
+// tasks pending. `task_queue_wait` sleeps until the earliest task is due and
+// is woken early only by a post that moves that deadline forward.
+//
+// task_queue_bench.c measures and stress-tests this queue without the
+// engine.
+
+#ifndef TASK_QUEUE_H
+#define TASK_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "embedder.h"
+#include "platform_thread.h"
+
+typedef struct {
+  FlutterTask task;
+  uint64_t target_time_nanos;
+  // Posting order, to run tasks with the same target time first in, first
+  // out.
+  uint64_t sequence;
+} ScheduledTask;
+
+typedef struct {
+  PlatformMutex mutex;
+  PlatformCond earlier_deadline;
+  ScheduledTask *heap;
+  size_t count;
+  size_t capacity;
+  uint64_t next_sequence;
+  // See task_queue_set_wake.
+  void (*wake)(void);
+} TaskQueue;
+
+void task_queue_init(TaskQueue *queue);
+void task_queue_destroy(TaskQueue *queue);
+// `wake` is also called, from the posting thread, when a post brings the
+// earliest deadline forward, for a platform thread that sleeps somewhere
+// other than task_queue_wait. Call before any task is posted.
+void task_queue_set_wake(TaskQueue *queue, void (*wake)(void));
+
+// Returns false when the queue cannot grow.
+bool task_queue_post(TaskQueue *queue, const FlutterTask *task,
+                     uint64_t target_time_nanos);
+// Pops the earliest task if it is due at `now_nanos`.
+bool task_queue_pop_due(TaskQueue *queue, uint64_t now_nanos,
+                        ScheduledTask *out);
+// Nanoseconds until the earliest task is due, at most `max_wait_nanos`.
+uint64_t task_queue_time_until_due(TaskQueue *queue, uint64_t now_nanos,
+                                   uint64_t max_wait_nanos);
+// Returns once a task is due, after `max_wait_nanos`, or when a post brings
+// the earliest deadline forward, whichever comes first.
+void task_queue_wait(TaskQueue *queue, uint64_t now_nanos,
+                     uint64_t max_wait_nanos);
+size_t task_queue_size(TaskQueue *queue);
+// How long the earliest task has been due at `now_nanos`, or 0.
+uint64_t task_queue_overdue(TaskQueue *queue, uint64_t now_nanos);
+
+#endif // TASK_QUEUE_H
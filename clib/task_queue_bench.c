@@ -0,0 +1,438 @@
+// Microbenchmark and concurrency stress test for the platform task queue
+// (see task_queue.h), run without the engine.
+//
+// The calling thread plays the platform thread: it runs the same pop/wait
+// loop as main.c and "runs" each task through a stub FlutterEngineRunTask
+// that records when the task was dispatched. Producer threads play the
+// engine threads posting work. Scenarios:
+//
+//   producers N   N producers post immediate tasks as fast as they can
+//   pending N     the same with 4 producers, while N delayed tasks spread
+//                 over the next half second are already queued
+//
+// Reported per scenario: posts/s over all producers, dispatch latency of
+// the immediate tasks (post until run, p50/p99/max) and, with pending
+// tasks, how late the delayed tasks ran. Every run also checks that each
+// task ran exactly once, never before its target time, and in posting order
+// among the immediate tasks of one producer; a violation exits with 1.
+//
+// Usage:
+//   task_queue_bench [--tasks N] [--pending N] [--legacy] [--json]
+//
+// --tasks is the number of immediate tasks per producer (default 20000),
+// --pending the number of delayed tasks (default 10000). --legacy runs the
+// sorted array the embedder used before, made thread-safe with a mutex, for
+// comparison.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "embedder.h"
+#include "platform_thread.h"
+#include "task_queue.h"
+
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_SEC 1000000000ULL
+#define MAX_PRODUCERS 8
+#define PENDING_PRODUCERS 4
+#define PENDING_SPREAD_NANOS (500 * NSEC_PER_MSEC)
+
+static uint64_t now_ns(void) {
+#ifdef _WIN32
+  static LARGE_INTEGER frequency = {0};
+  if (frequency.QuadPart == 0)
+    QueryPerformanceFrequency(&frequency);
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)((counter.QuadPart * NSEC_PER_SEC) / frequency.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Queue under test: the task queue, or the legacy sorted array.
+typedef struct {
+  const char *name;
+  void (*init)(void);
+  void (*destroy)(void);
+  bool (*post)(const FlutterTask *task, uint64_t target_time_nanos);
+  bool (*pop_due)(uint64_t now_nanos, ScheduledTask *out);
+  void (*wait)(uint64_t now_nanos, uint64_t max_wait_nanos);
+} QueueOps;
+
+static TaskQueue g_heap;
+
+static void heap_init(void) { task_queue_init(&g_heap); }
+static void heap_destroy(void) { task_queue_destroy(&g_heap); }
+static bool heap_post(const FlutterTask *task, uint64_t target_time_nanos) {
+  return task_queue_post(&g_heap, task, target_time_nanos);
+}
+static bool heap_pop_due(uint64_t now_nanos, ScheduledTask *out) {
+  return task_queue_pop_due(&g_heap, now_nanos, out);
+}
+static void heap_wait(uint64_t now_nanos, uint64_t max_wait_nanos) {
+  task_queue_wait(&g_heap, now_nanos, max_wait_nanos);
+}
+
+static const QueueOps kHeapQueue = {"heap",   heap_init,    heap_destroy,
+                                    heap_post, heap_pop_due, heap_wait};
+
+// The array main.c kept sorted by insertion, with a lock added. Posting
+// shifts every later task and popping moves the whole array down, and
+// nothing wakes the platform thread when a post arrives.
+static PlatformMutex g_legacy_mutex;
+static PlatformCond g_legacy_never_signalled;
+static ScheduledTask *g_legacy_tasks;
+static size_t g_legacy_count;
+static size_t g_legacy_capacity;
+
+static void legacy_init(void) {
+  platform_mutex_init(&g_legacy_mutex);
+  platform_cond_init(&g_legacy_never_signalled);
+  g_legacy_tasks = NULL;
+  g_legacy_count = g_legacy_capacity = 0;
+}
+
+static void legacy_destroy(void) {
+  free(g_legacy_tasks);
+  g_legacy_tasks = NULL;
+  platform_cond_destroy(&g_legacy_never_signalled);
+  platform_mutex_destroy(&g_legacy_mutex);
+}
+
+static bool legacy_post(const FlutterTask *task, uint64_t target_time_nanos) {
+  platform_mutex_lock(&g_legacy_mutex);
+  if (g_legacy_count == g_legacy_capacity) {
+    size_t capacity = g_legacy_capacity ? g_legacy_capacity * 2 : 16;
+    ScheduledTask *tasks = (ScheduledTask *)realloc(
+        g_legacy_tasks, capacity * sizeof(ScheduledTask));
+    if (!tasks) {
+      platform_mutex_unlock(&g_legacy_mutex);
+      return false;
+    }
+    g_legacy_tasks = tasks;
+    g_legacy_capacity = capacity;
+  }
+  size_t i = g_legacy_count;
+  while (i > 0 && g_legacy_tasks[i - 1].target_time_nanos > target_time_nanos) {
+    g_legacy_tasks[i] = g_legacy_tasks[i - 1];
+    --i;
+  }
+  g_legacy_tasks[i].task = *task;
+  g_legacy_tasks[i].target_time_nanos = target_time_nanos;
+  g_legacy_tasks[i].sequence = 0;
+  g_legacy_count++;
+  platform_mutex_unlock(&g_legacy_mutex);
+  return true;
+}
+
+static bool legacy_pop_due(uint64_t now_nanos, ScheduledTask *out) {
+  platform_mutex_lock(&g_legacy_mutex);
+  bool due = g_legacy_count > 0 &&
+             g_legacy_tasks[0].target_time_nanos <= now_nanos;
+  if (due) {
+    *out = g_legacy_tasks[0];
+    memmove(&g_legacy_tasks[0], &g_legacy_tasks[1],
+            (g_legacy_count - 1) * sizeof(ScheduledTask));
+    g_legacy_count--;
+  }
+  platform_mutex_unlock(&g_legacy_mutex);
+  return due;
+}
+
+static void legacy_wait(uint64_t now_nanos, uint64_t max_wait_nanos) {
+  platform_mutex_lock(&g_legacy_mutex);
+  uint64_t wait = max_wait_nanos;
+  if (g_legacy_count > 0) {
+    uint64_t target = g_legacy_tasks[0].target_time_nanos;
+    wait = target <= now_nanos              ? 0
+           : target - now_nanos < wait ? target - now_nanos
+                                           : wait;
+  }
+  if (wait > 0)
+    platform_cond_timed_wait(&g_legacy_never_signalled, &g_legacy_mutex, wait);
+  platform_mutex_unlock(&g_legacy_mutex);
+}
+
+static const QueueOps kLegacyQueue = {"legacy",    legacy_init,
+                                      legacy_destroy, legacy_post,
+                                      legacy_pop_due, legacy_wait};
+
+// Task ids are indices into these. Immediate tasks come first, producer by
+// producer, then the delayed tasks.
+typedef struct {
+  uint64_t target;
+  uint64_t dispatched;
+  unsigned runs;
+} TaskRecord;
+
+static TaskRecord *g_records;
+static size_t g_immediate_per_producer;
+static uint64_t g_dispatch_count;
+static uint64_t g_early_count;
+
+// Stands in for the engine: records the dispatch instead of running Dart.
+FlutterEngineResult FlutterEngineRunTask(FLUTTER_API_SYMBOL(FlutterEngine)
+                                             engine,
+                                         const FlutterTask *task) {
+  (void)engine;
+  uint64_t now = now_ns();
+  TaskRecord *record = &g_records[task->task];
+  if (record->runs++ == 0)
+    record->dispatched = now;
+  if (now < record->target)
+    g_early_count++;
+  g_dispatch_count++;
+  return kSuccess;
+}
+
+typedef struct {
+  const QueueOps *queue;
+  size_t first_id;
+  uint64_t started;
+  uint64_t finished;
+  bool failed;
+} Producer;
+
+static void produce(void *argument) {
+  Producer *producer = (Producer *)argument;
+  producer->started = now_ns();
+  for (size_t i = 0; i < g_immediate_per_producer; ++i) {
+    size_t id = producer->first_id + i;
+    FlutterTask task = {.runner = NULL, .task = id};
+    uint64_t now = now_ns();
+    g_records[id].target = now;
+    if (!producer->queue->post(&task, now))
+      producer->failed = true;
+  }
+  producer->finished = now_ns();
+}
+
+typedef struct {
+  char name[32];
+  double posts_per_second;
+  double latency_us[3]; // p50, p99, max of the immediate tasks
+  double lateness_us[3]; // the same for the delayed tasks
+  bool has_delayed;
+  unsigned violations;
+} ScenarioResult;
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// p50, p99 (nearest rank) and max of `count` values, in microseconds.
+static void summarize(uint64_t *values, size_t count, double out[3]) {
+  out[0] = out[1] = out[2] = 0;
+  if (count == 0)
+    return;
+  qsort(values, count, sizeof(uint64_t), compare_u64);
+  const double percentiles[2] = {50, 99};
+  for (int i = 0; i < 2; ++i) {
+    size_t rank = (size_t)(percentiles[i] / 100.0 * (double)count + 0.5);
+    rank = rank < 1 ? 1 : rank > count ? count : rank;
+    out[i] = values[rank - 1] / 1e3;
+  }
+  out[2] = values[count - 1] / 1e3;
+}
+
+static bool run_scenario(const QueueOps *queue, unsigned producers,
+                         size_t pending, ScenarioResult *result) {
+  size_t immediate = producers * g_immediate_per_producer;
+  size_t total = immediate + pending;
+  g_records = (TaskRecord *)calloc(total, sizeof(TaskRecord));
+  uint64_t *samples = (uint64_t *)malloc(total * sizeof(uint64_t));
+  if (!g_records || !samples) {
+    free(g_records);
+    free(samples);
+    return false;
+  }
+  g_dispatch_count = 0;
+  g_early_count = 0;
+  queue->init();
+
+  // Delayed tasks are queued in random order, as timers would be.
+  uint64_t start = now_ns();
+  uint64_t seed = 0x9E3779B97F4A7C15ULL;
+  bool failed = false;
+  for (size_t i = 0; i < pending; ++i) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    size_t id = immediate + i;
+    uint64_t target = start + NSEC_PER_MSEC + seed % PENDING_SPREAD_NANOS;
+    FlutterTask task = {.runner = NULL, .task = id};
+    g_records[id].target = target;
+    if (!queue->post(&task, target))
+      failed = true;
+  }
+
+  Producer workers[MAX_PRODUCERS];
+  PlatformThread threads[MAX_PRODUCERS];
+  unsigned started = 0;
+  for (unsigned p = 0; p < producers; ++p) {
+    workers[p] = (Producer){.queue = queue,
+                            .first_id = p * g_immediate_per_producer};
+    if (!platform_thread_start(&threads[p], produce, &workers[p]))
+      break;
+    started++;
+  }
+  size_t expected = started * g_immediate_per_producer + pending;
+
+  // The platform thread's loop from main.c, minus the shared-memory ring.
+  uint64_t deadline = now_ns() + 60 * NSEC_PER_SEC;
+  while (g_dispatch_count < expected) {
+    ScheduledTask task;
+    uint64_t now = now_ns();
+    if (queue->pop_due(now, &task)) {
+      FlutterEngineRunTask(NULL, &task.task);
+      continue;
+    }
+    if (now > deadline)
+      break;
+    queue->wait(now, 5 * NSEC_PER_MSEC);
+  }
+  for (unsigned p = 0; p < started; ++p)
+    platform_thread_join(threads[p]);
+
+  uint64_t first = UINT64_MAX, last = 0;
+  for (unsigned p = 0; p < started; ++p) {
+    failed |= workers[p].failed;
+    first = workers[p].started < first ? workers[p].started : first;
+    last = workers[p].finished > last ? workers[p].finished : last;
+  }
+  result->posts_per_second =
+      last > first ? started * g_immediate_per_producer * 1e9 / (last - first)
+                   : 0;
+
+  // Exactly once, never early, and in order per producer.
+  unsigned violations = started < producers || failed ? 1 : 0;
+  violations += (unsigned)g_early_count;
+  for (size_t id = 0; id < total; ++id) {
+    bool posted = id >= immediate || id < started * g_immediate_per_producer;
+    if (posted && g_records[id].runs != 1)
+      violations++;
+  }
+  for (unsigned p = 0; p < started; ++p) {
+    size_t first_id = p * g_immediate_per_producer;
+    for (size_t i = 1; i < g_immediate_per_producer; ++i) {
+      if (g_records[first_id + i].dispatched <
+          g_records[first_id + i - 1].dispatched)
+        violations++;
+    }
+  }
+  result->violations = violations;
+
+  size_t count = 0;
+  for (size_t id = 0; id < started * g_immediate_per_producer; ++id) {
+    if (g_records[id].runs)
+      samples[count++] = g_records[id].dispatched - g_records[id].target;
+  }
+  summarize(samples, count, result->latency_us);
+  result->has_delayed = pending > 0;
+  count = 0;
+  for (size_t id = immediate; id < total; ++id) {
+    if (g_records[id].runs && g_records[id].dispatched >= g_records[id].target)
+      samples[count++] = g_records[id].dispatched - g_records[id].target;
+  }
+  summarize(samples, count, result->lateness_us);
+
+  queue->destroy();
+  free(samples);
+  free(g_records);
+  g_records = NULL;
+  return true;
+}
+
+static void report(const ScenarioResult *result, const QueueOps *queue,
+                   bool json) {
+  if (json) {
+    printf("{\"queue\":\"%s\",\"scenario\":\"%s\",\"postsPerSecond\":%.0f,"
+           "\"latencyUs\":{\"p50\":%.1f,\"p99\":%.1f,\"max\":%.1f},",
+           queue->name, result->name, result->posts_per_second,
+           result->latency_us[0], result->latency_us[1],
+           result->latency_us[2]);
+    if (result->has_delayed)
+      printf("\"delayedLatenessUs\":{\"p50\":%.1f,\"p99\":%.1f,\"max\":%.1f},",
+             result->lateness_us[0], result->lateness_us[1],
+             result->lateness_us[2]);
+    printf("\"violations\":%u}\n", result->violations);
+  } else {
+    printf("%-7s %-14s %12.0f %9.1f %9.1f %10.1f", queue->name, result->name,
+           result->posts_per_second, result->latency_us[0],
+           result->latency_us[1], result->latency_us[2]);
+    if (result->has_delayed)
+      printf(" %9.1f %10.1f", result->lateness_us[1], result->lateness_us[2]);
+    else
+      printf(" %9s %10s", "-", "-");
+    printf("%s\n", result->violations ? "  VIOLATIONS" : "");
+  }
+  fflush(stdout);
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: task_queue_bench [--tasks N] [--pending N] "
+                  "[--legacy] [--json]\n");
+}
+
+int main(int argc, char **argv) {
+  long tasks = 20000;
+  long pending = 10000;
+  bool json = false;
+  const QueueOps *queue = &kHeapQueue;
+  for (int i = 1; i < argc; ++i) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (strcmp(argv[i], "--legacy") == 0) {
+      queue = &kLegacyQueue;
+    } else if (has_value && strcmp(argv[i], "--tasks") == 0) {
+      tasks = atol(argv[++i]);
+    } else if (has_value && strcmp(argv[i], "--pending") == 0) {
+      pending = atol(argv[++i]);
+    } else {
+      usage();
+      return 64;
+    }
+  }
+  if (tasks <= 0 || pending < 0) {
+    usage();
+    return 64;
+  }
+  g_immediate_per_producer = (size_t)tasks;
+
+  if (!json)
+    printf("%-7s %-14s %12s %9s %9s %10s %9s %10s\n", "queue", "scenario",
+           "posts/s", "p50 us", "p99 us", "max us", "late p99",
+           "late max");
+  fflush(stdout);
+  int exit_code = 0;
+  const unsigned producer_counts[] = {1, 2, 4, MAX_PRODUCERS};
+  for (size_t i = 0; i <= sizeof(producer_counts) / sizeof(unsigned); ++i) {
+    bool with_pending = i == sizeof(producer_counts) / sizeof(unsigned);
+    if (with_pending && pending == 0)
+      break;
+    unsigned producers = with_pending ? PENDING_PRODUCERS : producer_counts[i];
+    ScenarioResult result;
+    memset(&result, 0, sizeof(result));
+    if (with_pending)
+      snprintf(result.name, sizeof(result.name), "pending %ld", pending);
+    else
+      snprintf(result.name, sizeof(result.name), "producers %u", producers);
+    if (!run_scenario(queue, producers, with_pending ? (size_t)pending : 0,
+                      &result)) {
+      fprintf(stderr, "task_queue_bench: out of memory\n");
+      return 1;
+    }
+    if (result.violations)
+      exit_code = 1;
+    report(&result, queue, json);
+  }
+  return exit_code;
+}
@@ -0,0 +1,390 @@
+#include "template_jobs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "admission.h"
+#include "channels.h"
+#include "log_ring.h"
+#include "metrics.h"
+#include "platform_thread.h"
+#include "trace_events.h"
+#include "watchdog.h"
+
+#define TEMPLATE_CHANNEL "headless/templates"
+#define NSEC_PER_MSEC 1000000ull
+
+enum {
+  kTemplateOpReady = 1,
+};
+
+enum {
+  kTemplateFlagPreemptible = 1 << 0,
+};
+
+typedef struct TemplateJob {
+  uint8_t *message;
+  size_t message_size;
+  TemplateJobDone done;
+  void *user_data;
+  uint64_t trace_id;
+  uint64_t sent_at;
+  uint64_t dispatched_at;
+  // Jobs in flight once this one was dispatched.
+  uint32_t concurrency;
+  // Engine clock; the dispatch order.
+  uint64_t deadline;
+  JobPriority priority;
+  bool in_flight;
+  struct TemplateJob *next;
+} TemplateJob;
+
+typedef struct {
+  TemplateJob *head;
+  TemplateJob *tail;
+} TemplateJobList;
+
+// Set by template_jobs_install.
+static uint64_t g_budget_ns[kJobPriorityCount] = {1000 * NSEC_PER_MSEC,
+                                                  30000 * NSEC_PER_MSEC};
+static bool g_preempt;
+
+// Only touched on the platform thread. Every class has the same budget for
+// all of its jobs, so each pending list is already in deadline order.
+static bool g_templates_ready = false;
+static TemplateJobList g_pending[kJobPriorityCount];
+static uint64_t g_next_trace_id = 1;
+
+// Copies of the counts for metrics.h, which reads them from its own thread.
+static PlatformMutex g_stats_mutex = PLATFORM_MUTEX_INIT;
+static TemplateJobStats g_stats;
+
+void template_params_init(TemplateParams *params) {
+  memset(params, 0, sizeof(*params));
+  params->ok = true;
+}
+
+static uint8_t *params_grow(TemplateParams *params, size_t count) {
+  if (!params->ok)
+    return NULL;
+  if (params->capacity - params->size < count) {
+    size_t capacity = params->capacity == 0 ? 64 : params->capacity * 2;
+    while (capacity - params->size < count)
+      capacity *= 2;
+    uint8_t *data = (uint8_t *)realloc(params->data, capacity);
+    if (!data) {
+      params->ok = false;
+      return NULL;
+    }
+    params->data = data;
+    params->capacity = capacity;
+  }
+  uint8_t *out = params->data + params->size;
+  params->size += count;
+  return out;
+}
+
+static void put_varint(TemplateParams *params, uint64_t value) {
+  uint8_t buffer[10];
+  size_t length = 0;
+  do {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    buffer[length++] = value ? (uint8_t)(byte | 0x80) : byte;
+  } while (value);
+  uint8_t *out = params_grow(params, length);
+  if (out)
+    memcpy(out, buffer, length);
+}
+
+void template_params_put_int(TemplateParams *params, int64_t value) {
+  put_varint(params, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+void template_params_put_double(TemplateParams *params, double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint8_t *out = params_grow(params, 8);
+  if (out)
+    message_write_u64(out, bits);
+}
+
+void template_params_put_bool(TemplateParams *params, bool value) {
+  uint8_t *out = params_grow(params, 1);
+  if (out)
+    *out = value ? 1 : 0;
+}
+
+void template_params_put_color(TemplateParams *params, uint32_t argb) {
+  uint8_t *out = params_grow(params, 4);
+  if (out)
+    message_write_u32(out, argb);
+}
+
+void template_params_put_string(TemplateParams *params, const char *utf8) {
+  template_params_put_bytes(params, (const uint8_t *)utf8, strlen(utf8));
+}
+
+void template_params_put_bytes(TemplateParams *params, const uint8_t *data,
+                               size_t size) {
+  put_varint(params, size);
+  uint8_t *out = params_grow(params, size);
+  if (out && size > 0)
+    memcpy(out, data, size);
+}
+
+void template_params_release(TemplateParams *params) {
+  free(params->data);
+  memset(params, 0, sizeof(*params));
+}
+
+static void count_job(const TemplateJob *job, int pending, int in_flight) {
+  platform_mutex_lock(&g_stats_mutex);
+  g_stats.pending[job->priority] += pending;
+  g_stats.in_flight[job->priority] += in_flight;
+  platform_mutex_unlock(&g_stats_mutex);
+}
+
+static void pump(void);
+
+static void finish_job(TemplateJob *job, bool ok, uint64_t bytes,
+                       uint32_t width, uint32_t height, const JobCost *cost,
+                       const char *error) {
+  count_job(job, 0, job->in_flight ? -1 : 0);
+  trace_async_end("TemplateJob", job->trace_id);
+  metrics_observe(kMetricStageTemplate,
+                  FlutterEngineGetCurrentTime() - job->sent_at);
+  metrics_job_finished(kMetricJobTemplate, ok);
+  if (!ok)
+    log_ring_write(kLogWarning, "template", job->trace_id, error);
+  if (job->done)
+    job->done(ok, bytes, width, height, cost, error, job->user_data);
+  free(job->message);
+  free(job);
+}
+
+static void finish_reply(TemplateJob *job, bool ok, uint64_t bytes,
+                         uint32_t width, uint32_t height, const JobCost *cost,
+                         const char *error) {
+  finish_job(job, ok, bytes, width, height, cost, error);
+  pump();
+}
+
+static void handle_job_reply(const uint8_t *data, size_t size,
+                             void *user_data) {
+  TemplateJob *job = (TemplateJob *)user_data;
+  if (size == 0) {
+    finish_reply(job, false, 0, 0, 0, NULL, "templates are not served");
+    return;
+  }
+  if (data[0] != kChannelStatusOk) {
+    char error[256];
+    size_t length = size - 1 < sizeof(error) - 1 ? size - 1 : sizeof(error) - 1;
+    memcpy(error, data + 1, length);
+    error[length] = '\0';
+    finish_reply(job, false, 0, 0, 0, NULL,
+                 length > 0 ? error : "template job failed");
+    return;
+  }
+  MessageReader reader = message_reader(data + 1, size - 1);
+  uint32_t low = message_read_u32(&reader);
+  uint32_t high = message_read_u32(&reader);
+  uint32_t width = message_read_u32(&reader);
+  uint32_t height = message_read_u32(&reader);
+  JobCost cost;
+  bool has_cost = reader.ok && reader.size - reader.offset >= JOB_COST_SIZE;
+  if (has_cost)
+    job_cost_read(&reader, &cost);
+  // Failures are left out: a job rejected by its builder comes back at once
+  // and would pass for an idle engine.
+  if (reader.ok) {
+    uint64_t now = FlutterEngineGetCurrentTime();
+    admission_observe(now - job->dispatched_at, job->concurrency, now);
+  }
+  finish_reply(job, reader.ok, ((uint64_t)high << 32) | low, width, height,
+               has_cost ? &cost : NULL,
+               reader.ok ? NULL : "malformed template reply");
+}
+
+static uint32_t total_in_flight(void) {
+  platform_mutex_lock(&g_stats_mutex);
+  uint32_t count = 0;
+  for (int priority = 0; priority < kJobPriorityCount; ++priority)
+    count += g_stats.in_flight[priority];
+  platform_mutex_unlock(&g_stats_mutex);
+  return count;
+}
+
+static bool may_dispatch(JobPriority priority) {
+  uint32_t limit = admission_concurrency_limit();
+  if (total_in_flight() < limit)
+    return true;
+  // Batch jobs in flight step aside for this one at their next frame.
+  if (!g_preempt || priority != kJobPriorityInteractive)
+    return false;
+  platform_mutex_lock(&g_stats_mutex);
+  bool room = g_stats.in_flight[kJobPriorityInteractive] < limit;
+  platform_mutex_unlock(&g_stats_mutex);
+  return room;
+}
+
+// The pending job to send next: the earliest deadline among the classes
+// that may send one now.
+static TemplateJobList *next_list(void) {
+  TemplateJobList *best = NULL;
+  for (int priority = 0; priority < kJobPriorityCount; ++priority) {
+    TemplateJobList *list = &g_pending[priority];
+    if (list->head && may_dispatch((JobPriority)priority) &&
+        (!best || list->head->deadline < best->head->deadline))
+      best = list;
+  }
+  return best;
+}
+
+// The engine copies the message, so only the job itself outlives the send.
+static bool dispatch_job(TemplateJob *job) {
+  uint8_t flags = 0;
+  job->dispatched_at = FlutterEngineGetCurrentTime();
+  if (g_preempt && job->priority == kJobPriorityBatch &&
+      job->dispatched_at < job->deadline)
+    flags |= kTemplateFlagPreemptible;
+  job->message[6] = flags;
+  if (!channels_send(TEMPLATE_CHANNEL, job->message, job->message_size,
+                     handle_job_reply, job))
+    return false;
+  free(job->message);
+  job->message = NULL;
+  return true;
+}
+
+static void pump(void) {
+  if (!g_templates_ready)
+    return;
+  TemplateJobList *list;
+  while ((list = next_list())) {
+    TemplateJob *job = list->head;
+    list->head = job->next;
+    if (!list->head)
+      list->tail = NULL;
+    job->next = NULL;
+    job->in_flight = true;
+    count_job(job, -1, 1);
+    job->concurrency = total_in_flight();
+    if (!dispatch_job(job))
+      finish_job(job, false, 0, 0, 0, NULL, "cannot send template job");
+  }
+}
+
+bool template_job_send(uint32_t template_id, uint8_t format,
+                       JobPriority priority, const char *target,
+                       const uint8_t *params, size_t params_size,
+                       TemplateJobDone done, void *user_data,
+                       uint32_t *retry_after_ms) {
+  *retry_after_ms = 0;
+  size_t target_length = strlen(target);
+  if (target_length > UINT16_MAX || priority >= kJobPriorityCount)
+    return false;
+  TemplateJobStats stats;
+  template_jobs_stats(&stats);
+  uint32_t pending = 0;
+  for (int i = 0; i < kJobPriorityCount; ++i)
+    pending += stats.pending[i];
+  if (admission_check(pending, retry_after_ms) != kAdmissionAccepted)
+    return false;
+  TemplateJob *job = (TemplateJob *)calloc(1, sizeof(TemplateJob));
+  size_t header = 4 + 1 + 1 + 1 + 4 + 2 + target_length;
+  uint8_t *message = (uint8_t *)malloc(header + params_size);
+  if (!job || !message) {
+    free(job);
+    free(message);
+    return false;
+  }
+  message_write_u32(message, template_id);
+  message[4] = format;
+  message[5] = (uint8_t)priority;
+  message[6] = 0;
+  message_write_u32(message + 7, watchdog_job_timeout_ms());
+  message[11] = (uint8_t)target_length;
+  message[12] = (uint8_t)(target_length >> 8);
+  memcpy(message + 13, target, target_length);
+  if (params_size > 0)
+    memcpy(message + header, params, params_size);
+  job->message = message;
+  job->message_size = header + params_size;
+  job->done = done;
+  job->user_data = user_data;
+  job->priority = priority;
+  job->trace_id = g_next_trace_id++;
+  trace_async_begin("TemplateJob", job->trace_id);
+  job->sent_at = FlutterEngineGetCurrentTime();
+  job->deadline = job->sent_at + g_budget_ns[priority];
+  metrics_job_started(kMetricJobTemplate);
+
+  TemplateJobList *list = &g_pending[priority];
+  if (list->tail)
+    list->tail->next = job;
+  else
+    list->head = job;
+  list->tail = job;
+  count_job(job, 1, 0);
+  pump();
+  return true;
+}
+
+static void handle_template_message(const FlutterPlatformMessage *message,
+                                    void *user_data) {
+  (void)user_data;
+  MessageReader reader = message_reader(message->message, message->message_size);
+  if (message_read_u8(&reader) != kTemplateOpReady) {
+    channels_respond_status(message->response_handle, kChannelStatusError,
+                            "unknown template opcode");
+    return;
+  }
+  g_templates_ready = true;
+  channels_respond_status(message->response_handle, kChannelStatusOk, NULL);
+  pump();
+}
+
+static uint64_t env_count(const char *name, uint64_t fallback) {
+  const char *value = getenv(name);
+  if (!value || !*value)
+    return fallback;
+  char *end;
+  unsigned long long number = strtoull(value, &end, 10);
+  if (*end != '\0' || number == 0 || number > UINT32_MAX) {
+    fprintf(stderr, "Ignoring %s=%s: not a positive count\n", name, value);
+    return fallback;
+  }
+  return number;
+}
+
+void template_jobs_install(void) {
+  g_budget_ns[kJobPriorityInteractive] =
+      env_count("HEADLESS_DEADLINE_INTERACTIVE_MS", 1000) * NSEC_PER_MSEC;
+  g_budget_ns[kJobPriorityBatch] =
+      env_count("HEADLESS_DEADLINE_BATCH_MS", 30000) * NSEC_PER_MSEC;
+  const char *preempt = getenv("HEADLESS_PREEMPT");
+  g_preempt = preempt && strcmp(preempt, "1") == 0;
+  channels_register(TEMPLATE_CHANNEL, handle_template_message, NULL);
+}
+
+void template_jobs_stats(TemplateJobStats *stats) {
+  platform_mutex_lock(&g_stats_mutex);
+  *stats = g_stats;
+  platform_mutex_unlock(&g_stats_mutex);
+}
+
+void template_jobs_shutdown(void) {
+  for (int priority = 0; priority < kJobPriorityCount; ++priority) {
+    TemplateJob *job = g_pending[priority].head;
+    g_pending[priority].head = g_pending[priority].tail = NULL;
+    while (job) {
+      TemplateJob *next = job->next;
+      count_job(job, -1, 0);
+      finish_job(job, false, 0, 0, 0, NULL, "shutting down");
+      job = next;
+    }
+  }
+  g_templates_ready = false;
+}
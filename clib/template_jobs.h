@@ -0,0 +1,110 @@
+// Jobs that render a registered widget template.
+//
+// The Dart side registers templates in a `TemplateRegistry` under numeric
+// ids and calls `HeadlessRender.serveTemplates`, which announces itself on
+// this channel. From then on a job is a template id, an output format, a
+// target and the template's parameters in the compact encoding below. Dart
+// looks the builder up and hands it the parameters as they are, so there is
+// no request parsing or generic widget description in between.
+//
+// Jobs are interactive (someone waits for the image) or batch. The jobs
+// rendered at once are limited by admission.h, which also bounds the jobs
+// that wait here. Waiting jobs go to Dart earliest deadline first. A job's
+// deadline is its submission time plus its class's budget,
+// HEADLESS_DEADLINE_INTERACTIVE_MS (default 1000) or
+// HEADLESS_DEADLINE_BATCH_MS (default 30000). Within a class that is
+// arrival order, and across classes a batch job overtakes interactive jobs
+// submitted more than the difference of the budgets after it, which is the
+// aging that keeps a stream of interactive jobs from starving batch work.
+//
+// With HEADLESS_PREEMPT=1 interactive jobs do not wait for batch jobs to
+// leave the Dart side: they are sent even when the batch jobs fill every
+// slot, and batch jobs that are not yet past their deadline pause at their
+// next frame boundary while an interactive job renders.
+//
+// Channel "headless/templates":
+//   Dart to embedder, first byte is the opcode:
+//     1 ready: no payload. Replies with a status byte. Jobs sent before
+//              this are queued until it arrives.
+//   Embedder to Dart, one message per job:
+//     u32 template id, u8 format (0 PNG, 1 raw RGBA), u8 priority (see
+//     JobPriority), u8 flags (bit 0: pause at frame boundaries while
+//     interactive jobs render), u32 timeout in milliseconds from receipt (0
+//     for none, see watchdog.h), u16 length + UTF-8 target (see
+//     byte_sink.h), then the parameters up to the end.
+//     Replies with status, u64 bytes written and the written image's u32
+//     width and height, optionally followed by the job's cost (see
+//     job_cost.h), or with status and a UTF-8 reason.
+//
+// Parameters have no names or tags; a template reads them back in the order
+// they were written:
+//   int:    zigzag LEB128 varint
+//   double: f64
+//   bool:   u8
+//   color:  u32 0xAARRGGBB
+//   string: varint length + UTF-8
+//   bytes:  varint length + raw bytes
+// Fixed-size values are little-endian.
+
+#ifndef TEMPLATE_JOBS_H
+#define TEMPLATE_JOBS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "job_cost.h"
+
+typedef enum {
+  kJobPriorityInteractive = 0,
+  kJobPriorityBatch = 1,
+  kJobPriorityCount,
+} JobPriority;
+
+typedef struct {
+  uint32_t pending[kJobPriorityCount];
+  uint32_t in_flight[kJobPriorityCount];
+} TemplateJobStats;
+
+typedef struct {
+  uint8_t *data;
+  size_t size;
+  size_t capacity;
+  // Cleared when an append ran out of memory.
+  bool ok;
+} TemplateParams;
+
+void template_params_init(TemplateParams *params);
+void template_params_put_int(TemplateParams *params, int64_t value);
+void template_params_put_double(TemplateParams *params, double value);
+void template_params_put_bool(TemplateParams *params, bool value);
+void template_params_put_color(TemplateParams *params, uint32_t argb);
+void template_params_put_string(TemplateParams *params, const char *utf8);
+void template_params_put_bytes(TemplateParams *params, const uint8_t *data,
+                               size_t size);
+void template_params_release(TemplateParams *params);
+
+// Called on the platform thread once Dart finished the job. `error` is set
+// when `ok` is false; `cost` is NULL when the reply carried none.
+typedef void (*TemplateJobDone)(bool ok, uint64_t bytes, uint32_t width,
+                                uint32_t height, const JobCost *cost,
+                                const char *error, void *user_data);
+
+// Asks Dart to render template `template_id` with `params` and write it to
+// `target`. Platform thread only; `params` is copied. Returns false (without
+// calling `done`) when the job cannot be sent. `*retry_after_ms` is then the
+// wait admission.h suggests before sending again, or 0 when the job was
+// refused for being malformed.
+bool template_job_send(uint32_t template_id, uint8_t format,
+                       JobPriority priority, const char *target,
+                       const uint8_t *params, size_t params_size,
+                       TemplateJobDone done, void *user_data,
+                       uint32_t *retry_after_ms);
+
+void template_jobs_install(void);
+void template_jobs_stats(TemplateJobStats *stats);
+
+// Fails the jobs still waiting for the Dart side to become ready.
+void template_jobs_shutdown(void);
+
+#endif // TEMPLATE_JOBS_H
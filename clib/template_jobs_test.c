@@ -0,0 +1,252 @@
+// Checks the order in which template jobs go to Dart (see template_jobs.h),
+// run without the engine.
+//
+// template_jobs.c runs against stubs: the engine clock is a variable the
+// test sets before each submission, so every job's submission time and
+// deadline is known; admission.h only contributes a fixed concurrency
+// limit; and channels_send records the jobs sent to "Dart", which the test
+// answers one by one. Scenarios:
+//
+//   deadlines  earliest deadline first across classes: a batch job that
+//              waited longer than the difference of the budgets goes ahead
+//              of a newer interactive job, and each class keeps its arrival
+//              order.
+//   preempt    with HEADLESS_PREEMPT=1 an interactive job is sent beyond the
+//              limit, a batch job sent before its deadline is marked
+//              preemptible, and one sent after its deadline is not.
+//
+// Exits with 1 on the first job out of order.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "admission.h"
+#include "channels.h"
+#include "embedder.h"
+#include "job_cost.h"
+#include "log_ring.h"
+#include "metrics.h"
+#include "template_jobs.h"
+#include "trace_events.h"
+#include "watchdog.h"
+
+#define NSEC_PER_MSEC 1000000ull
+#define MAX_SENT 16
+
+typedef struct {
+  uint32_t template_id;
+  uint8_t flags;
+  FlutterDataCallback reply;
+  void *user_data;
+  bool answered;
+} SentJob;
+
+static uint64_t g_now;
+static uint32_t g_limit = 1;
+static ChannelHandler g_template_handler;
+static SentJob g_sent[MAX_SENT];
+static int g_sent_count;
+
+// Stubs for what template_jobs.c uses of the engine and the other modules.
+
+uint64_t FlutterEngineGetCurrentTime(void) { return g_now; }
+
+AdmissionVerdict admission_check(uint32_t pending, uint32_t *retry_after_ms) {
+  (void)pending;
+  (void)retry_after_ms;
+  return kAdmissionAccepted;
+}
+
+uint32_t admission_concurrency_limit(void) { return g_limit; }
+
+void admission_observe(uint64_t latency_nanos, uint32_t concurrency,
+                       uint64_t now) {
+  (void)latency_nanos;
+  (void)concurrency;
+  (void)now;
+}
+
+bool channels_register(const char *channel, ChannelHandler handler,
+                       void *user_data) {
+  (void)channel;
+  (void)user_data;
+  g_template_handler = handler;
+  return true;
+}
+
+bool channels_respond_status(const FlutterPlatformMessageResponseHandle *handle,
+                             uint8_t status, const char *message) {
+  (void)handle;
+  (void)status;
+  (void)message;
+  return true;
+}
+
+bool channels_send(const char *channel, const uint8_t *data, size_t size,
+                   FlutterDataCallback reply, void *user_data) {
+  (void)channel;
+  if (g_sent_count == MAX_SENT || size < 7)
+    return false;
+  SentJob *sent = &g_sent[g_sent_count++];
+  sent->template_id = (uint32_t)data[0] | (uint32_t)data[1] << 8 |
+                      (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+  sent->flags = data[6];
+  sent->reply = reply;
+  sent->user_data = user_data;
+  sent->answered = false;
+  return true;
+}
+
+void job_cost_read(MessageReader *reader, JobCost *cost) {
+  (void)reader;
+  memset(cost, 0, sizeof(*cost));
+}
+
+void log_ring_write(LogSeverity severity, const char *tag, uint64_t job,
+                    const char *message) {
+  (void)severity;
+  (void)tag;
+  (void)job;
+  (void)message;
+}
+
+void metrics_job_started(MetricJobKind kind) { (void)kind; }
+
+void metrics_job_finished(MetricJobKind kind, bool ok) {
+  (void)kind;
+  (void)ok;
+}
+
+void metrics_observe(MetricStage stage, uint64_t nanos) {
+  (void)stage;
+  (void)nanos;
+}
+
+void trace_async_begin(const char *name, uint64_t id) {
+  (void)name;
+  (void)id;
+}
+
+void trace_async_end(const char *name, uint64_t id) {
+  (void)name;
+  (void)id;
+}
+
+uint32_t watchdog_job_timeout_ms(void) { return 0; }
+
+// The test itself.
+
+static void fail(const char *scenario, const char *reason, int index) {
+  fprintf(stderr, "%s: %s (job %d sent)\n", scenario, reason, index);
+  exit(1);
+}
+
+static void submit(uint64_t at_ms, uint32_t template_id, JobPriority priority) {
+  g_now = at_ms * NSEC_PER_MSEC;
+  uint32_t retry_after_ms;
+  if (!template_job_send(template_id, 0, priority, "out.png", NULL, 0, NULL,
+                         NULL, &retry_after_ms)) {
+    fprintf(stderr, "cannot queue template %u\n", template_id);
+    exit(1);
+  }
+}
+
+static void announce_ready(void) {
+  uint8_t ready = 1;
+  FlutterPlatformMessage message;
+  memset(&message, 0, sizeof(message));
+  message.struct_size = sizeof(message);
+  message.message = &ready;
+  message.message_size = 1;
+  g_template_handler(&message, NULL);
+}
+
+// Replies OK to the `index`th job sent, which may send the next ones.
+static void answer(int index) {
+  uint8_t reply[17];
+  memset(reply, 0, sizeof(reply));
+  reply[0] = kChannelStatusOk;
+  g_sent[index].answered = true;
+  g_sent[index].reply(reply, sizeof(reply), g_sent[index].user_data);
+}
+
+static void expect_sent(const char *scenario, const uint32_t *order, int count) {
+  if (g_sent_count != count)
+    fail(scenario, "wrong number of jobs sent", g_sent_count);
+  for (int i = 0; i < count; ++i) {
+    if (g_sent[i].template_id != order[i])
+      fail(scenario, "out of order", i);
+  }
+}
+
+static void reset(bool preempt) {
+  g_sent_count = 0;
+  if (preempt)
+    setenv("HEADLESS_PREEMPT", "1", 1);
+  else
+    unsetenv("HEADLESS_PREEMPT");
+  template_jobs_install();
+}
+
+static void check_deadlines(void) {
+  reset(false);
+  // Deadlines with the default budgets of 1 s and 30 s.
+  submit(0, 1, kJobPriorityBatch);           // 30 s
+  submit(10000, 2, kJobPriorityInteractive); // 11 s
+  submit(10001, 3, kJobPriorityInteractive); // 11.001 s
+  submit(29500, 4, kJobPriorityInteractive); // 30.5 s, after job 1
+  submit(29600, 5, kJobPriorityBatch);       // 59.6 s
+  submit(29700, 6, kJobPriorityInteractive); // 30.7 s
+  // Jobs wait for Dart to announce itself, then go one at a time.
+  if (g_sent_count != 0)
+    fail("deadlines", "sent before ready", 0);
+  announce_ready();
+  for (int i = 0; i < 6; ++i) {
+    if (g_sent_count != i + 1)
+      fail("deadlines", "limit not respected", g_sent_count);
+    answer(i);
+  }
+  static const uint32_t kOrder[] = {2, 3, 1, 4, 6, 5};
+  expect_sent("deadlines", kOrder, 6);
+}
+
+static void check_preempt(void) {
+  reset(true);
+  submit(100000, 1, kJobPriorityBatch);
+  // Still before its deadline, so it pauses for interactive jobs.
+  if (g_sent_count != 1 || !(g_sent[0].flags & 1))
+    fail("preempt", "batch job before its deadline not preemptible", 0);
+  submit(100100, 2, kJobPriorityInteractive);
+  if (g_sent_count != 2 || g_sent[1].flags != 0)
+    fail("preempt", "interactive job not sent beyond the limit", 1);
+  submit(100200, 3, kJobPriorityBatch);
+  submit(100300, 4, kJobPriorityInteractive);
+  // Interactive jobs alone still keep to the limit.
+  if (g_sent_count != 2)
+    fail("preempt", "sent beyond the limit", g_sent_count);
+
+  g_now = 100500 * NSEC_PER_MSEC;
+  answer(1);
+  static const uint32_t kFirst[] = {1, 2, 4};
+  expect_sent("preempt", kFirst, 3);
+
+  // Job 3 is dispatched after its deadline at 130.2 s.
+  g_now = 140000 * NSEC_PER_MSEC;
+  answer(2);
+  answer(0);
+  static const uint32_t kAll[] = {1, 2, 4, 3};
+  expect_sent("preempt", kAll, 4);
+  if (g_sent[3].flags & 1)
+    fail("preempt", "batch job past its deadline still preemptible", 3);
+  answer(3);
+}
+
+int main(void) {
+  check_deadlines();
+  check_preempt();
+  printf("template_jobs_test: dispatch order as expected\n");
+  return 0;
+}
@@ -0,0 +1,250 @@
+#include "trace_events.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "embedder.h"
+#include "platform_thread.h"
+
+#ifndef _WIN32
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+// About 40 MB of events; later ones are counted and dropped.
+#define MAX_TRACE_EVENTS (1u << 20)
+
+typedef struct {
+  const char *name;
+  uint64_t start;
+  uint64_t duration;
+  // Job id of spans and instants, pairing id of async events.
+  uint64_t id;
+  uint32_t thread;
+  // Chrome trace phase: 'X' span, 'i' instant, 'b'/'e' async, 'M' thread
+  // name.
+  char phase;
+} TraceEvent;
+
+// Set once by trace_events_install, before any other thread starts.
+static bool g_enabled;
+static char *g_path;
+static char *g_engine_switch;
+
+// Guarded by g_trace_mutex.
+static PlatformMutex g_trace_mutex = PLATFORM_MUTEX_INIT;
+static TraceEvent *g_events;
+static size_t g_event_count;
+static size_t g_event_capacity;
+static uint64_t g_dropped;
+static bool g_engine_running;
+static bool g_written;
+
+static uint32_t current_thread_id(void) {
+#ifdef _WIN32
+  return (uint32_t)GetCurrentThreadId();
+#elif defined(__linux__)
+  return (uint32_t)syscall(SYS_gettid);
+#elif defined(__APPLE__)
+  uint64_t id = 0;
+  pthread_threadid_np(NULL, &id);
+  return (uint32_t)id;
+#else
+  return (uint32_t)(uintptr_t)pthread_self();
+#endif
+}
+
+static void record(const char *name, char phase, uint64_t start,
+                   uint64_t duration, uint64_t id) {
+  TraceEvent event = {name, start, duration, id, current_thread_id(), phase};
+  platform_mutex_lock(&g_trace_mutex);
+  if (g_event_count == g_event_capacity &&
+      g_event_capacity < MAX_TRACE_EVENTS) {
+    size_t capacity = g_event_capacity ? g_event_capacity * 2 : 4096;
+    TraceEvent *events =
+        (TraceEvent *)realloc(g_events, capacity * sizeof(TraceEvent));
+    if (events) {
+      g_events = events;
+      g_event_capacity = capacity;
+    }
+  }
+  if (g_event_count < g_event_capacity)
+    g_events[g_event_count++] = event;
+  else
+    g_dropped++;
+  platform_mutex_unlock(&g_trace_mutex);
+}
+
+static bool engine_running(void) {
+  platform_mutex_lock(&g_trace_mutex);
+  bool running = g_engine_running;
+  platform_mutex_unlock(&g_trace_mutex);
+  return running;
+}
+
+static void write_at_exit(void);
+
+void trace_events_install(void) {
+  const char *path = getenv("HEADLESS_TRACE");
+  if (!path || !*path)
+    return;
+  g_path = strdup(path);
+  size_t length = strlen(path);
+  if (length > 5 && strcmp(path + length - 5, ".json") == 0)
+    length -= 5;
+  const char *flag = "--trace-to-file=";
+  g_engine_switch = (char *)malloc(strlen(flag) + length + 9);
+  if (!g_path || !g_engine_switch) {
+    free(g_path);
+    free(g_engine_switch);
+    g_path = g_engine_switch = NULL;
+    return;
+  }
+  sprintf(g_engine_switch, "%s%.*s.pftrace", flag, (int)length, path);
+  g_enabled = true;
+  trace_thread_name("platform");
+  atexit(write_at_exit);
+}
+
+const char *trace_events_engine_switch(void) { return g_engine_switch; }
+
+void trace_events_set_engine_running(bool running) {
+  platform_mutex_lock(&g_trace_mutex);
+  g_engine_running = running;
+  platform_mutex_unlock(&g_trace_mutex);
+}
+
+TraceSpan trace_begin(const char *name) {
+  TraceSpan span = {name, 0, false};
+  if (!g_enabled)
+    return span;
+  span.forwarded = engine_running();
+  if (span.forwarded)
+    FlutterEngineTraceEventDurationBegin(name);
+  span.start = FlutterEngineGetCurrentTime();
+  return span;
+}
+
+void trace_end(TraceSpan span, uint64_t job) {
+  if (!g_enabled)
+    return;
+  uint64_t end = FlutterEngineGetCurrentTime();
+  if (span.forwarded)
+    FlutterEngineTraceEventDurationEnd(span.name);
+  record(span.name, 'X', span.start, end - span.start, job);
+}
+
+void trace_async_begin(const char *name, uint64_t id) {
+  if (g_enabled)
+    record(name, 'b', FlutterEngineGetCurrentTime(), 0, id);
+}
+
+void trace_async_end(const char *name, uint64_t id) {
+  if (g_enabled)
+    record(name, 'e', FlutterEngineGetCurrentTime(), 0, id);
+}
+
+void trace_instant(const char *name, uint64_t job) {
+  if (!g_enabled)
+    return;
+  if (engine_running())
+    FlutterEngineTraceEventInstant(name);
+  record(name, 'i', FlutterEngineGetCurrentTime(), 0, job);
+}
+
+void trace_thread_name(const char *name) {
+  if (g_enabled)
+    record(name, 'M', 0, 0, 0);
+}
+
+// Chrome trace timestamps are microseconds.
+static void write_micros(FILE *file, const char *key, uint64_t nanos) {
+  fprintf(file, ",\"%s\":%llu.%03u", key, (unsigned long long)(nanos / 1000),
+          (unsigned)(nanos % 1000));
+}
+
+static bool write_trace(FILE *file) {
+#ifdef _WIN32
+  unsigned long pid = GetCurrentProcessId();
+#else
+  unsigned long pid = (unsigned long)getpid();
+#endif
+  fputs("{\"traceEvents\":[\n", file);
+  for (size_t i = 0; i < g_event_count; ++i) {
+    const TraceEvent *event = &g_events[i];
+    fprintf(file, "%s{\"pid\":%lu,\"tid\":%u,\"ph\":\"%c\"", i ? ",\n" : "",
+            pid, event->thread, event->phase);
+    switch (event->phase) {
+    case 'M':
+      fprintf(file, ",\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+              event->name);
+      continue;
+    case 'b':
+    case 'e':
+      // Async events pair up by category and id; ids are only unique per
+      // name.
+      fprintf(file, ",\"name\":\"%s\",\"cat\":\"%s\",\"id\":%llu",
+              event->name, event->name, (unsigned long long)event->id);
+      write_micros(file, "ts", event->start);
+      fputc('}', file);
+      continue;
+    }
+    fprintf(file, ",\"name\":\"%s\",\"cat\":\"headless\"", event->name);
+    write_micros(file, "ts", event->start);
+    if (event->phase == 'X')
+      write_micros(file, "dur", event->duration);
+    else
+      fputs(",\"s\":\"t\"", file);
+    if (event->id)
+      fprintf(file, ",\"args\":{\"job\":%llu}", (unsigned long long)event->id);
+    fputc('}', file);
+  }
+  fprintf(file, "\n],\"displayTimeUnit\":\"ms\","
+                "\"otherData\":{\"droppedEvents\":%llu}}\n",
+          (unsigned long long)g_dropped);
+  return !ferror(file);
+}
+
+static void write_trace_file(void) {
+  if (g_written)
+    return;
+  g_written = true;
+  FILE *file = fopen(g_path, "w");
+  bool ok = file && write_trace(file);
+  if (file && fclose(file) != 0)
+    ok = false;
+  if (ok)
+    fprintf(stdout, "Trace written to %s (%zu events)\n", g_path,
+            g_event_count);
+  else
+    fprintf(stderr, "Cannot write trace to %s\n", g_path);
+}
+
+// Batch and bench mode end through Dart's exit(), which skips
+// trace_events_shutdown. Engine threads may still record, so nothing is
+// freed here.
+static void write_at_exit(void) {
+  platform_mutex_lock(&g_trace_mutex);
+  if (g_enabled)
+    write_trace_file();
+  platform_mutex_unlock(&g_trace_mutex);
+}
+
+void trace_events_shutdown(void) {
+  if (!g_enabled)
+    return;
+  trace_events_set_engine_running(false);
+  platform_mutex_lock(&g_trace_mutex);
+  write_trace_file();
+  free(g_events);
+  g_events = NULL;
+  g_event_count = g_event_capacity = 0;
+  g_enabled = false;
+  platform_mutex_unlock(&g_trace_mutex);
+  free(g_path);
+  free(g_engine_switch);
+  g_path = g_engine_switch = NULL;
+}
@@ -0,0 +1,52 @@
+// Timeline of what the embedder does with each frame and job.
+//
+// With HEADLESS_TRACE=<path> set, the embedder records spans for task
+// dispatch, present callbacks, encoding and output, and the lifetime of
+// every pipeline job, template job and file write. At shutdown, or when the
+// process ends through exit() as batch mode does, they are written to <path>
+// in the Chrome trace event format, which chrome://tracing and
+// ui.perfetto.dev open directly.
+//
+// The engine's own timeline (UI build, layout, raster) is written next to
+// it, as <path without .json>.pftrace in Perfetto's format: main.c starts
+// the engine with `--trace-to-file`, and spans that begin and end on one
+// thread are also sent to the engine through
+// FlutterEngineTraceEventDurationBegin/End. The .pftrace file thus holds
+// one job's whole path, from the build on the UI thread through the raster
+// and present to the encode and write, on one clock.
+//
+// Names must be string literals; only pointers to them are kept. All calls
+// are thread-safe and cost a single flag check while tracing is off.
+
+#ifndef TRACE_EVENTS_H
+#define TRACE_EVENTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+  const char *name;
+  uint64_t start;
+  bool forwarded;
+} TraceSpan;
+
+void trace_events_install(void);
+// The engine switch that writes the engine timeline, or NULL.
+const char *trace_events_engine_switch(void);
+// Spans are sent to the engine only while it runs.
+void trace_events_set_engine_running(bool running);
+void trace_events_shutdown(void);
+
+// A span on the calling thread. `job` tags it with a pipeline job id, or 0.
+TraceSpan trace_begin(const char *name);
+void trace_end(TraceSpan span, uint64_t job);
+// Something that outlives a thread's involvement in it, such as a job that
+// passes through several threads. Begin and end with the same name and id.
+void trace_async_begin(const char *name, uint64_t id);
+void trace_async_end(const char *name, uint64_t id);
+// A point in time on the calling thread, tagged like a span.
+void trace_instant(const char *name, uint64_t job);
+// Labels the calling thread in the Chrome trace.
+void trace_thread_name(const char *name);
+
+#endif // TRACE_EVENTS_H
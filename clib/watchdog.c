@@ -0,0 +1,109 @@
+#include "watchdog.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log_ring.h"
+#include "platform_thread.h"
+#include "shm_ring.h"
+#include "trace_events.h"
+
+#define DEFAULT_JOB_TIMEOUT_MS 60000u
+#define DEFAULT_STALL_GRACE_MS 10000u
+#define PROBE_INTERVAL_NS 1000000000ull
+#define NSEC_PER_MSEC 1000000ull
+
+// Set by watchdog_install and watchdog_attach, on the platform thread.
+static uint32_t g_job_timeout_ms = DEFAULT_JOB_TIMEOUT_MS;
+static uint64_t g_stall_limit_ns;
+static FlutterEngine g_engine;
+
+// Platform thread only.
+static uint64_t g_probe_sent;
+static uint64_t g_probe_sent_at;
+static uint64_t g_next_probe_at;
+
+// Written by the UI thread.
+static volatile uint64_t g_probe_answered;
+
+static bool env_ms(const char *name, uint64_t *ms) {
+  const char *value = getenv(name);
+  if (!value || !*value)
+    return false;
+  char *end;
+  unsigned long long number = strtoull(value, &end, 10);
+  if (*end != '\0' || number > UINT32_MAX) {
+    fprintf(stderr, "Ignoring %s=%s: not a millisecond count\n", name, value);
+    return false;
+  }
+  *ms = number;
+  return true;
+}
+
+void watchdog_install(void) {
+  uint64_t timeout = DEFAULT_JOB_TIMEOUT_MS;
+  env_ms("HEADLESS_JOB_TIMEOUT_MS", &timeout);
+  g_job_timeout_ms = (uint32_t)timeout;
+  uint64_t stall = timeout + DEFAULT_STALL_GRACE_MS;
+  env_ms("HEADLESS_WATCHDOG_MS", &stall);
+  g_stall_limit_ns = stall * NSEC_PER_MSEC;
+}
+
+static void answer_probe(FlutterNativeThreadType type, void *user_data) {
+  if (type == kFlutterNativeThreadTypeUI)
+    platform_atomic_store(&g_probe_answered, (uint64_t)(uintptr_t)user_data);
+}
+
+void watchdog_attach(FlutterEngine engine) {
+  if (g_stall_limit_ns > 0)
+    g_engine = engine;
+}
+
+uint32_t watchdog_job_timeout_ms(void) { return g_job_timeout_ms; }
+
+static void recycle(const char *reason) {
+  log_ring_printf(kLogError, "watchdog", 0, "%s, exiting for a restart",
+                  reason);
+  char abandoned[160];
+  snprintf(abandoned, sizeof(abandoned), "engine restarted: %s", reason);
+  shm_ring_abandon(abandoned);
+  // The engine's threads are still running and may be logging.
+  log_ring_flush();
+  trace_events_shutdown();
+  fflush(stdout);
+  fflush(stderr);
+  _Exit(WATCHDOG_EXIT_CODE);
+}
+
+static void recycle_engine(uint64_t silent_ns) {
+  char reason[96];
+  snprintf(reason, sizeof(reason),
+           "UI thread has not responded for %llu ms",
+           (unsigned long long)(silent_ns / NSEC_PER_MSEC));
+  recycle(reason);
+}
+
+void watchdog_poll(uint64_t now) {
+  if (!g_engine)
+    return;
+  bool outstanding = platform_atomic_load(&g_probe_answered) != g_probe_sent;
+  if (outstanding) {
+    if (now - g_probe_sent_at > g_stall_limit_ns)
+      recycle_engine(now - g_probe_sent_at);
+    return;
+  }
+  if (now < g_next_probe_at)
+    return;
+  // The probe runs as a task on every engine thread; only the UI thread's
+  // answer is checked.
+  uint64_t probe = g_probe_sent + 1;
+  if (FlutterEnginePostCallbackOnAllNativeThreads(
+          g_engine, answer_probe, (void *)(uintptr_t)probe) != kSuccess) {
+    g_next_probe_at = now + PROBE_INTERVAL_NS;
+    return;
+  }
+  g_probe_sent = probe;
+  g_probe_sent_at = now;
+  g_next_probe_at = now + PROBE_INTERVAL_NS;
+}
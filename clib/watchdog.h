@@ -0,0 +1,46 @@
+// Job deadlines and a liveness check of the engine's UI thread.
+//
+// Template jobs carry a deadline (see template_jobs.h). The Dart side
+// enforces it between the asynchronous steps of a render: it stops pumping
+// frames, unmounts the tree, releases the image and answers the job with an
+// error, so one widget whose `wait` future never completes does not hold up
+// the jobs behind it. Jobs are only cancelled before they reach the
+// pipeline; once submitted they finish in the embedder's own stages.
+//
+// Code that never yields, such as a layout that loops forever, cannot be
+// cancelled from Dart. The watchdog therefore posts a probe to the engine's
+// threads every second and checks from the platform thread that the UI
+// thread answered it. When it has been silent for longer than the stall
+// limit the engine cannot be recovered in this process (its shutdown would
+// wait for the stuck thread), so the watchdog fails the jobs that shared-
+// memory clients wait for, flushes the logs and the trace, and exits with
+// WATCHDOG_EXIT_CODE for the supervisor to start a fresh engine.
+//
+// Environment:
+//   HEADLESS_JOB_TIMEOUT_MS=N  deadline of a template job, default 60000;
+//                              0 turns deadlines off.
+//   HEADLESS_WATCHDOG_MS=N     longest the UI thread may be unresponsive,
+//                              default the job timeout plus 10 s; 0 turns
+//                              the check off.
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stdint.h>
+
+#include "embedder.h"
+
+// EX_TEMPFAIL: the job that wedged the engine may well succeed elsewhere.
+#define WATCHDOG_EXIT_CODE 75
+
+void watchdog_install(void);
+// Starts probing. Call once the engine runs.
+void watchdog_attach(FlutterEngine engine);
+
+// Deadline for a template job sent now, 0 for none.
+uint32_t watchdog_job_timeout_ms(void);
+
+// Platform thread; `now` is the monotonic clock in nanoseconds.
+void watchdog_poll(uint64_t now);
+
+#endif // WATCHDOG_H
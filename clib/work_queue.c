@@ -0,0 +1,95 @@
+#include "work_queue.h"
+
+#include <stdlib.h>
+
+#include "trace_events.h"
+
+static void worker_main(void *argument) {
+  WorkQueue *queue = (WorkQueue *)argument;
+  trace_thread_name(queue->name);
+  platform_mutex_lock(&queue->mutex);
+  for (;;) {
+    WorkItem *item = queue->head;
+    if (!item) {
+      if (queue->stopping)
+        break;
+      platform_cond_wait(&queue->changed, &queue->mutex);
+      continue;
+    }
+    queue->head = item->next;
+    if (!queue->head)
+      queue->tail = NULL;
+    platform_mutex_unlock(&queue->mutex);
+    item->run(item->argument);
+    free(item);
+    platform_mutex_lock(&queue->mutex);
+    // Counted until it ran, so the capacity bounds work in progress too.
+    queue->pending--;
+  }
+  platform_mutex_unlock(&queue->mutex);
+}
+
+bool work_queue_start(WorkQueue *queue, const char *name, size_t capacity) {
+  platform_mutex_init(&queue->mutex);
+  platform_cond_init(&queue->changed);
+  queue->name = name;
+  queue->head = queue->tail = NULL;
+  queue->pending = 0;
+  queue->capacity = capacity;
+  queue->stopping = false;
+  queue->started = platform_thread_start(&queue->thread, worker_main, queue);
+  if (!queue->started) {
+    platform_cond_destroy(&queue->changed);
+    platform_mutex_destroy(&queue->mutex);
+  }
+  return queue->started;
+}
+
+bool work_queue_post(WorkQueue *queue, WorkFunction run, void *argument) {
+  if (!queue->started)
+    return false;
+  WorkItem *item = (WorkItem *)malloc(sizeof(WorkItem));
+  if (!item)
+    return false;
+  item->run = run;
+  item->argument = argument;
+  item->next = NULL;
+  platform_mutex_lock(&queue->mutex);
+  if (queue->stopping ||
+      (queue->capacity > 0 && queue->pending >= queue->capacity)) {
+    platform_mutex_unlock(&queue->mutex);
+    free(item);
+    return false;
+  }
+  if (queue->tail)
+    queue->tail->next = item;
+  else
+    queue->head = item;
+  queue->tail = item;
+  queue->pending++;
+  platform_cond_signal(&queue->changed);
+  platform_mutex_unlock(&queue->mutex);
+  return true;
+}
+
+size_t work_queue_pending(WorkQueue *queue) {
+  if (!queue->started)
+    return 0;
+  platform_mutex_lock(&queue->mutex);
+  size_t pending = queue->pending;
+  platform_mutex_unlock(&queue->mutex);
+  return pending;
+}
+
+void work_queue_stop(WorkQueue *queue) {
+  if (!queue->started)
+    return;
+  platform_mutex_lock(&queue->mutex);
+  queue->stopping = true;
+  platform_cond_signal(&queue->changed);
+  platform_mutex_unlock(&queue->mutex);
+  platform_thread_join(queue->thread);
+  platform_cond_destroy(&queue->changed);
+  platform_mutex_destroy(&queue->mutex);
+  queue->started = false;
+}
@@ -0,0 +1,50 @@
+// A background thread that runs posted work in posting order.
+//
+// Channel handlers run on the platform thread, which also runs every engine
+// task. Handlers whose work can block (compression, a socket or disk write)
+// copy what they need out of the message and post it here; the work answers
+// the message itself, since channels_respond may be called from any thread.
+// A queue with a capacity refuses work once that much is waiting, so a slow
+// target cannot make the copies pile up.
+
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "platform_thread.h"
+
+typedef void (*WorkFunction)(void *argument);
+
+typedef struct WorkItem {
+  WorkFunction run;
+  void *argument;
+  struct WorkItem *next;
+} WorkItem;
+
+typedef struct {
+  PlatformMutex mutex;
+  PlatformCond changed;
+  PlatformThread thread;
+  const char *name;
+  WorkItem *head;
+  WorkItem *tail;
+  size_t pending;
+  // Most items waiting or running, 0 for no bound.
+  size_t capacity;
+  bool started;
+  bool stopping;
+} WorkQueue;
+
+// `name`, a string literal, labels the thread in traces. Returns false when
+// the thread cannot be started.
+bool work_queue_start(WorkQueue *queue, const char *name, size_t capacity);
+// Returns false, without running `run`, when the queue is full, stopped or
+// out of memory.
+bool work_queue_post(WorkQueue *queue, WorkFunction run, void *argument);
+size_t work_queue_pending(WorkQueue *queue);
+// Runs the work still queued and joins the thread.
+void work_queue_stop(WorkQueue *queue);
+
+#endif // WORK_QUEUE_H
@@ -1 +1,9 @@
+export 'src/batch_runner.dart' show BatchEntry, BatchFailure, BatchRunner, BatchSummary;
+export 'src/damage_tracking.dart' show DamageBoundary;
+export 'src/frame_capture.dart' show FrameCaptureResult, FrameFormat;
 export 'src/headless_render.dart';
+export 'src/picture_cache.dart' show CachedSubtree, PictureCache;
+export 'src/render_pipeline.dart'
+    show EngineCpuTime, OutputFormat, RenderJob, RenderJobCost, RenderJobResult, RenderPriority, RenderStageTimes;
+export 'src/template_registry.dart'
+    show RenderTemplate, TemplateBuilder, TemplateParams, TemplateParamsWriter, TemplateRegistry;
@@ -4,25 +4,90 @@ import 'dart:io';
 import 'package:flutter/cupertino.dart';
 import 'package:flutter/material.dart';
 import 'package:foo/headless_render.dart';
+import 'package:foo/src/benchmark.dart';
 
-Future<void> main() async {
-  print('Creating image...');
-  final headlessRender = HeadlessRender();
-  final image = await headlessRender.createImageFromWidget(
-    Container(
-      color: Colors.red,
-      child: Column(
-        mainAxisSize: MainAxisSize.min,
-        children: [
-          Text('Hello, World!', style: TextStyle(fontSize: 20, color: Colors.white)),
-          Icon(Icons.refresh, color: Colors.white),
-          Icon(CupertinoIcons.zzz),
-        ],
-      ),
+/// Templates available to `--batch` manifests and `--serve` jobs.
+TemplateRegistry _templates() => TemplateRegistry()
+  ..register(
+    1,
+    RenderTemplate(
+      width: 512,
+      builder: (TemplateParams params) => _greeting(params.isAtEnd ? 'Hello, World!' : params.readString()),
     ),
-    width: 512,
   );
+
+Widget _greeting(String text) => Container(
+  color: Colors.red,
+  child: Column(
+    mainAxisSize: MainAxisSize.min,
+    children: [
+      Text(text, style: TextStyle(fontSize: 20, color: Colors.white)),
+      Icon(Icons.refresh, color: Colors.white),
+      Icon(CupertinoIcons.zzz),
+    ],
+  ),
+);
+
+/// Usage:
+///   (no arguments)          writes test.png
+///   --batch <manifest> [--timeout-ms N]
+///                           renders a JSONL manifest (see BatchEntry),
+///                           cancelling lines that take longer than N ms
+///   --serve                 renders template jobs sent by the embedder
+///   --bench <fixture> [--iterations N] [--warmup N]
+///                           renders a benchmark fixture for headless_bench
+Future<void> main([List<String> args = const <String>[]]) async {
+  final headlessRender = HeadlessRender();
+
+  final int batch = args.indexOf('--batch');
+  if (batch >= 0) {
+    if (batch + 1 >= args.length) {
+      stderr.writeln('--batch needs a manifest path');
+      exit(64);
+    }
+    final int? timeoutMs = _intOption(args, '--timeout-ms');
+    final summary = await BatchRunner(
+      headlessRender,
+      _templates(),
+      jobTimeout: timeoutMs == null ? null : Duration(milliseconds: timeoutMs),
+    ).runFile(File(args[batch + 1]));
+    print(summary);
+    for (final failure in summary.failures) {
+      stderr.writeln(failure);
+    }
+    exit(summary.failed == 0 ? 0 : 1);
+  }
+
+  final int bench = args.indexOf('--bench');
+  if (bench >= 0) {
+    final fixture = bench + 1 < args.length ? benchFixture(args[bench + 1]) : null;
+    if (fixture == null) {
+      stderr.writeln('--bench needs one of: ${benchFixtures.map((fixture) => fixture.name).join(', ')}');
+      exit(64);
+    }
+    await runBenchmark(
+      headlessRender,
+      fixture,
+      iterations: _intOption(args, '--iterations') ?? 200,
+      warmup: _intOption(args, '--warmup') ?? 20,
+    );
+    exit(0);
+  }
+
+  if (args.contains('--serve')) {
+    await headlessRender.serveTemplates(_templates());
+    print('Serving templates');
+    return;
+  }
+
+  print('Creating image...');
+  final image = await headlessRender.createImageFromWidget(_greeting('Hello, World!'), width: 512);
   final imagePath = Directory.current.uri.resolve('test.png').toFilePath(windows: Platform.isWindows);
   await File(imagePath).writeAsBytes(image);
   print('Image created at $imagePath');
 }
+
+int? _intOption(List<String> args, String name) {
+  final int index = args.indexOf(name);
+  return index >= 0 && index + 1 < args.length ? int.tryParse(args[index + 1]) : null;
+}
@@ -0,0 +1,155 @@
+import 'dart:math' as math;
+
+import 'package:flutter/rendering.dart';
+import 'package:flutter/widgets.dart';
+
+/// Placement of a batch of boxes produced by [packShelves].
+class AtlasPacking {
+  const AtlasPacking({required this.size, required this.rects});
+
+  /// Bounding size of every placed box, padding included.
+  final Size size;
+
+  /// One rect per input size, in input order.
+  final List<Rect> rects;
+}
+
+/// Packs [sizes] into horizontal shelves no wider than [maxWidth].
+///
+/// Boxes are placed tallest first so each shelf wastes as little height as
+/// possible. A box wider than [maxWidth] gets a shelf of its own and widens the
+/// result. [padding] is kept between boxes and around the edges.
+AtlasPacking packShelves(List<Size> sizes, {required double maxWidth, double padding = 0}) {
+  final List<int> order = List<int>.generate(sizes.length, (i) => i)
+    ..sort((a, b) {
+      final int byHeight = sizes[b].height.compareTo(sizes[a].height);
+      return byHeight != 0 ? byHeight : a.compareTo(b);
+    });
+
+  final List<Rect> rects = List<Rect>.filled(sizes.length, Rect.zero);
+  double shelfTop = padding;
+  double shelfHeight = 0;
+  double cursorX = padding;
+  double width = 0;
+
+  for (final int index in order) {
+    final Size size = sizes[index];
+    if (cursorX > padding && cursorX + size.width + padding > maxWidth) {
+      shelfTop += shelfHeight + padding;
+      shelfHeight = 0;
+      cursorX = padding;
+    }
+    rects[index] = Rect.fromLTWH(cursorX, shelfTop, size.width, size.height);
+    cursorX += size.width + padding;
+    shelfHeight = math.max(shelfHeight, size.height);
+    width = math.max(width, cursorX);
+  }
+
+  final double height = sizes.isEmpty ? 0 : shelfTop + shelfHeight + padding;
+  return AtlasPacking(size: Size(width, height), rects: rects);
+}
+
+/// Lays out every child with loose constraints and shelf-packs the results.
+///
+/// Child sizes are rounded up to whole physical pixels at [pixelRatio] so the
+/// slices cut from the rasterized atlas never share a pixel.
+class AtlasLayout extends MultiChildRenderObjectWidget {
+  const AtlasLayout({super.key, required this.maxWidth, this.padding = 1, this.pixelRatio = 1.0, super.children});
+
+  final double maxWidth;
+  final double padding;
+  final double pixelRatio;
+
+  @override
+  RenderAtlas createRenderObject(BuildContext context) {
+    return RenderAtlas(maxWidth: maxWidth, padding: padding, pixelRatio: pixelRatio);
+  }
+
+  @override
+  void updateRenderObject(BuildContext context, RenderAtlas renderObject) {
+    renderObject
+      ..maxWidth = maxWidth
+      ..padding = padding
+      ..pixelRatio = pixelRatio;
+  }
+}
+
+class AtlasParentData extends ContainerBoxParentData<RenderBox> {}
+
+class RenderAtlas extends RenderBox
+    with ContainerRenderObjectMixin<RenderBox, AtlasParentData>, RenderBoxContainerDefaultsMixin<RenderBox, AtlasParentData> {
+  RenderAtlas({required double maxWidth, required double padding, required double pixelRatio})
+    : _maxWidth = maxWidth,
+      _padding = padding,
+      _pixelRatio = pixelRatio;
+
+  double get maxWidth => _maxWidth;
+  double _maxWidth;
+  set maxWidth(double value) {
+    if (_maxWidth == value) return;
+    _maxWidth = value;
+    markNeedsLayout();
+  }
+
+  double get padding => _padding;
+  double _padding;
+  set padding(double value) {
+    if (_padding == value) return;
+    _padding = value;
+    markNeedsLayout();
+  }
+
+  double get pixelRatio => _pixelRatio;
+  double _pixelRatio;
+  set pixelRatio(double value) {
+    if (_pixelRatio == value) return;
+    _pixelRatio = value;
+    markNeedsLayout();
+  }
+
+  /// Packing computed by the last layout, in logical pixels.
+  AtlasPacking get packing => _packing;
+  AtlasPacking _packing = const AtlasPacking(size: Size.zero, rects: <Rect>[]);
+
+  @override
+  void setupParentData(RenderBox child) {
+    if (child.parentData is! AtlasParentData) {
+      child.parentData = AtlasParentData();
+    }
+  }
+
+  @override
+  void performLayout() {
+    final BoxConstraints childConstraints = BoxConstraints(maxWidth: math.min(maxWidth, constraints.maxWidth));
+    final List<Size> sizes = <Size>[];
+    RenderBox? child = firstChild;
+    while (child != null) {
+      child.layout(childConstraints, parentUsesSize: true);
+      sizes.add(Size(_snap(child.size.width), _snap(child.size.height)));
+      child = childAfter(child);
+    }
+
+    _packing = packShelves(sizes, maxWidth: math.min(maxWidth, constraints.maxWidth), padding: _snap(padding));
+
+    int index = 0;
+    child = firstChild;
+    while (child != null) {
+      (child.parentData! as AtlasParentData).offset = _packing.rects[index++].topLeft;
+      child = childAfter(child);
+    }
+
+    size = constraints.constrain(_packing.size);
+  }
+
+  double _snap(double value) => (value * pixelRatio).ceilToDouble() / pixelRatio;
+
+  @override
+  void paint(PaintingContext context, Offset offset) {
+    defaultPaint(context, offset);
+  }
+
+  @override
+  bool hitTestChildren(BoxHitTestResult result, {required Offset position}) {
+    return defaultHitTestChildren(result, position: position);
+  }
+}
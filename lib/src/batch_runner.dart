@@ -0,0 +1,269 @@
+import 'dart:async';
+import 'dart:convert';
+import 'dart:io';
+import 'dart:typed_data';
+import 'dart:ui' show Color;
+
+import 'headless_render.dart';
+import 'render_pipeline.dart';
+import 'template_registry.dart';
+
+/// One line of a batch manifest.
+///
+/// A manifest is JSON Lines, one job per line:
+///
+/// ```json
+/// {"template": 1, "params": ["Ada", 36, true], "output": "out/ada.png"}
+/// {"template": 2, "params": [{"color": 4294901760}], "width": 600, "height": 400, "format": "raw", "output": "out/red.rgba"}
+/// ```
+///
+/// `params` are written in order with a [TemplateParamsWriter]: integers
+/// with `writeInt`, other numbers with `writeDouble`, booleans, strings, and
+/// `{"color": argb}` objects with `writeColor`. `width` and `height`
+/// override the template's canvas, `format` is `png` (default) or `raw`.
+/// Blank lines and lines starting with `#` are skipped.
+class BatchEntry {
+  const BatchEntry({
+    required this.templateId,
+    required this.params,
+    required this.output,
+    this.format = OutputFormat.png,
+    this.width,
+    this.height,
+  });
+
+  /// Parses a manifest line. Throws [FormatException] when it is malformed.
+  factory BatchEntry.parse(String line) {
+    final Object? json = jsonDecode(line);
+    if (json is! Map<String, Object?>) {
+      throw const FormatException('Manifest entry is not a JSON object');
+    }
+    final Object? template = json['template'];
+    final Object? output = json['output'];
+    if (template is! int || template < 0) {
+      throw const FormatException('"template" must be a template id');
+    }
+    if (output is! String || output.isEmpty) {
+      throw const FormatException('"output" must be a non-empty string');
+    }
+
+    final TemplateParamsWriter params = TemplateParamsWriter();
+    final Object? values = json['params'] ?? const <Object?>[];
+    if (values is! List<Object?>) {
+      throw const FormatException('"params" must be a list');
+    }
+    for (final Object? value in values) {
+      switch (value) {
+        case int():
+          params.writeInt(value);
+        case double():
+          params.writeDouble(value);
+        case bool():
+          params.writeBool(value);
+        case String():
+          params.writeString(value);
+        case {'color': final int argb}:
+          params.writeColor(Color(argb));
+        default:
+          throw FormatException('Unsupported template parameter: ${jsonEncode(value)}');
+      }
+    }
+
+    final OutputFormat format = switch (json['format']) {
+      null || 'png' => OutputFormat.png,
+      'raw' => OutputFormat.raw,
+      final Object? other => throw FormatException('Unknown format: $other'),
+    };
+    return BatchEntry(
+      templateId: template,
+      params: params.takeBytes(),
+      output: output,
+      format: format,
+      width: _dimension(json, 'width'),
+      height: _dimension(json, 'height'),
+    );
+  }
+
+  final int templateId;
+
+  /// The encoded template parameters.
+  final Uint8List params;
+  final String output;
+  final OutputFormat format;
+  final double? width;
+  final double? height;
+
+  static double? _dimension(Map<String, Object?> json, String key) {
+    final Object? value = json[key];
+    if (value == null) {
+      return null;
+    }
+    if (value is! num || value <= 0) {
+      throw FormatException('"$key" must be a positive number');
+    }
+    return value.toDouble();
+  }
+}
+
+/// A manifest line that could not be rendered or written.
+class BatchFailure {
+  const BatchFailure(this.line, this.reason);
+
+  /// One-based line number in the manifest.
+  final int line;
+  final String reason;
+
+  @override
+  String toString() => 'line $line: $reason';
+}
+
+/// Totals of a [BatchRunner.run].
+class BatchSummary {
+  const BatchSummary({
+    required this.jobs,
+    required this.failed,
+    required this.bytes,
+    required this.elapsed,
+    required this.failures,
+    this.cpu = Duration.zero,
+  });
+
+  final int jobs;
+  final int failed;
+
+  /// Bytes written by the jobs that succeeded.
+  final int bytes;
+  final Duration elapsed;
+
+  /// CPU time of the jobs that succeeded, see [RenderJobCost.cpu].
+  final Duration cpu;
+
+  /// The first [BatchRunner.maxReportedFailures] failures.
+  final List<BatchFailure> failures;
+
+  int get succeeded => jobs - failed;
+
+  @override
+  String toString() {
+    final double seconds = elapsed.inMicroseconds / Duration.microsecondsPerSecond;
+    final double rate = seconds > 0 ? succeeded / seconds : 0;
+    final double throughput = seconds > 0 ? bytes / seconds / (1 << 20) : 0;
+    return '$jobs jobs, $succeeded ok, $failed failed in ${seconds.toStringAsFixed(1)} s '
+        '(${rate.toStringAsFixed(1)} images/s, ${throughput.toStringAsFixed(1)} MB/s, '
+        '${(cpu.inMicroseconds / Duration.microsecondsPerSecond).toStringAsFixed(1)} s CPU)';
+  }
+}
+
+/// Renders a batch manifest (see [BatchEntry]) through the embedder's
+/// pipeline.
+///
+/// Lines are rendered one after another while the embedder encodes and
+/// writes earlier jobs on its worker threads (see `clib/render_pipeline.h`),
+/// so a manifest of any length runs in bounded memory: submitting waits
+/// whenever the pipeline's queues are full.
+class BatchRunner {
+  BatchRunner(this._renderer, this._registry, {this.jobTimeout});
+
+  static const int maxReportedFailures = 20;
+
+  /// Cancels a line whose rendering takes longer, and counts it as failed.
+  final Duration? jobTimeout;
+
+  final HeadlessRender _renderer;
+  final TemplateRegistry _registry;
+  final Set<String> _createdDirectories = <String>{};
+
+  Future<BatchSummary> run(Stream<String> lines) async {
+    final Stopwatch stopwatch = Stopwatch()..start();
+    final List<BatchFailure> failures = <BatchFailure>[];
+    int jobs = 0;
+    int failed = 0;
+    int bytes = 0;
+    Duration cpu = Duration.zero;
+    int pending = 0;
+    Completer<void>? drained;
+
+    void fail(int line, Object error) {
+      failed++;
+      if (failures.length < maxReportedFailures) {
+        failures.add(BatchFailure(line, '$error'));
+      }
+    }
+
+    void settle() {
+      if (--pending == 0) {
+        drained?.complete();
+      }
+    }
+
+    int lineNumber = 0;
+    await for (final String line in lines) {
+      lineNumber++;
+      final String trimmed = line.trim();
+      if (trimmed.isEmpty || trimmed.startsWith('#')) {
+        continue;
+      }
+      jobs++;
+      final int current = lineNumber;
+      try {
+        final BatchEntry entry = BatchEntry.parse(trimmed);
+        final RenderTemplate template = _registry[entry.templateId];
+        await _createParentDirectory(entry.output);
+        final RenderJob job = await _renderer.submitImageFromWidget(
+          template.builder(TemplateParams.fromBytes(entry.params)),
+          entry.output,
+          format: entry.format,
+          width: entry.width ?? template.width,
+          height: entry.height ?? template.height,
+          pixelRatio: template.pixelRatio,
+          shrinkWrap: template.shrinkWrap,
+          timeout: jobTimeout,
+        );
+        pending++;
+        job.result.then(
+          (RenderJobResult result) {
+            bytes += result.bytes;
+            cpu += result.cost.cpu;
+            settle();
+          },
+          onError: (Object error) {
+            fail(current, error);
+            settle();
+          },
+        );
+      } on UnsupportedError {
+        rethrow;
+      } catch (error) {
+        fail(current, error);
+      }
+    }
+
+    if (pending > 0) {
+      drained = Completer<void>();
+      await drained.future;
+    }
+    stopwatch.stop();
+    return BatchSummary(
+      jobs: jobs,
+      failed: failed,
+      bytes: bytes,
+      elapsed: stopwatch.elapsed,
+      failures: failures,
+      cpu: cpu,
+    );
+  }
+
+  /// Reads a manifest file line by line.
+  Future<BatchSummary> runFile(File manifest) =>
+      run(manifest.openRead().transform(utf8.decoder).transform(const LineSplitter()));
+
+  Future<void> _createParentDirectory(String target) async {
+    if (target.startsWith('tcp:') || target.startsWith('unix:') || target.startsWith('shm:')) {
+      return;
+    }
+    final String parent = File(target).parent.path;
+    if (_createdDirectories.add(parent)) {
+      await Directory(parent).create(recursive: true);
+    }
+  }
+}
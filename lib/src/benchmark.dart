@@ -0,0 +1,193 @@
+import 'dart:async';
+import 'dart:io';
+
+import 'package:flutter/material.dart';
+
+import 'headless_render.dart';
+import 'render_pipeline.dart';
+
+/// A widget the `headless_bench` driver (`clib/headless_bench.c`) renders
+/// over and over. [build] gets the iteration number so every render has
+/// different content, like a real batch.
+class BenchFixture {
+  const BenchFixture({
+    required this.name,
+    required this.build,
+    this.width = 1280,
+    this.height = 12000,
+    this.shrinkWrap = true,
+  });
+
+  final String name;
+  final Widget Function(int iteration) build;
+  final double width;
+  final double height;
+  final bool shrinkWrap;
+}
+
+const String _lorem =
+    'Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et '
+    'dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip '
+    'ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore.';
+
+const List<IconData> _icons = <IconData>[
+  Icons.home,
+  Icons.star,
+  Icons.favorite,
+  Icons.settings,
+  Icons.search,
+  Icons.person,
+  Icons.mail,
+  Icons.phone,
+  Icons.camera_alt,
+  Icons.map,
+  Icons.alarm,
+  Icons.cloud,
+];
+
+final List<BenchFixture> benchFixtures = <BenchFixture>[
+  BenchFixture(
+    name: 'badge',
+    width: 160,
+    height: 64,
+    build: (int i) => Container(
+      padding: const EdgeInsets.symmetric(horizontal: 12, vertical: 6),
+      decoration: BoxDecoration(color: Colors.indigo, borderRadius: BorderRadius.circular(16)),
+      child: Row(
+        mainAxisSize: MainAxisSize.min,
+        children: [
+          const Icon(Icons.verified, color: Colors.white, size: 16),
+          const SizedBox(width: 6),
+          Text('#$i', style: const TextStyle(color: Colors.white, fontSize: 14)),
+        ],
+      ),
+    ),
+  ),
+  BenchFixture(
+    name: 'card',
+    width: 480,
+    height: 2000,
+    build: (int i) => Card(
+      margin: EdgeInsets.zero,
+      child: Padding(
+        padding: const EdgeInsets.all(16),
+        child: Column(
+          mainAxisSize: MainAxisSize.min,
+          crossAxisAlignment: CrossAxisAlignment.start,
+          children: [
+            Text('Report $i', style: const TextStyle(fontSize: 24, fontWeight: FontWeight.bold)),
+            for (int paragraph = 0; paragraph < 6; paragraph++)
+              Padding(
+                padding: const EdgeInsets.only(top: 8),
+                child: Text('${paragraph + i}. $_lorem', style: const TextStyle(fontSize: 13)),
+              ),
+            const Divider(),
+            Text('Generated for customer ${i * 7919 % 100000}', style: const TextStyle(color: Colors.grey)),
+          ],
+        ),
+      ),
+    ),
+  ),
+  BenchFixture(
+    name: 'page',
+    shrinkWrap: false,
+    build: (int i) => ColoredBox(
+      color: Colors.white,
+      child: Column(
+        crossAxisAlignment: CrossAxisAlignment.stretch,
+        children: [
+          for (int section = 0; section < 60; section++)
+            SizedBox(
+              height: 200,
+              child: Row(
+                children: [
+                  Container(width: 24, color: Colors.primaries[(section + i) % Colors.primaries.length]),
+                  Expanded(
+                    child: Padding(
+                      padding: const EdgeInsets.all(12),
+                      child: Text('Section $section of page $i. $_lorem $_lorem', style: const TextStyle(fontSize: 16)),
+                    ),
+                  ),
+                ],
+              ),
+            ),
+        ],
+      ),
+    ),
+  ),
+  BenchFixture(
+    name: 'grid',
+    width: 640,
+    height: 2000,
+    build: (int i) => Wrap(
+      spacing: 8,
+      runSpacing: 8,
+      children: [
+        for (int cell = 0; cell < 200; cell++)
+          Icon(
+            _icons[(cell + i) % _icons.length],
+            size: 32,
+            color: Colors.primaries[(cell * 3 + i) % Colors.primaries.length],
+          ),
+      ],
+    ),
+  ),
+];
+
+BenchFixture? benchFixture(String name) {
+  for (final BenchFixture fixture in benchFixtures) {
+    if (fixture.name == name) {
+      return fixture;
+    }
+  }
+  return null;
+}
+
+/// Renders [fixture] through the embedder's pipeline and reports progress on
+/// stdout as `BENCH ...` lines for the driver:
+///
+///   BENCH ready                  the first (cold) image was written
+///   BENCH warm-start             warmup is over, measuring starts
+///   BENCH latency <us>           one measured image, submit to written
+///   BENCH done <images> <us>     all measured images written
+///
+/// Measured images are submitted back to back, as in a batch, so latencies
+/// include the time spent waiting for the pipeline.
+Future<void> runBenchmark(HeadlessRender renderer, BenchFixture fixture, {int iterations = 200, int warmup = 20}) async {
+  final Directory directory = await Directory.systemTemp.createTemp('headless_bench');
+  int next = 0;
+  Future<RenderJob> submit() {
+    final int i = next++;
+    return renderer.submitImageFromWidget(
+      fixture.build(i),
+      '${directory.path}/${fixture.name}-${i % 16}.png',
+      width: fixture.width,
+      height: fixture.height,
+      shrinkWrap: fixture.shrinkWrap,
+    );
+  }
+
+  try {
+    await (await submit()).written;
+    _report('ready');
+    for (int i = 0; i < warmup; i++) {
+      await (await submit()).written;
+    }
+    _report('warm-start');
+
+    final Stopwatch clock = Stopwatch()..start();
+    final List<Future<void>> written = <Future<void>>[];
+    for (int i = 0; i < iterations; i++) {
+      final int start = clock.elapsedMicroseconds;
+      final RenderJob job = await submit();
+      written.add(job.written.then((_) => _report('latency ${clock.elapsedMicroseconds - start}')));
+    }
+    await Future.wait(written);
+    _report('done $iterations ${clock.elapsedMicroseconds}');
+    await stdout.flush();
+  } finally {
+    await directory.delete(recursive: true);
+  }
+}
+
+void _report(String line) => stdout.writeln('BENCH $line');
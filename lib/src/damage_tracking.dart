@@ -0,0 +1,160 @@
+import 'package:flutter/foundation.dart';
+import 'package:flutter/rendering.dart';
+import 'package:flutter/widgets.dart';
+
+/// Marks a part of a template whose content depends on per-render data, such
+/// as a name or a number on a personalized card.
+///
+/// The subtree is painted into its own layer, so new data only repaints the
+/// boundaries whose content changed, and an [IncrementalRenderSession] only
+/// re-rasterizes and re-encodes their area. Outside a session this behaves
+/// like a [RepaintBoundary].
+class DamageBoundary extends SingleChildRenderObjectWidget {
+  const DamageBoundary({super.key, super.child});
+
+  @override
+  RenderObject createRenderObject(BuildContext context) => _RenderDamageBoundary(DamageScope.maybeOf(context));
+
+  @override
+  void updateRenderObject(BuildContext context, RenderObject renderObject) {
+    (renderObject as _RenderDamageBoundary).tracker = DamageScope.maybeOf(context);
+  }
+}
+
+/// Provides the [DamageTracker] that [DamageBoundary]s below it report to.
+class DamageScope extends InheritedWidget {
+  const DamageScope({super.key, required this.tracker, required super.child});
+
+  final DamageTracker tracker;
+
+  static DamageTracker? maybeOf(BuildContext context) =>
+      context.dependOnInheritedWidgetOfExactType<DamageScope>()?.tracker;
+
+  @override
+  bool updateShouldNotify(DamageScope oldWidget) => tracker != oldWidget.tracker;
+}
+
+/// Works out which area of a laid out tree may look different than it did
+/// at the previous [collectDamage].
+///
+/// Painting always records new pictures, so a part of the layer tree whose
+/// pictures are the same objects as last time was not repainted. Every
+/// [DamageBoundary] is compared on its own and contributes its old and new
+/// bounds when it changed; a change anywhere outside the boundaries damages
+/// the whole tree. Updates that only touch a composited layer's properties
+/// without repainting (such as [FadeTransition]) are not detected.
+class DamageTracker {
+  final Set<_RenderDamageBoundary> _boundaries = <_RenderDamageBoundary>{};
+  Map<_RenderDamageBoundary, _BoundaryState> _states = <_RenderDamageBoundary, _BoundaryState>{};
+  List<PictureLayer>? _outside;
+
+  /// Forgets what was painted, so the next [collectDamage] damages everything.
+  void reset() {
+    _states = <_RenderDamageBoundary, _BoundaryState>{};
+    _outside = null;
+  }
+
+  /// Returns the damaged area in [root]'s coordinates, or null when nothing
+  /// changed. [rootLayer] is the layer [root] paints into.
+  Rect? collectDamage(RenderBox root, ContainerLayer rootLayer) {
+    final Set<Layer> boundaryLayers = <Layer>{
+      for (final _RenderDamageBoundary boundary in _boundaries)
+        if (boundary._offsetLayer != null) boundary._offsetLayer!,
+    };
+
+    final List<PictureLayer> outside = <PictureLayer>[];
+    _collectPictures(rootLayer, boundaryLayers, outside);
+    final bool outsideChanged = _outside == null || !listEquals(outside, _outside);
+    _outside = outside;
+
+    Rect? damage;
+    final Map<_RenderDamageBoundary, _BoundaryState> states = <_RenderDamageBoundary, _BoundaryState>{};
+    for (final _RenderDamageBoundary boundary in _boundaries) {
+      final OffsetLayer? layer = boundary._offsetLayer;
+      if (layer == null || !boundary.hasSize) {
+        continue;
+      }
+      final List<PictureLayer> pictures = <PictureLayer>[];
+      for (Layer? child = layer.firstChild; child != null; child = child.nextSibling) {
+        if (!boundaryLayers.contains(child)) {
+          _collectPictures(child, boundaryLayers, pictures);
+        }
+      }
+      final Rect bounds = MatrixUtils.transformRect(boundary.getTransformTo(root), Offset.zero & boundary.size);
+      final _BoundaryState state = _BoundaryState(bounds, pictures);
+      final _BoundaryState? previous = _states.remove(boundary);
+      if (previous == null || previous.bounds != bounds || !listEquals(previous.pictures, pictures)) {
+        damage = _union(damage, bounds);
+        if (previous != null) {
+          damage = _union(damage, previous.bounds);
+        }
+      }
+      states[boundary] = state;
+    }
+    // Boundaries that went away leave their old area behind.
+    for (final _BoundaryState gone in _states.values) {
+      damage = _union(damage, gone.bounds);
+    }
+    _states = states;
+
+    if (outsideChanged) {
+      return Offset.zero & root.size;
+    }
+    return damage;
+  }
+
+  static Rect _union(Rect? a, Rect b) => a == null ? b : a.expandToInclude(b);
+
+  static void _collectPictures(Layer layer, Set<Layer> stops, List<PictureLayer> out) {
+    if (layer is PictureLayer) {
+      out.add(layer);
+    } else if (layer is ContainerLayer) {
+      for (Layer? child = layer.firstChild; child != null; child = child.nextSibling) {
+        if (!stops.contains(child)) {
+          _collectPictures(child, stops, out);
+        }
+      }
+    }
+  }
+}
+
+class _BoundaryState {
+  const _BoundaryState(this.bounds, this.pictures);
+
+  final Rect bounds;
+  final List<PictureLayer> pictures;
+}
+
+class _RenderDamageBoundary extends RenderProxyBox {
+  _RenderDamageBoundary(this._tracker);
+
+  DamageTracker? _tracker;
+
+  set tracker(DamageTracker? value) {
+    if (value == _tracker) {
+      return;
+    }
+    if (attached) {
+      _tracker?._boundaries.remove(this);
+      value?._boundaries.add(this);
+    }
+    _tracker = value;
+  }
+
+  @override
+  bool get isRepaintBoundary => true;
+
+  OffsetLayer? get _offsetLayer => layer as OffsetLayer?;
+
+  @override
+  void attach(PipelineOwner owner) {
+    super.attach(owner);
+    _tracker?._boundaries.add(this);
+  }
+
+  @override
+  void detach() {
+    _tracker?._boundaries.remove(this);
+    super.detach();
+  }
+}
@@ -0,0 +1,101 @@
+import 'dart:convert';
+import 'dart:typed_data';
+
+import 'package:flutter/services.dart';
+
+const String _captureChannel = 'headless/capture';
+
+const int _opBegin = 1;
+const int _opSync = 2;
+const int _opEnd = 3;
+
+/// Encoding used by the embedder for captured frame sequences.
+enum FrameFormat {
+  /// Every frame as straight-alpha RGBA8, back to back, with no header.
+  raw,
+
+  /// Animated PNG, looping forever.
+  apng,
+
+  /// Animated GIF with a median-cut palette per frame, looping forever.
+  gif,
+}
+
+/// Summary of a finished [HeadlessRender.captureFrames] call.
+class FrameCaptureResult {
+  const FrameCaptureResult({required this.frames, required this.bytes});
+
+  /// Frames encoded into the output.
+  final int frames;
+
+  /// Size of the encoded output in bytes.
+  final int bytes;
+}
+
+/// Client for the embedder's `headless/capture` channel.
+///
+/// See `clib/frame_capture.h` for the message layout.
+class NativeFrameCapture {
+  NativeFrameCapture(this._messenger);
+
+  final BinaryMessenger _messenger;
+
+  Future<void> begin({
+    required int width,
+    required int height,
+    required int frameCount,
+    required int fps,
+    required double pixelRatio,
+    required FrameFormat format,
+    required String path,
+  }) async {
+    final Uint8List pathBytes = utf8.encode(path);
+    final ByteData message = ByteData(1 + 4 * 4 + 8 + 1 + 2 + pathBytes.length)
+      ..setUint8(0, _opBegin)
+      ..setUint32(1, width, Endian.little)
+      ..setUint32(5, height, Endian.little)
+      ..setUint32(9, frameCount, Endian.little)
+      ..setUint32(13, fps, Endian.little)
+      ..setFloat64(17, pixelRatio, Endian.little)
+      ..setUint8(25, format.index)
+      ..setUint16(26, pathBytes.length, Endian.little);
+    message.buffer.asUint8List(28).setAll(0, pathBytes);
+    _checkStatus(await _send(message));
+  }
+
+  /// Completes once frame [index] went through the embedder's present path.
+  Future<void> sync(int index) async {
+    final ByteData message = ByteData(5)
+      ..setUint8(0, _opSync)
+      ..setUint32(1, index, Endian.little);
+    _checkStatus(await _send(message));
+  }
+
+  Future<FrameCaptureResult> end() async {
+    final ByteData reply = await _send(ByteData(1)..setUint8(0, _opEnd));
+    if (reply.lengthInBytes != 13) {
+      _checkStatus(reply);
+    }
+    final int frames = reply.getUint32(1, Endian.little);
+    if (reply.getUint8(0) != 0) {
+      throw StateError('Frame capture failed: encoder error after $frames frames');
+    }
+    return FrameCaptureResult(frames: frames, bytes: reply.getUint64(5, Endian.little));
+  }
+
+  Future<ByteData> _send(ByteData message) async {
+    final ByteData? reply = await _messenger.send(_captureChannel, message);
+    if (reply == null || reply.lengthInBytes == 0) {
+      throw UnsupportedError('Frame capture needs the headless embedder ($_captureChannel is not handled).');
+    }
+    return reply;
+  }
+
+  static ByteData _checkStatus(ByteData reply) {
+    if (reply.getUint8(0) != 0) {
+      final String reason = utf8.decode(reply.buffer.asUint8List(reply.offsetInBytes + 1, reply.lengthInBytes - 1));
+      throw StateError('Frame capture failed: ${reason.isEmpty ? 'encoder error' : reason}');
+    }
+    return reply;
+  }
+}
@@ -10,6 +10,11 @@ class HeadlessFlutterView implements FlutterView {
       _physicalSize = physicalSize,
       _display = HeadlessDisplay(devicePixelRatio, physicalSize);
 
+  /// View that receives the scenes composited for this view, if any.
+  ///
+  /// Only set while frames are captured through the embedder's present path.
+  FlutterView? presentTarget;
+
   void updatePhysicalSize(Size newSize) {
     _physicalSize = newSize;
     _display.updateSize(newSize);
@@ -41,7 +46,8 @@ class HeadlessFlutterView implements FlutterView {
 
   @override
   void render(Scene scene, {Size? size}) {
-    // Intentionally unused; headless view does not present scenes.
+    // Headless views only present when a capture forwards them to a real view.
+    presentTarget?.render(scene, size: size);
   }
 
   @override
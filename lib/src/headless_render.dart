@@ -1,27 +1,48 @@
+import 'dart:async';
+import 'dart:convert';
 import 'dart:io';
+import 'dart:math' as math;
 import 'dart:ui' as ui;
 
 import 'package:flutter/material.dart';
 import 'package:flutter/rendering.dart';
 import 'package:flutter/services.dart';
 
+import 'atlas_layout.dart';
+import 'damage_tracking.dart';
+import 'frame_capture.dart';
 import 'headless_flutter_view.dart';
 import 'headless_material_app.dart';
+import 'native_png_patcher.dart';
+import 'native_png_stream.dart';
+import 'picture_cache.dart';
+import 'png_stream_encoder.dart';
+import 'render_pipeline.dart';
 import 'size_reporting_widget.dart';
+import 'template_registry.dart';
+
+const String _templateChannel = 'headless/templates';
+const int _templateOpReady = 1;
 
 const String _opensansFontDirectory = 'assets/fonts/opensans/';
 const String opensansFontFamily = 'OpenSans';
 
 class HeadlessRender {
-  HeadlessRender({String? fontFamily, Uri? assetsDirectory})
+  HeadlessRender({String? fontFamily, Uri? assetsDirectory, PictureCache? pictureCache})
     : defaultFontFamily = fontFamily ?? opensansFontFamily,
-      assetsDirectory = assetsDirectory ?? Directory.current.uri;
+      assetsDirectory = assetsDirectory ?? Directory.current.uri,
+      pictureCache = pictureCache ?? PictureCache();
 
   final String defaultFontFamily;
   final Uri assetsDirectory;
 
+  /// Pictures recorded by [CachedSubtree]s, shared by every job of this
+  /// renderer.
+  final PictureCache pictureCache;
+
   late final WidgetsBinding _binding;
   bool _initialized = false;
+  final _PreemptionGate _interactiveJobs = _PreemptionGate();
 
   Future<void> initialize() async {
     if (_initialized) return;
@@ -43,10 +64,697 @@ class HeadlessRender {
   }) async {
     await initialize();
 
+    final _HeadlessTree tree = _createTree(Size(width, height), pixelRatio);
+    try {
+      await _buildAndLayout(tree, widget, wait: wait, pixelRatio: pixelRatio, shrinkWrap: shrinkWrap);
+      return await _encodeBoundary(tree, pixelRatio);
+    } finally {
+      tree.dispose();
+    }
+  }
+
+  /// Renders [widget] once per entry of [pixelRatios] from a single build and
+  /// layout pass.
+  ///
+  /// The layer tree painted for the widget is rasterized and encoded at every
+  /// requested ratio concurrently. The view reports the largest ratio as its
+  /// device pixel ratio, so resolution-aware assets are picked for the
+  /// sharpest output. Returns the encoded images keyed by pixel ratio.
+  Future<Map<double, Uint8List>> createImagesFromWidget(
+    Widget widget, {
+    List<double> pixelRatios = const <double>[1.0, 2.0, 3.0],
+    double width = 1280,
+    double height = 12000,
+    Future<void>? wait,
+    bool shrinkWrap = true,
+  }) async {
+    await initialize();
+    if (pixelRatios.isEmpty) return <double, Uint8List>{};
+
+    final double viewPixelRatio = pixelRatios.reduce(math.max);
+    final _HeadlessTree tree = _createTree(Size(width, height), viewPixelRatio);
+    try {
+      await _buildAndLayout(tree, widget, wait: wait, pixelRatio: viewPixelRatio, shrinkWrap: shrinkWrap);
+      final List<double> ratios = pixelRatios.toSet().toList();
+      final List<Uint8List> images = await Future.wait(<Future<Uint8List>>[
+        for (final double ratio in ratios) _encodeBoundary(tree, ratio),
+      ]);
+      return <double, Uint8List>{for (var i = 0; i < ratios.length; i++) ratios[i]: images[i]};
+    } finally {
+      tree.dispose();
+    }
+  }
+
+  /// Renders [widget] as a PNG written to [sink] band by band.
+  ///
+  /// After the usual build and layout, the layer tree is rasterized in
+  /// horizontal bands of [tileHeight] physical rows. Each band is read back,
+  /// handed to a [PngStreamEncoder] and released before the next one is
+  /// rasterized, so peak memory grows with the band rather than the image.
+  /// Returns the size of the encoded image in physical pixels.
+  Future<Size> streamImageFromWidget(
+    Widget widget,
+    IOSink sink, {
+    double width = 1280,
+    double height = 12000,
+    Future<void>? wait,
+    double pixelRatio = 1.0,
+    bool shrinkWrap = true,
+    int tileHeight = 256,
+  }) async {
+    assert(tileHeight > 0);
+    await initialize();
+
+    final _HeadlessTree tree = _createTree(Size(width, height), pixelRatio);
+    try {
+      await _buildAndLayout(tree, widget, wait: wait, pixelRatio: pixelRatio, shrinkWrap: shrinkWrap);
+
+      final Size logical = tree.repaintBoundary.size;
+      final int physicalWidth = (logical.width * pixelRatio).ceil();
+      final int physicalHeight = (logical.height * pixelRatio).ceil();
+      final PngStreamEncoder encoder = PngStreamEncoder(sink, width: physicalWidth, height: physicalHeight);
+      await for (final Uint8List band in _rasterizeBands(tree, physicalWidth, physicalHeight, pixelRatio, tileHeight)) {
+        encoder.addRows(band);
+        await sink.flush();
+      }
+      encoder.close();
+      await sink.flush();
+      return Size(physicalWidth.toDouble(), physicalHeight.toDouble());
+    } finally {
+      tree.dispose();
+    }
+  }
+
+  /// Renders [widget] as a PNG that the embedder encodes and writes to
+  /// [target] band by band.
+  ///
+  /// [target] is a file path, `tcp:<host>:<port>` or `unix:<path>`. Like
+  /// [streamImageFromWidget] the tree is rasterized [tileHeight] rows at a
+  /// time, but compression and I/O happen natively while the next band is
+  /// rasterized, and every band is flushed to the target as soon as it is
+  /// encoded. Throws [UnsupportedError] when not running in the headless
+  /// embedder. Returns the number of bytes written.
+  Future<int> writeImageFromWidget(
+    Widget widget,
+    String target, {
+    double width = 1280,
+    double height = 12000,
+    Future<void>? wait,
+    double pixelRatio = 1.0,
+    bool shrinkWrap = true,
+    int tileHeight = 256,
+  }) async {
+    assert(tileHeight > 0);
+    await initialize();
+
+    final _HeadlessTree tree = _createTree(Size(width, height), pixelRatio);
+    try {
+      await _buildAndLayout(tree, widget, wait: wait, pixelRatio: pixelRatio, shrinkWrap: shrinkWrap);
+
+      final Size logical = tree.repaintBoundary.size;
+      final int physicalWidth = (logical.width * pixelRatio).ceil();
+      final int physicalHeight = (logical.height * pixelRatio).ceil();
+      final NativePngStream stream = await NativePngStream.open(
+        _binding.defaultBinaryMessenger,
+        width: physicalWidth,
+        height: physicalHeight,
+        target: target,
+      );
+      try {
+        await for (final Uint8List band in _rasterizeBands(tree, physicalWidth, physicalHeight, pixelRatio, tileHeight)) {
+          await stream.addRows(band);
+        }
+      } catch (_) {
+        // Release the embedder side; the rasterization error is the one to report.
+        await stream.close().then((_) {}, onError: (Object _) {});
+        rethrow;
+      }
+      return await stream.close();
+    } finally {
+      tree.dispose();
+    }
+  }
+
+  /// Renders [widget] and hands the pixels to the embedder, which encodes
+  /// them and writes them to [target] on its own worker threads.
+  ///
+  /// Completes as soon as the job is queued, so the next job's build and
+  /// layout overlap with this job's encoding and I/O:
+  ///
+  /// ```dart
+  /// final jobs = <RenderJob>[];
+  /// for (final (widget, path) in work) {
+  ///   jobs.add(await renderer.submitImageFromWidget(widget, path));
+  /// }
+  /// await Future.wait(jobs.map((job) => job.written));
+  /// ```
+  ///
+  /// Queues between the stages are bounded; when the encoders fall behind,
+  /// the returned future is held back until a slot frees up. [target] is a
+  /// file path, `tcp:<host>:<port>` or `unix:<path>`. Throws
+  /// [UnsupportedError] when not running in the headless embedder.
+  ///
+  /// With [autoCrop], the widget is laid out loosely at the top-left of the
+  /// full [width] x [height] canvas instead of being shrink-wrapped, which
+  /// saves the size report and view resize frames, and the embedder trims
+  /// every border row and column that only holds [cropBackground]. Keep the
+  /// canvas close to the expected size, since all of it is rasterized.
+  /// [RenderJob.result] reports the kept rect.
+  ///
+  /// With a [timeout], rendering is abandoned once it runs out: pumping
+  /// stops, the tree is unmounted, the image is released and the returned
+  /// future fails with a [TimeoutException]. The deadline is checked between
+  /// frames and while waiting for [wait] or the raster thread; once the job
+  /// reached the pipeline it is no longer cancelled.
+  ///
+  /// A [preemptible] job pauses before each frame and before rasterizing
+  /// while [RenderPriority.interactive] jobs are being built, so they do not
+  /// queue behind it on the UI and raster threads. The embedder marks batch
+  /// template jobs preemptible when `HEADLESS_PREEMPT=1`.
+  Future<RenderJob> submitImageFromWidget(
+    Widget widget,
+    String target, {
+    OutputFormat format = OutputFormat.png,
+    double width = 1280,
+    double height = 12000,
+    Future<void>? wait,
+    double pixelRatio = 1.0,
+    bool shrinkWrap = true,
+    bool autoCrop = false,
+    Color cropBackground = Colors.transparent,
+    Duration? timeout,
+    RenderPriority priority = RenderPriority.interactive,
+    bool preemptible = false,
+  }) async {
+    await initialize();
+
+    final NativeRenderPipeline pipeline = NativeRenderPipeline(_binding.defaultBinaryMessenger);
+    final EngineCpuTime started = await pipeline.begin();
+    final _RenderDeadline? deadline = timeout == null ? null : _RenderDeadline(timeout);
+    final void Function() leaveGate = priority == RenderPriority.interactive ? _interactiveJobs.enter() : () {};
+    final Stopwatch stopwatch = Stopwatch()..start();
+    final _HeadlessTree tree = _createTree(Size(width, height), pixelRatio);
+    final ui.Image image;
+    final Duration build;
+    final Duration rasterize;
+    try {
+      await _buildAndLayout(
+        tree,
+        autoCrop ? Align(alignment: Alignment.topLeft, child: widget) : widget,
+        wait: wait,
+        pixelRatio: pixelRatio,
+        shrinkWrap: shrinkWrap && !autoCrop,
+        deadline: deadline,
+        preemptible: preemptible,
+      );
+      if (preemptible) {
+        await _RenderDeadline.guard(deadline, _interactiveJobs.idle);
+      }
+      build = stopwatch.elapsed;
+      image = await _RenderDeadline.guard(
+        deadline,
+        tree.repaintBoundary.toImage(pixelRatio: pixelRatio),
+        onLate: (ui.Image late) => late.dispose(),
+      );
+      rasterize = stopwatch.elapsed - build;
+    } catch (_) {
+      deadline?.cancel();
+      leaveGate();
+      rethrow;
+    } finally {
+      tree.dispose();
+    }
+
+    try {
+      final ByteData? pixels = await _RenderDeadline.guard(
+        deadline,
+        image.toByteData(format: ui.ImageByteFormat.rawStraightRgba),
+      );
+      if (pixels == null) {
+        throw StateError('Failed to read back the rendered image');
+      }
+      deadline?.cancel();
+      leaveGate();
+      return await pipeline.submit(
+        width: image.width,
+        height: image.height,
+        format: format,
+        target: target,
+        rgba: pixels,
+        autoCrop: autoCrop,
+        background: cropBackground,
+        started: started,
+        stages: RenderStageTimes(
+          build: build,
+          rasterize: rasterize,
+          readBack: stopwatch.elapsed - build - rasterize,
+        ),
+      );
+    } finally {
+      deadline?.cancel();
+      leaveGate();
+      image.dispose();
+    }
+  }
+
+  /// Renders the jobs the embedder sends for the templates in [registry].
+  ///
+  /// Installs the handler for the `headless/templates` channel and tells the
+  /// embedder it can start sending jobs (see `clib/template_jobs.h`). Each
+  /// job names a template by id and carries its parameters, which go to the
+  /// template's builder as they are; the widget is then rendered through
+  /// [submitImageFromWidget], cancelled when it overruns the deadline the
+  /// embedder set for the job (see `clib/watchdog.h`). Throws
+  /// [UnsupportedError] when not running in the headless embedder.
+  Future<void> serveTemplates(TemplateRegistry registry) async {
+    await initialize();
+
+    final BinaryMessenger messenger = _binding.defaultBinaryMessenger;
+    messenger.setMessageHandler(_templateChannel, (ByteData? message) async {
+      try {
+        final TemplateJob job = TemplateJob.decode(message ?? ByteData(0));
+        final RenderTemplate template = registry[job.templateId];
+        final RenderJob rendered = await submitImageFromWidget(
+          template.builder(job.params),
+          job.target,
+          format: job.format,
+          width: template.width,
+          height: template.height,
+          pixelRatio: template.pixelRatio,
+          shrinkWrap: template.shrinkWrap,
+          timeout: job.timeout,
+          priority: job.priority,
+          preemptible: job.preemptible,
+        );
+        final RenderJobResult result = await rendered.result;
+        final ByteData reply = ByteData(17 + RenderJobCost.encodedLength)
+          ..setUint8(0, 0)
+          ..setUint64(1, result.bytes, Endian.little)
+          ..setUint32(9, result.rect.width.toInt(), Endian.little)
+          ..setUint32(13, result.rect.height.toInt(), Endian.little);
+        result.cost.writeTo(reply, 17);
+        return reply;
+      } catch (error) {
+        final Uint8List reason = utf8.encode('$error');
+        final ByteData reply = ByteData(1 + reason.length)..setUint8(0, 1);
+        reply.buffer.asUint8List(1).setAll(0, reason);
+        return reply;
+      }
+    });
+
+    final ByteData? reply = await messenger.send(_templateChannel, ByteData(1)..setUint8(0, _templateOpReady));
+    if (reply == null || reply.lengthInBytes == 0) {
+      messenger.setMessageHandler(_templateChannel, null);
+      throw UnsupportedError('Serving templates needs the headless embedder ($_templateChannel is not handled).');
+    }
+  }
+
+  /// Mounts a template built by [builder] and keeps it mounted, so it can be
+  /// rendered again and again with different data.
+  ///
+  /// Each [IncrementalRenderSession.render] only updates the bound data.
+  /// Parts of the template wrapped in a [DamageBoundary] repaint on their
+  /// own, and only the area of the boundaries that changed is rasterized,
+  /// patched into the previous image and re-encoded by the embedder:
+  ///
+  /// ```dart
+  /// final session = await renderer.openIncrementalSession<User>(
+  ///   data: users.first,
+  ///   builder: (context, user) => Card(
+  ///     child: Column(children: [
+  ///       const Logo(),
+  ///       DamageBoundary(child: Text(user.name)),
+  ///     ]),
+  ///   ),
+  /// );
+  /// for (final user in users) {
+  ///   await session.render(user, 'out/${user.id}.png');
+  /// }
+  /// await session.close();
+  /// ```
+  ///
+  /// Changes outside every [DamageBoundary] still re-render the whole image.
+  /// Throws [UnsupportedError] on the first render when not running in the
+  /// headless embedder.
+  Future<IncrementalRenderSession<T>> openIncrementalSession<T>({
+    required T data,
+    required Widget Function(BuildContext context, T data) builder,
+    double width = 1280,
+    double height = 12000,
+    Future<void>? wait,
+    double pixelRatio = 1.0,
+    bool shrinkWrap = true,
+  }) async {
+    await initialize();
+
+    final _HeadlessTree tree = _createTree(Size(width, height), pixelRatio);
+    final ValueNotifier<T> notifier = ValueNotifier<T>(data);
+    final DamageTracker tracker = DamageTracker();
+    try {
+      await _buildAndLayout(
+        tree,
+        DamageScope(
+          tracker: tracker,
+          child: ValueListenableBuilder<T>(
+            valueListenable: notifier,
+            builder: (BuildContext context, T value, Widget? _) => builder(context, value),
+          ),
+        ),
+        wait: wait,
+        pixelRatio: pixelRatio,
+        shrinkWrap: shrinkWrap,
+      );
+    } catch (_) {
+      tree.dispose();
+      notifier.dispose();
+      rethrow;
+    }
+    return IncrementalRenderSession<T>._(this, tree, notifier, tracker, pixelRatio);
+  }
+
+  // Yields straight-alpha RGBA rows of the laid out tree, [tileHeight]
+  // physical rows at a time, by rasterizing the boundary's layer one band at
+  // a time.
+  Stream<Uint8List> _rasterizeBands(
+    _HeadlessTree tree,
+    int physicalWidth,
+    int physicalHeight,
+    double pixelRatio,
+    int tileHeight,
+  ) async* {
+    final int stride = physicalWidth * 4;
+    for (int top = 0; top < physicalHeight; top += tileHeight) {
+      final int rows = math.min(tileHeight, physicalHeight - top);
+      final Rect band = Rect.fromLTWH(0, top / pixelRatio, physicalWidth / pixelRatio, rows / pixelRatio);
+      final ui.Image image = await tree.repaintBoundary.toImageRegion(band, pixelRatio: pixelRatio);
+      final ByteData? pixels = await image.toByteData(format: ui.ImageByteFormat.rawStraightRgba);
+      final int imageWidth = image.width;
+      image.dispose();
+      if (pixels == null) {
+        throw StateError('Failed to read back rows $top..${top + rows}');
+      }
+
+      // Scene sizes are rounded up, so a band may carry an extra row or column.
+      if (imageWidth == physicalWidth && pixels.lengthInBytes >= rows * stride) {
+        yield pixels.buffer.asUint8List(pixels.offsetInBytes, rows * stride);
+      } else {
+        final Uint8List trimmed = Uint8List(rows * stride);
+        final int sourceStride = imageWidth * 4;
+        final int copied = math.min(stride, sourceStride);
+        for (int row = 0; row < rows && (row + 1) * sourceStride <= pixels.lengthInBytes; row++) {
+          trimmed.setRange(row * stride, row * stride + copied, pixels.buffer.asUint8List(pixels.offsetInBytes + row * sourceStride, copied));
+        }
+        yield trimmed;
+      }
+    }
+  }
+
+  /// Renders [duration] of [widget]'s animations at [fps] and encodes every
+  /// frame into [outputPath] natively.
+  ///
+  /// Animations run on virtual time: frame `i` is produced with a timestamp of
+  /// `i / fps` seconds however long rendering takes. The widget is
+  /// shrink-wrapped once before the first frame and every frame is rendered
+  /// into the engine's implicit view, so it reaches the embedder's present
+  /// callback where the capture session encodes it. Requires the headless
+  /// embedder; throws [UnsupportedError] otherwise.
+  Future<FrameCaptureResult> captureFrames(
+    Widget widget, {
+    required Duration duration,
+    required String outputPath,
+    int fps = 30,
+    FrameFormat format = FrameFormat.apng,
+    double width = 1280,
+    double height = 12000,
+    Future<void>? wait,
+    double pixelRatio = 1.0,
+  }) async {
+    await initialize();
+
+    final ui.FlutterView? target = _binding.platformDispatcher.implicitView;
+    if (target == null) {
+      throw UnsupportedError('Frame capture needs the implicit view of the headless embedder.');
+    }
+    final int frameCount = math.max(1, (duration.inMicroseconds * fps / Duration.microsecondsPerSecond).ceil());
+    final NativeFrameCapture capture = NativeFrameCapture(_binding.defaultBinaryMessenger);
+    final ui.FrameCallback? beginFrame = _binding.platformDispatcher.onBeginFrame;
+
+    final _HeadlessTree tree = _createTree(Size(width, height), pixelRatio);
+    bool capturing = false;
+    try {
+      await _buildAndLayout(tree, widget, wait: wait, pixelRatio: pixelRatio, shrinkWrap: true);
+
+      // Snap the view to whole physical pixels; every frame must match the
+      // size of the surface the engine presents.
+      final Size laidOut = tree.repaintBoundary.size;
+      final int physicalWidth = (laidOut.width * pixelRatio).ceil();
+      final int physicalHeight = (laidOut.height * pixelRatio).ceil();
+      _resizeView(tree.renderView, tree.view, Size(physicalWidth / pixelRatio, physicalHeight / pixelRatio), pixelRatio);
+
+      await capture.begin(
+        width: physicalWidth,
+        height: physicalHeight,
+        frameCount: frameCount,
+        fps: fps,
+        pixelRatio: pixelRatio,
+        format: format,
+        path: outputPath,
+      );
+      capturing = true;
+      tree.view.presentTarget = target;
+
+      for (var i = 0; i < frameCount; i++) {
+        await _captureFrame(tree, Duration(microseconds: i * Duration.microsecondsPerSecond ~/ fps));
+        await capture.sync(i);
+      }
+
+      capturing = false;
+      return await capture.end();
+    } finally {
+      tree.view.presentTarget = null;
+      _binding.platformDispatcher.onBeginFrame = beginFrame;
+      if (capturing) {
+        await capture.end().catchError((Object _) => const FrameCaptureResult(frames: 0, bytes: 0));
+      }
+      tree.dispose();
+    }
+  }
+
+  // Produces one engine-driven frame at virtual [timeStamp]. The scene has to
+  // be composited inside the engine's frame callbacks to reach the raster
+  // thread, so the tree is flushed from a post-frame callback.
+  Future<void> _captureFrame(_HeadlessTree tree, Duration timeStamp) {
+    final Completer<void> composited = Completer<void>();
+    _binding.platformDispatcher.onBeginFrame = (Duration _) => _binding.handleBeginFrame(timeStamp);
+    _binding.addPostFrameCallback((Duration _) {
+      tree.buildOwner.buildScope(tree.rootElement);
+      tree.buildOwner.finalizeTree();
+      tree.pipelineOwner.flushLayout();
+      tree.pipelineOwner.flushCompositingBits();
+      tree.pipelineOwner.flushPaint();
+      tree.renderView.compositeFrame();
+      composited.complete();
+    });
+    _binding.scheduleFrame();
+    return composited.future;
+  }
+
+  Future<void> _buildAndLayout(
+    _HeadlessTree tree,
+    Widget widget, {
+    required Future<void>? wait,
+    required double pixelRatio,
+    required bool shrinkWrap,
+    _RenderDeadline? deadline,
+    bool preemptible = false,
+  }) async {
+    _attach(
+      tree,
+      shrinkWrap
+          ? Center(
+              child: SizeReportingWidget(
+                child: widget,
+                onSizeChange: (newSize) async {
+                  if (newSize == tree.size) return;
+                  _resizeView(tree.renderView, tree.view, newSize, pixelRatio);
+                  await _pumpFrames(tree.buildOwner, tree.pipelineOwner, tree.rootElement, count: 3);
+                },
+              ),
+            )
+          : widget,
+    );
+
+    // Initial frame.
+    tree.buildOwner.buildScope(tree.rootElement);
+    tree.pipelineOwner.flushLayout();
+    tree.pipelineOwner.flushCompositingBits();
+    tree.pipelineOwner.flushPaint();
+
+    if (wait != null) {
+      // Allow async work (e.g. image loading) before final frame.
+      await _RenderDeadline.guard(deadline, wait);
+    }
+
+    await _pumpFrames(tree.buildOwner, tree.pipelineOwner, tree.rootElement, count: 3, deadline: deadline, preemptible: preemptible);
+  }
+
+  Future<Uint8List> _encodeBoundary(_HeadlessTree tree, double pixelRatio) async {
+    final ui.Image image = await tree.repaintBoundary.toImage(pixelRatio: pixelRatio);
+    final ByteData? byteData = await image.toByteData(format: ui.ImageByteFormat.png);
+    image.dispose();
+    return byteData?.buffer.asUint8List() ?? Uint8List(0);
+  }
+
+  /// Builds and lays out [widget] without painting or rasterizing it.
+  ///
+  /// The widget is laid out with the same loose constraints
+  /// [createImageFromWidget] uses when shrink-wrapping, so the returned size
+  /// matches the dimensions of the image it would produce at a `pixelRatio`
+  /// of 1. For every key in [keys] that is found in the subtree, the rect of
+  /// the corresponding render box is reported relative to the widget's origin.
+  Future<WidgetGeometry> measureWidget(
+    Widget widget, {
+    double width = 1280,
+    double height = 12000,
+    Future<void>? wait,
+    double pixelRatio = 1.0,
+    Iterable<Key> keys = const <Key>[],
+  }) async {
+    await initialize();
+
     final Size size = Size(width, height);
-    final RenderRepaintBoundary repaintBoundary = RenderRepaintBoundary();
+    final GlobalKey measuredKey = GlobalKey();
+    final _HeadlessTree tree = _createTree(size, pixelRatio);
+    try {
+      _attach(tree, Center(child: KeyedSubtree(key: measuredKey, child: widget)));
+      _layoutFrame(tree);
+
+      if (wait != null) {
+        await wait;
+      }
+
+      await _layoutFrames(tree, count: 3);
+
+      final RenderBox box = measuredKey.currentContext!.findRenderObject()! as RenderBox;
+      final Set<Key> wanted = keys.toSet();
+      final Map<Key, Rect> rects = <Key, Rect>{};
+      if (wanted.isNotEmpty) {
+        void visit(Element element) {
+          final Key? key = element.widget.key;
+          if (key != null && wanted.contains(key) && !rects.containsKey(key)) {
+            final RenderObject? renderObject = element.findRenderObject();
+            if (renderObject is RenderBox && renderObject.hasSize) {
+              rects[key] = MatrixUtils.transformRect(renderObject.getTransformTo(box), Offset.zero & renderObject.size);
+            }
+          }
+          element.visitChildren(visit);
+        }
+
+        measuredKey.currentContext!.visitChildElements(visit);
+      }
+
+      return WidgetGeometry(size: box.size, rects: rects);
+    } finally {
+      tree.dispose();
+    }
+  }
+
+  /// Renders [widgets] into one atlas with a single layout and rasterization.
+  ///
+  /// Every widget is laid out with loose constraints no wider than [maxWidth]
+  /// and shelf-packed into the atlas, [padding] logical pixels apart. The
+  /// result always carries the physical pixel rect of each widget inside the
+  /// atlas; [output] selects whether the encoded atlas is returned as a whole
+  /// or each slice is encoded as its own PNG.
+  Future<AtlasResult> createAtlasFromWidgets(
+    List<Widget> widgets, {
+    double maxWidth = 1280,
+    double maxHeight = 12000,
+    Future<void>? wait,
+    double pixelRatio = 1.0,
+    double padding = 1,
+    AtlasOutput output = AtlasOutput.regions,
+  }) async {
+    await initialize();
+
+    final Size size = Size(maxWidth, maxHeight);
+    final GlobalKey atlasKey = GlobalKey();
+    final _HeadlessTree tree = _createTree(size, pixelRatio);
+    try {
+      _attach(
+        tree,
+        Align(
+          alignment: Alignment.topLeft,
+          child: AtlasLayout(key: atlasKey, maxWidth: maxWidth, padding: padding, pixelRatio: pixelRatio, children: widgets),
+        ),
+      );
+
+      tree.buildOwner.buildScope(tree.rootElement);
+      tree.pipelineOwner.flushLayout();
+      tree.pipelineOwner.flushCompositingBits();
+      tree.pipelineOwner.flushPaint();
+
+      if (wait != null) {
+        await wait;
+      }
+
+      await _pumpFrames(tree.buildOwner, tree.pipelineOwner, tree.rootElement, count: 3);
+
+      final RenderAtlas atlas = atlasKey.currentContext!.findRenderObject()! as RenderAtlas;
+      final AtlasPacking packing = atlas.packing;
+      if (packing.size.height > maxHeight) {
+        throw StateError('Atlas needs ${packing.size.height} logical pixels of height but maxHeight is $maxHeight; split the batch.');
+      }
+
+      final Offset origin = atlas.localToGlobal(Offset.zero, ancestor: tree.repaintBoundary);
+      final ui.Image image = await tree.repaintBoundary.toImageRegion(origin & packing.size, pixelRatio: pixelRatio);
+      try {
+        final List<Rect> slices = <Rect>[
+          for (final Rect rect in packing.rects)
+            Rect.fromLTRB(
+              (rect.left * pixelRatio).roundToDouble(),
+              (rect.top * pixelRatio).roundToDouble(),
+              (rect.right * pixelRatio).roundToDouble(),
+              (rect.bottom * pixelRatio).roundToDouble(),
+            ),
+        ];
+
+        if (output == AtlasOutput.separate) {
+          final List<Uint8List> images = await Future.wait(<Future<Uint8List>>[
+            for (final Rect slice in slices) _encodeSlice(image, slice),
+          ]);
+          return AtlasResult(size: Size(image.width.toDouble(), image.height.toDouble()), slices: slices, images: images);
+        }
+
+        final ByteData? byteData = await image.toByteData(format: ui.ImageByteFormat.png);
+        return AtlasResult(
+          size: Size(image.width.toDouble(), image.height.toDouble()),
+          slices: slices,
+          atlas: byteData?.buffer.asUint8List() ?? Uint8List(0),
+        );
+      } finally {
+        image.dispose();
+      }
+    } finally {
+      tree.dispose();
+    }
+  }
+
+  Future<Uint8List> _encodeSlice(ui.Image atlas, Rect slice) async {
+    if (slice.isEmpty) return Uint8List(0);
+    final ui.PictureRecorder recorder = ui.PictureRecorder();
+    Canvas(recorder).drawImageRect(atlas, slice, Offset.zero & slice.size, Paint());
+    final ui.Picture picture = recorder.endRecording();
+    final ui.Image image = picture.toImageSync(slice.width.toInt(), slice.height.toInt());
+    picture.dispose();
+    final ByteData? byteData = await image.toByteData(format: ui.ImageByteFormat.png);
+    image.dispose();
+    return byteData?.buffer.asUint8List() ?? Uint8List(0);
+  }
+
+  _HeadlessTree _createTree(Size size, double pixelRatio) {
+    final _HeadlessRepaintBoundary repaintBoundary = _HeadlessRepaintBoundary();
     final HeadlessFlutterView view = HeadlessFlutterView(pixelRatio, size);
-    RenderObjectToWidgetElement<RenderBox>? rootElement;
 
     final RenderView renderView = RenderView(
       view: view,
@@ -64,49 +772,33 @@ class HeadlessRender {
     pipelineOwner.rootNode = renderView;
     renderView.prepareInitialFrame();
 
+    return _HeadlessTree(
+      size: size,
+      view: view,
+      renderView: renderView,
+      repaintBoundary: repaintBoundary,
+      pipelineOwner: pipelineOwner,
+      buildOwner: buildOwner,
+      focusManager: focusManager,
+    );
+  }
+
+  void _attach(_HeadlessTree tree, Widget child) {
     final ThemeData theme = ThemeData(
       fontFamily: defaultFontFamily,
       textTheme: ThemeData.light().textTheme.apply(fontFamily: defaultFontFamily),
     );
 
-    rootElement = RenderObjectToWidgetAdapter<RenderBox>(
-      container: repaintBoundary,
+    tree.rootElement = RenderObjectToWidgetAdapter<RenderBox>(
+      container: tree.repaintBoundary,
       child: HeadlessMaterialApp(
-        view: view,
+        view: tree.view,
         fontFamily: defaultFontFamily,
-        size: size,
+        size: tree.size,
         theme: theme,
-        child: shrinkWrap
-            ? Center(
-                child: SizeReportingWidget(
-                  child: widget,
-                  onSizeChange: (newSize) async {
-                    if (newSize == size) return;
-                    _resizeView(renderView, view, newSize, pixelRatio);
-                    await _pumpFrames(buildOwner, pipelineOwner, rootElement!, count: 3);
-                  },
-                ),
-              )
-            : widget,
+        child: PictureCacheScope(cache: pictureCache, child: child),
       ),
-    ).attachToRenderTree(buildOwner);
-
-    // Initial frame.
-    buildOwner.buildScope(rootElement);
-    pipelineOwner.flushLayout();
-    pipelineOwner.flushCompositingBits();
-    pipelineOwner.flushPaint();
-
-    if (wait != null) {
-      // Allow async work (e.g. image loading) before final frame.
-      await wait;
-    }
-
-    await _pumpFrames(buildOwner, pipelineOwner, rootElement, count: 3);
-
-    final ui.Image image = await repaintBoundary.toImage(pixelRatio: pixelRatio);
-    final ByteData? byteData = await image.toByteData(format: ui.ImageByteFormat.png);
-    return byteData?.buffer.asUint8List() ?? Uint8List(0);
+    ).attachToRenderTree(tree.buildOwner);
   }
 
   void _resizeView(RenderView renderView, HeadlessFlutterView view, Size size, double pixelRatio) {
@@ -118,8 +810,19 @@ class HeadlessRender {
     );
   }
 
-  Future<void> _pumpFrames(BuildOwner build, PipelineOwner pipeline, Element rootElement, {int count = 1}) async {
+  Future<void> _pumpFrames(
+    BuildOwner build,
+    PipelineOwner pipeline,
+    Element rootElement, {
+    int count = 1,
+    _RenderDeadline? deadline,
+    bool preemptible = false,
+  }) async {
     for (var i = 0; i < count; i++) {
+      if (preemptible) {
+        await _RenderDeadline.guard(deadline, _interactiveJobs.idle);
+      }
+      deadline?.check();
       await _pumpFrame(build, pipeline, rootElement);
     }
   }
@@ -136,6 +839,20 @@ class HeadlessRender {
     await Future<void>.delayed(const Duration(milliseconds: 5));
   }
 
+  Future<void> _layoutFrames(_HeadlessTree tree, {int count = 1}) async {
+    for (var i = 0; i < count; i++) {
+      _layoutFrame(tree);
+      await Future<void>.delayed(const Duration(milliseconds: 5));
+    }
+  }
+
+  // Build and layout only; measuring never needs compositing bits or paint.
+  void _layoutFrame(_HeadlessTree tree) {
+    tree.buildOwner.buildScope(tree.rootElement);
+    tree.buildOwner.finalizeTree();
+    tree.pipelineOwner.flushLayout();
+  }
+
   Future<void> _loadFont(String family, Uri path) async {
     final String resolvedPath = path.toFilePath(windows: Platform.isWindows);
     final FileSystemEntityType type = FileSystemEntity.typeSync(resolvedPath);
@@ -158,3 +875,290 @@ class HeadlessRender {
     await loader.load();
   }
 }
+
+/// Result of [HeadlessRender.measureWidget].
+class WidgetGeometry {
+  const WidgetGeometry({required this.size, this.rects = const <Key, Rect>{}});
+
+  /// Logical size of the laid out widget.
+  final Size size;
+
+  /// Rects of the requested keyed descendants, relative to the widget's origin.
+  final Map<Key, Rect> rects;
+}
+
+/// How [HeadlessRender.createAtlasFromWidgets] returns its slices.
+enum AtlasOutput {
+  /// A single encoded atlas plus the rect of every widget inside it.
+  regions,
+
+  /// One encoded image per widget, cut from the rasterized atlas.
+  separate,
+}
+
+/// Result of [HeadlessRender.createAtlasFromWidgets].
+class AtlasResult {
+  const AtlasResult({required this.size, required this.slices, this.atlas, this.images = const <Uint8List>[]});
+
+  /// Size of the rasterized atlas in physical pixels.
+  final Size size;
+
+  /// Physical pixel rect of each widget inside the atlas, in input order.
+  final List<Rect> slices;
+
+  /// Encoded atlas; only set for [AtlasOutput.regions].
+  final Uint8List? atlas;
+
+  /// Encoded slices in input order; only set for [AtlasOutput.separate].
+  final List<Uint8List> images;
+}
+
+/// What [IncrementalRenderSession.render] wrote.
+class IncrementalRenderResult {
+  const IncrementalRenderResult({required this.bytes, required this.damage, required this.bandsEncoded});
+
+  final int bytes;
+
+  /// The region rasterized again, in physical pixels. Empty when nothing
+  /// changed since the previous render.
+  final Rect damage;
+
+  /// Row bands the embedder compressed again; the rest of the PNG was reused.
+  final int bandsEncoded;
+}
+
+/// A template kept mounted between renders. See
+/// [HeadlessRender.openIncrementalSession].
+class IncrementalRenderSession<T> {
+  IncrementalRenderSession._(this._render, this._tree, this._data, this._tracker, this.pixelRatio);
+
+  final HeadlessRender _render;
+  final _HeadlessTree _tree;
+  final ValueNotifier<T> _data;
+  final DamageTracker _tracker;
+  final double pixelRatio;
+  NativePngPatcher? _patcher;
+  bool _busy = false;
+  bool _closed = false;
+
+  /// Rebuilds the template with [data] and writes it to [target] as a PNG.
+  ///
+  /// [target] is a file path, `tcp:<host>:<port>` or `unix:<path>`. Renders
+  /// of one session must not overlap.
+  Future<IncrementalRenderResult> render(T data, String target, {Future<void>? wait}) async {
+    if (_closed || _busy) {
+      throw StateError(_closed ? 'Session is closed' : 'A render of this session is still running');
+    }
+    _busy = true;
+    try {
+      _data.value = data;
+      await _render._pumpFrames(_tree.buildOwner, _tree.pipelineOwner, _tree.rootElement, count: 2);
+      if (wait != null) {
+        await wait;
+        await _render._pumpFrames(_tree.buildOwner, _tree.pipelineOwner, _tree.rootElement);
+      }
+
+      final _HeadlessRepaintBoundary boundary = _tree.repaintBoundary;
+      final int width = (boundary.size.width * pixelRatio).ceil();
+      final int height = (boundary.size.height * pixelRatio).ceil();
+      NativePngPatcher? patcher = _patcher;
+      if (patcher == null || patcher.width != width || patcher.height != height) {
+        _patcher = null;
+        await patcher?.close();
+        patcher = _patcher = await NativePngPatcher.open(
+          _render._binding.defaultBinaryMessenger,
+          width: width,
+          height: height,
+        );
+        _tracker.reset();
+      }
+
+      // Snap the damage outwards to whole physical pixels.
+      final Rect? damage = _tracker.collectDamage(boundary, boundary.rootLayer);
+      int left = 0, top = 0, right = 0, bottom = 0;
+      if (damage != null) {
+        left = (damage.left * pixelRatio).floor().clamp(0, width);
+        top = (damage.top * pixelRatio).floor().clamp(0, height);
+        right = (damage.right * pixelRatio).ceil().clamp(left, width);
+        bottom = (damage.bottom * pixelRatio).ceil().clamp(top, height);
+      }
+      if (right == left || bottom == top) {
+        right = left;
+        bottom = top;
+      }
+      final Uint8List pixels = right > left
+          ? await _rasterizeRegion(boundary, left, top, right - left, bottom - top)
+          : Uint8List(0);
+
+      final PngPatchResult result = await patcher.patch(
+        left: left,
+        top: top,
+        patchWidth: right - left,
+        patchHeight: bottom - top,
+        rgba: pixels,
+        target: target,
+      );
+      return IncrementalRenderResult(
+        bytes: result.bytes,
+        damage: Rect.fromLTRB(left.toDouble(), top.toDouble(), right.toDouble(), bottom.toDouble()),
+        bandsEncoded: result.bandsEncoded,
+      );
+    } finally {
+      _busy = false;
+    }
+  }
+
+  // Straight-alpha RGBA of a physical-pixel rect of the boundary.
+  Future<Uint8List> _rasterizeRegion(_HeadlessRepaintBoundary boundary, int left, int top, int width, int height) async {
+    final ui.Image image = await boundary.toImageRegion(
+      Rect.fromLTWH(left / pixelRatio, top / pixelRatio, width / pixelRatio, height / pixelRatio),
+      pixelRatio: pixelRatio,
+    );
+    try {
+      final ByteData? bytes = await image.toByteData(format: ui.ImageByteFormat.rawStraightRgba);
+      if (bytes == null) {
+        throw StateError('Failed to read back the damaged region');
+      }
+      final Uint8List rgba = bytes.buffer.asUint8List(bytes.offsetInBytes, bytes.lengthInBytes);
+      if (image.width == width && image.height == height) {
+        return rgba;
+      }
+      // The scene size is rounded up, so the image can be a pixel larger.
+      final Uint8List trimmed = Uint8List(width * height * 4);
+      final int copyWidth = math.min(width, image.width) * 4;
+      for (int y = 0; y < math.min(height, image.height); y++) {
+        trimmed.setRange(y * width * 4, y * width * 4 + copyWidth, rgba, y * image.width * 4);
+      }
+      return trimmed;
+    } finally {
+      image.dispose();
+    }
+  }
+
+  /// Unmounts the template and releases the embedder's copy of the image.
+  Future<void> close() async {
+    if (_closed) {
+      return;
+    }
+    _closed = true;
+    _tree.dispose();
+    _data.dispose();
+    final NativePngPatcher? patcher = _patcher;
+    _patcher = null;
+    await patcher?.close();
+  }
+}
+
+/// Cancels a render that runs past its deadline.
+class _RenderDeadline {
+  _RenderDeadline(this.timeout) {
+    _timer = Timer(timeout, () => _expired.completeError(TimeoutException('Render job exceeded its deadline', timeout)));
+    // Nothing may be waiting on it when it fires.
+    _expired.future.ignore();
+  }
+
+  final Duration timeout;
+  final Completer<Never> _expired = Completer<Never>();
+  late final Timer _timer;
+
+  /// Throws once the deadline passed.
+  void check() {
+    if (_expired.isCompleted) {
+      throw TimeoutException('Render job exceeded its deadline', timeout);
+    }
+  }
+
+  void cancel() => _timer.cancel();
+
+  /// Completes like [work], or fails when [deadline] passes first. [onLate]
+  /// releases what [work] produces after that.
+  static Future<T> guard<T>(_RenderDeadline? deadline, Future<T> work, {void Function(T value)? onLate}) {
+    if (deadline == null) {
+      return work;
+    }
+    deadline.check();
+    return Future.any<T>(<Future<T>>[
+      work.then((T value) {
+        if (deadline._expired.isCompleted) {
+          onLate?.call(value);
+        }
+        return value;
+      }),
+      deadline._expired.future,
+    ]);
+  }
+}
+
+/// Counts the interactive jobs between build and submit, for preemptible
+/// jobs to wait on.
+class _PreemptionGate {
+  int _active = 0;
+  Completer<void>? _idle;
+
+  /// Completes once no interactive job is rendering.
+  Future<void> get idle => _idle?.future ?? Future<void>.value();
+
+  /// Marks a job as rendering until the returned callback runs; calling it
+  /// again does nothing.
+  void Function() enter() {
+    _active++;
+    _idle ??= Completer<void>();
+    var left = false;
+    return () {
+      if (left) return;
+      left = true;
+      if (--_active == 0) {
+        _idle!.complete();
+        _idle = null;
+      }
+    };
+  }
+}
+
+/// Render tree owned by a single render or measure call.
+class _HeadlessTree {
+  _HeadlessTree({
+    required this.size,
+    required this.view,
+    required this.renderView,
+    required this.repaintBoundary,
+    required this.pipelineOwner,
+    required this.buildOwner,
+    required this.focusManager,
+  });
+
+  final Size size;
+  final HeadlessFlutterView view;
+  final RenderView renderView;
+  final _HeadlessRepaintBoundary repaintBoundary;
+  final PipelineOwner pipelineOwner;
+  final BuildOwner buildOwner;
+  final FocusManager focusManager;
+  RenderObjectToWidgetElement<RenderBox>? _rootElement;
+
+  RenderObjectToWidgetElement<RenderBox> get rootElement => _rootElement!;
+  set rootElement(RenderObjectToWidgetElement<RenderBox> element) => _rootElement = element;
+
+  /// Unmounts the widget tree and releases the pipeline.
+  void dispose() {
+    final RenderObjectToWidgetElement<RenderBox>? root = _rootElement;
+    if (root != null) {
+      RenderObjectToWidgetAdapter<RenderBox>(container: repaintBoundary).attachToRenderTree(buildOwner, root);
+      buildOwner.buildScope(root);
+      buildOwner.finalizeTree();
+    }
+    pipelineOwner.rootNode = null;
+    pipelineOwner.dispose();
+    focusManager.dispose();
+  }
+}
+
+class _HeadlessRepaintBoundary extends RenderRepaintBoundary {
+  ContainerLayer get rootLayer => layer! as ContainerLayer;
+
+  /// Rasterizes only [bounds] (in logical pixels) of this boundary's layer.
+  Future<ui.Image> toImageRegion(Rect bounds, {double pixelRatio = 1.0}) {
+    final OffsetLayer offsetLayer = layer! as OffsetLayer;
+    return offsetLayer.toImage(bounds, pixelRatio: pixelRatio);
+  }
+}
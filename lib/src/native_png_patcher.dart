@@ -0,0 +1,99 @@
+import 'dart:convert';
+import 'dart:typed_data';
+
+import 'package:flutter/services.dart';
+
+const String _pngPatchChannel = 'headless/png_patch';
+
+const int _opOpen = 1;
+const int _opPatch = 2;
+const int _opClose = 3;
+
+/// What the embedder wrote for one patch.
+class PngPatchResult {
+  const PngPatchResult({required this.bytes, required this.bandsEncoded});
+
+  final int bytes;
+
+  /// Row bands the embedder compressed again; the rest were reused.
+  final int bandsEncoded;
+}
+
+/// Client for the embedder's `headless/png_patch` channel.
+///
+/// The embedder keeps the last image of the session. Each [patch] replaces
+/// one rect of it and writes the whole image as a PNG, compressing only the
+/// rows around the rect again. See `clib/image_patch.h` for the message
+/// layout.
+class NativePngPatcher {
+  NativePngPatcher._(this._messenger, this._id, this.width, this.height);
+
+  /// Opens a session for [width] x [height] images. The kept image starts
+  /// out fully transparent.
+  static Future<NativePngPatcher> open(BinaryMessenger messenger, {required int width, required int height}) async {
+    final ByteData message = ByteData(9)
+      ..setUint8(0, _opOpen)
+      ..setUint32(1, width, Endian.little)
+      ..setUint32(5, height, Endian.little);
+    final ByteData reply = _checkStatus(await _send(messenger, message));
+    return NativePngPatcher._(messenger, reply.getUint32(1, Endian.little), width, height);
+  }
+
+  final BinaryMessenger _messenger;
+  final int _id;
+  final int width;
+  final int height;
+
+  /// Copies [rgba], `rect.width * rect.height` straight-alpha pixels, into
+  /// the kept image at ([left], [top]) and writes the result to [target], a
+  /// file path, `tcp:<host>:<port>` or `unix:<path>`. An empty rect writes
+  /// the previous image again.
+  Future<PngPatchResult> patch({
+    required int left,
+    required int top,
+    required int patchWidth,
+    required int patchHeight,
+    required Uint8List rgba,
+    required String target,
+  }) async {
+    assert(rgba.length == patchWidth * patchHeight * 4);
+    final Uint8List targetBytes = utf8.encode(target);
+    final int header = 1 + 4 * 5 + 2 + targetBytes.length;
+    final ByteData message = ByteData(header + rgba.length)
+      ..setUint8(0, _opPatch)
+      ..setUint32(1, _id, Endian.little)
+      ..setUint32(5, left, Endian.little)
+      ..setUint32(9, top, Endian.little)
+      ..setUint32(13, patchWidth, Endian.little)
+      ..setUint32(17, patchHeight, Endian.little)
+      ..setUint16(21, targetBytes.length, Endian.little);
+    message.buffer.asUint8List(23).setAll(0, targetBytes);
+    message.buffer.asUint8List(header).setAll(0, rgba);
+    final ByteData reply = _checkStatus(await _send(_messenger, message));
+    return PngPatchResult(bytes: reply.getUint64(1, Endian.little), bandsEncoded: reply.getUint32(9, Endian.little));
+  }
+
+  /// Releases the kept image.
+  Future<void> close() async {
+    final ByteData message = ByteData(5)
+      ..setUint8(0, _opClose)
+      ..setUint32(1, _id, Endian.little);
+    _checkStatus(await _send(_messenger, message));
+  }
+
+  static Future<ByteData> _send(BinaryMessenger messenger, ByteData message) async {
+    final ByteData? reply = await messenger.send(_pngPatchChannel, message);
+    if (reply == null || reply.lengthInBytes == 0) {
+      throw UnsupportedError('Incremental rendering needs the headless embedder ($_pngPatchChannel is not handled).');
+    }
+    return reply;
+  }
+
+  static ByteData _checkStatus(ByteData reply) {
+    if (reply.getUint8(0) != 0) {
+      final String reason = utf8.decode(reply.buffer.asUint8List(reply.offsetInBytes + 1, reply.lengthInBytes - 1));
+      throw StateError('PNG patch failed: ${reason.isEmpty ? 'encoder error' : reason}');
+    }
+    return reply;
+  }
+}
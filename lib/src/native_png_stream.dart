@@ -0,0 +1,88 @@
+import 'dart:convert';
+import 'dart:typed_data';
+
+import 'package:flutter/services.dart';
+
+const String _pngStreamChannel = 'headless/png_stream';
+
+const int _opBegin = 1;
+const int _opRows = 2;
+const int _opFinish = 3;
+
+/// Client for the embedder's `headless/png_stream` channel.
+///
+/// Rows are encoded and written to the target by the embedder. [addRows]
+/// returns as soon as the band is queued on the channel and only waits for
+/// the band before it, so the next band can be rasterized while the embedder
+/// compresses and flushes this one. See `clib/image_stream.h` for the message
+/// layout.
+class NativePngStream {
+  NativePngStream._(this._messenger, this._id, this.width);
+
+  /// Opens a stream of a [width] x [height] PNG written to [target], which
+  /// is a file path, `tcp:<host>:<port>` or `unix:<path>`.
+  static Future<NativePngStream> open(
+    BinaryMessenger messenger, {
+    required int width,
+    required int height,
+    required String target,
+  }) async {
+    final Uint8List targetBytes = utf8.encode(target);
+    final ByteData message = ByteData(1 + 4 + 4 + 2 + targetBytes.length)
+      ..setUint8(0, _opBegin)
+      ..setUint32(1, width, Endian.little)
+      ..setUint32(5, height, Endian.little)
+      ..setUint16(9, targetBytes.length, Endian.little);
+    message.buffer.asUint8List(11).setAll(0, targetBytes);
+    final ByteData reply = _checkStatus(await _send(messenger, message));
+    return NativePngStream._(messenger, reply.getUint32(1, Endian.little), width);
+  }
+
+  final BinaryMessenger _messenger;
+  final int _id;
+  final int width;
+  Future<void>? _inFlight;
+
+  /// Sends whole rows of `width * 4` straight-alpha RGBA bytes.
+  Future<void> addRows(Uint8List rgba) async {
+    final int stride = width * 4;
+    assert(rgba.length % stride == 0);
+    await _inFlight;
+    final ByteData message = ByteData(9 + rgba.length)
+      ..setUint8(0, _opRows)
+      ..setUint32(1, _id, Endian.little)
+      ..setUint32(5, rgba.length ~/ stride, Endian.little);
+    message.buffer.asUint8List(9).setAll(0, rgba);
+    _inFlight = _send(_messenger, message).then(_checkStatus);
+  }
+
+  /// Waits for the last band, writes the end of the PNG and returns the
+  /// number of bytes written to the target.
+  Future<int> close() async {
+    final Future<void> last = _inFlight ?? Future<void>.value();
+    _inFlight = null;
+    final ByteData message = ByteData(5)
+      ..setUint8(0, _opFinish)
+      ..setUint32(1, _id, Endian.little);
+    // Finish is sent even when a band failed, so the embedder releases the
+    // stream; channel messages arrive in order, after the last band.
+    final List<Object?> results = await Future.wait<Object?>(<Future<Object?>>[last, _send(_messenger, message)]);
+    return _checkStatus(results[1]! as ByteData).getUint64(1, Endian.little);
+  }
+
+  static Future<ByteData> _send(BinaryMessenger messenger, ByteData message) async {
+    final ByteData? reply = await messenger.send(_pngStreamChannel, message);
+    if (reply == null || reply.lengthInBytes == 0) {
+      throw UnsupportedError('Native PNG streaming needs the headless embedder ($_pngStreamChannel is not handled).');
+    }
+    return reply;
+  }
+
+  static ByteData _checkStatus(ByteData reply) {
+    if (reply.getUint8(0) != 0) {
+      final String reason = utf8.decode(reply.buffer.asUint8List(reply.offsetInBytes + 1, reply.lengthInBytes - 1));
+      throw StateError('PNG stream failed: ${reason.isEmpty ? 'encoder error' : reason}');
+    }
+    return reply;
+  }
+}
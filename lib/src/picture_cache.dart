@@ -0,0 +1,256 @@
+import 'dart:collection';
+import 'dart:ui' as ui;
+
+import 'package:flutter/rendering.dart';
+import 'package:flutter/widgets.dart';
+
+/// Bounded, memory-accounted store of recorded subtrees shared across jobs.
+///
+/// Entries are evicted least recently used first once either [maxBytes] or
+/// [maxEntries] is exceeded. A picture that is still drawn by a mounted
+/// [CachedSubtree] is only disposed once that subtree goes away.
+class PictureCache {
+  PictureCache({this.maxBytes = 32 << 20, this.maxEntries = 256});
+
+  final int maxBytes;
+  final int maxEntries;
+
+  final LinkedHashMap<Object, PictureCacheEntry> _entries = LinkedHashMap<Object, PictureCacheEntry>();
+  int _bytes = 0;
+  int _hits = 0;
+  int _misses = 0;
+
+  /// Approximate bytes held by cached pictures.
+  int get bytesUsed => _bytes;
+  int get length => _entries.length;
+  int get hits => _hits;
+  int get misses => _misses;
+
+  bool contains(Object key) => _entries.containsKey(key);
+
+  /// Returns the entry for [key] and marks it as most recently used.
+  PictureCacheEntry? lookup(Object key) {
+    final PictureCacheEntry? entry = _entries.remove(key);
+    if (entry == null) {
+      _misses++;
+      return null;
+    }
+    _hits++;
+    _entries[key] = entry;
+    return entry;
+  }
+
+  void _put(Object key, PictureCacheEntry entry) {
+    final PictureCacheEntry? previous = _entries.remove(key);
+    if (previous != null) {
+      _bytes -= previous.bytes;
+      previous._evict();
+    }
+    if (entry.bytes > maxBytes) {
+      entry._evict();
+      return;
+    }
+    _entries[key] = entry;
+    _bytes += entry.bytes;
+    while (_bytes > maxBytes || _entries.length > maxEntries) {
+      final Object oldest = _entries.keys.first;
+      final PictureCacheEntry evicted = _entries.remove(oldest)!;
+      _bytes -= evicted.bytes;
+      evicted._evict();
+    }
+  }
+
+  /// Drops every entry; pictures still in use are disposed once released.
+  void clear() {
+    for (final PictureCacheEntry entry in _entries.values) {
+      entry._evict();
+    }
+    _entries.clear();
+    _bytes = 0;
+  }
+}
+
+/// A recorded subtree: its laid out size and the picture it painted.
+class PictureCacheEntry {
+  PictureCacheEntry._(this.size, this._layer) : picture = (_layer.layer!.firstChild! as PictureLayer).picture!;
+
+  final Size size;
+  final ui.Picture picture;
+
+  // Owns the recorded picture layer; disposing it disposes [picture].
+  final LayerHandle<ContainerLayer> _layer;
+  int _users = 0;
+  bool _evicted = false;
+
+  int get bytes => picture.approximateBytesUsed;
+
+  void _retain() => _users++;
+
+  void _release() {
+    _users--;
+    _disposeIfUnused();
+  }
+
+  void _evict() {
+    _evicted = true;
+    _disposeIfUnused();
+  }
+
+  void _disposeIfUnused() {
+    if (_evicted && _users == 0 && _layer.layer != null) {
+      _layer.layer = null;
+    }
+  }
+}
+
+/// Makes a [PictureCache] available to [CachedSubtree]s below it.
+class PictureCacheScope extends InheritedWidget {
+  const PictureCacheScope({super.key, required this.cache, required super.child});
+
+  final PictureCache cache;
+
+  static PictureCache? maybeOf(BuildContext context) {
+    return context.dependOnInheritedWidgetOfExactType<PictureCacheScope>()?.cache;
+  }
+
+  @override
+  bool updateShouldNotify(PictureCacheScope oldWidget) => cache != oldWidget.cache;
+}
+
+/// Records [child] into a picture once and replays it in later jobs.
+///
+/// On a cache hit [child] is neither built, laid out nor painted; the cached
+/// picture is drawn at the size recorded on the first render. [cacheKey]
+/// names what [child] draws: subtrees with equal keys share one picture, so
+/// the key must change whenever the content does. Widgets compare by
+/// identity, which is why [child] cannot serve as the key. The subtree must
+/// not depend on its incoming constraints, and subtrees that need
+/// compositing (repaint boundaries, opacity layers, platform views) are
+/// painted normally and never cached.
+class CachedSubtree extends StatelessWidget {
+  const CachedSubtree({super.key, required this.cacheKey, required this.child});
+
+  final Object cacheKey;
+  final Widget child;
+
+  @override
+  Widget build(BuildContext context) {
+    final PictureCache? cache = PictureCacheScope.maybeOf(context);
+    if (cache == null) return child;
+
+    final PictureCacheEntry? entry = cache.lookup(cacheKey);
+    if (entry != null) {
+      return _CachedPicture(entry: entry);
+    }
+    return _PictureRecorder(cache: cache, cacheKey: cacheKey, child: child);
+  }
+}
+
+class _CachedPicture extends LeafRenderObjectWidget {
+  const _CachedPicture({required this.entry});
+
+  final PictureCacheEntry entry;
+
+  @override
+  _RenderCachedPicture createRenderObject(BuildContext context) => _RenderCachedPicture(entry);
+
+  @override
+  void updateRenderObject(BuildContext context, _RenderCachedPicture renderObject) {
+    renderObject.entry = entry;
+  }
+}
+
+class _RenderCachedPicture extends RenderBox {
+  _RenderCachedPicture(this._entry) {
+    _entry._retain();
+  }
+
+  PictureCacheEntry _entry;
+  set entry(PictureCacheEntry value) {
+    if (identical(_entry, value)) return;
+    value._retain();
+    _entry._release();
+    _entry = value;
+    markNeedsLayout();
+  }
+
+  @override
+  void performLayout() {
+    size = constraints.constrain(_entry.size);
+  }
+
+  @override
+  void paint(PaintingContext context, Offset offset) {
+    final Canvas canvas = context.canvas;
+    canvas.save();
+    canvas.translate(offset.dx, offset.dy);
+    canvas.drawPicture(_entry.picture);
+    canvas.restore();
+  }
+
+  @override
+  void dispose() {
+    _entry._release();
+    super.dispose();
+  }
+}
+
+class _PictureRecorder extends SingleChildRenderObjectWidget {
+  const _PictureRecorder({required this.cache, required this.cacheKey, required super.child});
+
+  final PictureCache cache;
+  final Object cacheKey;
+
+  @override
+  _RenderPictureRecorder createRenderObject(BuildContext context) => _RenderPictureRecorder(cache, cacheKey);
+
+  @override
+  void updateRenderObject(BuildContext context, _RenderPictureRecorder renderObject) {
+    renderObject
+      ..cache = cache
+      ..cacheKey = cacheKey;
+  }
+}
+
+class _RenderPictureRecorder extends RenderProxyBox {
+  _RenderPictureRecorder(this.cache, this.cacheKey);
+
+  PictureCache cache;
+  Object cacheKey;
+
+  @override
+  void paint(PaintingContext context, Offset offset) {
+    final RenderBox? child = this.child;
+    if (child == null) return;
+    if (child.needsCompositing || cache.contains(cacheKey)) {
+      context.paintChild(child, offset);
+      return;
+    }
+
+    final ContainerLayer container = ContainerLayer();
+    final _RecordingContext recording = _RecordingContext(container, Offset.zero & size);
+    recording.paintChild(child, Offset.zero);
+    recording.finish();
+
+    final Layer? recorded = container.firstChild;
+    if (recorded is! PictureLayer || recorded.nextSibling != null || recorded.picture == null) {
+      container.dispose();
+      context.paintChild(child, offset);
+      return;
+    }
+
+    final PictureCacheEntry entry = PictureCacheEntry._(size, LayerHandle<ContainerLayer>(container));
+    final Canvas canvas = context.canvas;
+    canvas.save();
+    canvas.translate(offset.dx, offset.dy);
+    canvas.drawPicture(entry.picture);
+    canvas.restore();
+    cache._put(cacheKey, entry);
+  }
+}
+
+class _RecordingContext extends PaintingContext {
+  _RecordingContext(super.containerLayer, super.estimatedBounds);
+
+  void finish() => stopRecordingIfNeeded();
+}
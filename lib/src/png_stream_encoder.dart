@@ -0,0 +1,127 @@
+import 'dart:convert';
+import 'dart:io';
+import 'dart:typed_data';
+
+const List<int> _pngSignature = <int>[0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a];
+
+// Compressed data is buffered up to this size before an IDAT chunk is emitted.
+const int _idatChunkSize = 64 * 1024;
+
+/// Incremental PNG encoder for straight-alpha RGBA8 rows.
+///
+/// Rows can be appended in bands of any height; they are filtered and fed to
+/// a chunked zlib encoder right away, and compressed data leaves as IDAT
+/// chunks, so the encoder only ever holds one band and one chunk in memory.
+class PngStreamEncoder {
+  PngStreamEncoder(this._sink, {required this.width, required this.height, int level = 6})
+    : _previousRow = Uint8List(width * 4) {
+    _sink.add(_pngSignature);
+    final ByteData header = ByteData(13)
+      ..setUint32(0, width)
+      ..setUint32(4, height)
+      ..setUint8(8, 8) // bit depth
+      ..setUint8(9, 6); // RGBA
+    _writeChunk('IHDR', header.buffer.asUint8List());
+    _deflate = ZLibEncoder(level: level).startChunkedConversion(_IdatSink(this));
+  }
+
+  final int width;
+  final int height;
+  final IOSink _sink;
+  late final ByteConversionSink _deflate;
+  final Uint8List _previousRow;
+  final BytesBuilder _pending = BytesBuilder(copy: false);
+  int _rowsWritten = 0;
+
+  int get rowsWritten => _rowsWritten;
+
+  /// Appends whole rows of `width * 4` bytes each.
+  void addRows(Uint8List rgba) {
+    final int stride = width * 4;
+    assert(rgba.length % stride == 0);
+    final int rows = rgba.length ~/ stride;
+    if (_rowsWritten + rows > height) {
+      throw StateError('PNG has $height rows, got ${_rowsWritten + rows}');
+    }
+
+    // Filter type 2 (Up) is cheap and works well on UI content.
+    final Uint8List filtered = Uint8List(rows * (stride + 1));
+    int out = 0;
+    for (int row = 0; row < rows; row++) {
+      final int start = row * stride;
+      filtered[out++] = 2;
+      for (int i = 0; i < stride; i++) {
+        final int value = rgba[start + i];
+        filtered[out++] = (value - _previousRow[i]) & 0xff;
+        _previousRow[i] = value;
+      }
+    }
+    _rowsWritten += rows;
+    _deflate.add(filtered);
+  }
+
+  /// Flushes the remaining compressed data and writes IEND.
+  void close() {
+    if (_rowsWritten != height) {
+      throw StateError('PNG has $height rows, only $_rowsWritten were written');
+    }
+    _deflate.close();
+    _flushIdat();
+    _writeChunk('IEND', Uint8List(0));
+  }
+
+  void _addCompressed(List<int> bytes) {
+    _pending.add(bytes);
+    if (_pending.length >= _idatChunkSize) {
+      _flushIdat();
+    }
+  }
+
+  void _flushIdat() {
+    if (_pending.isEmpty) return;
+    _writeChunk('IDAT', _pending.takeBytes());
+  }
+
+  void _writeChunk(String type, Uint8List data) {
+    final Uint8List typeBytes = ascii.encode(type);
+    final ByteData length = ByteData(4)..setUint32(0, data.length);
+    final ByteData crc = ByteData(4)..setUint32(0, _crc32(data, _crc32(typeBytes)) ^ 0xffffffff);
+    _sink
+      ..add(length.buffer.asUint8List())
+      ..add(typeBytes)
+      ..add(data)
+      ..add(crc.buffer.asUint8List());
+  }
+}
+
+class _IdatSink implements Sink<List<int>> {
+  _IdatSink(this._encoder);
+
+  final PngStreamEncoder _encoder;
+
+  @override
+  void add(List<int> chunk) => _encoder._addCompressed(chunk);
+
+  @override
+  void close() {}
+}
+
+final Uint32List _crcTable = () {
+  final Uint32List table = Uint32List(256);
+  for (int n = 0; n < 256; n++) {
+    int c = n;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) != 0 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    }
+    table[n] = c;
+  }
+  return table;
+}();
+
+// Running CRC without the final inversion; callers xor the result once.
+int _crc32(List<int> data, [int crc = 0xffffffff]) {
+  for (final int byte in data) {
+    crc = _crcTable[(crc ^ byte) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
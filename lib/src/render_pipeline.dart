@@ -0,0 +1,283 @@
+import 'dart:convert';
+import 'dart:typed_data';
+import 'dart:ui' show Color, Rect;
+
+import 'package:flutter/services.dart';
+
+const String _pipelineChannel = 'headless/pipeline';
+
+const int _opSubmit = 1;
+const int _opWait = 2;
+const int _opBegin = 3;
+
+const int _flagAutoCrop = 1 << 0;
+
+/// File format written by the embedder's output stage.
+enum OutputFormat {
+  png,
+
+  /// Straight-alpha RGBA8 rows with no header.
+  raw,
+}
+
+/// Scheduling class of a job. The embedder sends template jobs in
+/// earliest-deadline order, and each class sets how far a job's deadline
+/// lies after its arrival (see `clib/template_jobs.h`).
+enum RenderPriority {
+  /// Someone waits for the result.
+  interactive,
+
+  /// Throughput work that may wait behind interactive jobs.
+  batch,
+}
+
+/// CPU time the engine's UI and raster threads had used at some point, from
+/// [NativeRenderPipeline.begin]. Zero while the embedder does not know the
+/// threads yet.
+class EngineCpuTime {
+  const EngineCpuTime({required this.ui, required this.raster});
+
+  final Duration ui;
+  final Duration raster;
+}
+
+/// Wall time a job spent in the Dart stages before it was submitted.
+class RenderStageTimes {
+  const RenderStageTimes({
+    this.build = Duration.zero,
+    this.rasterize = Duration.zero,
+    this.readBack = Duration.zero,
+  });
+
+  /// Build, layout and paint of the widget tree.
+  final Duration build;
+
+  /// Turning the layer tree into an image on the raster thread.
+  final Duration rasterize;
+
+  /// Copying the image's pixels back to the UI isolate.
+  final Duration readBack;
+}
+
+/// What a [RenderJob] cost.
+///
+/// The UI and raster CPU times are the difference between the engine's
+/// thread times at [NativeRenderPipeline.begin] and at submit, so they also
+/// count other work on those threads in between; they are exact when jobs
+/// are rendered one at a time. See `clib/job_cost.h`.
+class RenderJobCost {
+  const RenderJobCost({
+    this.stages = const RenderStageTimes(),
+    this.uiCpu = Duration.zero,
+    this.rasterCpu = Duration.zero,
+    this.encodeCpu = Duration.zero,
+    this.outputCpu = Duration.zero,
+    this.queued = Duration.zero,
+    this.encode = Duration.zero,
+    this.output = Duration.zero,
+    this.allocatedBytes = 0,
+    this.peakSurfaceBytes = 0,
+  });
+
+  /// Reads the embedder's encoding, nine little-endian u64s.
+  factory RenderJobCost.decode(ByteData data, int offset, {RenderStageTimes stages = const RenderStageTimes()}) {
+    int field(int index) => data.getUint64(offset + index * 8, Endian.little);
+    Duration nanos(int index) => Duration(microseconds: field(index) ~/ 1000);
+    return RenderJobCost(
+      stages: stages,
+      uiCpu: nanos(0),
+      rasterCpu: nanos(1),
+      encodeCpu: nanos(2),
+      outputCpu: nanos(3),
+      queued: nanos(4),
+      encode: nanos(5),
+      output: nanos(6),
+      allocatedBytes: field(7),
+      peakSurfaceBytes: field(8),
+    );
+  }
+
+  /// Size of the embedder's encoding.
+  static const int encodedLength = 72;
+
+  final RenderStageTimes stages;
+
+  /// Thread CPU time of the engine's UI and raster threads, and of the
+  /// embedder's encode and output workers.
+  final Duration uiCpu;
+  final Duration rasterCpu;
+  final Duration encodeCpu;
+  final Duration outputCpu;
+
+  /// Wall time waiting for an encoder, encoding, and from encoded until
+  /// written.
+  final Duration queued;
+  final Duration encode;
+  final Duration output;
+
+  /// Buffers the embedder allocated for the job.
+  final int allocatedBytes;
+
+  /// Size of the largest pixel buffer of the job.
+  final int peakSurfaceBytes;
+
+  Duration get cpu => uiCpu + rasterCpu + encodeCpu + outputCpu;
+
+  Duration get wall => stages.build + stages.rasterize + stages.readBack + queued + encode + output;
+
+  /// Writes the embedder's encoding, leaving the Dart stage times out.
+  void writeTo(ByteData data, int offset) {
+    final List<int> fields = <int>[
+      uiCpu.inMicroseconds * 1000,
+      rasterCpu.inMicroseconds * 1000,
+      encodeCpu.inMicroseconds * 1000,
+      outputCpu.inMicroseconds * 1000,
+      queued.inMicroseconds * 1000,
+      encode.inMicroseconds * 1000,
+      output.inMicroseconds * 1000,
+      allocatedBytes,
+      peakSurfaceBytes,
+    ];
+    for (int i = 0; i < fields.length; i++) {
+      data.setUint64(offset + i * 8, fields[i], Endian.little);
+    }
+  }
+
+  Map<String, Object> toJson() => <String, Object>{
+        'buildMicros': stages.build.inMicroseconds,
+        'rasterizeMicros': stages.rasterize.inMicroseconds,
+        'readBackMicros': stages.readBack.inMicroseconds,
+        'uiCpuMicros': uiCpu.inMicroseconds,
+        'rasterCpuMicros': rasterCpu.inMicroseconds,
+        'encodeCpuMicros': encodeCpu.inMicroseconds,
+        'outputCpuMicros': outputCpu.inMicroseconds,
+        'queuedMicros': queued.inMicroseconds,
+        'encodeMicros': encode.inMicroseconds,
+        'outputMicros': output.inMicroseconds,
+        'allocatedBytes': allocatedBytes,
+        'peakSurfaceBytes': peakSurfaceBytes,
+      };
+}
+
+/// What the embedder wrote for a [RenderJob].
+class RenderJobResult {
+  const RenderJobResult({required this.bytes, required this.rect, this.cost = const RenderJobCost()});
+
+  final int bytes;
+
+  /// The written region of the rendered image, in physical pixels. Smaller
+  /// than the image when the job was auto-cropped.
+  final Rect rect;
+
+  final RenderJobCost cost;
+}
+
+/// A job handed to the embedder's encode and output stages.
+class RenderJob {
+  RenderJob._(this.id, this.result);
+
+  final int id;
+
+  /// Completes once the output stage is done with this job.
+  final Future<RenderJobResult> result;
+
+  /// Completes with the number of bytes written.
+  Future<int> get written => result.then((RenderJobResult result) => result.bytes);
+}
+
+/// Client for the embedder's `headless/pipeline` channel.
+///
+/// See `clib/render_pipeline.h` for the message layout.
+class NativeRenderPipeline {
+  NativeRenderPipeline(this._messenger);
+
+  final BinaryMessenger _messenger;
+
+  /// Samples the engine's thread CPU times; pass the result to [submit] as
+  /// `started` to have the job's UI and raster CPU time measured.
+  Future<EngineCpuTime> begin() async {
+    final ByteData reply = _checkStatus(await _send(ByteData(1)..setUint8(0, _opBegin)));
+    return EngineCpuTime(
+      ui: Duration(microseconds: reply.getUint64(1, Endian.little) ~/ 1000),
+      raster: Duration(microseconds: reply.getUint64(9, Endian.little) ~/ 1000),
+    );
+  }
+
+  /// Queues [rgba] for encoding and writing to [target].
+  ///
+  /// Completes once the embedder admitted the job, which is delayed while its
+  /// encode queue is full. [started] and [stages] end up in the job's
+  /// [RenderJobResult.cost].
+  Future<RenderJob> submit({
+    required int width,
+    required int height,
+    required OutputFormat format,
+    required String target,
+    required ByteData rgba,
+    bool autoCrop = false,
+    Color background = const Color(0x00000000),
+    EngineCpuTime? started,
+    RenderStageTimes stages = const RenderStageTimes(),
+  }) async {
+    final Uint8List targetBytes = utf8.encode(target);
+    final int header = 1 + 4 + 4 + 1 + 1 + 4 + 2 + targetBytes.length;
+    final int trailer = started == null ? 0 : 16;
+    final ByteData message = ByteData(header + rgba.lengthInBytes + trailer)
+      ..setUint8(0, _opSubmit)
+      ..setUint32(1, width, Endian.little)
+      ..setUint32(5, height, Endian.little)
+      ..setUint8(9, format.index)
+      ..setUint8(10, autoCrop ? _flagAutoCrop : 0)
+      ..setUint8(11, (background.r * 255).round())
+      ..setUint8(12, (background.g * 255).round())
+      ..setUint8(13, (background.b * 255).round())
+      ..setUint8(14, (background.a * 255).round())
+      ..setUint16(15, targetBytes.length, Endian.little);
+    message.buffer.asUint8List(17).setAll(0, targetBytes);
+    message.buffer.asUint8List(header).setAll(0, rgba.buffer.asUint8List(rgba.offsetInBytes, rgba.lengthInBytes));
+    if (started != null) {
+      final int offset = header + rgba.lengthInBytes;
+      message
+        ..setUint64(offset, started.ui.inMicroseconds * 1000, Endian.little)
+        ..setUint64(offset + 8, started.raster.inMicroseconds * 1000, Endian.little);
+    }
+    final ByteData reply = _checkStatus(await _send(message));
+    final int id = reply.getUint32(1, Endian.little);
+    return RenderJob._(id, _wait(id, stages));
+  }
+
+  Future<RenderJobResult> _wait(int id, RenderStageTimes stages) async {
+    final ByteData message = ByteData(5)
+      ..setUint8(0, _opWait)
+      ..setUint32(1, id, Endian.little);
+    final ByteData reply = _checkStatus(await _send(message));
+    return RenderJobResult(
+      bytes: reply.getUint64(1, Endian.little),
+      rect: Rect.fromLTWH(
+        reply.getUint32(9, Endian.little).toDouble(),
+        reply.getUint32(13, Endian.little).toDouble(),
+        reply.getUint32(17, Endian.little).toDouble(),
+        reply.getUint32(21, Endian.little).toDouble(),
+      ),
+      cost: reply.lengthInBytes >= 25 + RenderJobCost.encodedLength
+          ? RenderJobCost.decode(reply, 25, stages: stages)
+          : RenderJobCost(stages: stages),
+    );
+  }
+
+  Future<ByteData> _send(ByteData message) async {
+    final ByteData? reply = await _messenger.send(_pipelineChannel, message);
+    if (reply == null || reply.lengthInBytes == 0) {
+      throw UnsupportedError('Pipelined rendering needs the headless embedder ($_pipelineChannel is not handled).');
+    }
+    return reply;
+  }
+
+  static ByteData _checkStatus(ByteData reply) {
+    if (reply.getUint8(0) != 0) {
+      final String reason = utf8.decode(reply.buffer.asUint8List(reply.offsetInBytes + 1, reply.lengthInBytes - 1));
+      throw StateError('Render job failed: ${reason.isEmpty ? 'pipeline error' : reason}');
+    }
+    return reply;
+  }
+}
@@ -0,0 +1,212 @@
+import 'dart:convert';
+import 'dart:typed_data';
+import 'dart:ui' show Color;
+
+import 'package:flutter/widgets.dart';
+
+import 'render_pipeline.dart';
+
+const int _templateFlagPreemptible = 1 << 0;
+
+/// Builds a template's widget from its parameters.
+///
+/// Parameters are positional: read them in the order the job wrote them.
+typedef TemplateBuilder = Widget Function(TemplateParams params);
+
+/// Reads a template's parameters in the compact encoding described in
+/// `clib/template_jobs.h`.
+///
+/// Strings are decoded straight from the message and [readBytes] returns a
+/// view into it, so nothing is parsed up front.
+class TemplateParams {
+  TemplateParams(this._data);
+
+  /// Wraps the output of a [TemplateParamsWriter].
+  factory TemplateParams.fromBytes(Uint8List bytes) =>
+      TemplateParams(ByteData.sublistView(bytes));
+
+  final ByteData _data;
+  int _offset = 0;
+
+  bool get isAtEnd => _offset >= _data.lengthInBytes;
+
+  int readInt() {
+    final int value = _readVarint();
+    return (value >>> 1) ^ -(value & 1);
+  }
+
+  double readDouble() {
+    _require(8);
+    final double value = _data.getFloat64(_offset, Endian.little);
+    _offset += 8;
+    return value;
+  }
+
+  bool readBool() {
+    _require(1);
+    return _data.getUint8(_offset++) != 0;
+  }
+
+  Color readColor() {
+    _require(4);
+    final Color value = Color(_data.getUint32(_offset, Endian.little));
+    _offset += 4;
+    return value;
+  }
+
+  String readString() => utf8.decode(readBytes());
+
+  /// Returns a view into the message; copy it to keep it past the job.
+  Uint8List readBytes() {
+    final int length = _readVarint();
+    _require(length);
+    final Uint8List bytes = _data.buffer.asUint8List(_data.offsetInBytes + _offset, length);
+    _offset += length;
+    return bytes;
+  }
+
+  int _readVarint() {
+    int value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      _require(1);
+      final int byte = _data.getUint8(_offset++);
+      value |= (byte & 0x7f) << shift;
+      if (byte < 0x80) {
+        return value;
+      }
+    }
+    throw const FormatException('Template parameter varint is too long');
+  }
+
+  void _require(int count) {
+    if (_data.lengthInBytes - _offset < count) {
+      throw const FormatException('Template parameters ended early');
+    }
+  }
+}
+
+/// Writes parameters for [TemplateParams], for jobs created on the Dart side
+/// and for tests. The embedder has its own writer in `clib/template_jobs.h`.
+class TemplateParamsWriter {
+  final BytesBuilder _bytes = BytesBuilder();
+
+  void writeInt(int value) => _writeVarint((value << 1) ^ (value >> 63));
+
+  void writeDouble(double value) =>
+      _bytes.add((ByteData(8)..setFloat64(0, value, Endian.little)).buffer.asUint8List());
+
+  void writeBool(bool value) => _bytes.addByte(value ? 1 : 0);
+
+  void writeColor(Color value) =>
+      _bytes.add((ByteData(4)..setUint32(0, value.toARGB32(), Endian.little)).buffer.asUint8List());
+
+  void writeString(String value) => writeBytes(utf8.encode(value));
+
+  void writeBytes(Uint8List value) {
+    _writeVarint(value.length);
+    _bytes.add(value);
+  }
+
+  Uint8List takeBytes() => _bytes.takeBytes();
+
+  void _writeVarint(int value) {
+    while (value & ~0x7f != 0) {
+      _bytes.addByte((value & 0x7f) | 0x80);
+      value >>>= 7;
+    }
+    _bytes.addByte(value);
+  }
+}
+
+/// A registered template and the canvas it is rendered on.
+class RenderTemplate {
+  const RenderTemplate({
+    required this.builder,
+    this.width = 1280,
+    this.height = 12000,
+    this.pixelRatio = 1.0,
+    this.shrinkWrap = true,
+  });
+
+  final TemplateBuilder builder;
+  final double width;
+  final double height;
+  final double pixelRatio;
+  final bool shrinkWrap;
+}
+
+/// Templates that jobs refer to by numeric id.
+///
+/// Served to the embedder through [HeadlessRender.serveTemplates].
+class TemplateRegistry {
+  final Map<int, RenderTemplate> _templates = <int, RenderTemplate>{};
+
+  void register(int id, RenderTemplate template) {
+    if (_templates.containsKey(id)) {
+      throw ArgumentError.value(id, 'id', 'Template is already registered');
+    }
+    _templates[id] = template;
+  }
+
+  bool contains(int id) => _templates.containsKey(id);
+
+  RenderTemplate operator [](int id) {
+    final RenderTemplate? template = _templates[id];
+    if (template == null) {
+      throw ArgumentError.value(id, 'id', 'Unknown template');
+    }
+    return template;
+  }
+}
+
+/// A job sent by the embedder on the `headless/templates` channel.
+class TemplateJob {
+  const TemplateJob({
+    required this.templateId,
+    required this.format,
+    required this.target,
+    required this.params,
+    this.priority = RenderPriority.interactive,
+    this.preemptible = false,
+    this.timeout,
+  });
+
+  factory TemplateJob.decode(ByteData message) {
+    if (message.lengthInBytes < 13) {
+      throw const FormatException('Template job is too short');
+    }
+    final int format = message.getUint8(4);
+    final int priority = message.getUint8(5);
+    final int flags = message.getUint8(6);
+    final int timeoutMs = message.getUint32(7, Endian.little);
+    final int targetLength = message.getUint16(11, Endian.little);
+    if (format >= OutputFormat.values.length ||
+        priority >= RenderPriority.values.length ||
+        message.lengthInBytes < 13 + targetLength) {
+      throw const FormatException('Malformed template job');
+    }
+    return TemplateJob(
+      templateId: message.getUint32(0, Endian.little),
+      format: OutputFormat.values[format],
+      target: utf8.decode(message.buffer.asUint8List(message.offsetInBytes + 13, targetLength)),
+      params: TemplateParams(ByteData.sublistView(message, 13 + targetLength)),
+      priority: RenderPriority.values[priority],
+      preemptible: flags & _templateFlagPreemptible != 0,
+      timeout: timeoutMs > 0 ? Duration(milliseconds: timeoutMs) : null,
+    );
+  }
+
+  final int templateId;
+  final OutputFormat format;
+  final String target;
+  final TemplateParams params;
+  final RenderPriority priority;
+
+  /// Whether the job should pause between frames while interactive jobs
+  /// render; see [HeadlessRender.submitImageFromWidget].
+  final bool preemptible;
+
+  /// How long the job may take to render before it is cancelled; see
+  /// `clib/watchdog.h`.
+  final Duration? timeout;
+}
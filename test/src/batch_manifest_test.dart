@@ -0,0 +1,45 @@
+import 'dart:ui';
+
+import 'package:flutter_test/flutter_test.dart';
+import 'package:foo/src/batch_runner.dart';
+import 'package:foo/src/render_pipeline.dart';
+import 'package:foo/src/template_registry.dart';
+
+void main() {
+  test('BatchEntry encodes params in manifest order', () {
+    final entry = BatchEntry.parse(
+      '{"template": 7, "params": ["Ada", 36, 1.5, true, {"color": 4294901760}], '
+      '"width": 600, "height": 400, "format": "raw", "output": "out/ada.rgba"}',
+    );
+    expect(entry.templateId, 7);
+    expect(entry.output, 'out/ada.rgba');
+    expect(entry.format, OutputFormat.raw);
+    expect(entry.width, 600);
+    expect(entry.height, 400);
+
+    final params = TemplateParams.fromBytes(entry.params);
+    expect(params.readString(), 'Ada');
+    expect(params.readInt(), 36);
+    expect(params.readDouble(), 1.5);
+    expect(params.readBool(), isTrue);
+    expect(params.readColor(), const Color(0xffff0000));
+    expect(params.isAtEnd, isTrue);
+  });
+
+  test('BatchEntry defaults to PNG and the template canvas', () {
+    final entry = BatchEntry.parse('{"template": 1, "output": "a.png"}');
+    expect(entry.format, OutputFormat.png);
+    expect(entry.width, isNull);
+    expect(entry.height, isNull);
+    expect(entry.params, isEmpty);
+  });
+
+  test('BatchEntry rejects malformed lines', () {
+    expect(() => BatchEntry.parse('[1]'), throwsFormatException);
+    expect(() => BatchEntry.parse('{"output": "a.png"}'), throwsFormatException);
+    expect(() => BatchEntry.parse('{"template": 1}'), throwsFormatException);
+    expect(() => BatchEntry.parse('{"template": 1, "output": "a.png", "format": "gif"}'), throwsFormatException);
+    expect(() => BatchEntry.parse('{"template": 1, "output": "a.png", "params": [[1]]}'), throwsFormatException);
+    expect(() => BatchEntry.parse('{"template": 1, "output": "a.png", "width": 0}'), throwsFormatException);
+  });
+}
@@ -0,0 +1,23 @@
+import 'package:flutter/material.dart';
+import 'package:flutter_test/flutter_test.dart';
+import 'package:foo/headless_render.dart';
+
+void main() {
+  test('measureWidget', () async {
+    final headlessRender = HeadlessRender();
+    const Key titleKey = ValueKey<String>('title');
+    final geometry = await headlessRender.measureWidget(
+      Column(
+        mainAxisSize: MainAxisSize.min,
+        children: [
+          SizedBox(width: 200, height: 40),
+          SizedBox(key: titleKey, width: 120, height: 30),
+        ],
+      ),
+      width: 512,
+      keys: [titleKey],
+    );
+    expect(geometry.size, const Size(200, 70));
+    expect(geometry.rects[titleKey], const Rect.fromLTWH(40, 40, 120, 30));
+  });
+}
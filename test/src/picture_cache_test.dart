@@ -0,0 +1,21 @@
+import 'package:flutter/material.dart';
+import 'package:flutter_test/flutter_test.dart';
+import 'package:foo/headless_render.dart';
+
+void main() {
+  test('CachedSubtree records once and replays in later jobs', () async {
+    final headlessRender = HeadlessRender();
+    const header = CachedSubtree(
+      cacheKey: 'header',
+      child: ColoredBox(color: Colors.blue, child: SizedBox(width: 200, height: 40)),
+    );
+
+    final first = await headlessRender.createImageFromWidget(header, width: 512);
+    expect(headlessRender.pictureCache.length, 1);
+    expect(headlessRender.pictureCache.bytesUsed, greaterThan(0));
+
+    final second = await headlessRender.createImageFromWidget(header, width: 512);
+    expect(headlessRender.pictureCache.hits, greaterThan(0));
+    expect(second, first);
+  });
+}
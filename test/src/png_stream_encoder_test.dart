@@ -0,0 +1,43 @@
+import 'dart:io';
+import 'dart:typed_data';
+
+import 'package:flutter_test/flutter_test.dart';
+import 'package:foo/src/png_stream_encoder.dart';
+
+void main() {
+  test('PngStreamEncoder writes a decodable PNG from bands', () async {
+    final file = File('${Directory.systemTemp.createTempSync('png_stream').path}/bands.png');
+    final sink = file.openWrite();
+    final encoder = PngStreamEncoder(sink, width: 3, height: 4);
+    final rows = Uint8List.fromList(List<int>.generate(3 * 4 * 4, (i) => (i * 37) & 0xff));
+    encoder.addRows(rows.sublist(0, 3 * 4 * 3));
+    encoder.addRows(rows.sublist(3 * 4 * 3));
+    encoder.close();
+    await sink.close();
+
+    final bytes = file.readAsBytesSync();
+    expect(bytes.sublist(0, 8), [0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a]);
+
+    final data = ByteData.sublistView(bytes);
+    final compressed = BytesBuilder();
+    for (int offset = 8; offset < bytes.length;) {
+      final length = data.getUint32(offset);
+      final type = String.fromCharCodes(bytes.sublist(offset + 4, offset + 8));
+      if (type == 'IDAT') compressed.add(bytes.sublist(offset + 8, offset + 8 + length));
+      offset += length + 12;
+    }
+    final filtered = ZLibDecoder().convert(compressed.takeBytes());
+    expect(filtered.length, 4 * (1 + 3 * 4));
+
+    final decoded = <int>[];
+    final previous = List<int>.filled(12, 0);
+    for (int row = 0; row < 4; row++) {
+      expect(filtered[row * 13], 2);
+      for (int i = 0; i < 12; i++) {
+        previous[i] = (filtered[row * 13 + 1 + i] + previous[i]) & 0xff;
+      }
+      decoded.addAll(previous);
+    }
+    expect(decoded, rows);
+  });
+}
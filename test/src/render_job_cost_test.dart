@@ -0,0 +1,34 @@
+import 'dart:typed_data';
+
+import 'package:flutter_test/flutter_test.dart';
+import 'package:foo/src/render_pipeline.dart';
+
+void main() {
+  test('RenderJobCost reads back what it wrote', () {
+    const cost = RenderJobCost(
+      uiCpu: Duration(microseconds: 1500),
+      rasterCpu: Duration(microseconds: 2500),
+      encodeCpu: Duration(milliseconds: 4),
+      outputCpu: Duration(microseconds: 30),
+      queued: Duration(microseconds: 120),
+      encode: Duration(milliseconds: 5),
+      output: Duration(microseconds: 700),
+      allocatedBytes: 1 << 33,
+      peakSurfaceBytes: 1280 * 720 * 4,
+    );
+    final data = ByteData(8 + RenderJobCost.encodedLength);
+    cost.writeTo(data, 8);
+    // Nanoseconds, little-endian.
+    expect(data.getUint64(8, Endian.little), 1500000);
+
+    const stages = RenderStageTimes(build: Duration(milliseconds: 2), readBack: Duration(microseconds: 300));
+    final decoded = RenderJobCost.decode(data, 8, stages: stages);
+    expect(decoded.toJson(), {
+      ...cost.toJson(),
+      'buildMicros': 2000,
+      'readBackMicros': 300,
+    });
+    expect(decoded.cpu, const Duration(microseconds: 8030));
+    expect(decoded.wall, const Duration(microseconds: 8120));
+  });
+}
@@ -0,0 +1,25 @@
+import 'package:flutter/painting.dart';
+import 'package:flutter_test/flutter_test.dart';
+import 'package:foo/src/atlas_layout.dart';
+
+void main() {
+  test('packShelves fills shelves tallest first', () {
+    final packing = packShelves(
+      const [Size(40, 10), Size(40, 30), Size(40, 20), Size(40, 10)],
+      maxWidth: 100,
+    );
+    expect(packing.rects, const [
+      Rect.fromLTWH(0, 30, 40, 10),
+      Rect.fromLTWH(0, 0, 40, 30),
+      Rect.fromLTWH(40, 0, 40, 20),
+      Rect.fromLTWH(40, 30, 40, 10),
+    ]);
+    expect(packing.size, const Size(80, 40));
+  });
+
+  test('packShelves keeps padding around boxes', () {
+    final packing = packShelves(const [Size(10, 10), Size(10, 10)], maxWidth: 100, padding: 2);
+    expect(packing.rects, const [Rect.fromLTWH(2, 2, 10, 10), Rect.fromLTWH(14, 2, 10, 10)]);
+    expect(packing.size, const Size(26, 14));
+  });
+}
@@ -0,0 +1,36 @@
+import 'dart:io';
+import 'dart:math' as math;
+import 'dart:typed_data';
+
+import 'package:flutter/services.dart';
+import 'package:flutter_test/flutter_test.dart';
+
+// clib/standard_codec_test.c decodes and re-encodes the same fixture, so the
+// two together check the C codec against this one.
+void main() {
+  test('StandardMessageCodec writes the fixture the C codec is tested against', () {
+    final message = <Object?>[
+      null,
+      true,
+      false,
+      7,
+      -1,
+      0x80000000,
+      -(1 << 40),
+      1.5,
+      'héllo',
+      'a' * 253,
+      'b' * 254,
+      Uint8List.fromList(List<int>.generate(65536, (i) => i & 0xff)),
+      Int32List.fromList(<int>[1, -2, 3]),
+      Int64List.fromList(<int>[1 << 40, -5]),
+      Float32List.fromList(<double>[0.5, -2.25]),
+      Float64List.fromList(<double>[math.pi, -0.0]),
+      <Object?, Object?>{'k': 1, 2: <Object?>[true]},
+      2.0,
+    ];
+    final encoded = const StandardMessageCodec().encodeMessage(message)!;
+    final fixture = File('test/fixtures/standard_codec_message.bin').readAsBytesSync();
+    expect(encoded.buffer.asUint8List(encoded.offsetInBytes, encoded.lengthInBytes), fixture);
+  });
+}
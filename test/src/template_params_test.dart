@@ -0,0 +1,63 @@
+import 'dart:typed_data';
+import 'dart:ui';
+
+import 'package:flutter_test/flutter_test.dart';
+import 'package:foo/src/render_pipeline.dart';
+import 'package:foo/src/template_registry.dart';
+
+void main() {
+  test('TemplateParams reads back what TemplateParamsWriter wrote', () {
+    final writer = TemplateParamsWriter()
+      ..writeInt(-1)
+      ..writeInt(300)
+      ..writeInt(-9007199254740991)
+      ..writeDouble(2.5)
+      ..writeBool(true)
+      ..writeColor(const Color(0x80ff0000))
+      ..writeString('Grüße')
+      ..writeBytes(Uint8List.fromList([1, 2, 3]));
+    final bytes = writer.takeBytes();
+    // Zigzag varints: -1 is one byte, 300 is 600 = 0xd8 0x04.
+    expect(bytes.sublist(0, 3), [0x01, 0xd8, 0x04]);
+
+    final params = TemplateParams.fromBytes(bytes);
+    expect(params.readInt(), -1);
+    expect(params.readInt(), 300);
+    expect(params.readInt(), -9007199254740991);
+    expect(params.readDouble(), 2.5);
+    expect(params.readBool(), isTrue);
+    expect(params.readColor(), const Color(0x80ff0000));
+    expect(params.readString(), 'Grüße');
+    expect(params.readBytes(), [1, 2, 3]);
+    expect(params.isAtEnd, isTrue);
+    expect(params.readBool, throwsFormatException);
+  });
+
+  test('TemplateJob.decode reads the layout of clib/template_jobs.h', () {
+    ByteData job(int timeoutMs, {int priority = 1, int flags = 1}) {
+      final data = ByteData(13 + 5 + 1)
+        ..setUint32(0, 7, Endian.little)
+        ..setUint8(4, 1)
+        ..setUint8(5, priority)
+        ..setUint8(6, flags)
+        ..setUint32(7, timeoutMs, Endian.little)
+        ..setUint16(11, 5, Endian.little)
+        ..setUint8(18, 1);
+      data.buffer.asUint8List(13).setAll(0, 'shm:3'.codeUnits);
+      return data;
+    }
+
+    final decoded = TemplateJob.decode(job(1500));
+    expect(decoded.templateId, 7);
+    expect(decoded.format, OutputFormat.raw);
+    expect(decoded.target, 'shm:3');
+    expect(decoded.priority, RenderPriority.batch);
+    expect(decoded.preemptible, isTrue);
+    expect(decoded.timeout, const Duration(milliseconds: 1500));
+    expect(decoded.params.readBool(), isTrue);
+    expect(TemplateJob.decode(job(0)).timeout, isNull);
+    expect(TemplateJob.decode(job(0, priority: 0, flags: 0)).preemptible, isFalse);
+    expect(() => TemplateJob.decode(job(0, priority: 2)), throwsFormatException);
+    expect(() => TemplateJob.decode(ByteData(12)), throwsFormatException);
+  });
+}